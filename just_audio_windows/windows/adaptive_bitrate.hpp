@@ -0,0 +1,193 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <optional>
+#include <vector>
+
+// An exponentially weighted moving average whose samples are weighted by the
+// time they cover, so that a long download counts for more than a short one.
+class WeightedEwma
+{
+public:
+	explicit WeightedEwma(double halfLifeSeconds)
+		: alpha(std::exp(std::log(0.5) / halfLifeSeconds))
+	{
+	}
+
+	void sample(double weight, double value)
+	{
+		double adjustedAlpha = std::pow(alpha, weight);
+		estimate = value * (1 - adjustedAlpha) + adjustedAlpha * estimate;
+		totalWeight += weight;
+	}
+
+	double getEstimate() const
+	{
+		// Corrects the bias towards the initial zero estimate.
+		double zeroFactor = 1 - std::pow(alpha, totalWeight);
+		return zeroFactor > 0 ? estimate / zeroFactor : 0;
+	}
+
+	void reset()
+	{
+		estimate = 0;
+		totalWeight = 0;
+	}
+
+private:
+	double alpha;
+	double estimate = 0;
+	double totalWeight = 0;
+};
+
+// Estimates the network bandwidth from completed segment downloads.
+//
+// Two averages are kept: a fast one that follows drops quickly, and a slow one
+// that ignores short spikes. The estimate is the smaller of both. The estimator
+// never reads a clock itself; every sample carries its own transfer time, so the
+// same sequence of downloads always produces the same estimate.
+class BandwidthEstimator
+{
+public:
+	// Segments smaller than this mostly measure latency, not throughput.
+	static constexpr uint64_t kMinSampleBytes = 16 * 1024;
+	// The estimate is not trusted until this many bytes have been measured.
+	static constexpr uint64_t kMinTotalBytes = 128 * 1024;
+
+	BandwidthEstimator(uint64_t defaultEstimate = 500000,
+		double fastHalfLifeSeconds = 2,
+		double slowHalfLifeSeconds = 5)
+		: defaultEstimate(defaultEstimate), fast(fastHalfLifeSeconds), slow(slowHalfLifeSeconds)
+	{
+	}
+
+	/// Records a download of |bytes| that took |seconds| from request to last byte.
+	void addSample(uint64_t bytes, double seconds)
+	{
+		if (bytes < kMinSampleBytes || seconds <= 0)
+		{
+			return;
+		}
+
+		double bitsPerSecond = (double)bytes * 8 / seconds;
+		fast.sample(seconds, bitsPerSecond);
+		slow.sample(seconds, bitsPerSecond);
+		totalBytes += bytes;
+	}
+
+	bool hasEstimate() const
+	{
+		return totalBytes >= kMinTotalBytes;
+	}
+
+	/// The estimated bandwidth in bits per second.
+	uint64_t getEstimate() const
+	{
+		if (!hasEstimate())
+		{
+			return defaultEstimate;
+		}
+		return (uint64_t)std::min(fast.getEstimate(), slow.getEstimate());
+	}
+
+	void reset()
+	{
+		fast.reset();
+		slow.reset();
+		totalBytes = 0;
+	}
+
+private:
+	uint64_t defaultEstimate;
+	WeightedEwma fast;
+	WeightedEwma slow;
+	uint64_t totalBytes = 0;
+};
+
+// Chooses which rendition of an adaptive stream to download next.
+//
+// The choice only depends on its inputs, so it can be replayed against a
+// recorded or simulated throughput trace. Hysteresis between the up-switch and
+// down-switch factors keeps the selection from oscillating on noisy links.
+class RenditionSelector
+{
+public:
+	/// Caps the selected bitrate. Zero means no limit.
+	void setPreferredPeakBitRate(uint64_t bitRate)
+	{
+		preferredPeakBitRate = bitRate;
+	}
+
+	uint64_t getPreferredPeakBitRate() const
+	{
+		return preferredPeakBitRate;
+	}
+
+	/// When set, only switches up with a larger bandwidth margin, trading
+	/// quality for fewer stalls.
+	void setConservative(bool value)
+	{
+		upSwitchFactor = value ? 0.7 : 0.85;
+	}
+
+	/// Returns the bitrate to use out of |available| given the bandwidth
+	/// |estimate|, both in bits per second. |current| is the bitrate being
+	/// downloaded now, or zero if there is none.
+	uint32_t select(std::vector<uint32_t> available, uint64_t estimate, uint32_t current) const
+	{
+		if (available.empty())
+		{
+			return 0;
+		}
+		std::sort(available.begin(), available.end());
+
+		// Renditions over the peak are never chosen, unless there is nothing
+		// else to choose.
+		if (preferredPeakBitRate > 0)
+		{
+			auto end = std::upper_bound(available.begin(), available.end(), preferredPeakBitRate);
+			if (end == available.begin())
+			{
+				return available.front();
+			}
+			available.erase(end, available.end());
+		}
+
+		uint32_t choice = available.front();
+		for (auto bitrate : available)
+		{
+			// Staying on (or going below) the current rendition only needs the
+			// looser down-switch margin.
+			double factor = current != 0 && bitrate <= current ? downSwitchFactor : upSwitchFactor;
+			if (bitrate <= estimate * factor)
+			{
+				choice = bitrate;
+			}
+		}
+		return choice;
+	}
+
+	/// Whether pinning the desired min and max bitrates of a source to
+	/// |bitrate| must set the max first, so that the min never exceeds the max
+	/// in between: the max goes first when the rendition goes up from
+	/// |currentMin|, and the min first when it goes down.
+	static bool setsMaxFirst(std::optional<uint32_t> currentMin, uint32_t bitrate)
+	{
+		return !currentMin || bitrate >= *currentMin;
+	}
+
+	/// Returns the position of |bitrate| among |available| sorted ascending, or -1.
+	static int indexOf(std::vector<uint32_t> available, uint32_t bitrate)
+	{
+		std::sort(available.begin(), available.end());
+		auto it = std::find(available.begin(), available.end(), bitrate);
+		return it == available.end() ? -1 : (int)(it - available.begin());
+	}
+
+private:
+	uint64_t preferredPeakBitRate = 0;
+	double upSwitchFactor = 0.7;
+	double downSwitchFactor = 0.95;
+};
@@ -0,0 +1,101 @@
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+
+// Catches heap allocations on threads that must not make them. Code that must
+// not allocate, such as the mixer calling render(), runs inside a
+// RealtimeScope; in builds with JUST_AUDIO_ALLOCATION_GUARD, which Debug
+// builds define, the plugin's operator new and delete report every call made
+// inside one. By default that aborts, so a test that plays through the
+// render path fails where the allocation happens; a scope can count them
+// instead.
+class AllocationGuard
+{
+public:
+	enum class Mode
+	{
+		// Allocations are allowed, outside any scope.
+		off,
+		count,
+		abort,
+	};
+
+	/// Whether operator new and delete report to the guard in this build.
+	static constexpr bool isEnabled()
+	{
+#ifdef JUST_AUDIO_ALLOCATION_GUARD
+		return true;
+#else
+		return false;
+#endif
+	}
+
+	/// Called by operator new and delete on every thread, so it does not
+	/// allocate itself.
+	static void onAllocation()
+	{
+		auto& state = threadState();
+		if (state.mode == Mode::off)
+		{
+			return;
+		}
+		state.count++;
+		if (state.mode == Mode::abort)
+		{
+			std::fputs("just_audio_windows: heap allocation on a real-time thread\n", stderr);
+			std::abort();
+		}
+	}
+
+	/// The allocations and frees this thread made inside counting scopes.
+	static uint64_t getCount()
+	{
+		return threadState().count;
+	}
+
+private:
+	friend class RealtimeScope;
+
+	struct ThreadState
+	{
+		Mode mode = Mode::off;
+		uint64_t count = 0;
+	};
+
+	static ThreadState& threadState()
+	{
+		// Trivially constructed, so the first use on a thread does not allocate.
+		static thread_local ThreadState state;
+		return state;
+	}
+};
+
+// Marks the current thread as real-time until destroyed. Scopes nest; the
+// outermost one decides what an allocation does, so that a test can count
+// what a scope in the code under test would abort on.
+class RealtimeScope
+{
+public:
+	explicit RealtimeScope(AllocationGuard::Mode mode = AllocationGuard::Mode::abort)
+		: previous(AllocationGuard::threadState().mode)
+	{
+		if (previous == AllocationGuard::Mode::off)
+		{
+			AllocationGuard::threadState().mode = mode;
+		}
+	}
+
+	~RealtimeScope()
+	{
+		AllocationGuard::threadState().mode = previous;
+	}
+
+	// Prevent copying.
+	RealtimeScope(RealtimeScope const&) = delete;
+	RealtimeScope& operator=(RealtimeScope const&) = delete;
+
+private:
+	AllocationGuard::Mode previous;
+};
@@ -0,0 +1,236 @@
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <memory>
+#include <optional>
+#include <string>
+#include <vector>
+
+class SyncGroup;
+
+// A node of the audio source tree sent by `load`, independent of the method
+// channel encoding. Durations are in microseconds.
+struct AudioSourceSpec
+{
+	enum class Type
+	{
+		progressive,
+		dash,
+		hls,
+		silence,
+		concatenating,
+		clipping,
+		looping,
+	};
+
+	Type type = Type::progressive;
+	std::string id{};
+	// progressive, dash and hls
+	std::string uri{};
+	std::map<std::string, std::string> headers{};
+	// silence
+	int64_t durationUs = 0;
+	// clipping
+	std::optional<int64_t> startUs{};
+	std::optional<int64_t> endUs{};
+	// looping
+	int32_t count = 1;
+	// concatenating holds any number of children; clipping and looping one.
+	std::vector<AudioSourceSpec> children{};
+	std::vector<int32_t> shuffleOrder{};
+
+	bool isLeaf() const
+	{
+		return type != Type::concatenating && type != Type::clipping && type != Type::looping;
+	}
+};
+
+// Values of ProcessingStateMessage.
+enum class ProcessingState
+{
+	idle = 0,
+	loading = 1,
+	buffering = 2,
+	ready = 3,
+	completed = 4,
+};
+
+// Values of LoopModeMessage.
+enum class LoopMode
+{
+	off = 0,
+	one = 1,
+	all = 2,
+};
+
+// How a volume change reaches its new value.
+struct VolumeRamp
+{
+	enum class Curve
+	{
+		// Equal steps of gain.
+		linear,
+		// Equal steps of decibels, which sound even to the ear.
+		exponential,
+	};
+
+	// Zero applies the change at once.
+	int64_t durationUs = 0;
+	Curve curve = Curve::linear;
+};
+
+// What counts as silence worth skipping, and how much of it is kept.
+struct SkipSilenceOptions
+{
+	// Blocks quieter than this on average are silent.
+	double thresholdDb = -50;
+	// Shorter silences are played in full.
+	int64_t minimumGapUs = 300000;
+	// Silence kept at each end of a skipped gap.
+	int64_t paddingUs = 40000;
+	// How long the two ends of a gap take to fade into each other.
+	int64_t crossfadeUs = 5000;
+};
+
+// A band of AndroidEqualizerBandMessage. Frequencies are in Hz.
+struct EqualizerBand
+{
+	int32_t index;
+	double lowerFrequency;
+	double upperFrequency;
+	double centerFrequency;
+	double gainDb;
+};
+
+// The shape of AndroidEqualizerParametersMessage.
+struct EqualizerParameters
+{
+	double minDecibels;
+	double maxDecibels;
+	std::vector<EqualizerBand> bands;
+};
+
+// A snapshot of the state that playback and data events report.
+struct BackendState
+{
+	ProcessingState processingState = ProcessingState::idle;
+	bool playing = false;
+	int64_t positionUs = 0;
+	int64_t bufferedPositionUs = 0;
+	std::optional<int64_t> durationUs{};
+	std::optional<int32_t> currentIndex{};
+	double volume = 1.0;
+	double speed = 1.0;
+	double pitch = 1.0;
+	LoopMode loopMode = LoopMode::off;
+	bool shuffle = false;
+	// Times the output found no audio ready while more was to come, and the
+	// frames of silence played instead.
+	uint64_t underrunCount = 0;
+	uint64_t underrunFrames = 0;
+	// The share of real time spent changing tempo and pitch, from 0 to 1.
+	double timeStretchLoad = 0;
+	// Media time left out by skipping silence.
+	int64_t skippedSilenceUs = 0;
+	// How far the loudness enhancer's limiter is holding peaks down, in dB.
+	double gainReductionDb = 0;
+};
+
+// Plays an audio source tree. AudioPlayer forwards the commands of its method
+// channel here, so that playback can run on something other than the
+// platform media player, such as the software pipeline of SoftwareBackend.
+//
+// Commands may be called from any thread. Listeners are called from the
+// backend's own threads.
+class AudioBackend
+{
+public:
+	virtual ~AudioBackend() = default;
+
+	/// Replaces the playlist with |source|. Throws std::invalid_argument for
+	/// sources the backend can not play.
+	virtual void load(const AudioSourceSpec& source, std::optional<int32_t> initialIndex, int64_t initialPositionUs) = 0;
+	virtual void play() = 0;
+	/// Like play(), from the output frame heard at |hostTimeUs| on the steady
+	/// clock, in microseconds, rather than the next one mixed.
+	virtual void playAt(int64_t hostTimeUs) = 0;
+	virtual void pause() = 0;
+	/// Seeks to |positionUs| in the item at |index|, or in the current item.
+	virtual void seek(std::optional<int32_t> index, int64_t positionUs) = 0;
+	/// Changes the volume over |ramp|, from wherever a previous ramp got to.
+	virtual void setVolume(double volume, VolumeRamp ramp) = 0;
+	/// Places the output between the left (-1) and right (1) speakers.
+	virtual void setPan(double pan) = 0;
+	/// Ranks the player for keeping its voice when players outnumber voices.
+	virtual void setPriority(int32_t priority) = 0;
+	virtual void setSpeed(double speed) = 0;
+	/// Raises or lowers the pitch by a factor, whatever the speed.
+	virtual void setPitch(double pitch) = 0;
+	/// Shortens silent gaps while |enabled|, reporting positions in the media.
+	virtual void setSkipSilence(bool enabled, SkipSilenceOptions options) = 0;
+	virtual void setEqualizerEnabled(bool enabled) = 0;
+	/// Sets the gain of a band of getEqualizerParameters(). Throws
+	/// std::out_of_range for bands that do not exist.
+	virtual void setEqualizerBandGain(int32_t band, double gainDb) = 0;
+	virtual EqualizerParameters getEqualizerParameters() = 0;
+	virtual void setLoudnessEnhancerEnabled(bool enabled) = 0;
+	/// Sets the gain of the loudness enhancer, in dB.
+	virtual void setLoudnessEnhancerTargetGain(double gainDb) = 0;
+	/// Sets how long the enhancer's limiter takes to hold a peak down and to
+	/// let go of it.
+	virtual void setLimiterTiming(int64_t attackUs, int64_t releaseUs) = 0;
+	/// Overlaps the end of each item with the start of the next by
+	/// |durationUs|, or joins them without a gap if zero.
+	virtual void setCrossfade(int64_t durationUs) = 0;
+	virtual void setLoopMode(LoopMode loopMode) = 0;
+	virtual void setShuffle(bool enabled) = 0;
+	/// Applies the shuffle orders of |source|, which has the shape of the
+	/// loaded source.
+	virtual void setShuffleOrder(const AudioSourceSpec& source) = 0;
+	/// Inserts |children| at |index| of the top-level concatenating source.
+	virtual void insert(int32_t index, const std::vector<AudioSourceSpec>& children) = 0;
+	virtual void removeRange(int32_t start, int32_t end) = 0;
+	virtual void move(int32_t from, int32_t to) = 0;
+	/// Plays, pauses, seeks and changes speed together with the other members
+	/// of |group|, or on its own without one. Throws std::invalid_argument for
+	/// players that can not join it.
+	virtual void setSyncGroup(std::shared_ptr<SyncGroup> group) = 0;
+	virtual BackendState getState() = 0;
+	/// Stops playback for good and releases the output.
+	virtual void dispose() = 0;
+
+	/// Called whenever the state changes in a way events should report.
+	void setStateListener(std::function<void()> listener)
+	{
+		stateListener = listener;
+	}
+
+	/// Called with an error code and message when an item fails.
+	void setErrorListener(std::function<void(const std::string&, const std::string&)> listener)
+	{
+		errorListener = listener;
+	}
+
+protected:
+	void notifyState()
+	{
+		if (stateListener)
+		{
+			stateListener();
+		}
+	}
+
+	void notifyError(const std::string& code, const std::string& message)
+	{
+		if (errorListener)
+		{
+			errorListener(code, message);
+		}
+	}
+
+private:
+	std::function<void()> stateListener = nullptr;
+	std::function<void(const std::string&, const std::string&)> errorListener = nullptr;
+};
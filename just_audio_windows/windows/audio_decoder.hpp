@@ -0,0 +1,412 @@
+#pragma once
+
+#include <algorithm>
+#include <cctype>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <memory>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "audio_backend.hpp"
+#include "mapped_file.hpp"
+#include "metadata_probe.hpp"
+#include "sample_kernels.hpp"
+
+struct AudioFormat
+{
+	uint32_t sampleRate;
+	uint32_t channels;
+
+	bool operator==(const AudioFormat& other) const
+	{
+		return sampleRate == other.sampleRate && channels == other.channels;
+	}
+
+	bool operator!=(const AudioFormat& other) const
+	{
+		return !(*this == other);
+	}
+};
+
+// Frames an encoder added before and after the audio, such as the priming
+// and padding of MP3 and AAC, which gapless playback leaves out.
+struct EncoderTrim
+{
+	int64_t delayFrames = 0;
+	int64_t paddingFrames = 0;
+};
+
+// Decodes a source into interleaved float samples. Not thread safe; each
+// decoder is driven by one thread at a time.
+class AudioDecoder
+{
+public:
+	virtual ~AudioDecoder() = default;
+
+	virtual AudioFormat getFormat() const = 0;
+	/// The number of frames, if known.
+	virtual std::optional<int64_t> getLength() const = 0;
+	/// Decodes up to |frames| frames into |output|, returning how many were
+	/// decoded. Returns zero at the end of the source.
+	virtual size_t read(float* output, size_t frames) = 0;
+	/// Moves to |frame|, returning whether the decoder could.
+	virtual bool seek(int64_t frame) = 0;
+	/// The frames to leave out of what read() returns, as the container
+	/// records them. DecoderRegistry trims them, so that other code never sees
+	/// them.
+	virtual EncoderTrim getEncoderTrim() const
+	{
+		return EncoderTrim{};
+	}
+};
+
+// The output of a SilenceAudioSource.
+class SilenceDecoder : public AudioDecoder
+{
+public:
+	SilenceDecoder(AudioFormat format, int64_t length)
+		: format(format), length(length)
+	{
+	}
+
+	AudioFormat getFormat() const override
+	{
+		return format;
+	}
+
+	std::optional<int64_t> getLength() const override
+	{
+		return length;
+	}
+
+	size_t read(float* output, size_t frames) override
+	{
+		auto count = (size_t)std::min<int64_t>((int64_t)frames, length - position);
+		std::fill(output, output + count * format.channels, 0.0f);
+		position += (int64_t)count;
+		return count;
+	}
+
+	bool seek(int64_t frame) override
+	{
+		position = std::clamp<int64_t>(frame, 0, length);
+		return true;
+	}
+
+private:
+	AudioFormat format;
+	int64_t length;
+	int64_t position = 0;
+};
+
+// Leaves the encoder delay and padding out of another decoder, so that items
+// join without a gap. The padding is only known, and trimmed, when the length
+// is.
+class TrimmedDecoder : public AudioDecoder
+{
+public:
+	TrimmedDecoder(std::unique_ptr<AudioDecoder> decoder, EncoderTrim trim)
+		: decoder(std::move(decoder)), trim(trim)
+	{
+		this->decoder->seek(trim.delayFrames);
+	}
+
+	AudioFormat getFormat() const override
+	{
+		return decoder->getFormat();
+	}
+
+	std::optional<int64_t> getLength() const override
+	{
+		auto length = decoder->getLength();
+		if (!length)
+		{
+			return std::nullopt;
+		}
+		return std::max<int64_t>(0, *length - trim.delayFrames - trim.paddingFrames);
+	}
+
+	size_t read(float* output, size_t frames) override
+	{
+		if (auto length = getLength())
+		{
+			frames = (size_t)std::clamp<int64_t>(*length - position, 0, (int64_t)frames);
+		}
+		auto count = frames > 0 ? decoder->read(output, frames) : 0;
+		position += (int64_t)count;
+		return count;
+	}
+
+	bool seek(int64_t frame) override
+	{
+		position = std::max<int64_t>(frame, 0);
+		return decoder->seek(position + trim.delayFrames);
+	}
+
+private:
+	std::unique_ptr<AudioDecoder> decoder;
+	EncoderTrim trim;
+	int64_t position = 0;
+};
+
+/// The frames a decoder outputs before and after the audio of a file with
+/// |metadata|: the encoder's delay and padding, shifted by the delay of MP3
+/// decoders. Without either recorded, nothing is trimmed.
+inline EncoderTrim encoderTrimOf(const TrackMetadata& metadata)
+{
+	if (!metadata.encoderDelay && !metadata.encoderPadding)
+	{
+		return EncoderTrim{};
+	}
+	EncoderTrim trim{ metadata.encoderDelay.value_or(0), metadata.encoderPadding.value_or(0) };
+	if (metadata.format == "mp3")
+	{
+		trim.delayFrames += MetadataProbe::kMp3DecoderDelay;
+		trim.paddingFrames = std::max<int64_t>(0, trim.paddingFrames - MetadataProbe::kMp3DecoderDelay);
+	}
+	return trim;
+}
+
+/// Reads the encoder trim the file at |path| records, for decoders that do not
+/// read it themselves.
+inline EncoderTrim readEncoderTrim(const std::string& path)
+{
+	MappedFile file(path);
+	if (!file.data())
+	{
+		return EncoderTrim{};
+	}
+	auto metadata = MetadataProbe::probe(file.data(), file.size(), false);
+	return metadata ? encoderTrimOf(*metadata) : EncoderTrim{};
+}
+
+// Decodes PCM and IEEE float WAV files from a memory mapping.
+class WavDecoder : public AudioDecoder
+{
+public:
+	/// Opens |path|, throwing std::runtime_error if it is not a supported WAV
+	/// file.
+	explicit WavDecoder(const std::string& path)
+		: file(std::make_unique<MappedFile>(path))
+	{
+		auto* data = file->data();
+		auto size = file->size();
+		if (!data || size < 12 || std::memcmp(data, "RIFF", 4) != 0 || std::memcmp(data + 8, "WAVE", 4) != 0)
+		{
+			throw std::runtime_error("Not a WAV file: " + path);
+		}
+
+		size_t position = 12;
+		bool hasFormat = false;
+		while (position + 8 <= size)
+		{
+			auto* chunk = data + position;
+			size_t chunkSize = readLe32(chunk + 4);
+			auto available = std::min<size_t>(chunkSize, size - position - 8);
+			if (std::memcmp(chunk, "fmt ", 4) == 0 && available >= 16)
+			{
+				auto tag = readLe16(chunk + 8);
+				// WAVE_FORMAT_EXTENSIBLE keeps the real tag in its sub format.
+				if (tag == 0xFFFE && available >= 26)
+				{
+					tag = readLe16(chunk + 8 + 24);
+				}
+				format.channels = readLe16(chunk + 10);
+				format.sampleRate = readLe32(chunk + 12);
+				bitsPerSample = readLe16(chunk + 22);
+				isFloat = tag == 3;
+				hasFormat = (tag == 1 && (bitsPerSample == 8 || bitsPerSample == 16 || bitsPerSample == 24 || bitsPerSample == 32)) ||
+					(tag == 3 && (bitsPerSample == 32 || bitsPerSample == 64));
+			}
+			else if (std::memcmp(chunk, "data", 4) == 0)
+			{
+				samples = chunk + 8;
+				samplesSize = available;
+			}
+			position += 8 + chunkSize + (chunkSize & 1);
+		}
+
+		if (!hasFormat || !samples || format.channels == 0 || format.sampleRate == 0)
+		{
+			throw std::runtime_error("Unsupported WAV file: " + path);
+		}
+		frameSize = format.channels * bitsPerSample / 8;
+		length = (int64_t)(samplesSize / frameSize);
+	}
+
+	AudioFormat getFormat() const override
+	{
+		return format;
+	}
+
+	std::optional<int64_t> getLength() const override
+	{
+		return length;
+	}
+
+	size_t read(float* output, size_t frames) override
+	{
+		auto count = (size_t)std::min<int64_t>((int64_t)frames, length - position);
+		auto* input = samples + (size_t)position * frameSize;
+		auto sampleCount = count * format.channels;
+		auto& kernels = SampleKernels::get();
+		if (isFloat && bitsPerSample == 32)
+		{
+			std::memcpy(output, input, sampleCount * sizeof(float));
+		}
+		else if (!isFloat && bitsPerSample == 16)
+		{
+			kernels.int16ToFloat(input, output, sampleCount);
+		}
+		else if (!isFloat && bitsPerSample == 24)
+		{
+			kernels.int24ToFloat(input, output, sampleCount);
+		}
+		else if (!isFloat && bitsPerSample == 32)
+		{
+			kernels.int32ToFloat(input, output, sampleCount);
+		}
+		else
+		{
+			for (size_t i = 0; i < sampleCount; i++)
+			{
+				output[i] = readSample(input, i);
+			}
+		}
+		position += (int64_t)count;
+		return count;
+	}
+
+	bool seek(int64_t frame) override
+	{
+		position = std::clamp<int64_t>(frame, 0, length);
+		return true;
+	}
+
+private:
+	static uint32_t readLe16(const uint8_t* p) { return (uint32_t)p[1] << 8 | p[0]; }
+	static uint32_t readLe32(const uint8_t* p) { return (uint32_t)p[3] << 24 | (uint32_t)p[2] << 16 | (uint32_t)p[1] << 8 | p[0]; }
+
+	/// Reads the formats without a kernel: 8-bit and 64-bit float.
+	float readSample(const uint8_t* input, size_t i) const
+	{
+		if (isFloat)
+		{
+			double value;
+			std::memcpy(&value, input + i * 8, 8);
+			return (float)value;
+		}
+		return ((int)input[i] - 128) / 128.0f;
+	}
+
+	std::unique_ptr<MappedFile> file;
+	AudioFormat format{};
+	uint32_t bitsPerSample = 0;
+	bool isFloat = false;
+	const uint8_t* samples = nullptr;
+	size_t samplesSize = 0;
+	size_t frameSize = 0;
+	int64_t length = 0;
+	int64_t position = 0;
+};
+
+/// Converts a file:// URI or a plain path into a path, or returns std::nullopt
+/// for other schemes.
+inline std::optional<std::string> uriToPath(const std::string& uri)
+{
+	auto scheme = uri.find("://");
+	if (scheme == std::string::npos)
+	{
+		return uri;
+	}
+	if (uri.compare(0, scheme, "file") != 0)
+	{
+		return std::nullopt;
+	}
+
+	auto path = uri.substr(scheme + 3);
+	// file:///C:/music has a slash before the drive letter.
+	if (path.size() >= 3 && path[0] == '/' && path[2] == ':')
+	{
+		path.erase(0, 1);
+	}
+
+	std::string decoded{};
+	for (size_t i = 0; i < path.size(); i++)
+	{
+		if (path[i] == '%' && i + 2 < path.size() && std::isxdigit((unsigned char)path[i + 1]) && std::isxdigit((unsigned char)path[i + 2]))
+		{
+			decoded.push_back((char)std::stoi(path.substr(i + 1, 2), nullptr, 16));
+			i += 2;
+		}
+		else
+		{
+			decoded.push_back(path[i]);
+		}
+	}
+	return decoded;
+}
+
+// Opens decoders for leaf sources. WAV files are decoded natively by the
+// factory each registry starts with; platform decoders are added after it
+// with add(), and the first factory that returns a decoder wins.
+class DecoderRegistry
+{
+public:
+	using Factory = std::function<std::unique_ptr<AudioDecoder>(const AudioSourceSpec&)>;
+
+	DecoderRegistry()
+	{
+		add([](const AudioSourceSpec& source) -> std::unique_ptr<AudioDecoder>
+			{
+				auto path = uriToPath(source.uri);
+				if (!path || path->size() < 4)
+				{
+					return nullptr;
+				}
+				auto extension = path->substr(path->size() - 4);
+				std::transform(extension.begin(), extension.end(), extension.begin(), [](char c)
+					{ return (char)std::tolower((unsigned char)c); });
+				if (extension != ".wav")
+				{
+					return nullptr;
+				}
+				return std::make_unique<WavDecoder>(*path); });
+	}
+
+	void add(Factory factory)
+	{
+		factories.push_back(factory);
+	}
+
+	/// Opens a decoder for |source|, producing silence in |silenceFormat| for
+	/// silence sources, and without the encoder's delay and padding. Throws
+	/// std::runtime_error if no factory can.
+	std::unique_ptr<AudioDecoder> open(const AudioSourceSpec& source, AudioFormat silenceFormat) const
+	{
+		if (source.type == AudioSourceSpec::Type::silence)
+		{
+			return std::make_unique<SilenceDecoder>(silenceFormat, source.durationUs * silenceFormat.sampleRate / 1000000);
+		}
+		for (auto& factory : factories)
+		{
+			if (auto decoder = factory(source))
+			{
+				auto trim = decoder->getEncoderTrim();
+				if (trim.delayFrames > 0 || trim.paddingFrames > 0)
+				{
+					return std::make_unique<TrimmedDecoder>(std::move(decoder), trim);
+				}
+				return decoder;
+			}
+		}
+		throw std::runtime_error("No decoder for " + source.uri);
+	}
+
+private:
+	std::vector<Factory> factories{};
+};
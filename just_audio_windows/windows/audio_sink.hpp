@@ -0,0 +1,322 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "audio_decoder.hpp"
+#include "spsc_ring.hpp"
+
+// Where SoftwareBackend sends its rendered output.
+class AudioSink
+{
+public:
+	virtual ~AudioSink() = default;
+
+	virtual AudioFormat getFormat() const = 0;
+	/// Consumes |frames| interleaved frames. Real-time sinks block until the
+	/// output has room, which paces rendering.
+	virtual void write(const float* samples, size_t frames) = 0;
+	/// Stops output. Further writes are dropped.
+	virtual void close() {}
+	/// Whether write() is paced like a device. Other sinks take output as fast
+	/// as it can be rendered.
+	virtual bool isRealtime() const
+	{
+		return false;
+	}
+
+	/// The frames written that the output has yet to play, which are heard
+	/// that much later than they were written. Read from any thread.
+	virtual uint64_t getLatencyFrames() const
+	{
+		return 0;
+	}
+
+	/// The number of frames written so far.
+	uint64_t getFramesWritten() const
+	{
+		return framesWritten;
+	}
+
+protected:
+	std::atomic<uint64_t> framesWritten = 0;
+};
+
+// Discards the output, either as fast as it comes or at the pace of a device
+// when |realtime|, reporting the latency of a device that holds
+// |latencyFrames|.
+class NullSink : public AudioSink
+{
+public:
+	explicit NullSink(AudioFormat format, bool realtime = false, uint64_t latencyFrames = 0)
+		: format(format), realtime(realtime), latencyFrames(latencyFrames)
+	{
+	}
+
+	AudioFormat getFormat() const override
+	{
+		return format;
+	}
+
+	void write(const float* samples, size_t frames) override
+	{
+		if (closed)
+		{
+			return;
+		}
+		if (realtime)
+		{
+			if (framesWritten == 0)
+			{
+				start = std::chrono::steady_clock::now();
+			}
+			auto due = start + std::chrono::microseconds((int64_t)(framesWritten * 1000000 / format.sampleRate));
+			std::this_thread::sleep_until(due);
+		}
+		framesWritten += frames;
+	}
+
+	void close() override
+	{
+		closed = true;
+	}
+
+	bool isRealtime() const override
+	{
+		return realtime;
+	}
+
+	uint64_t getLatencyFrames() const override
+	{
+		return latencyFrames;
+	}
+
+private:
+	AudioFormat format;
+	bool realtime;
+	uint64_t latencyFrames;
+	std::atomic<bool> closed = false;
+	std::chrono::steady_clock::time_point start{};
+};
+
+// How a file or buffer of output is laid out: a WAV file, or the bare
+// interleaved samples.
+enum class PcmContainer
+{
+	wav,
+	raw,
+};
+
+/// The header of a 32-bit float WAV file holding |dataSize| bytes of
+/// samples. Sizes over 4GB do not fit; they are clamped as most writers do.
+inline std::array<uint8_t, 44> makeWavHeader(AudioFormat format, uint64_t dataSize)
+{
+	auto size = (uint32_t)std::min<uint64_t>(dataSize, UINT32_MAX - 36);
+	std::array<uint8_t, 44> header{};
+	auto put16 = [&](size_t offset, uint32_t value)
+	{
+		header[offset] = (uint8_t)value;
+		header[offset + 1] = (uint8_t)(value >> 8);
+	};
+	auto put32 = [&](size_t offset, uint32_t value)
+	{
+		put16(offset, value & 0xFFFF);
+		put16(offset + 2, value >> 16);
+	};
+	std::memcpy(header.data(), "RIFF", 4);
+	put32(4, 36 + size);
+	std::memcpy(header.data() + 8, "WAVEfmt ", 8);
+	put32(16, 16);
+	put16(20, 3); // IEEE float
+	put16(22, format.channels);
+	put32(24, format.sampleRate);
+	put32(28, format.sampleRate * format.channels * 4);
+	put16(32, format.channels * 4);
+	put16(34, 32);
+	std::memcpy(header.data() + 36, "data", 4);
+	put32(40, size);
+	return header;
+}
+
+// Writes the output to a 32-bit float WAV file, or to a file of the bare
+// samples. The sizes in the WAV header are filled in by close().
+class WavFileSink : public AudioSink
+{
+public:
+	WavFileSink(const std::string& path, AudioFormat format, PcmContainer container = PcmContainer::wav)
+		: format(format), container(container)
+	{
+#ifdef _WIN32
+		fopen_s(&file, path.c_str(), "wb");
+#else
+		file = std::fopen(path.c_str(), "wb");
+#endif
+		if (file)
+		{
+			writeHeader(0);
+		}
+	}
+
+	~WavFileSink()
+	{
+		close();
+	}
+
+	// Prevent copying.
+	WavFileSink(WavFileSink const&) = delete;
+	WavFileSink& operator=(WavFileSink const&) = delete;
+
+	bool isOpen() const
+	{
+		return file != nullptr;
+	}
+
+	AudioFormat getFormat() const override
+	{
+		return format;
+	}
+
+	void write(const float* samples, size_t frames) override
+	{
+		if (!file)
+		{
+			return;
+		}
+		std::fwrite(samples, sizeof(float), frames * format.channels, file);
+		framesWritten += frames;
+	}
+
+	void close() override
+	{
+		if (!file)
+		{
+			return;
+		}
+		std::fseek(file, 0, SEEK_SET);
+		writeHeader(framesWritten * format.channels * sizeof(float));
+		std::fclose(file);
+		file = nullptr;
+	}
+
+private:
+	void writeHeader(uint64_t dataSize)
+	{
+		if (container == PcmContainer::wav)
+		{
+			auto header = makeWavHeader(format, dataSize);
+			std::fwrite(header.data(), 1, header.size(), file);
+		}
+	}
+
+	AudioFormat format;
+	PcmContainer container;
+	std::FILE* file = nullptr;
+};
+
+// Keeps the output in memory as the bytes of a WAV file or of the bare
+// samples, which take() hands over once the sink is closed.
+class MemorySink : public AudioSink
+{
+public:
+	explicit MemorySink(AudioFormat format, PcmContainer container = PcmContainer::wav)
+		: format(format), container(container)
+	{
+		if (container == PcmContainer::wav)
+		{
+			auto header = makeWavHeader(format, 0);
+			bytes.assign(header.begin(), header.end());
+		}
+	}
+
+	AudioFormat getFormat() const override
+	{
+		return format;
+	}
+
+	void write(const float* samples, size_t frames) override
+	{
+		if (closed)
+		{
+			return;
+		}
+		auto* data = reinterpret_cast<const uint8_t*>(samples);
+		bytes.insert(bytes.end(), data, data + frames * format.channels * sizeof(float));
+		framesWritten += frames;
+	}
+
+	void close() override
+	{
+		if (closed)
+		{
+			return;
+		}
+		closed = true;
+		if (container == PcmContainer::wav)
+		{
+			auto header = makeWavHeader(format, framesWritten * format.channels * sizeof(float));
+			std::copy(header.begin(), header.end(), bytes.begin());
+		}
+	}
+
+	/// Moves out what was written, closing the sink.
+	std::vector<uint8_t> take()
+	{
+		close();
+		return std::move(bytes);
+	}
+
+private:
+	AudioFormat format;
+	PcmContainer container;
+	std::vector<uint8_t> bytes{};
+	bool closed = false;
+};
+
+// Keeps the output in a ring that another thread drains with read(), for
+// tests that inspect what was played. When the ring is full, new frames are
+// counted as dropped rather than overwriting old ones.
+class CaptureSink : public AudioSink
+{
+public:
+	CaptureSink(AudioFormat format, size_t capacityFrames)
+		: format(format), ring(capacityFrames * format.channels)
+	{
+	}
+
+	AudioFormat getFormat() const override
+	{
+		return format;
+	}
+
+	void write(const float* samples, size_t frames) override
+	{
+		auto count = frames * format.channels;
+		auto accepted = ring.write(samples, std::min(count, ring.writeAvailable()) / format.channels * format.channels);
+		framesWritten += frames;
+		droppedFrames += (count - accepted) / format.channels;
+	}
+
+	/// Moves up to |frames| captured frames into |samples|, returning how many.
+	size_t read(float* samples, size_t frames)
+	{
+		return ring.read(samples, frames * format.channels) / format.channels;
+	}
+
+	uint64_t getDroppedFrames() const
+	{
+		return droppedFrames;
+	}
+
+private:
+	AudioFormat format;
+	SpscRing<float> ring;
+	std::atomic<uint64_t> droppedFrames = 0;
+};
@@ -0,0 +1,164 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+// The load control options of AudioLoadConfigurationMessage. Durations are in
+// microseconds. The defaults are those of the Android implementation.
+struct LoadControlSettings
+{
+	int64_t minBufferUs = 50000000;
+	int64_t maxBufferUs = 50000000;
+	int64_t bufferForPlaybackUs = 2500000;
+	int64_t bufferForPlaybackAfterRebufferUs = 5000000;
+	// Negative when there is no byte target.
+	int64_t targetBufferBytes = -1;
+	bool prioritizeTimeOverSizeThresholds = true;
+};
+
+struct BufferedRange
+{
+	int64_t startUs;
+	int64_t endUs;
+};
+
+// Decides when playback may start and when loading should continue, in the way
+// of ExoPlayer's DefaultLoadControl, and counts stalls.
+//
+// The controller only makes decisions; the player feeds it positions and
+// buffered ranges and applies the result. It does nothing until configured.
+class BufferingController
+{
+public:
+	void configure(const LoadControlSettings& value)
+	{
+		settings = value;
+		enabled = true;
+		isLoading = true;
+	}
+
+	bool isEnabled() const
+	{
+		return enabled;
+	}
+
+	const LoadControlSettings& getSettings() const
+	{
+		return settings;
+	}
+
+	/// Returns the end of the buffered range containing |positionUs|, or
+	/// |positionUs| itself if nothing is buffered there.
+	static int64_t bufferedPosition(int64_t positionUs, std::vector<BufferedRange> ranges)
+	{
+		std::sort(ranges.begin(), ranges.end(), [](const BufferedRange& a, const BufferedRange& b)
+			{ return a.startUs < b.startUs; });
+
+		int64_t end = positionUs;
+		for (auto& range : ranges)
+		{
+			// Ranges that touch are treated as one.
+			if (range.startUs <= end && range.endUs > end)
+			{
+				end = range.endUs;
+			}
+		}
+		return end;
+	}
+
+	static int64_t bufferedAhead(int64_t positionUs, const std::vector<BufferedRange>& ranges)
+	{
+		return bufferedPosition(positionUs, ranges) - positionUs;
+	}
+
+	/// Whether enough is buffered to start playing. After a stall, the larger
+	/// rebuffer threshold applies.
+	bool shouldStartPlayback(int64_t bufferedAheadUs) const
+	{
+		if (!enabled)
+		{
+			return true;
+		}
+		auto threshold = rebuffering ? settings.bufferForPlaybackAfterRebufferUs : settings.bufferForPlaybackUs;
+		return bufferedAheadUs >= threshold;
+	}
+
+	/// Whether the source should keep loading. Between the minimum and maximum
+	/// buffer, the previous decision is kept so that loading happens in bursts.
+	bool shouldContinueLoading(int64_t bufferedAheadUs, int64_t bufferedBytes)
+	{
+		if (!enabled)
+		{
+			return true;
+		}
+
+		bool targetBytesReached = settings.targetBufferBytes >= 0 && bufferedBytes >= settings.targetBufferBytes;
+		if (bufferedAheadUs < settings.minBufferUs)
+		{
+			isLoading = settings.prioritizeTimeOverSizeThresholds || !targetBytesReached;
+		}
+		else if (bufferedAheadUs >= settings.maxBufferUs || targetBytesReached)
+		{
+			isLoading = false;
+		}
+		return isLoading;
+	}
+
+	/// Whether a live stream of |bytesPerSecond| should keep loading, with
+	/// |deliveredBytes| delivered and |playedUs| played. What was delivered
+	/// and not yet played is the buffer.
+	bool shouldContinueLoadingStream(uint64_t deliveredBytes, int64_t playedUs, int64_t bytesPerSecond)
+	{
+		int64_t playedBytes = playedUs * bytesPerSecond / 1000000;
+		auto bufferedBytes = std::max<int64_t>(0, (int64_t)deliveredBytes - playedBytes);
+		return shouldContinueLoading(bufferedBytes * 1000000 / bytesPerSecond, bufferedBytes);
+	}
+
+	/// Playback ran out of data.
+	void onStall()
+	{
+		stallCount++;
+		rebuffering = true;
+	}
+
+	/// Playback resumed after a stall.
+	void onResumed()
+	{
+		if (rebuffering)
+		{
+			rebufferCount++;
+			rebuffering = false;
+		}
+	}
+
+	/// A new source was loaded.
+	void reset()
+	{
+		rebuffering = false;
+		isLoading = true;
+	}
+
+	bool isRebuffering() const
+	{
+		return rebuffering;
+	}
+
+	int64_t getStallCount() const
+	{
+		return stallCount;
+	}
+
+	int64_t getRebufferCount() const
+	{
+		return rebufferCount;
+	}
+
+private:
+	LoadControlSettings settings{};
+	bool enabled = false;
+	bool isLoading = true;
+	bool rebuffering = false;
+	int64_t stallCount = 0;
+	int64_t rebufferCount = 0;
+};
@@ -0,0 +1,485 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+struct DecodeSchedulerStatistics
+{
+	unsigned threads;
+	size_t jobs;
+	// Runs that are due and waiting for a worker, now and at most.
+	size_t queueDepth;
+	size_t maxQueueDepth;
+	uint64_t runs;
+	// Runs a worker took from another's queue.
+	uint64_t steals;
+	// Runs that started after their deadline, when the buffer they fill had
+	// already run out.
+	uint64_t deadlineMisses;
+};
+
+// Runs the decoding of every player on one pool of threads, one per core,
+// rather than on a thread per player. A job decodes a little at a time and
+// says when to run next: at once while its buffer has room, or after a while
+// to check again. Due runs are taken in order of their deadline, the time
+// their buffer runs out, so that the player closest to an underrun decodes
+// first.
+//
+// Each worker keeps the runs it is due to make in a queue of its own, and
+// takes the most urgent run from another worker's queue once its own is
+// empty. Runs that are not due yet wait in a shared timer queue, which the
+// first worker to notice moves to its own queue as they fall due.
+class DecodeScheduler
+{
+public:
+	// When a job is to run next. Runs without a deadline come after every run
+	// with one.
+	struct Next
+	{
+		int64_t notBeforeUs;
+		std::optional<int64_t> deadlineUs;
+	};
+
+	using Job = std::function<Next()>;
+
+	/// The scheduler shared by the players of the process, which lasts while
+	/// any of them does.
+	static std::shared_ptr<DecodeScheduler> shared()
+	{
+		// Never destroyed, so that players torn down during exit still find
+		// them.
+		static auto* sharedMutex = new std::mutex();
+		static auto* instance = new std::weak_ptr<DecodeScheduler>();
+		std::lock_guard<std::mutex> lock(*sharedMutex);
+		auto scheduler = instance->lock();
+		if (!scheduler)
+		{
+			scheduler = std::make_shared<DecodeScheduler>();
+			*instance = scheduler;
+		}
+		return scheduler;
+	}
+
+	static int64_t nowUs()
+	{
+		return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+	}
+
+	/// Starts |threadCount| workers, or one per core if zero.
+	explicit DecodeScheduler(unsigned threadCount = 0)
+	{
+		if (threadCount == 0)
+		{
+			threadCount = std::max(1u, std::thread::hardware_concurrency());
+		}
+		for (unsigned i = 0; i < threadCount; i++)
+		{
+			queues.push_back(std::make_unique<Queue>());
+		}
+		for (unsigned i = 0; i < threadCount; i++)
+		{
+			workers.emplace_back([this, i]()
+				{ work(i); });
+		}
+	}
+
+	/// Stops the workers once the runs they are making are done.
+	~DecodeScheduler()
+	{
+		{
+			std::lock_guard<std::mutex> lock(timerMutex);
+			stopping = true;
+		}
+		wakeWorkers.notify_all();
+		for (auto& worker : workers)
+		{
+			worker.join();
+		}
+	}
+
+	// Prevent copying.
+	DecodeScheduler(DecodeScheduler const&) = delete;
+	DecodeScheduler& operator=(DecodeScheduler const&) = delete;
+
+	/// Adds |job|, which first runs at once, returning its id.
+	uint64_t add(Job job)
+	{
+		auto entry = std::make_shared<Entry>();
+		entry->job = std::move(job);
+		{
+			std::lock_guard<std::mutex> lock(jobsMutex);
+			entry->id = nextId++;
+			jobs[entry->id] = entry;
+		}
+		{
+			std::lock_guard<std::mutex> lock(entry->mutex);
+			entry->state = State::ready;
+			pushReady(nextQueue(), Item{ entry, entry->generation, nowUs() });
+		}
+		notifyReady();
+		return entry->id;
+	}
+
+	/// Has the job run as soon as a worker is free, ahead of runs without a
+	/// deadline, or again once it finishes if it is running.
+	void wake(uint64_t id)
+	{
+		auto entry = find(id);
+		if (!entry)
+		{
+			return;
+		}
+		{
+			std::lock_guard<std::mutex> lock(entry->mutex);
+			if (entry->state == State::running)
+			{
+				entry->woken = true;
+				return;
+			}
+			auto now = nowUs();
+			if (entry->state == State::ready && entry->readyKey <= now)
+			{
+				return;
+			}
+			// The run it replaces, queued for later, is dropped when taken.
+			entry->generation++;
+			entry->state = State::ready;
+			pushReady(nextQueue(), Item{ entry, entry->generation, now });
+		}
+		notifyReady();
+	}
+
+	/// Removes the job, waiting for it to finish running unless it is the
+	/// caller.
+	void remove(uint64_t id)
+	{
+		std::shared_ptr<Entry> entry;
+		{
+			std::lock_guard<std::mutex> lock(jobsMutex);
+			auto found = jobs.find(id);
+			if (found == jobs.end())
+			{
+				return;
+			}
+			entry = found->second;
+			jobs.erase(found);
+		}
+		std::unique_lock<std::mutex> lock(entry->mutex);
+		entry->removed = true;
+		entry->generation++;
+		entry->finished.wait(lock, [&]()
+			{ return entry->state != State::running || entry->runner == std::this_thread::get_id(); });
+	}
+
+	DecodeSchedulerStatistics getStatistics()
+	{
+		DecodeSchedulerStatistics statistics{};
+		statistics.threads = (unsigned)workers.size();
+		{
+			std::lock_guard<std::mutex> lock(jobsMutex);
+			statistics.jobs = jobs.size();
+		}
+		statistics.queueDepth = readyCount.load(std::memory_order_relaxed);
+		statistics.maxQueueDepth = maxReadyCount.load(std::memory_order_relaxed);
+		statistics.runs = runs.load(std::memory_order_relaxed);
+		statistics.steals = steals.load(std::memory_order_relaxed);
+		statistics.deadlineMisses = deadlineMisses.load(std::memory_order_relaxed);
+		return statistics;
+	}
+
+private:
+	enum class State
+	{
+		waiting,
+		ready,
+		running,
+	};
+
+	struct Entry
+	{
+		uint64_t id = 0;
+		Job job{};
+		std::mutex mutex;
+		std::condition_variable finished;
+		State state = State::waiting;
+		// Queued runs of an older generation were replaced and are dropped.
+		uint64_t generation = 0;
+		bool woken = false;
+		bool removed = false;
+		// The deadline of the next run, from the last.
+		bool hasDeadline = false;
+		int64_t deadlineUs = INT64_MAX;
+		// The key of the run queued last, while ready.
+		int64_t readyKey = INT64_MAX;
+		std::thread::id runner{};
+	};
+
+	// A run in a queue, ordered by |key|: the deadline in a worker's queue,
+	// the time it falls due in the timer queue.
+	struct Item
+	{
+		std::shared_ptr<Entry> entry;
+		uint64_t generation;
+		int64_t key;
+	};
+
+	struct Later
+	{
+		bool operator()(const Item& a, const Item& b) const
+		{
+			return a.key > b.key;
+		}
+	};
+
+	struct Queue
+	{
+		std::mutex mutex;
+		std::vector<Item> items{};
+	};
+
+	std::shared_ptr<Entry> find(uint64_t id)
+	{
+		std::lock_guard<std::mutex> lock(jobsMutex);
+		auto found = jobs.find(id);
+		return found != jobs.end() ? found->second : nullptr;
+	}
+
+	size_t nextQueue()
+	{
+		return nextQueueIndex.fetch_add(1, std::memory_order_relaxed) % queues.size();
+	}
+
+	/// Called with the lock of the item's entry held.
+	void pushReady(size_t queue, Item item)
+	{
+		item.entry->readyKey = item.key;
+		size_t depth;
+		{
+			std::lock_guard<std::mutex> lock(queues[queue]->mutex);
+			queues[queue]->items.push_back(std::move(item));
+			std::push_heap(queues[queue]->items.begin(), queues[queue]->items.end(), Later{});
+			depth = readyCount.fetch_add(1, std::memory_order_relaxed) + 1;
+		}
+		auto highest = maxReadyCount.load(std::memory_order_relaxed);
+		while (depth > highest && !maxReadyCount.compare_exchange_weak(highest, depth, std::memory_order_relaxed))
+		{
+		}
+	}
+
+	/// Wakes a sleeping worker for a run that is due.
+	void notifyReady()
+	{
+		{
+			// Taken so that a worker about to sleep sees the run first.
+			std::lock_guard<std::mutex> lock(timerMutex);
+		}
+		wakeWorkers.notify_one();
+	}
+
+	/// Takes the most urgent run of |queue|, if it has one.
+	std::optional<Item> popReady(size_t queue)
+	{
+		std::lock_guard<std::mutex> lock(queues[queue]->mutex);
+		auto& items = queues[queue]->items;
+		if (items.empty())
+		{
+			return std::nullopt;
+		}
+		std::pop_heap(items.begin(), items.end(), Later{});
+		auto item = std::move(items.back());
+		items.pop_back();
+		readyCount.fetch_sub(1, std::memory_order_relaxed);
+		return item;
+	}
+
+	/// Moves the runs that have fallen due to |queue|.
+	void collectDue(size_t queue)
+	{
+		size_t collected = 0;
+		{
+			std::lock_guard<std::mutex> lock(timerMutex);
+			auto now = nowUs();
+			while (!timers.empty() && timers.front().key <= now)
+			{
+				std::pop_heap(timers.begin(), timers.end(), Later{});
+				auto item = std::move(timers.back());
+				timers.pop_back();
+				std::lock_guard<std::mutex> entryLock(item.entry->mutex);
+				if (item.generation != item.entry->generation)
+				{
+					continue;
+				}
+				item.entry->state = State::ready;
+				item.key = item.entry->deadlineUs;
+				pushReady(queue, std::move(item));
+				collected++;
+			}
+		}
+		if (collected > 1)
+		{
+			// Idle workers take the rest.
+			wakeWorkers.notify_all();
+		}
+	}
+
+	/// Takes the next run for worker |index|: its own most urgent one, or else
+	/// the most urgent at the head of another worker's queue.
+	std::optional<Item> take(size_t index)
+	{
+		collectDue(index);
+		if (auto item = popReady(index))
+		{
+			return item;
+		}
+		std::optional<size_t> victim{};
+		int64_t earliest = INT64_MAX;
+		for (size_t i = 1; i < queues.size(); i++)
+		{
+			auto other = (index + i) % queues.size();
+			std::lock_guard<std::mutex> lock(queues[other]->mutex);
+			auto& items = queues[other]->items;
+			if (!items.empty() && (!victim || items.front().key < earliest))
+			{
+				victim = other;
+				earliest = items.front().key;
+			}
+		}
+		if (!victim)
+		{
+			return std::nullopt;
+		}
+		auto item = popReady(*victim);
+		if (item)
+		{
+			steals.fetch_add(1, std::memory_order_relaxed);
+		}
+		return item;
+	}
+
+	void work(size_t index)
+	{
+		while (!stopping)
+		{
+			auto item = take(index);
+			if (!item)
+			{
+				std::unique_lock<std::mutex> lock(timerMutex);
+				if (stopping)
+				{
+					return;
+				}
+				if (readyCount.load(std::memory_order_relaxed) == 0)
+				{
+					if (timers.empty())
+					{
+						wakeWorkers.wait(lock);
+					}
+					else
+					{
+						// Runs of removed jobs may wait far ahead; they are only dropped.
+						auto waitUs = std::clamp<int64_t>(timers.front().key - nowUs(), 0, 1000000);
+						wakeWorkers.wait_for(lock, std::chrono::microseconds(waitUs));
+					}
+				}
+				continue;
+			}
+			run(index, *item);
+		}
+	}
+
+	void run(size_t index, Item& item)
+	{
+		auto& entry = *item.entry;
+		bool late;
+		{
+			std::lock_guard<std::mutex> lock(entry.mutex);
+			if (item.generation != entry.generation || entry.removed)
+			{
+				return;
+			}
+			entry.state = State::running;
+			entry.runner = std::this_thread::get_id();
+			entry.woken = false;
+			late = entry.hasDeadline && nowUs() > entry.deadlineUs;
+		}
+		runs.fetch_add(1, std::memory_order_relaxed);
+		if (late)
+		{
+			deadlineMisses.fetch_add(1, std::memory_order_relaxed);
+		}
+
+		auto next = entry.job();
+
+		bool timer = false;
+		uint64_t generation;
+		{
+			std::lock_guard<std::mutex> lock(entry.mutex);
+			entry.hasDeadline = next.deadlineUs.has_value();
+			entry.deadlineUs = next.deadlineUs.value_or(INT64_MAX);
+			if (entry.removed)
+			{
+				entry.state = State::waiting;
+			}
+			else if (entry.woken || next.notBeforeUs <= nowUs())
+			{
+				entry.state = State::ready;
+				pushReady(index, Item{ item.entry, entry.generation, entry.woken ? nowUs() : entry.deadlineUs });
+			}
+			else
+			{
+				entry.state = State::waiting;
+				timer = true;
+			}
+			entry.runner = std::thread::id{};
+			generation = entry.generation;
+		}
+		entry.finished.notify_all();
+		if (timer)
+		{
+			std::lock_guard<std::mutex> lock(timerMutex);
+			std::lock_guard<std::mutex> entryLock(entry.mutex);
+			if (entry.generation != generation || entry.state != State::waiting || entry.removed)
+			{
+				// Woken or removed meanwhile.
+				return;
+			}
+			timers.push_back(Item{ item.entry, generation, next.notBeforeUs });
+			std::push_heap(timers.begin(), timers.end(), Later{});
+			if (timers.front().entry == item.entry)
+			{
+				// Sleeping workers wait for the earliest timer, which this now is.
+				wakeWorkers.notify_one();
+			}
+		}
+	}
+
+	std::vector<std::unique_ptr<Queue>> queues{};
+	std::vector<std::thread> workers{};
+	std::atomic<size_t> nextQueueIndex = 0;
+
+	std::mutex jobsMutex;
+	std::unordered_map<uint64_t, std::shared_ptr<Entry>> jobs{};
+	uint64_t nextId = 1;
+
+	// Guards the timer queue and the workers' sleep.
+	std::mutex timerMutex;
+	std::condition_variable wakeWorkers;
+	std::vector<Item> timers{};
+	std::atomic<bool> stopping = false;
+
+	std::atomic<size_t> readyCount = 0;
+	std::atomic<size_t> maxReadyCount = 0;
+	std::atomic<uint64_t> runs = 0;
+	std::atomic<uint64_t> steals = 0;
+	std::atomic<uint64_t> deadlineMisses = 0;
+};
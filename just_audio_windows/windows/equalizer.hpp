@@ -0,0 +1,285 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cmath>
+#include <cstdint>
+#include <stdexcept>
+#include <vector>
+
+#if defined(_M_X64) || defined(__SSE__)
+#include <xmmintrin.h>
+#ifndef JUST_AUDIO_SSE
+#define JUST_AUDIO_SSE 1
+#endif
+#elif defined(_M_ARM64) || defined(__ARM_NEON)
+#include <arm_neon.h>
+#ifndef JUST_AUDIO_NEON
+#define JUST_AUDIO_NEON 1
+#endif
+#endif
+
+#include "audio_backend.hpp"
+#include "audio_decoder.hpp"
+
+// A graphic equalizer of peaking biquad filters, one per band, with the bands
+// of the Android equalizer.
+//
+// Gains are set from any thread without locking. process() moves each band
+// towards its gain a little every few frames, so that changes and turning the
+// equalizer on or off do not click; turned off and back at 0dB, it does
+// nothing.
+class Equalizer
+{
+public:
+	static constexpr size_t kBands = 5;
+	static constexpr double kMinDecibels = -15;
+	static constexpr double kMaxDecibels = 15;
+
+	explicit Equalizer(AudioFormat format)
+		: format(format), state(kBands * std::max<uint32_t>(format.channels, 1) * 2)
+	{
+		for (size_t i = 0; i < kBands; i++)
+		{
+			targetDb[i] = 0.0f;
+			currentDb[i] = 0.0f;
+			coefficients[i] = designPeak(kCenters[i], kCenters[i] / (kUpper[i] - kLower[i]), 0.0);
+		}
+	}
+
+	void setEnabled(bool value)
+	{
+		enabled.store(value, std::memory_order_release);
+	}
+
+	bool isEnabled() const
+	{
+		return enabled.load(std::memory_order_acquire);
+	}
+
+	/// Sets the gain of |band|, clamped to the range of getParameters(). Throws
+	/// std::out_of_range for bands that do not exist.
+	void setBandGain(size_t band, double gainDb)
+	{
+		if (band >= kBands)
+		{
+			throw std::out_of_range("band index out of range");
+		}
+		targetDb[band].store((float)std::clamp(gainDb, kMinDecibels, kMaxDecibels), std::memory_order_release);
+	}
+
+	EqualizerParameters getParameters() const
+	{
+		EqualizerParameters parameters{ kMinDecibels, kMaxDecibels, {} };
+		for (size_t i = 0; i < kBands; i++)
+		{
+			parameters.bands.push_back(EqualizerBand{ (int32_t)i, kLower[i], kUpper[i], kCenters[i], targetDb[i].load(std::memory_order_acquire) });
+		}
+		return parameters;
+	}
+
+	/**
+	 * Filters |frames| interleaved frames in place. Called from the output's
+	 * thread; neither locks nor allocates.
+	 */
+	void process(float* samples, size_t frames)
+	{
+		auto on = enabled.load(std::memory_order_acquire);
+		if (!on && !active)
+		{
+			return;
+		}
+
+		for (size_t done = 0; done < frames;)
+		{
+			auto count = std::min(frames - done, kSmoothFrames);
+			active = smooth(on);
+			filter(samples + done * format.channels, count);
+			done += count;
+			if (!active)
+			{
+				reset();
+				break;
+			}
+		}
+	}
+
+	/// Clears what the filters remember of the audio before, after a jump.
+	void reset()
+	{
+		std::fill(state.begin(), state.end(), 0.0f);
+	}
+
+private:
+	struct Biquad
+	{
+		float b0;
+		float b1;
+		float b2;
+		float a1;
+		float a2;
+	};
+
+	// The bands of the Android equalizer.
+	static constexpr double kLower[kBands] = { 30, 120, 460, 1800, 7000 };
+	static constexpr double kUpper[kBands] = { 120, 460, 1800, 7000, 20000 };
+	static constexpr double kCenters[kBands] = { 60, 230, 910, 3600, 14000 };
+	// Gains move at most this fast, and coefficients are recomputed this often
+	// while they move.
+	static constexpr double kDbPerSecond = 200;
+	static constexpr size_t kSmoothFrames = 32;
+
+	/// The peaking filter of the Audio EQ Cookbook, with its center kept
+	/// below the Nyquist frequency.
+	Biquad designPeak(double frequency, double q, double gainDb) const
+	{
+		constexpr double pi = 3.14159265358979323846;
+		auto w0 = 2 * pi * std::min(frequency, format.sampleRate * 0.45) / format.sampleRate;
+		auto a = std::pow(10.0, gainDb / 40);
+		auto alpha = std::sin(w0) / (2 * q);
+		auto a0 = 1 + alpha / a;
+		return Biquad{ (float)((1 + alpha * a) / a0), (float)(-2 * std::cos(w0) / a0), (float)((1 - alpha * a) / a0),
+			(float)(-2 * std::cos(w0) / a0), (float)((1 - alpha / a) / a0) };
+	}
+
+	/// Moves every band towards its gain, or towards 0dB when off. Returns
+	/// whether any band changes the audio.
+	bool smooth(bool on)
+	{
+		auto step = (float)(kDbPerSecond * kSmoothFrames / format.sampleRate);
+		bool any = false;
+		for (size_t i = 0; i < kBands; i++)
+		{
+			auto target = on ? targetDb[i].load(std::memory_order_acquire) : 0.0f;
+			if (currentDb[i] != target)
+			{
+				auto difference = target - currentDb[i];
+				currentDb[i] = std::abs(difference) <= step ? target : currentDb[i] + (difference > 0 ? step : -step);
+				coefficients[i] = designPeak(kCenters[i], kCenters[i] / (kUpper[i] - kLower[i]), currentDb[i]);
+			}
+			any = any || currentDb[i] != 0.0f;
+		}
+		return any || on;
+	}
+
+	/// Runs the bands one after another over |frames| frames, in transposed
+	/// direct form II with the state of each band and channel in |state|.
+	void filter(float* samples, size_t frames)
+	{
+		auto channels = format.channels;
+#if defined(JUST_AUDIO_SSE)
+		if (channels == 2)
+		{
+			// Both channels of a frame go through each band together.
+			__m128 b0[kBands], b1[kBands], b2[kBands], a1[kBands], a2[kBands], z1[kBands], z2[kBands];
+			for (size_t i = 0; i < kBands; i++)
+			{
+				b0[i] = _mm_set1_ps(coefficients[i].b0);
+				b1[i] = _mm_set1_ps(coefficients[i].b1);
+				b2[i] = _mm_set1_ps(coefficients[i].b2);
+				a1[i] = _mm_set1_ps(coefficients[i].a1);
+				a2[i] = _mm_set1_ps(coefficients[i].a2);
+				z1[i] = _mm_setr_ps(state[i * 4], state[i * 4 + 1], 0, 0);
+				z2[i] = _mm_setr_ps(state[i * 4 + 2], state[i * 4 + 3], 0, 0);
+			}
+			for (size_t f = 0; f < frames; f++)
+			{
+				auto x = _mm_loadl_pi(_mm_setzero_ps(), (const __m64*)(samples + f * 2));
+				for (size_t i = 0; i < kBands; i++)
+				{
+					auto y = _mm_add_ps(_mm_mul_ps(b0[i], x), z1[i]);
+					z1[i] = _mm_add_ps(_mm_sub_ps(_mm_mul_ps(b1[i], x), _mm_mul_ps(a1[i], y)), z2[i]);
+					z2[i] = _mm_sub_ps(_mm_mul_ps(b2[i], x), _mm_mul_ps(a2[i], y));
+					x = y;
+				}
+				_mm_storel_pi((__m64*)(samples + f * 2), x);
+			}
+			for (size_t i = 0; i < kBands; i++)
+			{
+				float values[4];
+				_mm_storeu_ps(values, z1[i]);
+				state[i * 4] = flushDenormal(values[0]);
+				state[i * 4 + 1] = flushDenormal(values[1]);
+				_mm_storeu_ps(values, z2[i]);
+				state[i * 4 + 2] = flushDenormal(values[0]);
+				state[i * 4 + 3] = flushDenormal(values[1]);
+			}
+			return;
+		}
+#elif defined(JUST_AUDIO_NEON)
+		if (channels == 2)
+		{
+			float32x2_t b0[kBands], b1[kBands], b2[kBands], a1[kBands], a2[kBands], z1[kBands], z2[kBands];
+			for (size_t i = 0; i < kBands; i++)
+			{
+				b0[i] = vdup_n_f32(coefficients[i].b0);
+				b1[i] = vdup_n_f32(coefficients[i].b1);
+				b2[i] = vdup_n_f32(coefficients[i].b2);
+				a1[i] = vdup_n_f32(coefficients[i].a1);
+				a2[i] = vdup_n_f32(coefficients[i].a2);
+				z1[i] = vld1_f32(state.data() + i * 4);
+				z2[i] = vld1_f32(state.data() + i * 4 + 2);
+			}
+			for (size_t f = 0; f < frames; f++)
+			{
+				auto x = vld1_f32(samples + f * 2);
+				for (size_t i = 0; i < kBands; i++)
+				{
+					auto y = vmla_f32(z1[i], b0[i], x);
+					z1[i] = vadd_f32(vmls_f32(vmul_f32(b1[i], x), a1[i], y), z2[i]);
+					z2[i] = vmls_f32(vmul_f32(b2[i], x), a2[i], y);
+					x = y;
+				}
+				vst1_f32(samples + f * 2, x);
+			}
+			for (size_t i = 0; i < kBands; i++)
+			{
+				vst1_f32(state.data() + i * 4, z1[i]);
+				vst1_f32(state.data() + i * 4 + 2, z2[i]);
+			}
+			for (auto& value : state)
+			{
+				value = flushDenormal(value);
+			}
+			return;
+		}
+#endif
+		for (size_t i = 0; i < kBands; i++)
+		{
+			auto& c = coefficients[i];
+			for (uint32_t ch = 0; ch < channels; ch++)
+			{
+				auto& z1 = state[(i * channels + ch) * 2];
+				auto& z2 = state[(i * channels + ch) * 2 + 1];
+				for (size_t f = 0; f < frames; f++)
+				{
+					auto& x = samples[f * channels + ch];
+					auto y = c.b0 * x + z1;
+					z1 = c.b1 * x - c.a1 * y + z2;
+					z2 = c.b2 * x - c.a2 * y;
+					x = y;
+				}
+				z1 = flushDenormal(z1);
+				z2 = flushDenormal(z2);
+			}
+		}
+	}
+
+	/// Lets filters ringing out over silence reach zero instead of slowing
+	/// to a crawl on denormal numbers.
+	static float flushDenormal(float value)
+	{
+		return std::abs(value) < 1e-15f ? 0.0f : value;
+	}
+
+	AudioFormat format;
+	std::atomic<bool> enabled = false;
+	std::array<std::atomic<float>, kBands> targetDb{};
+
+	// Owned by process().
+	std::array<float, kBands> currentDb{};
+	std::array<Biquad, kBands> coefficients{};
+	std::vector<float> state;
+	bool active = false;
+};
@@ -0,0 +1,496 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cctype>
+#include <cstring>
+#include <functional>
+#include <map>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+// The `icy-*` response headers of a SHOUTcast/Icecast stream.
+struct IcyHeaders
+{
+	std::optional<int32_t> bitrate;
+	std::optional<std::string> genre;
+	std::optional<std::string> name;
+	std::optional<int32_t> metadataInterval;
+	std::optional<std::string> url;
+	std::optional<bool> isPublic;
+
+	bool operator==(const IcyHeaders& other) const
+	{
+		return bitrate == other.bitrate && genre == other.genre && name == other.name &&
+			metadataInterval == other.metadataInterval && url == other.url && isPublic == other.isPublic;
+	}
+
+	bool operator!=(const IcyHeaders& other) const
+	{
+		return !(*this == other);
+	}
+
+	/**
+	 * Whether a source at |uri|, requested with |headers|, is known to be a
+	 * live stream before it is opened: it asks for ICY metadata with an
+	 * `Icy-MetaData` header, or its path holds a `;`, as SHOUTcast stream
+	 * URIs such as `http://host:8000/;` do.
+	 */
+	static bool isKnownStream(const std::string& uri, const std::map<std::string, std::string>& headers)
+	{
+		for (auto& header : headers)
+		{
+			std::string name{};
+			for (auto c : header.first)
+			{
+				name.push_back((char)std::tolower((unsigned char)c));
+			}
+			if (name == "icy-metadata" && header.second != "0")
+			{
+				return true;
+			}
+		}
+		auto scheme = uri.find("://");
+		auto pathStart = uri.find('/', scheme == std::string::npos ? 0 : scheme + 3);
+		if (pathStart == std::string::npos)
+		{
+			return false;
+		}
+		auto path = uri.substr(pathStart, uri.find_first_of("?#", pathStart) - pathStart);
+		return path.find(';') != std::string::npos;
+	}
+
+	/// Reads the headers through |lookup|, which returns the value of a header
+	/// name or std::nullopt if it is absent.
+	template <typename Lookup>
+	static IcyHeaders parse(Lookup lookup)
+	{
+		IcyHeaders headers{};
+		headers.bitrate = parseInt(lookup("icy-br"));
+		headers.genre = lookup("icy-genre");
+		headers.name = lookup("icy-name");
+		headers.metadataInterval = parseInt(lookup("icy-metaint"));
+		headers.url = lookup("icy-url");
+		if (auto isPublic = lookup("icy-pub"))
+		{
+			headers.isPublic = *isPublic == "1";
+		}
+		return headers;
+	}
+
+private:
+	static std::optional<int32_t> parseInt(const std::optional<std::string>& value)
+	{
+		if (!value)
+		{
+			return std::nullopt;
+		}
+		try
+		{
+			return std::stoi(*value);
+		}
+		catch (...)
+		{
+			return std::nullopt;
+		}
+	}
+};
+
+// The in-stream metadata of a SHOUTcast/Icecast stream.
+struct IcyInfo
+{
+	std::optional<std::string> title;
+	std::optional<std::string> url;
+
+	bool operator==(const IcyInfo& other) const
+	{
+		return title == other.title && url == other.url;
+	}
+
+	bool operator!=(const IcyInfo& other) const
+	{
+		return !(*this == other);
+	}
+
+	/// Parses a metadata block such as `StreamTitle='Artist - Song';StreamUrl='';`.
+	/// Values may contain quotes and semicolons, so a value only ends at a quote
+	/// followed by a semicolon or the end of the block.
+	static IcyInfo parse(const char* data, size_t length)
+	{
+		// Blocks are padded with zeros up to a multiple of 16 bytes.
+		while (length > 0 && data[length - 1] == '\0')
+		{
+			length--;
+		}
+
+		IcyInfo info{};
+		std::string block(data, length);
+		size_t position = 0;
+		while (position < block.size())
+		{
+			auto separator = block.find("='", position);
+			if (separator == std::string::npos)
+			{
+				break;
+			}
+			auto key = block.substr(position, separator - position);
+
+			auto valueStart = separator + 2;
+			auto valueEnd = block.find("';", valueStart);
+			if (valueEnd == std::string::npos)
+			{
+				valueEnd = block.size();
+				if (valueEnd > valueStart && block[valueEnd - 1] == '\'')
+				{
+					valueEnd--;
+				}
+			}
+			auto value = block.substr(valueStart, valueEnd - valueStart);
+
+			if (key == "StreamTitle")
+			{
+				info.title = toUtf8(value);
+			}
+			else if (key == "StreamUrl")
+			{
+				info.url = toUtf8(value);
+			}
+			position = valueEnd + 2;
+		}
+		return info;
+	}
+
+	/// Many servers send Latin-1 rather than UTF-8. Valid UTF-8 is returned as
+	/// is; anything else is converted from Latin-1.
+	static std::string toUtf8(const std::string& value)
+	{
+		size_t i = 0;
+		while (i < value.size())
+		{
+			auto c = (uint8_t)value[i];
+			size_t length = c < 0x80 ? 1 : (c >> 5) == 0x6 ? 2 : (c >> 4) == 0xE ? 3 : (c >> 3) == 0x1E ? 4 : 0;
+			if (length == 0 || i + length > value.size())
+			{
+				break;
+			}
+			size_t j = 1;
+			while (j < length && ((uint8_t)value[i + j] >> 6) == 0x2)
+			{
+				j++;
+			}
+			if (j != length)
+			{
+				break;
+			}
+			i += length;
+		}
+		if (i == value.size())
+		{
+			return value;
+		}
+
+		std::string converted{};
+		for (auto c : value)
+		{
+			auto byte = (uint8_t)c;
+			if (byte < 0x80)
+			{
+				converted.push_back(c);
+			}
+			else
+			{
+				converted.push_back((char)(0xC0 | (byte >> 6)));
+				converted.push_back((char)(0x80 | (byte & 0x3F)));
+			}
+		}
+		return converted;
+	}
+};
+
+// Separates the metadata blocks interleaved in an ICY stream from the audio.
+//
+// Every |metadataInterval| audio bytes, the server inserts one length byte
+// (in units of 16 bytes) followed by that many bytes of metadata. Readers that
+// never ask for more than audioBytesUntilMetadata() at a time can hand the
+// audio straight to the decoder without ever moving it; strip() handles
+// buffers that span blocks.
+class IcyParser
+{
+public:
+	explicit IcyParser(uint32_t metadataInterval)
+		: metadataInterval(metadataInterval), audioRemaining(metadataInterval)
+	{
+	}
+
+	/// Whether the next stream bytes belong to a metadata block.
+	bool inMetadata() const
+	{
+		return audioRemaining == 0;
+	}
+
+	/// The number of audio bytes before the next metadata block.
+	size_t audioBytesUntilMetadata() const
+	{
+		return audioRemaining;
+	}
+
+	/// The number of bytes left in the current metadata block, counting its
+	/// length byte if that has not been read yet.
+	size_t metadataBytesRemaining() const
+	{
+		if (!inMetadata())
+		{
+			return 0;
+		}
+		return metadataRemaining < 0 ? 1 : (size_t)metadataRemaining;
+	}
+
+	/// Marks |count| audio bytes as read. |count| may not exceed
+	/// audioBytesUntilMetadata().
+	void consumeAudio(size_t count)
+	{
+		audioRemaining -= (uint32_t)std::min<size_t>(count, audioRemaining);
+	}
+
+	/// Consumes bytes of the current metadata block, returning how many were
+	/// used. Once the block is complete, the parser is back in audio.
+	size_t consumeMetadata(const uint8_t* data, size_t length)
+	{
+		size_t consumed = 0;
+		if (length > 0 && metadataRemaining < 0)
+		{
+			metadataRemaining = data[0] * 16;
+			metadataLength = 0;
+			consumed = 1;
+		}
+
+		auto count = std::min<size_t>(length - consumed, (size_t)std::max(metadataRemaining, 0));
+		std::memcpy(metadata + metadataLength, data + consumed, count);
+		metadataLength += count;
+		metadataRemaining -= (int32_t)count;
+		consumed += count;
+
+		if (metadataRemaining == 0)
+		{
+			finishMetadata();
+		}
+		return consumed;
+	}
+
+	/// Removes the metadata blocks from |data| in place and returns the number
+	/// of audio bytes left at its start. Audio before the first block is left
+	/// where it is; only audio following a block is moved down.
+	size_t strip(uint8_t* data, size_t length)
+	{
+		size_t read = 0;
+		size_t written = 0;
+		while (read < length)
+		{
+			if (inMetadata())
+			{
+				read += consumeMetadata(data + read, length - read);
+				continue;
+			}
+
+			auto count = std::min<size_t>(audioRemaining, length - read);
+			if (written != read)
+			{
+				std::memmove(data + written, data + read, count);
+			}
+			consumeAudio(count);
+			read += count;
+			written += count;
+		}
+		return written;
+	}
+
+	/// Returns true and sets |info| if a block with different metadata than the
+	/// last one was parsed since the previous call.
+	bool takeInfo(IcyInfo& info)
+	{
+		if (!infoChanged)
+		{
+			return false;
+		}
+		infoChanged = false;
+		info = lastInfo;
+		return true;
+	}
+
+private:
+	void finishMetadata()
+	{
+		// Empty blocks mean that nothing changed.
+		if (metadataLength > 0)
+		{
+			auto info = IcyInfo::parse(metadata, metadataLength);
+			if (info != lastInfo)
+			{
+				lastInfo = info;
+				infoChanged = true;
+			}
+		}
+		metadataRemaining = -1;
+		audioRemaining = metadataInterval;
+	}
+
+	uint32_t metadataInterval;
+	uint32_t audioRemaining;
+	// -1 until the length byte of the current block has been read.
+	int32_t metadataRemaining = -1;
+	char metadata[255 * 16];
+	size_t metadataLength = 0;
+	IcyInfo lastInfo{};
+	bool infoChanged = false;
+};
+
+// Reads the audio of a live connection for a decoder, from the bytes
+// |readConnection| receives, with the ICY metadata blocks removed.
+//
+// Audio is read from the connection straight into the caller's buffer: reads
+// stop at the next metadata block, so audio bytes are never copied or moved.
+//
+// The connection can not seek. Only the first kHeadSize audio bytes are
+// retained, so that the decoder can rewind after probing the format.
+class IcyStreamReader
+{
+public:
+	static constexpr uint32_t kHeadSize = 64 * 1024;
+
+	/// Reads up to |length| bytes into |data|, waiting for at least one.
+	/// Returns zero once the connection ended.
+	using ConnectionRead = std::function<size_t(uint8_t* data, size_t length)>;
+
+	IcyStreamReader(std::optional<uint32_t> metadataInterval, ConnectionRead readConnection, std::function<void(const IcyInfo&)> onInfo = nullptr)
+		: readConnection(readConnection), onInfo(onInfo)
+	{
+		if (metadataInterval)
+		{
+			parser.emplace(*metadataInterval);
+		}
+	}
+
+	// Prevent copying.
+	IcyStreamReader(IcyStreamReader const&) = delete;
+	IcyStreamReader& operator=(IcyStreamReader const&) = delete;
+
+	/// The position requested by the decoder.
+	uint64_t getPosition() const
+	{
+		return position;
+	}
+
+	void seek(uint64_t value)
+	{
+		position = value;
+	}
+
+	/// The number of audio bytes received from the connection.
+	uint64_t getLivePosition() const
+	{
+		return livePosition;
+	}
+
+	/// Whether a read at the position would read from the connection, rather
+	/// than from the retained head.
+	bool atLiveEdge() const
+	{
+		return position >= livePosition;
+	}
+
+	/**
+	 * Reads up to |count| audio bytes from the position into |data|, and
+	 * returns how many. Returns zero once the connection ended, or if the
+	 * position is ahead of it. Throws std::runtime_error if the position was
+	 * rewound before the retained head, rather than ending the stream there.
+	 */
+	size_t read(uint8_t* data, size_t count)
+	{
+		if (count == 0)
+		{
+			return 0;
+		}
+
+		// Rewinds are served from the retained head of the stream.
+		if (position < livePosition)
+		{
+			if (position >= head.size())
+			{
+				throw std::runtime_error("Live stream rewound to byte " + std::to_string(position) +
+					", past the first " + std::to_string(kHeadSize) + " bytes retained");
+			}
+			auto length = (size_t)std::min<uint64_t>(count, head.size() - position);
+			std::memcpy(data, head.data() + position, length);
+			position += length;
+			return length;
+		}
+
+		// Bytes ahead of the connection do not exist yet.
+		if (position > livePosition)
+		{
+			return 0;
+		}
+
+		if (!skipMetadata())
+		{
+			return 0;
+		}
+
+		auto length = count;
+		if (parser)
+		{
+			length = std::min(length, parser->audioBytesUntilMetadata());
+		}
+		length = readConnection(data, length);
+
+		if (livePosition < kHeadSize)
+		{
+			auto retained = (size_t)std::min<uint64_t>(length, kHeadSize - livePosition);
+			head.insert(head.end(), data, data + retained);
+		}
+
+		if (parser)
+		{
+			parser->consumeAudio(length);
+		}
+		livePosition += length;
+		position = livePosition.load();
+		return length;
+	}
+
+private:
+	/// Reads past the metadata block at the current position, if any. Returns
+	/// false if the connection ended first.
+	bool skipMetadata()
+	{
+		while (parser && parser->inMetadata())
+		{
+			uint8_t block[1 + 255 * 16];
+			auto length = readConnection(block, parser->metadataBytesRemaining());
+			if (length == 0)
+			{
+				return false;
+			}
+			parser->consumeMetadata(block, length);
+
+			IcyInfo info{};
+			if (parser->takeInfo(info) && onInfo)
+			{
+				onInfo(info);
+			}
+		}
+		return true;
+	}
+
+	ConnectionRead readConnection;
+	std::function<void(const IcyInfo&)> onInfo;
+	std::optional<IcyParser> parser{};
+
+	// Read without the lock of the stream reading, to decide whether to wait.
+	std::atomic<uint64_t> position = 0;
+	std::atomic<uint64_t> livePosition = 0;
+	std::vector<uint8_t> head{};
+};
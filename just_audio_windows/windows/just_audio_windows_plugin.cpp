@@ -9,17 +9,107 @@
 #include <flutter/plugin_registrar_windows.h>
 #include <flutter/standard_method_codec.h>
 
+#include <cstdlib>
 #include <map>
 #include <memory>
+#include <new>
 #include <sstream>
 
+#include "allocation_guard.hpp"
+#include "loudness_analyzer.hpp"
+#include "media_foundation_decoder.hpp"
+#include "metadata_cache.hpp"
+#include "mp3_seek_index.hpp"
+#include "offline_renderer.hpp"
+#include "platform_task_runner.hpp"
+#include "resampler.hpp"
 #include "player.hpp"
+#include "sample_backend.hpp"
+#include "software_backend.hpp"
+#include "sync_group.hpp"
+#include "wasapi_sink.hpp"
+#include "worker_threads.hpp"
 
 using flutter::EncodableMap;
 using flutter::EncodableValue;
 
+#ifdef JUST_AUDIO_ALLOCATION_GUARD
+// Reports every allocation and free made in the plugin to the guard, which
+// fails those made on the render thread. Only this module's heap calls are
+// replaced.
+void *operator new(std::size_t size) {
+  AllocationGuard::onAllocation();
+  if (void *pointer = std::malloc(size ? size : 1)) {
+    return pointer;
+  }
+  throw std::bad_alloc();
+}
+
+void *operator new[](std::size_t size) {
+  return operator new(size);
+}
+
+void *operator new(std::size_t size, const std::nothrow_t &) noexcept {
+  AllocationGuard::onAllocation();
+  return std::malloc(size ? size : 1);
+}
+
+void *operator new[](std::size_t size, const std::nothrow_t &tag) noexcept {
+  return operator new(size, tag);
+}
+
+void operator delete(void *pointer) noexcept {
+  if (pointer) {
+    AllocationGuard::onAllocation();
+  }
+  std::free(pointer);
+}
+
+void operator delete[](void *pointer) noexcept {
+  operator delete(pointer);
+}
+
+void operator delete(void *pointer, std::size_t) noexcept {
+  operator delete(pointer);
+}
+
+void operator delete[](void *pointer, std::size_t) noexcept {
+  operator delete(pointer);
+}
+#endif
+
 namespace {
 
+// Decodes WAV files natively, through the decoder every DecoderRegistry
+// starts with, and every other format Windows has a codec for through Media
+// Foundation, added after it.
+std::shared_ptr<DecoderRegistry> CreateDecoderRegistry() {
+  auto decoders = std::make_shared<DecoderRegistry>();
+  decoders->add(MediaFoundationDecoder::factory());
+  return decoders;
+}
+
+// The metadata caches opened so far, by directory. Shared with the workers
+// that open them, since loading a large index is slow.
+class MetadataCaches {
+ public:
+  // Returns the cache stored in |directory|, loading it on first use.
+  std::shared_ptr<MetadataCache> Get(const std::string &directory) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = caches_.find(directory);
+    if (it != caches_.end()) {
+      return it->second;
+    }
+    auto cache = std::make_shared<MetadataCache>(std::filesystem::u8path(directory));
+    caches_[directory] = cache;
+    return cache;
+  }
+
+ private:
+  std::mutex mutex_;
+  std::map<std::string, std::shared_ptr<MetadataCache>> caches_;
+};
+
 // static std::unordered_map<std::string, AudioPlayer> players;
 std::vector<std::unique_ptr<AudioPlayer>> players_;
 
@@ -27,7 +117,7 @@ class JustAudioWindowsPlugin : public flutter::Plugin {
  public:
   static void RegisterWithRegistrar(flutter::PluginRegistrarWindows *registrar);
 
-  JustAudioWindowsPlugin();
+  JustAudioWindowsPlugin(flutter::PluginRegistrarWindows *registrar);
 
   virtual ~JustAudioWindowsPlugin();
 
@@ -43,8 +133,279 @@ class JustAudioWindowsPlugin : public flutter::Plugin {
 
   // Disposes camera by camera id.
   void DisposePlayerByPlayerId(std::string id);
+
+  // Probes the metadata of many files on worker threads and replies once all
+  // of them are done, without blocking the platform thread.
+  void ProbeMetadata(
+      const flutter::EncodableMap &args,
+      std::unique_ptr<flutter::MethodResult<flutter::EncodableValue>> result);
+
+  // Measures the loudness of many files on the analyzer's workers and replies
+  // once all of them are done, without blocking the platform thread.
+  void AnalyzeLoudness(
+      const flutter::EncodableMap &args,
+      std::unique_ptr<flutter::MethodResult<flutter::EncodableValue>> result);
+
+  // Returns the analyzer shared by every player that normalizes loudness,
+  // starting it on first use.
+  std::shared_ptr<LoudnessAnalyzer> GetLoudnessAnalyzer();
+
+  // Indexes a local MP3 file for exact seeking on a worker thread, or reads
+  // its index from the cache, and replies with what was indexed.
+  void BuildSeekIndex(
+      const flutter::EncodableMap &args,
+      std::unique_ptr<flutter::MethodResult<flutter::EncodableValue>> result);
+
+  // Returns the seek indexer shared by every player, starting it on first
+  // use.
+  std::shared_ptr<Mp3SeekIndexer> GetSeekIndexer();
+
+  // Puts the players given by id in a new sync group, which replaces any
+  // group of the same id. Every player must be a voice of the shared mixer.
+  void CreateSyncGroup(
+      const flutter::EncodableMap &args,
+      std::unique_ptr<flutter::MethodResult<flutter::EncodableValue>> result);
+
+  // Renders an audio source to a file or to memory on worker threads, as fast
+  // as it decodes, and replies with how many times real time that took.
+  void RenderOffline(
+      const flutter::EncodableMap &args,
+      std::unique_ptr<flutter::MethodResult<flutter::EncodableValue>> result);
+
+  // Replies with the counters of the decoded audio cache and of the decode
+  // scheduler.
+  void GetMetrics(std::unique_ptr<flutter::MethodResult<flutter::EncodableValue>> result);
+
+  std::shared_ptr<PlatformTaskRunner> task_runner_;
+  // Mixes the players created with a shared software backend.
+  std::shared_ptr<Mixer> mixer_;
+  // Decoded audio shared by every software backend player.
+  std::shared_ptr<PcmCache> pcm_cache_ = std::make_shared<PcmCache>();
+  // Opens the sources of software backend players, sample players and
+  // offline renders.
+  std::shared_ptr<DecoderRegistry> decoders_ = CreateDecoderRegistry();
+  // Clips decoded for sample players, shared so that each is decoded once.
+  std::shared_ptr<SamplePool> sample_pool_ = std::make_shared<SamplePool>(pcm_cache_, decoders_);
+  // Decodes for every software backend player, held so that its counters
+  // outlive the players.
+  std::shared_ptr<DecodeScheduler> decode_scheduler_ = DecodeScheduler::shared();
+  std::shared_ptr<MetadataCaches> metadata_caches_ = std::make_shared<MetadataCaches>();
+  std::mutex loudness_analyzer_mutex_;
+  std::shared_ptr<LoudnessAnalyzer> loudness_analyzer_;
+  std::mutex seek_indexer_mutex_;
+  std::shared_ptr<Mp3SeekIndexer> seek_indexer_;
+  std::map<std::string, std::shared_ptr<SyncGroup>> sync_groups_;
+  // Runs the method calls that reply later. Declared last, so that they are
+  // joined before anything else is destroyed.
+  WorkerThreads workers_;
 };
 
+// Converts a probe result into the map sent to Dart. Durations are in
+// microseconds, like everywhere else in the plugin.
+flutter::EncodableMap EncodeProbeResult(const ProbeResult &probe_result) {
+  auto data = flutter::EncodableMap();
+  data[flutter::EncodableValue("path")] = flutter::EncodableValue(probe_result.path);
+  if (!probe_result.entry) {
+    data[flutter::EncodableValue("error")] = flutter::EncodableValue("unsupported");
+    return data;
+  }
+
+  auto optional_string = [](const std::optional<std::string> &value) {
+    return value ? flutter::EncodableValue(*value) : flutter::EncodableValue();
+  };
+  auto optional_int = [](const auto &value) {
+    return value ? flutter::EncodableValue((int64_t)*value) : flutter::EncodableValue();
+  };
+
+  const auto &entry = *probe_result.entry;
+  const auto &metadata = entry.metadata;
+  data[flutter::EncodableValue("cached")] = flutter::EncodableValue(probe_result.cached);
+  data[flutter::EncodableValue("format")] = flutter::EncodableValue(metadata.format);
+  data[flutter::EncodableValue("title")] = optional_string(metadata.title);
+  data[flutter::EncodableValue("artist")] = optional_string(metadata.artist);
+  data[flutter::EncodableValue("album")] = optional_string(metadata.album);
+  data[flutter::EncodableValue("albumArtist")] = optional_string(metadata.albumArtist);
+  data[flutter::EncodableValue("genre")] = optional_string(metadata.genre);
+  data[flutter::EncodableValue("date")] = optional_string(metadata.date);
+  data[flutter::EncodableValue("trackNumber")] = optional_int(metadata.trackNumber);
+  data[flutter::EncodableValue("discNumber")] = optional_int(metadata.discNumber);
+  data[flutter::EncodableValue("duration")] = optional_int(metadata.durationUs);
+  data[flutter::EncodableValue("sampleRate")] = optional_int(metadata.sampleRate);
+  data[flutter::EncodableValue("channels")] = optional_int(metadata.channels);
+  data[flutter::EncodableValue("bitrate")] = optional_int(metadata.bitrate);
+  data[flutter::EncodableValue("encoderDelay")] = optional_int(metadata.encoderDelay);
+  data[flutter::EncodableValue("encoderPadding")] = optional_int(metadata.encoderPadding);
+  data[flutter::EncodableValue("artworkMimeType")] = optional_string(metadata.artworkMimeType);
+  data[flutter::EncodableValue("artworkPath")] = optional_string(entry.artworkPath);
+  return data;
+}
+
+// Creates the sink described by the `softwareBackend` option of init, or
+// returns nullptr and sets |error| if the options are invalid.
+std::shared_ptr<AudioSink> CreateSink(const flutter::EncodableMap &options, AudioFormat format, std::string *error) {
+  const auto* sink_type = std::get_if<std::string>(ValueOrNull(options, "sink"));
+  if (!sink_type || sink_type->compare("null") == 0) {
+    const auto* realtime = std::get_if<bool>(ValueOrNull(options, "realtime"));
+    return std::make_shared<NullSink>(format, realtime && *realtime);
+  } else if (sink_type->compare("device") == 0) {
+    return std::make_shared<WasapiSink>(format);
+  } else if (sink_type->compare("wav") == 0) {
+    const auto* path = std::get_if<std::string>(ValueOrNull(options, "path"));
+    if (!path) {
+      *error = "path argument missing";
+      return nullptr;
+    }
+    auto wav_sink = std::make_shared<WavFileSink>(*path, format);
+    if (!wav_sink->isOpen()) {
+      *error = "could not open " + *path;
+      return nullptr;
+    }
+    return wav_sink;
+  }
+  *error = "unknown sink " + *sink_type;
+  return nullptr;
+}
+
+// Reads a time stretch quality, "off" being none. Returns false for unknown
+// names.
+bool ParseTimeStretchQuality(const std::string &name, std::optional<TimeStretcher::Quality> *quality) {
+  if (name.compare("off") == 0) {
+    *quality = std::nullopt;
+  } else if (name.compare("fast") == 0) {
+    *quality = TimeStretcher::Quality::fast;
+  } else if (name.compare("balanced") == 0) {
+    *quality = TimeStretcher::Quality::balanced;
+  } else if (name.compare("best") == 0) {
+    *quality = TimeStretcher::Quality::best;
+  } else {
+    return false;
+  }
+  return true;
+}
+
+bool ParseResamplerQuality(const std::string &name, Resampler::Quality *quality) {
+  if (name.compare("fast") == 0) {
+    *quality = Resampler::Quality::fast;
+  } else if (name.compare("balanced") == 0) {
+    *quality = Resampler::Quality::balanced;
+  } else if (name.compare("best") == 0) {
+    *quality = Resampler::Quality::best;
+  } else {
+    return false;
+  }
+  return true;
+}
+
+// Creates the software backend described by the `softwareBackend` option of
+// init, or returns nullptr and sets |error| if the options are invalid. With
+// `shared`, the player is a voice of |shared_mixer|, which the first such
+// player creates. With `mode: "sample"`, the player plays clips decoded into
+// |sample_pool|; otherwise short sources are kept in |pcm_cache|, and with
+// `normalizeLoudness`, items are levelled as measured by |loudness_analyzer|.
+std::unique_ptr<AudioBackend> CreateSoftwareBackend(const flutter::EncodableMap &options, std::shared_ptr<Mixer> *shared_mixer, std::shared_ptr<DecoderRegistry> decoders, std::shared_ptr<SamplePool> sample_pool, std::shared_ptr<PcmCache> pcm_cache, std::shared_ptr<LoudnessAnalyzer> loudness_analyzer, std::string *error) {
+  AudioFormat format{48000, 2};
+  if (auto sample_rate = LongValueOrNull(options, "sampleRate")) {
+    format.sampleRate = (uint32_t)*sample_rate;
+  }
+  if (auto channels = LongValueOrNull(options, "channels")) {
+    format.channels = (uint32_t)*channels;
+  }
+  if (format.sampleRate == 0 || format.channels == 0) {
+    *error = "sampleRate and channels must be positive";
+    return nullptr;
+  }
+  auto buffer_depth = LongValueOrNull(options, "bufferDepth").value_or(SoftwareBackend::kDefaultBufferDepthMs);
+  if (buffer_depth <= 0) {
+    *error = "bufferDepth must be positive";
+    return nullptr;
+  }
+
+  // Smaller blocks are heard sooner, at the cost of more wakeups.
+  auto block_frames = LongValueOrNull(options, "blockFrames").value_or(Mixer::kDefaultBlockFrames);
+  if (block_frames <= 0) {
+    *error = "blockFrames must be positive";
+    return nullptr;
+  }
+  const auto* mode = std::get_if<std::string>(ValueOrNull(options, "mode"));
+  bool sample_mode = mode && mode->compare("sample") == 0;
+  if (mode && !sample_mode && mode->compare("stream") != 0) {
+    *error = "unknown mode " + *mode;
+    return nullptr;
+  }
+  auto polyphony = (size_t)std::max<int64_t>(LongValueOrNull(options, "polyphony").value_or(SampleBackend::kDefaultPolyphony), 1);
+  std::optional<TimeStretcher::Quality> time_stretch = TimeStretcher::Quality::balanced;
+  if (const auto* quality = std::get_if<std::string>(ValueOrNull(options, "timeStretch"))) {
+    if (!ParseTimeStretchQuality(*quality, &time_stretch)) {
+      *error = "unknown timeStretch " + *quality;
+      return nullptr;
+    }
+  }
+  auto resampler = Resampler::Quality::balanced;
+  if (const auto* quality = std::get_if<std::string>(ValueOrNull(options, "resampler"))) {
+    if (!ParseResamplerQuality(*quality, &resampler)) {
+      *error = "unknown resampler " + *quality;
+      return nullptr;
+    }
+  }
+
+  const auto* use_pcm_cache = std::get_if<bool>(ValueOrNull(options, "pcmCache"));
+  if (use_pcm_cache && !*use_pcm_cache) {
+    pcm_cache = nullptr;
+  }
+  auto crossfade = std::max<int64_t>(LongValueOrNull(options, "crossfade").value_or(0), 0);
+  // The target loudness in LUFS.
+  std::optional<double> normalize_loudness;
+  if (const auto* target = std::get_if<double>(ValueOrNull(options, "normalizeLoudness"))) {
+    normalize_loudness = *target;
+  }
+
+  std::unique_ptr<AudioBackend> backend = nullptr;
+  const auto* shared = std::get_if<bool>(ValueOrNull(options, "shared"));
+  if (shared && *shared) {
+    if (!*shared_mixer) {
+      auto sink = CreateSink(options, format, error);
+      if (!sink) {
+        return nullptr;
+      }
+      auto max_voices = LongValueOrNull(options, "maxVoices").value_or(Mixer::kDefaultMaxVoices);
+      *shared_mixer = std::make_shared<Mixer>(format, sink, (size_t)std::max<int64_t>(max_voices, 1), (size_t)block_frames);
+    } else if (auto max_voices = LongValueOrNull(options, "maxVoices")) {
+      (*shared_mixer)->setMaxVoices((size_t)std::max<int64_t>(*max_voices, 1));
+    }
+    if (sample_mode) {
+      backend = std::make_unique<SampleBackend>(*shared_mixer, sample_pool, polyphony);
+    } else {
+      auto software_backend = std::make_unique<SoftwareBackend>(*shared_mixer, decoders, (uint32_t)buffer_depth);
+      software_backend->setPcmCache(pcm_cache);
+      software_backend->setTimeStretchQuality(time_stretch);
+      software_backend->setResamplerQuality(resampler);
+      software_backend->setLoudnessNormalization(loudness_analyzer, normalize_loudness);
+      software_backend->setCrossfade(crossfade);
+      backend = std::move(software_backend);
+    }
+  } else {
+    auto sink = CreateSink(options, format, error);
+    if (!sink) {
+      return nullptr;
+    }
+    if (sample_mode) {
+      backend = std::make_unique<SampleBackend>(sink, sample_pool, polyphony, (size_t)block_frames);
+    } else {
+      auto software_backend = std::make_unique<SoftwareBackend>(sink, decoders, (uint32_t)buffer_depth);
+      software_backend->setPcmCache(pcm_cache);
+      software_backend->setTimeStretchQuality(time_stretch);
+      software_backend->setResamplerQuality(resampler);
+      software_backend->setLoudnessNormalization(loudness_analyzer, normalize_loudness);
+      software_backend->setCrossfade(crossfade);
+      backend = std::move(software_backend);
+    }
+  }
+  if (auto priority = LongValueOrNull(options, "priority")) {
+    backend->setPriority((int32_t)*priority);
+  }
+  return backend;
+}
+
 // static
 void JustAudioWindowsPlugin::RegisterWithRegistrar(
     flutter::PluginRegistrarWindows *registrar) {
@@ -53,7 +414,7 @@ void JustAudioWindowsPlugin::RegisterWithRegistrar(
           registrar->messenger(), "com.ryanheise.just_audio.methods",
           &flutter::StandardMethodCodec::GetInstance());
 
-  auto plugin = std::make_unique<JustAudioWindowsPlugin>();
+  auto plugin = std::make_unique<JustAudioWindowsPlugin>(registrar);
 
   channel->SetMethodCallHandler(
       [plugin_pointer = plugin.get(), messenger_pointer = registrar->messenger()](const auto &call, auto result) {
@@ -63,7 +424,8 @@ void JustAudioWindowsPlugin::RegisterWithRegistrar(
   registrar->AddPlugin(std::move(plugin));
 }
 
-JustAudioWindowsPlugin::JustAudioWindowsPlugin() {}
+JustAudioWindowsPlugin::JustAudioWindowsPlugin(flutter::PluginRegistrarWindows *registrar)
+    : task_runner_(std::make_shared<PlatformTaskRunner>(registrar)) {}
 
 JustAudioWindowsPlugin::~JustAudioWindowsPlugin() {}
 
@@ -79,6 +441,22 @@ void JustAudioWindowsPlugin::HandleMethodCall(
         return result->Error("argument_error", "id argument missing");
       }
       auto player = std::make_unique<AudioPlayer>(*id, messenger);
+      const auto* loadConfiguration = std::get_if<flutter::EncodableMap>(ValueOrNull(*args, "audioLoadConfiguration"));
+      if (loadConfiguration) {
+        player->setLoadConfiguration(*loadConfiguration);
+      }
+      const auto* software_backend = std::get_if<flutter::EncodableMap>(ValueOrNull(*args, "softwareBackend"));
+      if (software_backend) {
+        std::string error;
+        auto loudness_analyzer = ValueOrNull(*software_backend, "normalizeLoudness") ? GetLoudnessAnalyzer() : nullptr;
+        auto backend = CreateSoftwareBackend(*software_backend, &mixer_, decoders_, sample_pool_, pcm_cache_, loudness_analyzer, &error);
+        if (!backend) {
+          return result->Error("argument_error", error);
+        }
+        player->setBackend(std::move(backend));
+      }
+      player->setSeekIndexer(GetSeekIndexer());
+      player->setTaskRunner(task_runner_);
       players_.push_back(std::move(player));
       result->Success();
     } else if (method_call.method_name().compare("disposePlayer") == 0) {
@@ -91,6 +469,41 @@ void JustAudioWindowsPlugin::HandleMethodCall(
     } else if (method_call.method_name().compare("disposeAllPlayers") == 0) {
       players_.clear();
       result->Success(flutter::EncodableMap());
+    } else if (method_call.method_name().compare("createSyncGroup") == 0) {
+      CreateSyncGroup(*args, std::move(result));
+    } else if (method_call.method_name().compare("disposeSyncGroup") == 0) {
+      const auto* id = std::get_if<std::string>(ValueOrNull(*args, "id"));
+      if (!id) {
+        return result->Error("argument_error", "id argument missing");
+      }
+      auto group = sync_groups_.find(*id);
+      if (group != sync_groups_.end()) {
+        group->second->dissolve();
+        sync_groups_.erase(group);
+      }
+      result->Success(flutter::EncodableMap());
+    } else if (method_call.method_name().compare("getHostTime") == 0) {
+      // The clock of playAt.
+      auto response = flutter::EncodableMap();
+      response[flutter::EncodableValue("hostTime")] = flutter::EncodableValue(RenderClock::nowUs());
+      result->Success(response);
+    } else if (method_call.method_name().compare("probeMetadata") == 0) {
+      ProbeMetadata(*args, std::move(result));
+    } else if (method_call.method_name().compare("analyzeLoudness") == 0) {
+      AnalyzeLoudness(*args, std::move(result));
+    } else if (method_call.method_name().compare("buildSeekIndex") == 0) {
+      BuildSeekIndex(*args, std::move(result));
+    } else if (method_call.method_name().compare("renderOffline") == 0) {
+      RenderOffline(*args, std::move(result));
+    } else if (method_call.method_name().compare("getMetrics") == 0) {
+      GetMetrics(std::move(result));
+    } else if (method_call.method_name().compare("setPcmCacheBudget") == 0) {
+      auto bytes = LongValueOrNull(*args, "bytes");
+      if (!bytes || *bytes < 0) {
+        return result->Error("argument_error", "bytes argument missing");
+      }
+      pcm_cache_->setBudget((size_t)*bytes);
+      result->Success(flutter::EncodableMap());
     } else {
       result->NotImplemented();
     }
@@ -117,6 +530,344 @@ void JustAudioWindowsPlugin::DisposePlayerByPlayerId(std::string id) {
   }
 }
 
+void JustAudioWindowsPlugin::CreateSyncGroup(
+    const flutter::EncodableMap &args,
+    std::unique_ptr<flutter::MethodResult<flutter::EncodableValue>> result) {
+  const auto* id = std::get_if<std::string>(ValueOrNull(args, "id"));
+  const auto* player_ids = std::get_if<flutter::EncodableList>(ValueOrNull(args, "players"));
+  if (!id || !player_ids) {
+    return result->Error("argument_error", "id or players argument missing");
+  }
+  if (!mixer_) {
+    return result->Error("argument_error", "sync groups need players of a shared software backend");
+  }
+
+  auto previous = sync_groups_.find(*id);
+  if (previous != sync_groups_.end()) {
+    previous->second->dissolve();
+    sync_groups_.erase(previous);
+  }
+  auto group = std::make_shared<SyncGroup>(mixer_);
+  for (const auto &player_id : *player_ids) {
+    const auto* player_id_string = std::get_if<std::string>(&player_id);
+    auto* player = player_id_string ? GetPlayerByPlayerId(*player_id_string) : nullptr;
+    if (!player) {
+      group->dissolve();
+      return result->Error("argument_error", "player not found");
+    }
+    try {
+      player->setSyncGroup(group);
+    } catch (const std::exception &error) {
+      group->dissolve();
+      return result->Error("argument_error", error.what());
+    }
+  }
+  sync_groups_[*id] = group;
+  result->Success(flutter::EncodableMap());
+}
+
+void JustAudioWindowsPlugin::ProbeMetadata(
+    const flutter::EncodableMap &args,
+    std::unique_ptr<flutter::MethodResult<flutter::EncodableValue>> result) {
+  const auto* paths_list = std::get_if<flutter::EncodableList>(ValueOrNull(args, "paths"));
+  if (!paths_list) {
+    return result->Error("argument_error", "paths argument missing");
+  }
+  std::vector<std::string> paths;
+  for (const auto &path : *paths_list) {
+    if (const auto* path_string = std::get_if<std::string>(&path)) {
+      paths.push_back(*path_string);
+    }
+  }
+
+  const auto* include_artwork_value = std::get_if<bool>(ValueOrNull(args, "includeArtwork"));
+  bool include_artwork = include_artwork_value ? *include_artwork_value : true;
+  auto threads = LongValueOrNull(args, "threads").value_or(0);
+
+  std::string directory;
+  if (const auto* cache_directory = std::get_if<std::string>(ValueOrNull(args, "cacheDirectory"))) {
+    directory = *cache_directory;
+  } else if (const char* local_app_data = std::getenv("LOCALAPPDATA")) {
+    directory = (std::filesystem::u8path(local_app_data) / "just_audio_windows" / "metadata").u8string();
+  } else {
+    directory = (std::filesystem::temp_directory_path() / "just_audio_windows" / "metadata").u8string();
+  }
+
+  // MethodResult is not copyable, but tasks must be.
+  std::shared_ptr<flutter::MethodResult<flutter::EncodableValue>> shared_result = std::move(result);
+  workers_.run([caches = metadata_caches_, directory, paths, include_artwork, threads, shared_result, task_runner = task_runner_]() {
+    // Loading a large index is slow too, so it happens here.
+    auto cache = caches->Get(directory);
+
+    ProbeStatistics statistics;
+    auto results = MetadataScanner::scan(*cache, paths, include_artwork, (unsigned)std::max<int64_t>(threads, 0), statistics);
+
+    auto encoded_results = flutter::EncodableList();
+    for (const auto &probe_result : results) {
+      encoded_results.push_back(flutter::EncodableValue(EncodeProbeResult(probe_result)));
+    }
+    auto encoded_statistics = flutter::EncodableMap();
+    encoded_statistics[flutter::EncodableValue("files")] = flutter::EncodableValue((int64_t)statistics.files);
+    encoded_statistics[flutter::EncodableValue("cached")] = flutter::EncodableValue((int64_t)statistics.cached);
+    encoded_statistics[flutter::EncodableValue("failed")] = flutter::EncodableValue((int64_t)statistics.failed);
+    encoded_statistics[flutter::EncodableValue("elapsed")] = flutter::EncodableValue(statistics.elapsedUs);
+    encoded_statistics[flutter::EncodableValue("filesPerSecond")] = flutter::EncodableValue(statistics.filesPerSecond);
+
+    auto response = flutter::EncodableMap();
+    response[flutter::EncodableValue("results")] = flutter::EncodableValue(encoded_results);
+    response[flutter::EncodableValue("statistics")] = flutter::EncodableValue(encoded_statistics);
+    task_runner->post([shared_result, response]() { shared_result->Success(response); });
+  });
+}
+
+void JustAudioWindowsPlugin::AnalyzeLoudness(
+    const flutter::EncodableMap &args,
+    std::unique_ptr<flutter::MethodResult<flutter::EncodableValue>> result) {
+  const auto* paths_list = std::get_if<flutter::EncodableList>(ValueOrNull(args, "paths"));
+  if (!paths_list) {
+    return result->Error("argument_error", "paths argument missing");
+  }
+  std::vector<std::string> paths;
+  for (const auto &path : *paths_list) {
+    if (const auto* path_string = std::get_if<std::string>(&path)) {
+      paths.push_back(*path_string);
+    }
+  }
+
+  std::shared_ptr<flutter::MethodResult<flutter::EncodableValue>> shared_result = std::move(result);
+  workers_.run([analyzer = GetLoudnessAnalyzer(), paths, shared_result, task_runner = task_runner_]() {
+    LoudnessStatistics statistics;
+    auto results = analyzer->analyze(paths, statistics);
+
+    auto encoded_results = flutter::EncodableList();
+    for (const auto &analysis : results) {
+      auto data = flutter::EncodableMap();
+      data[flutter::EncodableValue("path")] = flutter::EncodableValue(analysis.path);
+      if (analysis.result) {
+        data[flutter::EncodableValue("cached")] = flutter::EncodableValue(analysis.cached);
+        data[flutter::EncodableValue("integratedLoudness")] = flutter::EncodableValue(analysis.result->integratedLufs);
+        data[flutter::EncodableValue("truePeak")] = flutter::EncodableValue(analysis.result->truePeakDb);
+        data[flutter::EncodableValue("duration")] = flutter::EncodableValue(analysis.result->durationUs);
+      } else {
+        data[flutter::EncodableValue("error")] = flutter::EncodableValue("unsupported");
+      }
+      encoded_results.push_back(flutter::EncodableValue(data));
+    }
+    auto encoded_statistics = flutter::EncodableMap();
+    encoded_statistics[flutter::EncodableValue("files")] = flutter::EncodableValue((int64_t)statistics.files);
+    encoded_statistics[flutter::EncodableValue("cached")] = flutter::EncodableValue((int64_t)statistics.cached);
+    encoded_statistics[flutter::EncodableValue("failed")] = flutter::EncodableValue((int64_t)statistics.failed);
+    encoded_statistics[flutter::EncodableValue("elapsed")] = flutter::EncodableValue(statistics.elapsedUs);
+    encoded_statistics[flutter::EncodableValue("threads")] = flutter::EncodableValue((int64_t)analyzer->getThreadCount());
+    encoded_statistics[flutter::EncodableValue("realtimeFactor")] = flutter::EncodableValue(statistics.realtimeFactor);
+
+    auto response = flutter::EncodableMap();
+    response[flutter::EncodableValue("results")] = flutter::EncodableValue(encoded_results);
+    response[flutter::EncodableValue("statistics")] = flutter::EncodableValue(encoded_statistics);
+    task_runner->post([shared_result, response]() { shared_result->Success(response); });
+  });
+}
+
+void JustAudioWindowsPlugin::BuildSeekIndex(
+    const flutter::EncodableMap &args,
+    std::unique_ptr<flutter::MethodResult<flutter::EncodableValue>> result) {
+  const auto* path = std::get_if<std::string>(ValueOrNull(args, "path"));
+  if (!path) {
+    return result->Error("argument_error", "path argument missing");
+  }
+
+  std::shared_ptr<flutter::MethodResult<flutter::EncodableValue>> shared_result = std::move(result);
+  workers_.run([indexer = GetSeekIndexer(), path = *path, shared_result, task_runner = task_runner_]() {
+    auto build = indexer->get(path);
+    if (!build.index) {
+      task_runner->post([shared_result]() { shared_result->Error("index_error", "not an MPEG audio file"); });
+      return;
+    }
+    auto response = flutter::EncodableMap();
+    response[flutter::EncodableValue("frames")] = flutter::EncodableValue((int64_t)build.index->getFrameCount());
+    response[flutter::EncodableValue("points")] = flutter::EncodableValue((int64_t)build.index->getPointCount());
+    response[flutter::EncodableValue("duration")] = flutter::EncodableValue(build.index->getDurationUs());
+    response[flutter::EncodableValue("variableBitrate")] = flutter::EncodableValue(build.index->isVariableBitrate());
+    response[flutter::EncodableValue("tableOfContents")] = flutter::EncodableValue(build.index->hasTableOfContents());
+    response[flutter::EncodableValue("cached")] = flutter::EncodableValue(build.cached);
+    response[flutter::EncodableValue("elapsed")] = flutter::EncodableValue(build.elapsedUs);
+    task_runner->post([shared_result, response]() { shared_result->Success(response); });
+  });
+}
+
+void JustAudioWindowsPlugin::RenderOffline(
+    const flutter::EncodableMap &args,
+    std::unique_ptr<flutter::MethodResult<flutter::EncodableValue>> result) {
+  const auto* source_map = std::get_if<flutter::EncodableMap>(ValueOrNull(args, "audioSource"));
+  if (!source_map) {
+    return result->Error("argument_error", "audioSource argument missing");
+  }
+  AudioSourceSpec source;
+  try {
+    source = ParseAudioSource(*source_map);
+  } catch (const std::exception &error) {
+    return result->Error("argument_error", error.what());
+  }
+
+  AudioFormat format{48000, 2};
+  if (auto sample_rate = LongValueOrNull(args, "sampleRate")) {
+    format.sampleRate = (uint32_t)*sample_rate;
+  }
+  if (auto channels = LongValueOrNull(args, "channels")) {
+    format.channels = (uint32_t)*channels;
+  }
+  if (format.sampleRate == 0 || format.channels == 0) {
+    return result->Error("argument_error", "sampleRate and channels must be positive");
+  }
+  auto container = PcmContainer::wav;
+  if (const auto* name = std::get_if<std::string>(ValueOrNull(args, "container"))) {
+    if (name->compare("raw") == 0) {
+      container = PcmContainer::raw;
+    } else if (name->compare("wav") != 0) {
+      return result->Error("argument_error", "unknown container " + *name);
+    }
+  }
+
+  OfflineRenderOptions options;
+  options.decoders = decoders_;
+  options.threads = (unsigned)std::max<int64_t>(LongValueOrNull(args, "threads").value_or(0), 0);
+  if (const auto* volume = std::get_if<double>(ValueOrNull(args, "volume"))) {
+    options.volume = *volume;
+  }
+  if (const auto* speed = std::get_if<double>(ValueOrNull(args, "speed"))) {
+    options.speed = *speed;
+  }
+  if (const auto* pitch = std::get_if<double>(ValueOrNull(args, "pitch"))) {
+    options.pitch = *pitch;
+  }
+  if (const auto* quality = std::get_if<std::string>(ValueOrNull(args, "timeStretch"))) {
+    if (!ParseTimeStretchQuality(*quality, &options.timeStretchQuality)) {
+      return result->Error("argument_error", "unknown timeStretch " + *quality);
+    }
+  }
+  if (const auto* quality = std::get_if<std::string>(ValueOrNull(args, "resampler"))) {
+    if (!ParseResamplerQuality(*quality, &options.resamplerQuality)) {
+      return result->Error("argument_error", "unknown resampler " + *quality);
+    }
+  }
+  const auto* skip_silence = std::get_if<bool>(ValueOrNull(args, "skipSilence"));
+  if (skip_silence && *skip_silence) {
+    options.skipSilence = SkipSilenceOptions{};
+  }
+  options.crossfadeUs = std::max<int64_t>(LongValueOrNull(args, "crossfade").value_or(0), 0);
+  if (const auto* target = std::get_if<double>(ValueOrNull(args, "normalizeLoudness"))) {
+    options.loudnessAnalyzer = GetLoudnessAnalyzer();
+    options.normalizationTargetLufs = *target;
+  }
+  if (const auto* gains = std::get_if<flutter::EncodableList>(ValueOrNull(args, "equalizerGains"))) {
+    if (gains->size() > Equalizer::kBands) {
+      return result->Error("argument_error", "too many equalizerGains");
+    }
+    for (const auto &gain : *gains) {
+      const auto* gain_value = std::get_if<double>(&gain);
+      options.equalizerGainsDb.push_back(gain_value ? *gain_value : 0.0);
+    }
+  }
+  if (const auto* gain = std::get_if<double>(ValueOrNull(args, "loudnessEnhancerGain"))) {
+    options.loudnessEnhancerGainDb = *gain;
+  }
+
+  // Without a path, the output is sent back in the reply.
+  std::shared_ptr<AudioSink> sink;
+  std::shared_ptr<MemorySink> memory_sink;
+  if (const auto* path = std::get_if<std::string>(ValueOrNull(args, "path"))) {
+    auto file_sink = std::make_shared<WavFileSink>(*path, format, container);
+    if (!file_sink->isOpen()) {
+      return result->Error("argument_error", "could not open " + *path);
+    }
+    sink = file_sink;
+  } else {
+    memory_sink = std::make_shared<MemorySink>(format, container);
+    sink = memory_sink;
+  }
+
+  std::shared_ptr<flutter::MethodResult<flutter::EncodableValue>> shared_result = std::move(result);
+  workers_.run([source, options, sink, memory_sink, shared_result, task_runner = task_runner_]() {
+    OfflineRenderResult render{};
+    try {
+      render = OfflineRenderer(options).render(source, *sink);
+    } catch (const std::exception &error) {
+      std::string message = error.what();
+      task_runner->post([shared_result, message]() { shared_result->Error("render_error", message); });
+      return;
+    }
+    auto response = flutter::EncodableMap();
+    response[flutter::EncodableValue("items")] = flutter::EncodableValue((int64_t)render.items);
+    response[flutter::EncodableValue("threads")] = flutter::EncodableValue((int64_t)render.threads);
+    response[flutter::EncodableValue("frames")] = flutter::EncodableValue((int64_t)render.frames);
+    response[flutter::EncodableValue("duration")] = flutter::EncodableValue(render.durationUs);
+    response[flutter::EncodableValue("elapsed")] = flutter::EncodableValue(render.elapsedUs);
+    response[flutter::EncodableValue("realtimeFactor")] = flutter::EncodableValue(render.realtimeFactor);
+    if (memory_sink) {
+      response[flutter::EncodableValue("data")] = flutter::EncodableValue(memory_sink->take());
+    }
+    task_runner->post([shared_result, response]() { shared_result->Success(response); });
+  });
+}
+
+void JustAudioWindowsPlugin::GetMetrics(std::unique_ptr<flutter::MethodResult<flutter::EncodableValue>> result) {
+  auto metrics = pcm_cache_->getMetrics();
+  auto lookups = metrics.hits + metrics.misses;
+  auto pcm_cache = flutter::EncodableMap();
+  pcm_cache[flutter::EncodableValue("hits")] = flutter::EncodableValue((int64_t)metrics.hits);
+  pcm_cache[flutter::EncodableValue("misses")] = flutter::EncodableValue((int64_t)metrics.misses);
+  pcm_cache[flutter::EncodableValue("hitRate")] = flutter::EncodableValue(lookups > 0 ? (double)metrics.hits / lookups : 0.0);
+  pcm_cache[flutter::EncodableValue("insertions")] = flutter::EncodableValue((int64_t)metrics.insertions);
+  pcm_cache[flutter::EncodableValue("evictions")] = flutter::EncodableValue((int64_t)metrics.evictions);
+  pcm_cache[flutter::EncodableValue("pressureEvictions")] = flutter::EncodableValue((int64_t)metrics.pressureEvictions);
+  pcm_cache[flutter::EncodableValue("residentBytes")] = flutter::EncodableValue((int64_t)metrics.residentBytes);
+  pcm_cache[flutter::EncodableValue("budgetBytes")] = flutter::EncodableValue((int64_t)metrics.budgetBytes);
+  pcm_cache[flutter::EncodableValue("entries")] = flutter::EncodableValue((int64_t)metrics.entries);
+
+  auto statistics = decode_scheduler_->getStatistics();
+  auto decode_scheduler = flutter::EncodableMap();
+  decode_scheduler[flutter::EncodableValue("threads")] = flutter::EncodableValue((int64_t)statistics.threads);
+  decode_scheduler[flutter::EncodableValue("jobs")] = flutter::EncodableValue((int64_t)statistics.jobs);
+  decode_scheduler[flutter::EncodableValue("queueDepth")] = flutter::EncodableValue((int64_t)statistics.queueDepth);
+  decode_scheduler[flutter::EncodableValue("maxQueueDepth")] = flutter::EncodableValue((int64_t)statistics.maxQueueDepth);
+  decode_scheduler[flutter::EncodableValue("runs")] = flutter::EncodableValue((int64_t)statistics.runs);
+  decode_scheduler[flutter::EncodableValue("steals")] = flutter::EncodableValue((int64_t)statistics.steals);
+  decode_scheduler[flutter::EncodableValue("deadlineMisses")] = flutter::EncodableValue((int64_t)statistics.deadlineMisses);
+
+  auto response = flutter::EncodableMap();
+  response[flutter::EncodableValue("pcmCache")] = flutter::EncodableValue(pcm_cache);
+  response[flutter::EncodableValue("decodeScheduler")] = flutter::EncodableValue(decode_scheduler);
+  result->Success(response);
+}
+
+std::shared_ptr<LoudnessAnalyzer> JustAudioWindowsPlugin::GetLoudnessAnalyzer() {
+  std::lock_guard<std::mutex> lock(loudness_analyzer_mutex_);
+  if (!loudness_analyzer_) {
+    std::filesystem::path directory;
+    if (const char* local_app_data = std::getenv("LOCALAPPDATA")) {
+      directory = std::filesystem::u8path(local_app_data) / "just_audio_windows" / "loudness";
+    } else {
+      directory = std::filesystem::temp_directory_path() / "just_audio_windows" / "loudness";
+    }
+    loudness_analyzer_ = std::make_shared<LoudnessAnalyzer>(std::make_shared<LoudnessCache>(directory), decoders_);
+  }
+  return loudness_analyzer_;
+}
+
+std::shared_ptr<Mp3SeekIndexer> JustAudioWindowsPlugin::GetSeekIndexer() {
+  std::lock_guard<std::mutex> lock(seek_indexer_mutex_);
+  if (!seek_indexer_) {
+    std::filesystem::path directory;
+    if (const char* local_app_data = std::getenv("LOCALAPPDATA")) {
+      directory = std::filesystem::u8path(local_app_data) / "just_audio_windows" / "seek_index";
+    } else {
+      directory = std::filesystem::temp_directory_path() / "just_audio_windows" / "seek_index";
+    }
+    seek_indexer_ = std::make_shared<Mp3SeekIndexer>(std::make_shared<Mp3SeekIndexCache>(directory));
+  }
+  return seek_indexer_;
+}
+
 }  // namespace
 
 void JustAudioWindowsPluginRegisterWithRegistrar(
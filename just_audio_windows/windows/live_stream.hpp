@@ -0,0 +1,545 @@
+#pragma once
+
+#include <winrt/Windows.Foundation.h>
+#include <winrt/Windows.Foundation.Collections.h>
+#include <winrt/Windows.Storage.Streams.h>
+#include <winrt/Windows.Web.Http.h>
+#include <winrt/Windows.Web.Http.Headers.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <functional>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "icy_metadata.hpp"
+#include "mapped_file.hpp"
+#include "timeshift_buffer.hpp"
+
+using winrt::Windows::Foundation::IAsyncOperation;
+using winrt::Windows::Foundation::IAsyncOperationWithProgress;
+using winrt::Windows::Storage::Streams::IBuffer;
+using winrt::Windows::Storage::Streams::IInputStream;
+using winrt::Windows::Storage::Streams::InputStreamOptions;
+using winrt::Windows::Storage::Streams::IOutputStream;
+using winrt::Windows::Storage::Streams::IRandomAccessStream;
+
+// An open HTTP response of a live stream, such as an internet radio station.
+struct LiveConnection
+{
+	winrt::Windows::Web::Http::HttpResponseMessage response;
+	IInputStream body;
+	IcyHeaders icyHeaders;
+	winrt::hstring contentType;
+
+	std::optional<uint32_t> metadataInterval() const
+	{
+		if (icyHeaders.metadataInterval && *icyHeaders.metadataInterval > 0)
+		{
+			return (uint32_t)*icyHeaders.metadataInterval;
+		}
+		return std::nullopt;
+	}
+
+	bool hasIcyHeaders() const
+	{
+		return icyHeaders.metadataInterval || icyHeaders.name || icyHeaders.bitrate;
+	}
+
+	/**
+	 * Opens |uri| asking the server to interleave ICY metadata. With
+	 * |requireIcy|, returns std::nullopt if the response has no `icy-*`
+	 * headers, in which case it is not a live stream and should be played
+	 * from its URI instead.
+	 *
+	 * This blocks, so it must not be called on the platform thread.
+	 */
+	static std::optional<LiveConnection> open(
+		const winrt::Windows::Foundation::Uri& uri,
+		const std::map<std::string, std::string>& headers,
+		bool requireIcy = true)
+	{
+		using namespace winrt::Windows::Web::Http;
+
+		HttpClient client{};
+		HttpRequestMessage request(HttpMethod::Get(), uri);
+		request.Headers().TryAppendWithoutValidation(L"Icy-MetaData", L"1");
+		for (auto& header : headers)
+		{
+			request.Headers().TryAppendWithoutValidation(winrt::to_hstring(header.first), winrt::to_hstring(header.second));
+		}
+
+		auto response = client.SendRequestAsync(request, HttpCompletionOption::ResponseHeadersRead).get();
+		if (!response.IsSuccessStatusCode())
+		{
+			response.Close();
+			return std::nullopt;
+		}
+
+		auto responseHeaders = response.Headers();
+		auto icyHeaders = IcyHeaders::parse([&](const char* name) -> std::optional<std::string>
+			{
+				auto key = winrt::to_hstring(name);
+				if (!responseHeaders.HasKey(key))
+				{
+					return std::nullopt;
+				}
+				return IcyInfo::toUtf8(winrt::to_string(responseHeaders.Lookup(key)));
+			});
+
+		winrt::hstring contentType = L"audio/mpeg";
+		if (auto mediaType = response.Content().Headers().ContentType())
+		{
+			contentType = mediaType.MediaType();
+		}
+
+		LiveConnection connection{ response, nullptr, icyHeaders, contentType };
+		if (requireIcy && !connection.hasIcyHeaders())
+		{
+			response.Close();
+			return std::nullopt;
+		}
+		connection.body = response.Content().ReadAsInputStreamAsync().get();
+		return connection;
+	}
+
+	void close()
+	{
+		body.Close();
+		response.Close();
+	}
+};
+
+// The parts of IRandomAccessStream that a read-only, decoder-facing stream
+// does not support.
+template <typename D>
+struct ReadOnlyStream : winrt::implements<D, IRandomAccessStream>
+{
+	// Live streams have no end. The decoder is told that the stream is as
+	// large as possible.
+	static constexpr uint64_t kUnknownSize = UINT64_MAX / 2;
+
+	uint64_t Size() const
+	{
+		return kUnknownSize;
+	}
+
+	void Size(uint64_t)
+	{
+		throw winrt::hresult_not_implemented();
+	}
+
+	IInputStream GetInputStreamAt(uint64_t)
+	{
+		throw winrt::hresult_not_implemented();
+	}
+
+	IOutputStream GetOutputStreamAt(uint64_t)
+	{
+		throw winrt::hresult_not_implemented();
+	}
+
+	IRandomAccessStream CloneStream()
+	{
+		throw winrt::hresult_not_implemented();
+	}
+
+	bool CanRead() const
+	{
+		return true;
+	}
+
+	bool CanWrite() const
+	{
+		return false;
+	}
+
+	IAsyncOperationWithProgress<uint32_t, uint32_t> WriteAsync(IBuffer)
+	{
+		throw winrt::hresult_not_implemented();
+	}
+
+	IAsyncOperation<bool> FlushAsync()
+	{
+		throw winrt::hresult_not_implemented();
+	}
+};
+
+// A stream reading a live connection as it arrives, through an
+// IcyStreamReader: ICY metadata blocks are removed before the decoder sees the
+// bytes, and audio is read from the connection straight into the decoder's
+// buffer.
+//
+// The stream can not seek. Only the first IcyStreamReader::kHeadSize bytes are
+// retained, so the decoder can rewind after probing the format; a rewind any
+// further fails the read.
+//
+// |canRead| is asked with the number of bytes delivered so far before reading
+// from the connection; while it returns false, the read waits. This lets the
+// player stop loading once enough is buffered.
+struct LiveStream : ReadOnlyStream<LiveStream>
+{
+	static constexpr std::chrono::milliseconds kLoadPollInterval{ 50 };
+
+	LiveStream(LiveConnection connection, std::function<void(const IcyInfo&)> onInfo, std::function<bool(uint64_t)> canRead = nullptr)
+		: connection(connection), canRead(canRead),
+		reader(connection.metadataInterval(), [this](uint8_t* data, size_t length)
+			{ return readConnection(data, length); }, onInfo)
+	{
+	}
+
+	uint64_t Position() const
+	{
+		return reader.getPosition();
+	}
+
+	void Seek(uint64_t value)
+	{
+		reader.seek(value);
+	}
+
+	void Close()
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		if (closed)
+		{
+			return;
+		}
+		closed = true;
+		connection.close();
+	}
+
+	IAsyncOperationWithProgress<IBuffer, uint32_t> ReadAsync(IBuffer buffer, uint32_t count, InputStreamOptions options)
+	{
+		auto strong = get_strong();
+		co_await winrt::resume_background();
+
+		while (canRead && !closed && reader.atLiveEdge() && !canRead(reader.getLivePosition()))
+		{
+			std::this_thread::sleep_for(kLoadPollInterval);
+		}
+
+		std::lock_guard<std::mutex> lock(mutex);
+		buffer.Length(0);
+		if (closed || count == 0)
+		{
+			co_return buffer;
+		}
+
+		size_t length = 0;
+		target = buffer;
+		try
+		{
+			length = reader.read(buffer.data(), count);
+		}
+		catch (std::runtime_error const& error)
+		{
+			// Ending the read would end playback as if the stream had.
+			target = nullptr;
+			throw winrt::hresult_error(E_FAIL, winrt::to_hstring(error.what()));
+		}
+		target = nullptr;
+		buffer.Length((uint32_t)length);
+		co_return buffer;
+	}
+
+private:
+	/// Reads from the connection for |reader|. Audio is read into the
+	/// decoder's buffer itself; metadata through a buffer of its own.
+	size_t readConnection(uint8_t* data, size_t length)
+	{
+		if (target && data == target.data())
+		{
+			auto result = connection.body.ReadAsync(target, (uint32_t)length, InputStreamOptions::Partial).get();
+			if (result != target)
+			{
+				std::memcpy(data, result.data(), result.Length());
+			}
+			return result.Length();
+		}
+		winrt::Windows::Storage::Streams::Buffer scratch((uint32_t)length);
+		auto result = connection.body.ReadAsync(scratch, (uint32_t)length, InputStreamOptions::Partial).get();
+		std::memcpy(data, result.data(), result.Length());
+		return result.Length();
+	}
+
+	LiveConnection connection;
+	std::function<bool(uint64_t)> canRead;
+
+	std::mutex mutex;
+	std::atomic<bool> closed = false;
+	// The decoder's buffer of the read in progress.
+	IBuffer target{ nullptr };
+	IcyStreamReader reader;
+};
+
+// Downloads a live connection into a TimeshiftBuffer on a background thread,
+// independently of whether anything is playing it.
+class TimeshiftRecorder
+{
+public:
+	static constexpr uint32_t kChunkSize = 16 * 1024;
+
+	TimeshiftRecorder(LiveConnection connection, std::shared_ptr<TimeshiftBuffer> buffer, std::function<void(const IcyInfo&)> onInfo)
+		: connection(connection), buffer(buffer), onInfo(onInfo)
+	{
+		if (auto metadataInterval = connection.metadataInterval())
+		{
+			parser.emplace(*metadataInterval);
+		}
+		if (connection.icyHeaders.bitrate && *connection.icyHeaders.bitrate > 0)
+		{
+			bytesPerSecond = *connection.icyHeaders.bitrate * 1000 / 8;
+		}
+		thread = std::thread([this]()
+			{ record(); });
+	}
+
+	~TimeshiftRecorder()
+	{
+		stopped = true;
+		try
+		{
+			connection.close();
+		}
+		catch (...)
+		{
+		}
+		if (thread.joinable())
+		{
+			thread.join();
+		}
+		buffer->close();
+	}
+
+	// Prevent copying.
+	TimeshiftRecorder(TimeshiftRecorder const&) = delete;
+	TimeshiftRecorder& operator=(TimeshiftRecorder const&) = delete;
+
+private:
+	void record()
+	{
+		winrt::init_apartment();
+
+		// One buffer is reused for every read. Metadata is stripped in place.
+		winrt::Windows::Storage::Streams::Buffer chunk(kChunkSize);
+		auto started = std::chrono::steady_clock::now();
+		uint64_t recorded = 0;
+		int64_t lastTimeUs = 0;
+
+		try
+		{
+			while (!stopped)
+			{
+				auto result = connection.body.ReadAsync(chunk, kChunkSize, InputStreamOptions::Partial).get();
+				if (result.Length() == 0)
+				{
+					break;
+				}
+
+				size_t length = result.Length();
+				if (parser)
+				{
+					length = parser->strip(result.data(), length);
+
+					IcyInfo info{};
+					if (parser->takeInfo(info) && onInfo)
+					{
+						onInfo(info);
+					}
+				}
+
+				// Times come from the bitrate when the server announces it, since
+				// servers send a burst of data on connecting.
+				int64_t timeUs;
+				if (bytesPerSecond > 0)
+				{
+					timeUs = (int64_t)((recorded + length) * 1000000 / bytesPerSecond);
+				}
+				else
+				{
+					timeUs = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - started).count();
+				}
+
+				buffer->append(result.data(), length, lastTimeUs, timeUs);
+				recorded += length;
+				lastTimeUs = timeUs;
+			}
+		}
+		catch (winrt::hresult_error const& ex)
+		{
+			if (!stopped)
+			{
+				std::cerr << "[just_audio_windows] Timeshift recording stopped: " << winrt::to_string(ex.message()) << std::endl;
+			}
+		}
+
+		buffer->close();
+	}
+
+	LiveConnection connection;
+	std::shared_ptr<TimeshiftBuffer> buffer;
+	std::function<void(const IcyInfo&)> onInfo;
+	std::optional<IcyParser> parser{};
+	uint64_t bytesPerSecond = 0;
+	std::atomic<bool> stopped = false;
+	std::thread thread;
+};
+
+// A stream reading a TimeshiftBuffer from |startOffset| onwards, waiting for
+// the recorder when it reaches the live edge.
+//
+// If playback falls further behind than the window, reading continues from the
+// oldest byte still recorded.
+struct TimeshiftStream : ReadOnlyStream<TimeshiftStream>
+{
+	static constexpr std::chrono::milliseconds kReadTimeout{ 10000 };
+
+	TimeshiftStream(std::shared_ptr<TimeshiftBuffer> recording, uint64_t startOffset, std::function<void(uint64_t)> onRead)
+		: recording(recording), startOffset(startOffset), onRead(onRead)
+	{
+	}
+
+	uint64_t Position() const
+	{
+		return position;
+	}
+
+	void Seek(uint64_t value)
+	{
+		position = value;
+	}
+
+	void Close()
+	{
+		closed = true;
+	}
+
+	IAsyncOperationWithProgress<IBuffer, uint32_t> ReadAsync(IBuffer buffer, uint32_t count, InputStreamOptions options)
+	{
+		auto strong = get_strong();
+		co_await winrt::resume_background();
+
+		buffer.Length(0);
+		auto offset = startOffset + position;
+		if (closed || count == 0)
+		{
+			co_return buffer;
+		}
+
+		// Ending the read would end playback, so a stalled connection is waited
+		// for until the recording stops.
+		while (!recording->waitForData(offset, kReadTimeout))
+		{
+			if (closed || recording->isFinished())
+			{
+				co_return buffer;
+			}
+		}
+
+		// The window may slide on while this read waits, so the bytes are read
+		// from wherever it starts then.
+		auto requested = offset;
+		auto length = (uint32_t)recording->readFromWindow(offset, buffer.data(), count);
+		if (offset > requested)
+		{
+			std::cerr << "[just_audio_windows] Timeshift window exceeded, skipping " << offset - requested << " bytes" << std::endl;
+			startOffset += offset - requested;
+		}
+		if (length == 0)
+		{
+			// The byte waited for is recorded, so nothing read means the ring
+			// file failed, which must not end playback as if the stream had.
+			throw winrt::hresult_error(E_FAIL, L"Timeshift recording could not be read");
+		}
+		buffer.Length(length);
+		position += length;
+
+		if (onRead)
+		{
+			onRead(offset + length);
+		}
+		co_return buffer;
+	}
+
+	/// The offset in the recording of the first byte of this stream.
+	uint64_t getStartOffset() const
+	{
+		return startOffset;
+	}
+
+private:
+	std::shared_ptr<TimeshiftBuffer> recording;
+	std::atomic<uint64_t> startOffset;
+	std::function<void(uint64_t)> onRead;
+	std::atomic<uint64_t> position = 0;
+	std::atomic<bool> closed = false;
+};
+
+// A stream reading a memory-mapped file from |startOffset|, so that the
+// decoder starts at a frame a seek index found rather than at the start of
+// the file.
+struct FileRangeStream : ReadOnlyStream<FileRangeStream>
+{
+	using ReadOnlyStream<FileRangeStream>::Size;
+
+	FileRangeStream(std::shared_ptr<MappedFile> file, uint64_t startOffset)
+		: file(file), startOffset(std::min<uint64_t>(startOffset, file->size()))
+	{
+	}
+
+	uint64_t Size() const
+	{
+		return file->size() - startOffset;
+	}
+
+	uint64_t Position() const
+	{
+		return position;
+	}
+
+	void Seek(uint64_t value)
+	{
+		position = value;
+	}
+
+	void Close()
+	{
+	}
+
+	IAsyncOperationWithProgress<IBuffer, uint32_t> ReadAsync(IBuffer buffer, uint32_t count, InputStreamOptions options)
+	{
+		auto strong = get_strong();
+		// Reading the mapping may wait for the disk.
+		co_await winrt::resume_background();
+
+		auto offset = startOffset + position;
+		auto length = (uint32_t)std::min<uint64_t>(count, offset < file->size() ? file->size() - offset : 0);
+		if (length > 0)
+		{
+			std::memcpy(buffer.data(), file->data() + offset, length);
+		}
+		buffer.Length(length);
+		position += length;
+		co_return buffer;
+	}
+
+	/// The offset in the file of the first byte of this stream.
+	uint64_t getStartOffset() const
+	{
+		return startOffset;
+	}
+
+private:
+	std::shared_ptr<MappedFile> file;
+	uint64_t startOffset;
+	std::atomic<uint64_t> position = 0;
+};
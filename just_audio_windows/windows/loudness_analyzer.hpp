@@ -0,0 +1,830 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#if defined(_M_X64) || defined(__SSE__)
+#include <xmmintrin.h>
+#ifndef JUST_AUDIO_SSE
+#define JUST_AUDIO_SSE 1
+#endif
+#elif defined(_M_ARM64) || defined(__ARM_NEON)
+#include <arm_neon.h>
+#ifndef JUST_AUDIO_NEON
+#define JUST_AUDIO_NEON 1
+#endif
+#endif
+
+#include "audio_decoder.hpp"
+#include "mapped_file.hpp"
+
+// The loudness of a whole source, as EBU R128 measures it.
+struct LoudnessResult
+{
+	// Gated integrated loudness in LUFS; -infinity if every block is below
+	// the absolute gate.
+	double integratedLufs;
+	// The highest peak between samples, in dB relative to full scale.
+	double truePeakDb;
+	int64_t durationUs;
+};
+
+// Measures the integrated loudness and true peak of interleaved audio, as
+// ITU-R BS.1770 describes them.
+//
+// The audio is K-weighted by a shelf and a high-pass filter, and its mean
+// square is taken over 400ms blocks overlapping by 75%. Blocks below -70LUFS,
+// then those 10LU below the loudness of the rest, are left out. The true peak
+// is taken from the audio oversampled four times.
+//
+// Channels are filtered four at a time, one in each lane of a vector.
+class LoudnessMeter
+{
+public:
+	static constexpr double kAbsoluteGateLufs = -70;
+	static constexpr double kRelativeGateLu = -10;
+
+	explicit LoudnessMeter(AudioFormat format)
+		: format(format), groups((format.channels + kLanes - 1) / kLanes),
+		subBlockFrames(std::max<size_t>(1, format.sampleRate / 10)),
+		state(groups), history(groups * kHistory * 2 * kLanes)
+	{
+		designFilters();
+		designOversampler();
+		// 5.1 weights its surround channels up and leaves the LFE out.
+		for (uint32_t c = 0; c < groups * kLanes; c++)
+		{
+			auto weight = c < format.channels ? 1.0 : 0.0;
+			if (format.channels == 6 && c == 3)
+			{
+				weight = 0;
+			}
+			else if (format.channels == 6 && c >= 4 && c < 6)
+			{
+				weight = 1.41;
+			}
+			weights.push_back(weight);
+		}
+	}
+
+	/// Measures |frames| more interleaved frames.
+	void process(const float* samples, size_t frames)
+	{
+		auto channels = format.channels;
+		for (size_t done = 0; done < frames;)
+		{
+			auto count = std::min(frames - done, subBlockFrames - subBlockFill);
+			for (size_t g = 0; g < groups; g++)
+			{
+				auto lanes = std::min<uint32_t>(kLanes, channels - (uint32_t)(g * kLanes));
+				processGroup(g, samples + done * channels + g * kLanes, count, lanes);
+			}
+			subBlockFill += count;
+			done += count;
+			if (subBlockFill == subBlockFrames)
+			{
+				finishSubBlock();
+			}
+		}
+		measuredFrames += frames;
+	}
+
+	double getIntegratedLufs() const
+	{
+		auto absoluteGate = toEnergy(kAbsoluteGateLufs);
+		auto mean = gatedMean(absoluteGate);
+		if (!mean)
+		{
+			return -std::numeric_limits<double>::infinity();
+		}
+		auto relativeGate = std::max(absoluteGate, *mean * std::pow(10.0, kRelativeGateLu / 10));
+		return toLufs(gatedMean(relativeGate).value_or(*mean));
+	}
+
+	double getTruePeakDb() const
+	{
+		float peaks[kLanes];
+		float highest = 0;
+		for (auto& group : state)
+		{
+			store(peaks, group.peak);
+			highest = std::max({ highest, peaks[0], peaks[1], peaks[2], peaks[3] });
+		}
+		return 20 * std::log10(std::max(highest, 1e-10f));
+	}
+
+	LoudnessResult getResult() const
+	{
+		return LoudnessResult{ getIntegratedLufs(), getTruePeakDb(), (int64_t)(measuredFrames * 1000000 / format.sampleRate) };
+	}
+
+private:
+	static constexpr size_t kLanes = 4;
+	static constexpr size_t kPhases = 4;
+	static constexpr size_t kHistory = 12;
+
+#ifdef JUST_AUDIO_SSE
+	using Vector = __m128;
+	static Vector splat(float value) { return _mm_set1_ps(value); }
+	static Vector load(const float* values) { return _mm_loadu_ps(values); }
+	static void store(float* values, Vector vector) { _mm_storeu_ps(values, vector); }
+	static Vector add(Vector a, Vector b) { return _mm_add_ps(a, b); }
+	static Vector sub(Vector a, Vector b) { return _mm_sub_ps(a, b); }
+	static Vector mul(Vector a, Vector b) { return _mm_mul_ps(a, b); }
+	static Vector max(Vector a, Vector b) { return _mm_max_ps(a, b); }
+	static Vector abs(Vector a) { return _mm_andnot_ps(_mm_set1_ps(-0.0f), a); }
+#elif defined(JUST_AUDIO_NEON)
+	using Vector = float32x4_t;
+	static Vector splat(float value) { return vdupq_n_f32(value); }
+	static Vector load(const float* values) { return vld1q_f32(values); }
+	static void store(float* values, Vector vector) { vst1q_f32(values, vector); }
+	static Vector add(Vector a, Vector b) { return vaddq_f32(a, b); }
+	static Vector sub(Vector a, Vector b) { return vsubq_f32(a, b); }
+	static Vector mul(Vector a, Vector b) { return vmulq_f32(a, b); }
+	static Vector max(Vector a, Vector b) { return vmaxq_f32(a, b); }
+	static Vector abs(Vector a) { return vabsq_f32(a); }
+#else
+	struct Vector
+	{
+		float lanes[kLanes];
+	};
+	template <typename Operation>
+	static Vector map(Vector a, Vector b, Operation operation)
+	{
+		Vector result;
+		for (size_t i = 0; i < kLanes; i++)
+		{
+			result.lanes[i] = operation(a.lanes[i], b.lanes[i]);
+		}
+		return result;
+	}
+	static Vector splat(float value) { return Vector{ { value, value, value, value } }; }
+	static Vector load(const float* values) { return Vector{ { values[0], values[1], values[2], values[3] } }; }
+	static void store(float* values, Vector vector) { std::copy(vector.lanes, vector.lanes + kLanes, values); }
+	static Vector add(Vector a, Vector b) { return map(a, b, [](float x, float y) { return x + y; }); }
+	static Vector sub(Vector a, Vector b) { return map(a, b, [](float x, float y) { return x - y; }); }
+	static Vector mul(Vector a, Vector b) { return map(a, b, [](float x, float y) { return x * y; }); }
+	static Vector max(Vector a, Vector b) { return map(a, b, [](float x, float y) { return std::max(x, y); }); }
+	static Vector abs(Vector a) { return map(a, a, [](float x, float) { return std::abs(x); }); }
+#endif
+
+	// The filter state of up to four channels.
+	struct Group
+	{
+		Vector shelf1 = splat(0);
+		Vector shelf2 = splat(0);
+		Vector highPass1 = splat(0);
+		Vector highPass2 = splat(0);
+		Vector sum = splat(0);
+		Vector peak = splat(0);
+		size_t historyPosition = 0;
+	};
+
+	// Transposed direct form II biquad coefficients.
+	struct Biquad
+	{
+		Vector b0, b1, b2, a1, a2;
+	};
+
+	/// The two K-weighting stages, as given for 48kHz and moved to the
+	/// format's rate.
+	void designFilters()
+	{
+		auto rate = (double)format.sampleRate;
+		const double pi = 3.14159265358979323846;
+
+		auto k = std::tan(pi * 1681.974450955533 / rate);
+		auto q = 0.7071752369554196;
+		auto vh = std::pow(10.0, 3.999843853973347 / 20);
+		auto vb = std::pow(vh, 0.4996667741545416);
+		auto a0 = 1 + k / q + k * k;
+		shelf = Biquad{ splat((float)((vh + vb * k / q + k * k) / a0)), splat((float)(2 * (k * k - vh) / a0)),
+			splat((float)((vh - vb * k / q + k * k) / a0)), splat((float)(2 * (k * k - 1) / a0)),
+			splat((float)((1 - k / q + k * k) / a0)) };
+
+		k = std::tan(pi * 38.13547087602444 / rate);
+		q = 0.5003270373238773;
+		a0 = 1 + k / q + k * k;
+		highPass = Biquad{ splat(1.0f), splat(-2.0f), splat(1.0f), splat((float)(2 * (k * k - 1) / a0)),
+			splat((float)((1 - k / q + k * k) / a0)) };
+	}
+
+	/// A windowed sinc split into four phases, each giving the audio at a
+	/// quarter of a frame further on.
+	void designOversampler()
+	{
+		const double pi = 3.14159265358979323846;
+		auto length = kPhases * kHistory;
+		auto center = (length - 1) / 2.0;
+		std::vector<double> taps(length);
+		for (size_t i = 0; i < length; i++)
+		{
+			auto x = (i - center) / kPhases;
+			auto sinc = std::sin(pi * x) / (pi * x);
+			auto window = 0.5 - 0.5 * std::cos(2 * pi * (i + 0.5) / length);
+			taps[i] = sinc * window;
+		}
+		for (size_t phase = 0; phase < kPhases; phase++)
+		{
+			// Each phase passes a constant through unchanged.
+			double sum = 0;
+			for (size_t k = 0; k < kHistory; k++)
+			{
+				sum += taps[phase + k * kPhases];
+			}
+			for (size_t k = 0; k < kHistory; k++)
+			{
+				oversampler.insert(oversampler.end(), kLanes, (float)(taps[phase + k * kPhases] / sum));
+			}
+		}
+	}
+
+	static Vector filter(const Biquad& biquad, Vector input, Vector& z1, Vector& z2)
+	{
+		auto output = add(mul(biquad.b0, input), z1);
+		z1 = add(sub(mul(biquad.b1, input), mul(biquad.a1, output)), z2);
+		z2 = sub(mul(biquad.b2, input), mul(biquad.a2, output));
+		return output;
+	}
+
+	void processGroup(size_t index, const float* samples, size_t frames, uint32_t lanes)
+	{
+		auto& group = state[index];
+		auto* recent = history.data() + index * kHistory * 2 * kLanes;
+		auto channels = format.channels;
+		float frame[kLanes] = {};
+		for (size_t f = 0; f < frames; f++)
+		{
+			std::copy(samples + f * channels, samples + f * channels + lanes, frame);
+			auto input = load(frame);
+
+			auto weighted = filter(highPass, filter(shelf, input, group.shelf1, group.shelf2), group.highPass1, group.highPass2);
+			group.sum = add(group.sum, mul(weighted, weighted));
+
+			// The newest frame goes first, and is mirrored so that the taps read
+			// a contiguous run.
+			group.historyPosition = group.historyPosition == 0 ? kHistory - 1 : group.historyPosition - 1;
+			store(recent + group.historyPosition * kLanes, input);
+			store(recent + (group.historyPosition + kHistory) * kLanes, input);
+			auto* run = recent + group.historyPosition * kLanes;
+			auto peak = max(group.peak, abs(input));
+			for (size_t phase = 0; phase < kPhases; phase++)
+			{
+				auto* taps = oversampler.data() + phase * kHistory * kLanes;
+				auto sum = mul(load(taps), load(run));
+				for (size_t k = 1; k < kHistory; k++)
+				{
+					sum = add(sum, mul(load(taps + k * kLanes), load(run + k * kLanes)));
+				}
+				peak = max(peak, abs(sum));
+			}
+			group.peak = peak;
+		}
+	}
+
+	/// Adds the energy of the last 100ms, and the block it completes.
+	void finishSubBlock()
+	{
+		double energy = 0;
+		float sums[kLanes];
+		for (size_t g = 0; g < groups; g++)
+		{
+			auto& group = state[g];
+			store(sums, group.sum);
+			for (size_t lane = 0; lane < kLanes; lane++)
+			{
+				energy += weights[g * kLanes + lane] * sums[lane];
+			}
+			group.sum = splat(0);
+
+			// Silence would otherwise decay into denormals.
+			float values[kLanes];
+			for (auto* z : { &group.shelf1, &group.shelf2, &group.highPass1, &group.highPass2 })
+			{
+				store(values, *z);
+				for (auto& value : values)
+				{
+					value = std::abs(value) < 1e-15f ? 0.0f : value;
+				}
+				*z = load(values);
+			}
+		}
+		recentEnergies[subBlocks % 4] = energy / subBlockFrames;
+		subBlocks++;
+		subBlockFill = 0;
+		if (subBlocks >= 4)
+		{
+			blocks.push_back((recentEnergies[0] + recentEnergies[1] + recentEnergies[2] + recentEnergies[3]) / 4);
+		}
+	}
+
+	/// The mean energy of the blocks above |gate|, if any are.
+	std::optional<double> gatedMean(double gate) const
+	{
+		double sum = 0;
+		size_t count = 0;
+		for (auto energy : blocks)
+		{
+			if (energy > gate)
+			{
+				sum += energy;
+				count++;
+			}
+		}
+		return count > 0 ? std::optional<double>(sum / count) : std::nullopt;
+	}
+
+	static double toEnergy(double lufs)
+	{
+		return std::pow(10.0, (lufs + 0.691) / 10);
+	}
+
+	static double toLufs(double energy)
+	{
+		return -0.691 + 10 * std::log10(energy);
+	}
+
+	AudioFormat format;
+	size_t groups;
+	size_t subBlockFrames;
+	std::vector<double> weights{};
+	Biquad shelf{};
+	Biquad highPass{};
+	// The taps of each phase and the recent frames of each group, kLanes
+	// floats to a vector.
+	std::vector<float> oversampler{};
+
+	std::vector<Group> state;
+	std::vector<float> history;
+	size_t subBlockFill = 0;
+	uint64_t subBlocks = 0;
+	double recentEnergies[4] = {};
+	std::vector<double> blocks{};
+	uint64_t measuredFrames = 0;
+};
+
+/// Measures the whole of |decoder| from where it is.
+inline LoudnessResult measureLoudness(AudioDecoder& decoder)
+{
+	auto format = decoder.getFormat();
+	LoudnessMeter meter(format);
+	std::vector<float> buffer(4096 * format.channels);
+	while (auto frames = decoder.read(buffer.data(), 4096))
+	{
+		meter.process(buffer.data(), frames);
+	}
+	return meter.getResult();
+}
+
+/// The gain that brings |result| to |targetLufs|, limited so that a raised
+/// track keeps its true peak under -1dBTP. Silence is left alone.
+inline double loudnessNormalizationGainDb(const LoudnessResult& result, double targetLufs)
+{
+	if (!std::isfinite(result.integratedLufs))
+	{
+		return 0;
+	}
+	auto gainDb = std::clamp(targetLufs - result.integratedLufs, -24.0, 12.0);
+	if (gainDb > 0)
+	{
+		gainDb = std::min(gainDb, std::max(0.0, -1.0 - result.truePeakDb));
+	}
+	return gainDb;
+}
+
+// Loudness of audio files persisted in |directory|, keyed by path, size and
+// modification time like MetadataCache, so that a file is only measured again
+// after it changed.
+class LoudnessCache
+{
+public:
+	explicit LoudnessCache(const std::filesystem::path& directory)
+		: directory(directory)
+	{
+		std::error_code error{};
+		std::filesystem::create_directories(directory, error);
+		load();
+	}
+
+	// Prevent copying.
+	LoudnessCache(LoudnessCache const&) = delete;
+	LoudnessCache& operator=(LoudnessCache const&) = delete;
+
+	std::optional<LoudnessResult> get(const std::string& path, const FileStamp& stamp)
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		auto it = entries.find(path);
+		if (it == entries.end() || it->second.stamp != stamp)
+		{
+			return std::nullopt;
+		}
+		return it->second.result;
+	}
+
+	void put(const std::string& path, const FileStamp& stamp, const LoudnessResult& result)
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		entries[path] = Entry{ stamp, result };
+		dirty = true;
+	}
+
+	/// Writes the index if it changed. The previous index is only replaced
+	/// once the new one is complete.
+	bool flush()
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		if (!dirty)
+		{
+			return true;
+		}
+
+		std::string buffer{};
+		buffer.append(kMagic, 4);
+		writeInt(buffer, kVersion);
+		writeInt(buffer, (uint64_t)entries.size());
+		for (auto& [path, entry] : entries)
+		{
+			writeInt(buffer, (uint32_t)path.size());
+			buffer.append(path);
+			writeInt(buffer, entry.stamp.size);
+			writeInt(buffer, entry.stamp.modifiedTime);
+			writeDouble(buffer, entry.result.integratedLufs);
+			writeDouble(buffer, entry.result.truePeakDb);
+			writeInt(buffer, entry.result.durationUs);
+		}
+
+		auto indexPath = directory / "loudness.bin";
+		auto temporaryPath = directory / "loudness.bin.tmp";
+		{
+			std::ofstream file(temporaryPath, std::ios::binary | std::ios::trunc);
+			file.write(buffer.data(), (std::streamsize)buffer.size());
+			if (!file)
+			{
+				return false;
+			}
+		}
+		std::error_code error{};
+		std::filesystem::rename(temporaryPath, indexPath, error);
+		if (error)
+		{
+			return false;
+		}
+		dirty = false;
+		return true;
+	}
+
+	size_t size()
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		return entries.size();
+	}
+
+private:
+	static constexpr char kMagic[4] = { 'J', 'A', 'L', 'C' };
+	static constexpr uint32_t kVersion = 1;
+
+	struct Entry
+	{
+		FileStamp stamp;
+		LoudnessResult result;
+	};
+
+	void load()
+	{
+		std::ifstream file(directory / "loudness.bin", std::ios::binary);
+		if (!file)
+		{
+			return;
+		}
+		std::string buffer((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+		if (buffer.size() < 4 || buffer.compare(0, 4, kMagic, 4) != 0)
+		{
+			return;
+		}
+		size_t position = 4;
+		bool ok = true;
+		if (readInt<uint32_t>(buffer, position, ok) != kVersion)
+		{
+			return;
+		}
+
+		std::unordered_map<std::string, Entry> loaded{};
+		auto count = readInt<uint64_t>(buffer, position, ok);
+		for (uint64_t i = 0; i < count && ok; i++)
+		{
+			auto length = readInt<uint32_t>(buffer, position, ok);
+			if (!ok || buffer.size() - position < length)
+			{
+				ok = false;
+				break;
+			}
+			auto path = buffer.substr(position, length);
+			position += length;
+			Entry entry{};
+			entry.stamp.size = readInt<uint64_t>(buffer, position, ok);
+			entry.stamp.modifiedTime = readInt<int64_t>(buffer, position, ok);
+			entry.result.integratedLufs = readDouble(buffer, position, ok);
+			entry.result.truePeakDb = readDouble(buffer, position, ok);
+			entry.result.durationUs = readInt<int64_t>(buffer, position, ok);
+			loaded[path] = entry;
+		}
+		if (ok)
+		{
+			entries = std::move(loaded);
+		}
+	}
+
+	// Little-endian encoding of the index.
+	template <typename T>
+	static void writeInt(std::string& buffer, T value)
+	{
+		for (size_t i = 0; i < sizeof(T); i++)
+		{
+			buffer.push_back((char)(((uint64_t)value >> (i * 8)) & 0xFF));
+		}
+	}
+
+	static void writeDouble(std::string& buffer, double value)
+	{
+		uint64_t bits;
+		std::memcpy(&bits, &value, sizeof(bits));
+		writeInt(buffer, bits);
+	}
+
+	/// Reads a T at |position|, clearing |ok| instead of reading past the end.
+	template <typename T>
+	static T readInt(const std::string& buffer, size_t& position, bool& ok)
+	{
+		if (!ok || buffer.size() - position < sizeof(T))
+		{
+			ok = false;
+			return T{};
+		}
+		uint64_t value = 0;
+		for (size_t i = 0; i < sizeof(T); i++)
+		{
+			value |= (uint64_t)(uint8_t)buffer[position + i] << (i * 8);
+		}
+		position += sizeof(T);
+		return (T)value;
+	}
+
+	static double readDouble(const std::string& buffer, size_t& position, bool& ok)
+	{
+		auto bits = readInt<uint64_t>(buffer, position, ok);
+		double value;
+		std::memcpy(&value, &bits, sizeof(value));
+		return value;
+	}
+
+	std::filesystem::path directory;
+	std::mutex mutex;
+	std::unordered_map<std::string, Entry> entries{};
+	bool dirty = false;
+};
+
+// The outcome of measuring one file. |result| is empty if the file could not
+// be decoded.
+struct LoudnessAnalysis
+{
+	std::string path;
+	std::optional<LoudnessResult> result;
+	bool cached;
+};
+
+struct LoudnessStatistics
+{
+	size_t files = 0;
+	size_t cached = 0;
+	size_t failed = 0;
+	int64_t elapsedUs = 0;
+	// Seconds of audio measured per second, over the files not in the cache.
+	double realtimeFactor = 0;
+};
+
+// Measures the loudness of files on a pool of worker threads, going through
+// a LoudnessCache. Players request files in the background as playlists are
+// loaded; analyze() measures a list and waits for it, ahead of those.
+class LoudnessAnalyzer
+{
+public:
+	/// Starts |threadCount| workers, or one less than there are cores if zero,
+	/// leaving one for playback.
+	LoudnessAnalyzer(std::shared_ptr<LoudnessCache> cache,
+		std::shared_ptr<DecoderRegistry> decoders = std::make_shared<DecoderRegistry>(),
+		unsigned threadCount = 0)
+		: cache(cache), decoders(decoders)
+	{
+		if (threadCount == 0)
+		{
+			threadCount = std::max(2u, std::thread::hardware_concurrency()) - 1;
+		}
+		for (unsigned i = 0; i < threadCount; i++)
+		{
+			workers.emplace_back([this]()
+				{ work(); });
+		}
+	}
+
+	/// Stops the workers once the files they are measuring are done. Files
+	/// still queued are dropped.
+	~LoudnessAnalyzer()
+	{
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			stopping = true;
+		}
+		wake.notify_all();
+		for (auto& worker : workers)
+		{
+			worker.join();
+		}
+		cache->flush();
+	}
+
+	// Prevent copying.
+	LoudnessAnalyzer(LoudnessAnalyzer const&) = delete;
+	LoudnessAnalyzer& operator=(LoudnessAnalyzer const&) = delete;
+
+	/// Returns the loudness of |path| if it was measured since it last
+	/// changed. Costs a single stat.
+	std::optional<LoudnessResult> find(const std::string& path)
+	{
+		auto stamp = MappedFile::stat(path);
+		return stamp ? cache->get(path, *stamp) : std::nullopt;
+	}
+
+	/// Queues |path| to be measured in the background, unless it is in the
+	/// cache or already queued.
+	void request(const std::string& path)
+	{
+		if (find(path))
+		{
+			return;
+		}
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			if (!queued.insert(path).second)
+			{
+				return;
+			}
+			jobs.push_back(Job{ path, nullptr, 0 });
+		}
+		wake.notify_one();
+	}
+
+	/// Measures |paths| and waits for them. Results are in the order of
+	/// |paths|.
+	std::vector<LoudnessAnalysis> analyze(const std::vector<std::string>& paths, LoudnessStatistics& statistics)
+	{
+		auto start = std::chrono::steady_clock::now();
+		auto batch = std::make_shared<Batch>();
+		batch->results.resize(paths.size());
+		batch->remaining = paths.size();
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			for (size_t i = paths.size(); i-- > 0;)
+			{
+				jobs.push_front(Job{ paths[i], batch, i });
+			}
+			wake.notify_all();
+			done.wait(lock, [&]()
+				{ return batch->remaining == 0 || stopping; });
+		}
+
+		statistics = LoudnessStatistics{};
+		statistics.files = paths.size();
+		int64_t measuredUs = 0;
+		for (auto& analysis : batch->results)
+		{
+			statistics.cached += analysis.cached ? 1 : 0;
+			statistics.failed += analysis.result ? 0 : 1;
+			if (analysis.result && !analysis.cached)
+			{
+				measuredUs += analysis.result->durationUs;
+			}
+		}
+		statistics.elapsedUs = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+		statistics.realtimeFactor = statistics.elapsedUs > 0 ? (double)measuredUs / statistics.elapsedUs : 0;
+		return batch->results;
+	}
+
+	size_t getThreadCount() const
+	{
+		return workers.size();
+	}
+
+	/// Measures |path|, or takes it from |cache| if it did not change.
+	static LoudnessAnalysis analyzeFile(LoudnessCache& cache, const DecoderRegistry& decoders, const std::string& path)
+	{
+		LoudnessAnalysis analysis{ path, std::nullopt, false };
+		auto stamp = MappedFile::stat(path);
+		if (!stamp)
+		{
+			return analysis;
+		}
+		if (auto result = cache.get(path, *stamp))
+		{
+			analysis.result = result;
+			analysis.cached = true;
+			return analysis;
+		}
+		try
+		{
+			AudioSourceSpec source{};
+			source.uri = path;
+			auto decoder = decoders.open(source, AudioFormat{ 48000, 2 });
+			analysis.result = measureLoudness(*decoder);
+			cache.put(path, *stamp, *analysis.result);
+		}
+		catch (const std::exception&)
+		{
+		}
+		return analysis;
+	}
+
+private:
+	// Files measured by one call to analyze().
+	struct Batch
+	{
+		std::vector<LoudnessAnalysis> results{};
+		size_t remaining = 0;
+	};
+
+	// A file to measure, for |batch| or in the background if it is null.
+	struct Job
+	{
+		std::string path;
+		std::shared_ptr<Batch> batch;
+		size_t index;
+	};
+
+	void work()
+	{
+		std::unique_lock<std::mutex> lock(mutex);
+		while (true)
+		{
+			wake.wait(lock, [&]()
+				{ return stopping || !jobs.empty(); });
+			if (stopping)
+			{
+				return;
+			}
+			auto job = std::move(jobs.front());
+			jobs.pop_front();
+
+			lock.unlock();
+			auto analysis = analyzeFile(*cache, *decoders, job.path);
+			lock.lock();
+
+			if (job.batch)
+			{
+				job.batch->results[job.index] = std::move(analysis);
+				if (--job.batch->remaining == 0)
+				{
+					done.notify_all();
+				}
+			}
+			else
+			{
+				queued.erase(job.path);
+			}
+			if (jobs.empty())
+			{
+				// Written once the queue drains rather than after every file.
+				lock.unlock();
+				cache->flush();
+				lock.lock();
+			}
+		}
+	}
+
+	std::shared_ptr<LoudnessCache> cache;
+	std::shared_ptr<DecoderRegistry> decoders;
+	std::vector<std::thread> workers{};
+
+	std::mutex mutex;
+	std::condition_variable wake;
+	std::condition_variable done;
+	std::deque<Job> jobs{};
+	// Paths requested in the background and not measured yet.
+	std::unordered_set<std::string> queued{};
+	bool stopping = false;
+};
@@ -0,0 +1,300 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+#if defined(_M_X64) || defined(__SSE__)
+#include <xmmintrin.h>
+#ifndef JUST_AUDIO_SSE
+#define JUST_AUDIO_SSE 1
+#endif
+#elif defined(_M_ARM64) || defined(__ARM_NEON)
+#include <arm_neon.h>
+#ifndef JUST_AUDIO_NEON
+#define JUST_AUDIO_NEON 1
+#endif
+#endif
+
+#include "audio_decoder.hpp"
+
+// Raises the level by a target gain, as the Android loudness enhancer does,
+// and keeps the peaks this would clip under a ceiling with a lookahead
+// limiter.
+//
+// The audio is delayed by the lookahead, so that the gain is already down
+// when a peak comes out. Peaks are measured over chunks of 16 frames; the
+// gain of a chunk is the lowest that any chunk within the attack after it
+// needs, averaged over the attack, which ramps the gain down ahead of a peak
+// and never lets one through. It comes back up over the release.
+//
+// Settings are atomics, so that process() never waits for the thread that
+// changes them. Until first enabled, it neither delays nor changes the audio.
+class LoudnessEnhancer
+{
+public:
+	static constexpr double kMinGainDb = -24;
+	static constexpr double kMaxGainDb = 24;
+	// The limiter's ceiling, -1dBFS.
+	static constexpr float kCeiling = 0.8912509f;
+	static constexpr int64_t kMaxAttackUs = 10000;
+	static constexpr int64_t kDefaultAttackUs = 5000;
+	static constexpr int64_t kDefaultReleaseUs = 100000;
+
+	explicit LoudnessEnhancer(AudioFormat format)
+		: format(format),
+		maxAttackChunks(std::max<size_t>(1, (size_t)((kMaxAttackUs * format.sampleRate / 1000000 + kChunkFrames - 1) / kChunkFrames))),
+		delayFrames((maxAttackChunks + 1) * kChunkFrames),
+		delay(delayFrames * format.channels), chunk(kChunkFrames * format.channels),
+		required(maxAttackChunks + 4, 1.0f), envelope(maxAttackChunks + 4, 1.0f)
+	{
+		// The silence the delay starts with counts as chunks already read.
+		inputChunks = maxAttackChunks + 1;
+	}
+
+	void setEnabled(bool value)
+	{
+		enabled.store(value, std::memory_order_release);
+	}
+
+	bool isEnabled() const
+	{
+		return enabled.load(std::memory_order_acquire);
+	}
+
+	/// Sets the gain applied while enabled, clamped to kMinGainDb and
+	/// kMaxGainDb.
+	void setTargetGain(double gainDb)
+	{
+		targetGain.store((float)std::pow(10.0, std::clamp(gainDb, kMinGainDb, kMaxGainDb) / 20), std::memory_order_release);
+	}
+
+	double getTargetGainDb() const
+	{
+		return 20 * std::log10(targetGain.load(std::memory_order_acquire));
+	}
+
+	/// Sets how long the gain takes to come down before a peak, up to
+	/// kMaxAttackUs, and to recover after it.
+	void setTiming(int64_t attackUs, int64_t releaseUs)
+	{
+		attack.store(std::clamp<int64_t>(attackUs, 0, kMaxAttackUs), std::memory_order_release);
+		release.store(std::max<int64_t>(releaseUs, 0), std::memory_order_release);
+	}
+
+	/// How far the limiter held the last block down, in dB.
+	double getGainReductionDb() const
+	{
+		return gainReductionDb.load(std::memory_order_relaxed);
+	}
+
+	/// The delay added once enabled, in frames.
+	size_t getLatencyFrames() const
+	{
+		return delayFrames;
+	}
+
+	/**
+	 * Processes |frames| interleaved frames in place. Called from the output's
+	 * thread; neither locks nor allocates.
+	 */
+	void process(float* samples, size_t frames)
+	{
+		auto on = enabled.load(std::memory_order_acquire);
+		if (!engaged)
+		{
+			if (!on)
+			{
+				return;
+			}
+			// The delay stays from now on, so that turning off does not jump.
+			engaged = true;
+		}
+
+		auto channels = format.channels;
+		auto target = on ? targetGain.load(std::memory_order_acquire) : 1.0f;
+		auto releaseFrames = (double)release.load(std::memory_order_acquire) * format.sampleRate / 1000000;
+		auto releaseCoefficient = releaseFrames > 1 ? (float)(1 - std::exp(-1 / releaseFrames)) : 1.0f;
+		float lowest = 1.0f;
+		for (size_t done = 0; done < frames;)
+		{
+			if (chunkFill == 0)
+			{
+				startChunk(target);
+			}
+			auto count = std::min(frames - done, kChunkFrames - chunkFill);
+			auto* input = samples + done * channels;
+			auto* staged = chunk.data() + chunkFill * channels;
+
+			// Makeup gain, ramped across the chunk.
+			for (size_t f = 0; f < count; f++)
+			{
+				auto makeup = makeupFrom + (makeupTo - makeupFrom) * (float)(chunkFill + f) / kChunkFrames;
+				for (uint32_t c = 0; c < channels; c++)
+				{
+					staged[f * channels + c] = input[f * channels + c] * makeup;
+				}
+			}
+			chunkPeak = std::max(chunkPeak, peak(staged, count * channels));
+
+			// What leaves the delay gets the limiter's gain.
+			for (size_t f = 0; f < count; f++)
+			{
+				attackSum += envelopeAt((int64_t)outputFrames) - envelopeAt((int64_t)outputFrames - (int64_t)attackFrames);
+				auto wanted = (float)(attackSum / attackFrames);
+				gain = wanted < gain ? wanted : gain + (wanted - gain) * releaseCoefficient;
+				lowest = std::min(lowest, gain);
+
+				auto* slot = delay.data() + delayPosition * channels;
+				for (uint32_t c = 0; c < channels; c++)
+				{
+					auto delayed = slot[c];
+					slot[c] = staged[f * channels + c];
+					input[f * channels + c] = delayed * gain;
+				}
+				delayPosition = delayPosition + 1 == delayFrames ? 0 : delayPosition + 1;
+				outputFrames++;
+			}
+
+			chunkFill += count;
+			done += count;
+			if (chunkFill == kChunkFrames)
+			{
+				finishChunk(on);
+			}
+		}
+		gainReductionDb.store(-20 * std::log10(std::max(lowest, 1e-6f)), std::memory_order_relaxed);
+	}
+
+	/// The largest magnitude among |count| samples.
+	static float peak(const float* samples, size_t count)
+	{
+		float result = 0;
+		size_t i = 0;
+#ifdef JUST_AUDIO_SSE
+		auto peakVector = _mm_setzero_ps();
+		auto signMask = _mm_set1_ps(-0.0f);
+		for (; i + 4 <= count; i += 4)
+		{
+			peakVector = _mm_max_ps(peakVector, _mm_andnot_ps(signMask, _mm_loadu_ps(samples + i)));
+		}
+		float peaks[4];
+		_mm_storeu_ps(peaks, peakVector);
+		result = std::max({ peaks[0], peaks[1], peaks[2], peaks[3] });
+#elif defined(JUST_AUDIO_NEON)
+		auto peakVector = vdupq_n_f32(0.0f);
+		for (; i + 4 <= count; i += 4)
+		{
+			peakVector = vmaxq_f32(peakVector, vabsq_f32(vld1q_f32(samples + i)));
+		}
+		float peaks[4];
+		vst1q_f32(peaks, peakVector);
+		result = std::max({ peaks[0], peaks[1], peaks[2], peaks[3] });
+#endif
+		for (; i < count; i++)
+		{
+			result = std::max(result, std::abs(samples[i]));
+		}
+		return result;
+	}
+
+private:
+	static constexpr size_t kChunkFrames = 16;
+	// How long the makeup gain takes to settle on a new target.
+	static constexpr double kMakeupSeconds = 0.02;
+
+	/// Moves the makeup gain a step towards |target| over the next chunk, and
+	/// applies a new attack from its start.
+	void startChunk(float target)
+	{
+		auto coefficient = (float)(1 - std::exp(-(double)kChunkFrames / (kMakeupSeconds * format.sampleRate)));
+		makeupFrom = makeupTo;
+		makeupTo = std::abs(target - makeupTo) < 1e-5f ? target : makeupTo + (target - makeupTo) * coefficient;
+		chunkPeak = 0;
+
+		auto chunks = std::clamp<size_t>((size_t)(attack.load(std::memory_order_acquire) * format.sampleRate / 1000000 / kChunkFrames), 1, maxAttackChunks);
+		if (chunks != attackChunks)
+		{
+			attackChunks = chunks;
+			attackFrames = chunks * kChunkFrames;
+			updateEnvelope();
+			// The average restarts over the new length.
+			attackSum = 0;
+			for (auto frame = (int64_t)outputFrames - (int64_t)attackFrames; frame < (int64_t)outputFrames; frame++)
+			{
+				attackSum += envelopeAt(frame);
+			}
+		}
+	}
+
+	/// Records what the finished chunk needs.
+	void finishChunk(bool on)
+	{
+		auto index = inputChunks++;
+		// Turned off, peaks are only held down until the makeup gain is gone.
+		auto limiting = on || makeupTo > 1.0f;
+		required[index % required.size()] = limiting && chunkPeak > kCeiling ? kCeiling / chunkPeak : 1.0f;
+		chunkFill = 0;
+		updateEnvelope();
+	}
+
+	/// Works out the envelope of the chunks whose attack has been read.
+	void updateEnvelope()
+	{
+		int64_t last = (int64_t)inputChunks - 1 - (int64_t)attackChunks;
+		for (; nextEnvelope <= last; nextEnvelope++)
+		{
+			float lowest = 1.0f;
+			for (auto i = nextEnvelope; i <= nextEnvelope + (int64_t)attackChunks; i++)
+			{
+				lowest = std::min(lowest, required[(size_t)i % required.size()]);
+			}
+			envelope[(size_t)nextEnvelope % envelope.size()] = lowest;
+		}
+	}
+
+	/// The envelope at |frame|, counting from the start of the delay, which is
+	/// 1 before it.
+	double envelopeAt(int64_t frame) const
+	{
+		auto index = frame / (int64_t)kChunkFrames;
+		if (frame < 0 || index >= nextEnvelope)
+		{
+			return 1.0;
+		}
+		return envelope[(size_t)index % envelope.size()];
+	}
+
+	AudioFormat format;
+	std::atomic<bool> enabled = false;
+	std::atomic<float> targetGain = 1.0f;
+	std::atomic<int64_t> attack = kDefaultAttackUs;
+	std::atomic<int64_t> release = kDefaultReleaseUs;
+	std::atomic<double> gainReductionDb = 0;
+
+	// Owned by process().
+	size_t maxAttackChunks;
+	size_t delayFrames;
+	std::vector<float> delay;
+	size_t delayPosition = 0;
+	std::vector<float> chunk;
+	size_t chunkFill = 0;
+	float chunkPeak = 0;
+	uint64_t inputChunks = 0;
+	uint64_t outputFrames = 0;
+	// The gain each input chunk needs, and the lowest any chunk within the
+	// attack after each output chunk needs.
+	std::vector<float> required;
+	std::vector<float> envelope;
+	int64_t nextEnvelope = 0;
+	size_t attackChunks = 0;
+	size_t attackFrames = kChunkFrames;
+	double attackSum = 0;
+	float makeupFrom = 1.0f;
+	float makeupTo = 1.0f;
+	float gain = 1.0f;
+	bool engaged = false;
+};
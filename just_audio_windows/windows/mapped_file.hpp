@@ -0,0 +1,198 @@
+#pragma once
+
+#include <cstdint>
+#include <optional>
+#include <string>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+// The size and modification time of a file, which identify its contents well
+// enough for caching.
+struct FileStamp
+{
+	uint64_t size;
+	// In the native resolution of the platform: 100ns ticks on Windows and
+	// nanoseconds elsewhere.
+	int64_t modifiedTime;
+
+	bool operator==(const FileStamp& other) const
+	{
+		return size == other.size && modifiedTime == other.modifiedTime;
+	}
+
+	bool operator!=(const FileStamp& other) const
+	{
+		return !(*this == other);
+	}
+};
+
+// A read-only memory mapping of a whole file. Paths are UTF-8.
+//
+// Pages are only read from disk when touched, so parsers can jump between the
+// start and the end of large files without reading what lies in between.
+class MappedFile
+{
+public:
+	explicit MappedFile(const std::string& path)
+	{
+#ifdef _WIN32
+		auto widePath = toWide(path);
+		file = CreateFileW(widePath.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+			nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+		if (file == INVALID_HANDLE_VALUE)
+		{
+			return;
+		}
+
+		LARGE_INTEGER fileSize{};
+		FILETIME lastWrite{};
+		if (!GetFileSizeEx(file, &fileSize) || !GetFileTime(file, nullptr, nullptr, &lastWrite))
+		{
+			return;
+		}
+		stamp = FileStamp{ (uint64_t)fileSize.QuadPart, (int64_t)((uint64_t)lastWrite.dwHighDateTime << 32 | lastWrite.dwLowDateTime) };
+
+		// Empty files can not be mapped.
+		if (fileSize.QuadPart == 0)
+		{
+			return;
+		}
+		mapping = CreateFileMappingW(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+		if (!mapping)
+		{
+			return;
+		}
+		view = (const uint8_t*)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+		if (view)
+		{
+			length = (size_t)fileSize.QuadPart;
+		}
+#else
+		descriptor = ::open(path.c_str(), O_RDONLY);
+		if (descriptor < 0)
+		{
+			return;
+		}
+
+		struct stat status{};
+		if (::fstat(descriptor, &status) != 0)
+		{
+			return;
+		}
+		stamp = FileStamp{ (uint64_t)status.st_size, (int64_t)status.st_mtim.tv_sec * 1000000000 + status.st_mtim.tv_nsec };
+
+		if (status.st_size == 0)
+		{
+			return;
+		}
+		auto address = ::mmap(nullptr, (size_t)status.st_size, PROT_READ, MAP_PRIVATE, descriptor, 0);
+		if (address != MAP_FAILED)
+		{
+			view = (const uint8_t*)address;
+			length = (size_t)status.st_size;
+		}
+#endif
+	}
+
+	~MappedFile()
+	{
+#ifdef _WIN32
+		if (view)
+		{
+			UnmapViewOfFile(view);
+		}
+		if (mapping)
+		{
+			CloseHandle(mapping);
+		}
+		if (file != INVALID_HANDLE_VALUE)
+		{
+			CloseHandle(file);
+		}
+#else
+		if (view)
+		{
+			::munmap((void*)view, length);
+		}
+		if (descriptor >= 0)
+		{
+			::close(descriptor);
+		}
+#endif
+	}
+
+	// Prevent copying.
+	MappedFile(MappedFile const&) = delete;
+	MappedFile& operator=(MappedFile const&) = delete;
+
+	/// Whether the file could be opened. Empty files are open but not mapped.
+	bool isOpen() const
+	{
+		return stamp.has_value();
+	}
+
+	const uint8_t* data() const
+	{
+		return view;
+	}
+
+	size_t size() const
+	{
+		return length;
+	}
+
+	const std::optional<FileStamp>& getStamp() const
+	{
+		return stamp;
+	}
+
+	/// Returns the stamp of |path| without opening it, or std::nullopt if it
+	/// does not exist.
+	static std::optional<FileStamp> stat(const std::string& path)
+	{
+#ifdef _WIN32
+		WIN32_FILE_ATTRIBUTE_DATA attributes{};
+		if (!GetFileAttributesExW(toWide(path).c_str(), GetFileExInfoStandard, &attributes))
+		{
+			return std::nullopt;
+		}
+		return FileStamp{
+			(uint64_t)attributes.nFileSizeHigh << 32 | attributes.nFileSizeLow,
+			(int64_t)((uint64_t)attributes.ftLastWriteTime.dwHighDateTime << 32 | attributes.ftLastWriteTime.dwLowDateTime),
+		};
+#else
+		struct stat status{};
+		if (::stat(path.c_str(), &status) != 0)
+		{
+			return std::nullopt;
+		}
+		return FileStamp{ (uint64_t)status.st_size, (int64_t)status.st_mtim.tv_sec * 1000000000 + status.st_mtim.tv_nsec };
+#endif
+	}
+
+private:
+#ifdef _WIN32
+	static std::wstring toWide(const std::string& path)
+	{
+		auto length = MultiByteToWideChar(CP_UTF8, 0, path.data(), (int)path.size(), nullptr, 0);
+		std::wstring widePath(length, L'\0');
+		MultiByteToWideChar(CP_UTF8, 0, path.data(), (int)path.size(), widePath.data(), length);
+		return widePath;
+	}
+
+	HANDLE file = INVALID_HANDLE_VALUE;
+	HANDLE mapping = nullptr;
+#else
+	int descriptor = -1;
+#endif
+	const uint8_t* view = nullptr;
+	size_t length = 0;
+	std::optional<FileStamp> stamp{};
+};
@@ -0,0 +1,252 @@
+#pragma once
+
+// This must be included before many other Windows headers.
+#include <windows.h>
+
+#include <mfapi.h>
+#include <mferror.h>
+#include <mfidl.h>
+#include <mfreadwrite.h>
+#include <winrt/base.h>
+
+#include <algorithm>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "audio_decoder.hpp"
+
+// Decodes what Windows has codecs for, such as MP3, AAC, FLAC, ALAC and WMA,
+// from files and http(s) URLs, through a Media Foundation source reader that
+// outputs 32-bit float PCM at the source's rate and channel count.
+//
+// The reader is free-threaded, so that the decoder can be opened on one
+// thread and read on the decode scheduler's; each thread that uses it joins
+// the multithreaded COM apartment first.
+class MediaFoundationDecoder : public AudioDecoder
+{
+public:
+	/// Opens |url|, throwing std::runtime_error if Media Foundation can not
+	/// decode its audio. Media Foundation decodes the encoder's delay and
+	/// padding, so |trim| passes on what the file records of them.
+	explicit MediaFoundationDecoder(const std::string& url, EncoderTrim trim = EncoderTrim{})
+		: trim(trim)
+	{
+		startup();
+		initializeCom();
+		try
+		{
+			winrt::check_hresult(MFCreateSourceReaderFromURL(winrt::to_hstring(url).c_str(), nullptr, reader.put()));
+			winrt::check_hresult(reader->SetStreamSelection((DWORD)MF_SOURCE_READER_ALL_STREAMS, FALSE));
+			winrt::check_hresult(reader->SetStreamSelection((DWORD)MF_SOURCE_READER_FIRST_AUDIO_STREAM, TRUE));
+
+			winrt::com_ptr<IMFMediaType> requested{};
+			winrt::check_hresult(MFCreateMediaType(requested.put()));
+			winrt::check_hresult(requested->SetGUID(MF_MT_MAJOR_TYPE, MFMediaType_Audio));
+			winrt::check_hresult(requested->SetGUID(MF_MT_SUBTYPE, MFAudioFormat_Float));
+			winrt::check_hresult(reader->SetCurrentMediaType((DWORD)MF_SOURCE_READER_FIRST_AUDIO_STREAM, nullptr, requested.get()));
+
+			winrt::com_ptr<IMFMediaType> output{};
+			winrt::check_hresult(reader->GetCurrentMediaType((DWORD)MF_SOURCE_READER_FIRST_AUDIO_STREAM, output.put()));
+			UINT32 channels = 0;
+			UINT32 sampleRate = 0;
+			winrt::check_hresult(output->GetUINT32(MF_MT_AUDIO_NUM_CHANNELS, &channels));
+			winrt::check_hresult(output->GetUINT32(MF_MT_AUDIO_SAMPLES_PER_SECOND, &sampleRate));
+			format = AudioFormat{ sampleRate, channels };
+		}
+		catch (winrt::hresult_error const& error)
+		{
+			throw std::runtime_error("Could not decode " + url + ": " + winrt::to_string(error.message()));
+		}
+		if (format.channels == 0 || format.sampleRate == 0)
+		{
+			throw std::runtime_error("No audio in " + url);
+		}
+
+		PROPVARIANT value;
+		PropVariantInit(&value);
+		if (SUCCEEDED(reader->GetPresentationAttribute((DWORD)MF_SOURCE_READER_MEDIASOURCE, MF_PD_DURATION, &value)) && value.vt == VT_UI8)
+		{
+			length = toFrames((int64_t)value.uhVal.QuadPart);
+		}
+		PropVariantClear(&value);
+		if (SUCCEEDED(reader->GetPresentationAttribute((DWORD)MF_SOURCE_READER_MEDIASOURCE, MF_SOURCE_READER_MEDIASOURCE_CHARACTERISTICS, &value)) && value.vt == VT_UI4)
+		{
+			seekable = (value.ulVal & MFMEDIASOURCE_CAN_SEEK) != 0;
+		}
+		PropVariantClear(&value);
+	}
+
+	/// Opens local files and http(s) URLs. Added after the built-in WAV
+	/// factory, it decodes the formats that one does not.
+	static DecoderRegistry::Factory factory()
+	{
+		return [](const AudioSourceSpec& source) -> std::unique_ptr<AudioDecoder>
+		{
+			if (source.uri.rfind("http://", 0) == 0 || source.uri.rfind("https://", 0) == 0)
+			{
+				return std::make_unique<MediaFoundationDecoder>(source.uri);
+			}
+			auto path = uriToPath(source.uri);
+			if (!path)
+			{
+				return nullptr;
+			}
+			return std::make_unique<MediaFoundationDecoder>(*path, readEncoderTrim(*path));
+		};
+	}
+
+	AudioFormat getFormat() const override
+	{
+		return format;
+	}
+
+	std::optional<int64_t> getLength() const override
+	{
+		return length;
+	}
+
+	EncoderTrim getEncoderTrim() const override
+	{
+		return trim;
+	}
+
+	size_t read(float* output, size_t frames) override
+	{
+		initializeCom();
+		size_t count = 0;
+		while (count < frames)
+		{
+			if (pendingOffset == pending.size() && !decodeSample())
+			{
+				break;
+			}
+			auto available = (pending.size() - pendingOffset) / format.channels;
+			auto take = std::min(available, frames - count);
+			std::memcpy(output + count * format.channels, pending.data() + pendingOffset, take * format.channels * sizeof(float));
+			pendingOffset += take * format.channels;
+			count += take;
+		}
+		return count;
+	}
+
+	bool seek(int64_t frame) override
+	{
+		if (!seekable)
+		{
+			return false;
+		}
+		initializeCom();
+		frame = std::max<int64_t>(frame, 0);
+		PROPVARIANT position;
+		PropVariantInit(&position);
+		position.vt = VT_I8;
+		position.hVal.QuadPart = frame * 10000000 / format.sampleRate;
+		auto result = reader->SetCurrentPosition(GUID_NULL, position);
+		PropVariantClear(&position);
+		if (FAILED(result))
+		{
+			return false;
+		}
+		pending.clear();
+		pendingOffset = 0;
+		ended = false;
+		seekTarget = frame;
+		return true;
+	}
+
+private:
+	/// Starts Media Foundation once for the process. It is never shut down, as
+	/// decoders may be open on any thread until the process ends.
+	static void startup()
+	{
+		static std::once_flag started;
+		std::call_once(started, []()
+			{
+				winrt::check_hresult(MFStartup(MF_VERSION, MFSTARTUP_FULL)); });
+	}
+
+	static void initializeCom()
+	{
+		// A thread already in a single-threaded apartment, such as the platform
+		// thread, stays in it; the reader works from either.
+		static thread_local HRESULT result = CoInitializeEx(nullptr, COINIT_MULTITHREADED);
+		(void)result;
+	}
+
+	int64_t toFrames(int64_t time) const
+	{
+		return (time * format.sampleRate + 5000000) / 10000000;
+	}
+
+	/// Reads the next sample of the stream into |pending|, returning false at
+	/// the end of the stream or on an error. After a seek, which lands on the
+	/// sample holding the target or one before it, drops the frames before the
+	/// target.
+	bool decodeSample()
+	{
+		while (!ended)
+		{
+			DWORD flags = 0;
+			LONGLONG time = 0;
+			winrt::com_ptr<IMFSample> sample{};
+			if (FAILED(reader->ReadSample((DWORD)MF_SOURCE_READER_FIRST_AUDIO_STREAM, 0, nullptr, &flags, &time, sample.put())) ||
+				(flags & (MF_SOURCE_READERF_ERROR | MF_SOURCE_READERF_ENDOFSTREAM)))
+			{
+				ended = true;
+				break;
+			}
+			if (!sample)
+			{
+				continue;
+			}
+
+			winrt::com_ptr<IMFMediaBuffer> buffer{};
+			BYTE* data = nullptr;
+			DWORD size = 0;
+			if (FAILED(sample->ConvertToContiguousBuffer(buffer.put())) || FAILED(buffer->Lock(&data, nullptr, &size)))
+			{
+				ended = true;
+				break;
+			}
+			auto sampleCount = size / sizeof(float) / format.channels * format.channels;
+			pending.resize(sampleCount);
+			std::memcpy(pending.data(), data, sampleCount * sizeof(float));
+			buffer->Unlock();
+			pendingOffset = 0;
+
+			if (seekTarget)
+			{
+				auto skip = std::clamp<int64_t>(*seekTarget - toFrames(time), 0, (int64_t)(sampleCount / format.channels));
+				pendingOffset = (size_t)skip * format.channels;
+				if (pendingOffset == pending.size())
+				{
+					continue;
+				}
+				seekTarget.reset();
+			}
+			if (pendingOffset < pending.size())
+			{
+				return true;
+			}
+		}
+		pending.clear();
+		pendingOffset = 0;
+		return false;
+	}
+
+	winrt::com_ptr<IMFSourceReader> reader{};
+	EncoderTrim trim;
+	AudioFormat format{};
+	std::optional<int64_t> length{};
+	bool seekable = false;
+	// Decoded samples not read yet.
+	std::vector<float> pending{};
+	size_t pendingOffset = 0;
+	bool ended = false;
+	std::optional<int64_t> seekTarget{};
+};
@@ -0,0 +1,464 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "mapped_file.hpp"
+#include "metadata_probe.hpp"
+
+// Probed metadata as kept by MetadataCache. The artwork is stored in its own
+// file, shared by every track with the same picture.
+struct MetadataEntry
+{
+	FileStamp stamp;
+	// The artwork bytes are never kept here.
+	TrackMetadata metadata;
+	std::optional<std::string> artworkPath;
+	// Whether the file was probed for artwork at all.
+	bool artworkProbed;
+};
+
+// Metadata of audio files persisted in |directory|, keyed by path, size and
+// modification time, so that a file is only probed again after it changed.
+//
+// The index is loaded once and written back by flush(). An index that can not
+// be read, for example one written by another version, is discarded.
+class MetadataCache
+{
+public:
+	explicit MetadataCache(const std::filesystem::path& directory)
+		: directory(directory)
+	{
+		std::error_code error{};
+		std::filesystem::create_directories(directory / "artwork", error);
+		load();
+	}
+
+	// Prevent copying.
+	MetadataCache(MetadataCache const&) = delete;
+	MetadataCache& operator=(MetadataCache const&) = delete;
+
+	/// Returns the entry of |path| if it was probed with the same |stamp|, and
+	/// for artwork if |includeArtwork|.
+	std::optional<MetadataEntry> get(const std::string& path, const FileStamp& stamp, bool includeArtwork)
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		auto it = entries.find(path);
+		if (it == entries.end() || it->second.stamp != stamp || (includeArtwork && !it->second.artworkProbed))
+		{
+			return std::nullopt;
+		}
+		return it->second;
+	}
+
+	/// Stores |metadata| probed from |path|, moving its artwork into a file.
+	MetadataEntry put(const std::string& path, const FileStamp& stamp, TrackMetadata metadata, bool includeArtwork)
+	{
+		MetadataEntry entry{ stamp, {}, std::nullopt, includeArtwork };
+		if (!metadata.artwork.empty())
+		{
+			entry.artworkPath = saveArtwork(metadata.artwork, metadata.artworkMimeType.value_or(""));
+			metadata.artwork.clear();
+			metadata.artwork.shrink_to_fit();
+		}
+		entry.metadata = std::move(metadata);
+
+		std::lock_guard<std::mutex> lock(mutex);
+		entries[path] = entry;
+		dirty = true;
+		return entry;
+	}
+
+	/// Writes the index if it changed. The previous index is only replaced
+	/// once the new one is complete.
+	bool flush()
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		if (!dirty)
+		{
+			return true;
+		}
+
+		std::string buffer{};
+		buffer.append(kMagic, 4);
+		writeInt(buffer, kVersion);
+		writeInt(buffer, (uint64_t)entries.size());
+		for (auto& [path, entry] : entries)
+		{
+			writeString(buffer, path);
+			writeEntry(buffer, entry);
+		}
+
+		auto indexPath = directory / "index.bin";
+		auto temporaryPath = directory / "index.bin.tmp";
+		{
+			std::ofstream file(temporaryPath, std::ios::binary | std::ios::trunc);
+			file.write(buffer.data(), (std::streamsize)buffer.size());
+			if (!file)
+			{
+				return false;
+			}
+		}
+		std::error_code error{};
+		std::filesystem::rename(temporaryPath, indexPath, error);
+		if (error)
+		{
+			return false;
+		}
+		dirty = false;
+		return true;
+	}
+
+	size_t size()
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		return entries.size();
+	}
+
+private:
+	static constexpr char kMagic[4] = { 'J', 'A', 'M', 'C' };
+	static constexpr uint32_t kVersion = 2;
+
+	void load()
+	{
+		std::ifstream file(directory / "index.bin", std::ios::binary);
+		if (!file)
+		{
+			return;
+		}
+		std::string buffer((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+
+		Reader reader{ buffer, 0, true };
+		if (buffer.size() < 4 || buffer.compare(0, 4, kMagic, 4) != 0)
+		{
+			return;
+		}
+		reader.position = 4;
+		if (reader.readInt<uint32_t>() != kVersion)
+		{
+			return;
+		}
+
+		std::unordered_map<std::string, MetadataEntry> loaded{};
+		auto count = reader.readInt<uint64_t>();
+		for (uint64_t i = 0; i < count && reader.ok; i++)
+		{
+			auto path = reader.readString();
+			auto entry = readEntry(reader);
+			if (reader.ok)
+			{
+				loaded[path] = entry;
+			}
+		}
+		if (reader.ok)
+		{
+			entries = std::move(loaded);
+		}
+	}
+
+	/// Writes |artwork| to a file named after its hash, unless an identical
+	/// picture is already there.
+	std::optional<std::string> saveArtwork(const std::vector<uint8_t>& artwork, const std::string& mimeType)
+	{
+		// FNV-1a
+		uint64_t hash = 0xCBF29CE484222325ull;
+		for (auto byte : artwork)
+		{
+			hash = (hash ^ byte) * 0x100000001B3ull;
+		}
+		char name[32];
+		std::snprintf(name, sizeof(name), "%016llx-%zx", (unsigned long long)hash, artwork.size());
+		auto extension = mimeType == "image/png" ? ".png" : mimeType == "image/jpeg" || mimeType == "image/jpg" ? ".jpg" : ".img";
+		auto path = directory / "artwork" / (std::string(name) + extension);
+
+		std::error_code error{};
+		if (!std::filesystem::exists(path, error))
+		{
+			// Writers racing for the same picture write the same bytes.
+			auto temporaryPath = path;
+			temporaryPath += ".tmp" + std::to_string(std::hash<std::thread::id>()(std::this_thread::get_id()));
+			{
+				std::ofstream file(temporaryPath, std::ios::binary | std::ios::trunc);
+				file.write((const char*)artwork.data(), (std::streamsize)artwork.size());
+				if (!file)
+				{
+					return std::nullopt;
+				}
+			}
+			std::filesystem::rename(temporaryPath, path, error);
+			if (error)
+			{
+				std::filesystem::remove(temporaryPath, error);
+				if (!std::filesystem::exists(path, error))
+				{
+					return std::nullopt;
+				}
+			}
+		}
+		return path.u8string();
+	}
+
+	// Little-endian encoding of the index.
+	template <typename T>
+	static void writeInt(std::string& buffer, T value)
+	{
+		for (size_t i = 0; i < sizeof(T); i++)
+		{
+			buffer.push_back((char)(((uint64_t)value >> (i * 8)) & 0xFF));
+		}
+	}
+
+	static void writeString(std::string& buffer, const std::string& value)
+	{
+		writeInt(buffer, (uint32_t)value.size());
+		buffer.append(value);
+	}
+
+	static void writeOptional(std::string& buffer, const std::optional<std::string>& value)
+	{
+		buffer.push_back(value ? 1 : 0);
+		if (value)
+		{
+			writeString(buffer, *value);
+		}
+	}
+
+	template <typename T>
+	static void writeOptional(std::string& buffer, const std::optional<T>& value)
+	{
+		buffer.push_back(value ? 1 : 0);
+		if (value)
+		{
+			writeInt(buffer, *value);
+		}
+	}
+
+	static void writeEntry(std::string& buffer, const MetadataEntry& entry)
+	{
+		auto& metadata = entry.metadata;
+		writeInt(buffer, entry.stamp.size);
+		writeInt(buffer, entry.stamp.modifiedTime);
+		buffer.push_back(entry.artworkProbed ? 1 : 0);
+		writeOptional(buffer, entry.artworkPath);
+		writeString(buffer, metadata.format);
+		writeOptional(buffer, metadata.title);
+		writeOptional(buffer, metadata.artist);
+		writeOptional(buffer, metadata.album);
+		writeOptional(buffer, metadata.albumArtist);
+		writeOptional(buffer, metadata.genre);
+		writeOptional(buffer, metadata.date);
+		writeOptional(buffer, metadata.trackNumber);
+		writeOptional(buffer, metadata.discNumber);
+		writeOptional(buffer, metadata.durationUs);
+		writeOptional(buffer, metadata.sampleRate);
+		writeOptional(buffer, metadata.channels);
+		writeOptional(buffer, metadata.bitrate);
+		writeOptional(buffer, metadata.encoderDelay);
+		writeOptional(buffer, metadata.encoderPadding);
+		writeOptional(buffer, metadata.artworkMimeType);
+	}
+
+	// Reads the index, clearing |ok| instead of reading past its end.
+	struct Reader
+	{
+		const std::string& buffer;
+		size_t position;
+		bool ok;
+
+		template <typename T>
+		T readInt()
+		{
+			if (!ok || buffer.size() - position < sizeof(T))
+			{
+				ok = false;
+				return T{};
+			}
+			uint64_t value = 0;
+			for (size_t i = 0; i < sizeof(T); i++)
+			{
+				value |= (uint64_t)(uint8_t)buffer[position + i] << (i * 8);
+			}
+			position += sizeof(T);
+			return (T)value;
+		}
+
+		std::string readString()
+		{
+			auto length = readInt<uint32_t>();
+			if (!ok || buffer.size() - position < length)
+			{
+				ok = false;
+				return std::string();
+			}
+			auto value = buffer.substr(position, length);
+			position += length;
+			return value;
+		}
+
+		bool readFlag()
+		{
+			return readInt<uint8_t>() != 0;
+		}
+
+		void readOptional(std::optional<std::string>& value)
+		{
+			if (readFlag())
+			{
+				value = readString();
+			}
+		}
+
+		template <typename T>
+		void readOptional(std::optional<T>& value)
+		{
+			if (readFlag())
+			{
+				value = readInt<T>();
+			}
+		}
+	};
+
+	static MetadataEntry readEntry(Reader& reader)
+	{
+		MetadataEntry entry{};
+		auto& metadata = entry.metadata;
+		entry.stamp.size = reader.readInt<uint64_t>();
+		entry.stamp.modifiedTime = reader.readInt<int64_t>();
+		entry.artworkProbed = reader.readFlag();
+		reader.readOptional(entry.artworkPath);
+		metadata.format = reader.readString();
+		reader.readOptional(metadata.title);
+		reader.readOptional(metadata.artist);
+		reader.readOptional(metadata.album);
+		reader.readOptional(metadata.albumArtist);
+		reader.readOptional(metadata.genre);
+		reader.readOptional(metadata.date);
+		reader.readOptional(metadata.trackNumber);
+		reader.readOptional(metadata.discNumber);
+		reader.readOptional(metadata.durationUs);
+		reader.readOptional(metadata.sampleRate);
+		reader.readOptional(metadata.channels);
+		reader.readOptional(metadata.bitrate);
+		reader.readOptional(metadata.encoderDelay);
+		reader.readOptional(metadata.encoderPadding);
+		reader.readOptional(metadata.artworkMimeType);
+		return entry;
+	}
+
+	std::filesystem::path directory;
+	std::mutex mutex;
+	std::unordered_map<std::string, MetadataEntry> entries{};
+	bool dirty = false;
+};
+
+// The outcome of probing one file. |entry| is empty if the file could not be
+// opened or its format is not recognized.
+struct ProbeResult
+{
+	std::string path;
+	std::optional<MetadataEntry> entry;
+	bool cached;
+};
+
+struct ProbeStatistics
+{
+	size_t files = 0;
+	size_t cached = 0;
+	size_t failed = 0;
+	int64_t elapsedUs = 0;
+	double filesPerSecond = 0;
+};
+
+// Probes many files at once on worker threads, going through a MetadataCache.
+class MetadataScanner
+{
+public:
+	/// Probes |paths| on up to |threadCount| threads, or one per core if zero,
+	/// and flushes the cache. Results are in the order of |paths|.
+	static std::vector<ProbeResult> scan(MetadataCache& cache, const std::vector<std::string>& paths,
+		bool includeArtwork, unsigned threadCount, ProbeStatistics& statistics)
+	{
+		auto start = std::chrono::steady_clock::now();
+		std::vector<ProbeResult> results(paths.size());
+
+		if (threadCount == 0)
+		{
+			threadCount = std::max(1u, std::thread::hardware_concurrency());
+		}
+		threadCount = (unsigned)std::min<size_t>(threadCount, paths.size());
+
+		// Workers take the next file as they finish one, so a few large files do
+		// not hold up the rest.
+		std::atomic<size_t> next = 0;
+		auto work = [&]()
+		{
+			for (auto i = next++; i < paths.size(); i = next++)
+			{
+				results[i] = probeFile(cache, paths[i], includeArtwork);
+			}
+		};
+
+		std::vector<std::thread> workers{};
+		for (unsigned i = 1; i < threadCount; i++)
+		{
+			workers.emplace_back(work);
+		}
+		work();
+		for (auto& worker : workers)
+		{
+			worker.join();
+		}
+		cache.flush();
+
+		statistics = ProbeStatistics{};
+		statistics.files = paths.size();
+		for (auto& result : results)
+		{
+			statistics.cached += result.cached ? 1 : 0;
+			statistics.failed += result.entry ? 0 : 1;
+		}
+		statistics.elapsedUs = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+		statistics.filesPerSecond = statistics.elapsedUs > 0 ? (double)paths.size() * 1000000 / statistics.elapsedUs : 0;
+		return results;
+	}
+
+	static ProbeResult probeFile(MetadataCache& cache, const std::string& path, bool includeArtwork)
+	{
+		ProbeResult result{ path, std::nullopt, false };
+
+		// A cache hit costs a single stat.
+		if (auto stamp = MappedFile::stat(path))
+		{
+			if (auto entry = cache.get(path, *stamp, includeArtwork))
+			{
+				result.entry = entry;
+				result.cached = true;
+				return result;
+			}
+		}
+
+		MappedFile file(path);
+		if (!file.isOpen() || !file.data())
+		{
+			return result;
+		}
+		auto metadata = MetadataProbe::probe(file.data(), file.size(), includeArtwork);
+		if (metadata)
+		{
+			result.entry = cache.put(path, *file.getStamp(), std::move(*metadata), includeArtwork);
+		}
+		return result;
+	}
+};
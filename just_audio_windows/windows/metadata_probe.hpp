@@ -0,0 +1,1521 @@
+#pragma once
+
+#include <algorithm>
+#include <cctype>
+#include <cstdint>
+#include <cstring>
+#include <optional>
+#include <string>
+#include <vector>
+
+// Tags and stream properties of an audio file, read without decoding it.
+struct TrackMetadata
+{
+	// One of "mp3", "flac", "vorbis", "opus", "mp4" or "wav".
+	std::string format;
+	std::optional<std::string> title;
+	std::optional<std::string> artist;
+	std::optional<std::string> album;
+	std::optional<std::string> albumArtist;
+	std::optional<std::string> genre;
+	std::optional<std::string> date;
+	std::optional<int32_t> trackNumber;
+	std::optional<int32_t> discNumber;
+	std::optional<int64_t> durationUs;
+	std::optional<int32_t> sampleRate;
+	std::optional<int32_t> channels;
+	// In bits per second, averaged over the whole file.
+	std::optional<int32_t> bitrate;
+	// Frames the encoder added before and after the audio, as an MP3 LAME tag
+	// or an iTunSMPB tag records them. MP3 decoders add a delay of their own.
+	std::optional<int32_t> encoderDelay;
+	std::optional<int32_t> encoderPadding;
+	std::optional<std::string> artworkMimeType;
+	std::vector<uint8_t> artwork;
+};
+
+// Reads tags (ID3v1/v2, Vorbis comments, MP4 atoms, RIFF INFO) and the exact
+// duration of MP3, FLAC, Ogg Vorbis/Opus, MP4 and WAV files from memory.
+//
+// Everything works on a read-only view of the whole file, typically a memory
+// mapping, so only the pages that are looked at are read from disk. Malformed
+// input never reads out of bounds; the fields that could not be read are
+// left empty.
+class MetadataProbe
+{
+public:
+	/// The frames MP3 decoders output before the encoder's delay, which LAME
+	/// tags leave out.
+	static constexpr int32_t kMp3DecoderDelay = 529;
+
+	/// Returns the metadata of the file in |data|, or std::nullopt if its
+	/// format is not recognized. Artwork is only copied with |includeArtwork|.
+	static std::optional<TrackMetadata> probe(const uint8_t* data, size_t size, bool includeArtwork = true)
+	{
+		MetadataProbe instance(data, size, includeArtwork);
+		if (!instance.run())
+		{
+			return std::nullopt;
+		}
+		return instance.metadata;
+	}
+
+private:
+	MetadataProbe(const uint8_t* data, size_t size, bool includeArtwork)
+		: data(data), size(size), includeArtwork(includeArtwork)
+	{
+	}
+
+	bool run()
+	{
+		// ID3v2 tags may precede MP3, FLAC and even some WAV files.
+		size_t offset = 0;
+		while (offset + 10 <= size && std::memcmp(data + offset, "ID3", 3) == 0)
+		{
+			auto tagSize = parseId3v2(data + offset, size - offset);
+			if (tagSize == 0)
+			{
+				break;
+			}
+			offset += tagSize;
+		}
+
+		auto remaining = size - offset;
+		auto* start = data + offset;
+		bool recognized = false;
+		if (remaining >= 4 && std::memcmp(start, "fLaC", 4) == 0)
+		{
+			recognized = parseFlac(start, remaining);
+		}
+		else if (remaining >= 4 && std::memcmp(start, "OggS", 4) == 0)
+		{
+			recognized = parseOgg(start, remaining);
+		}
+		else if (remaining >= 12 && std::memcmp(start, "RIFF", 4) == 0 && std::memcmp(start + 8, "WAVE", 4) == 0)
+		{
+			recognized = parseWav(start, remaining);
+		}
+		else if (remaining >= 8 && std::memcmp(start + 4, "ftyp", 4) == 0)
+		{
+			recognized = parseMp4(start, remaining);
+		}
+		else
+		{
+			recognized = parseMpeg(offset);
+		}
+
+		if (recognized && metadata.format == "mp3")
+		{
+			parseId3v1();
+		}
+		return recognized;
+	}
+
+	// Byte order helpers. Callers check the bounds.
+	static uint32_t be16(const uint8_t* p) { return (uint32_t)p[0] << 8 | p[1]; }
+	static uint32_t be24(const uint8_t* p) { return (uint32_t)p[0] << 16 | (uint32_t)p[1] << 8 | p[2]; }
+	static uint32_t be32(const uint8_t* p) { return (uint32_t)p[0] << 24 | (uint32_t)p[1] << 16 | (uint32_t)p[2] << 8 | p[3]; }
+	static uint64_t be64(const uint8_t* p) { return (uint64_t)be32(p) << 32 | be32(p + 4); }
+	static uint32_t le16(const uint8_t* p) { return (uint32_t)p[1] << 8 | p[0]; }
+	static uint32_t le32(const uint8_t* p) { return (uint32_t)p[3] << 24 | (uint32_t)p[2] << 16 | (uint32_t)p[1] << 8 | p[0]; }
+	static uint64_t le64(const uint8_t* p) { return (uint64_t)le32(p + 4) << 32 | le32(p); }
+	static uint32_t synchsafe32(const uint8_t* p)
+	{
+		return (uint32_t)(p[0] & 0x7F) << 21 | (uint32_t)(p[1] & 0x7F) << 14 | (uint32_t)(p[2] & 0x7F) << 7 | (p[3] & 0x7F);
+	}
+
+	static int64_t samplesToUs(uint64_t samples, uint32_t sampleRate)
+	{
+		return (int64_t)(samples / sampleRate * 1000000 + samples % sampleRate * 1000000 / sampleRate);
+	}
+
+	/// Sets |field| unless a tag read earlier already did.
+	template <typename T>
+	static void setIfEmpty(std::optional<T>& field, const std::optional<T>& value)
+	{
+		if (!field && value)
+		{
+			field = value;
+		}
+	}
+
+	static std::optional<std::string> nonEmpty(std::string value)
+	{
+		while (!value.empty() && (value.back() == ' ' || value.back() == '\0'))
+		{
+			value.pop_back();
+		}
+		if (value.empty())
+		{
+			return std::nullopt;
+		}
+		return value;
+	}
+
+	/// Reads the leading number of values such as "3" or "3/12".
+	static std::optional<int32_t> parseNumber(const std::string& value)
+	{
+		int64_t number = 0;
+		size_t i = 0;
+		while (i < value.size() && value[i] == ' ')
+		{
+			i++;
+		}
+		auto digits = i;
+		while (i < value.size() && std::isdigit((unsigned char)value[i]) && i - digits < 9)
+		{
+			number = number * 10 + (value[i] - '0');
+			i++;
+		}
+		if (i == digits)
+		{
+			return std::nullopt;
+		}
+		return (int32_t)number;
+	}
+
+	static void appendUtf8(std::string& out, uint32_t codePoint)
+	{
+		if (codePoint < 0x80)
+		{
+			out.push_back((char)codePoint);
+		}
+		else if (codePoint < 0x800)
+		{
+			out.push_back((char)(0xC0 | (codePoint >> 6)));
+			out.push_back((char)(0x80 | (codePoint & 0x3F)));
+		}
+		else if (codePoint < 0x10000)
+		{
+			out.push_back((char)(0xE0 | (codePoint >> 12)));
+			out.push_back((char)(0x80 | ((codePoint >> 6) & 0x3F)));
+			out.push_back((char)(0x80 | (codePoint & 0x3F)));
+		}
+		else
+		{
+			out.push_back((char)(0xF0 | (codePoint >> 18)));
+			out.push_back((char)(0x80 | ((codePoint >> 12) & 0x3F)));
+			out.push_back((char)(0x80 | ((codePoint >> 6) & 0x3F)));
+			out.push_back((char)(0x80 | (codePoint & 0x3F)));
+		}
+	}
+
+	static std::string latin1ToUtf8(const uint8_t* p, size_t length)
+	{
+		std::string out{};
+		for (size_t i = 0; i < length && p[i] != 0; i++)
+		{
+			appendUtf8(out, p[i]);
+		}
+		return out;
+	}
+
+	static std::string utf16ToUtf8(const uint8_t* p, size_t length, bool bigEndian)
+	{
+		std::string out{};
+		for (size_t i = 0; i + 1 < length; i += 2)
+		{
+			uint32_t unit = bigEndian ? be16(p + i) : le16(p + i);
+			if (unit == 0)
+			{
+				break;
+			}
+			if (unit >= 0xD800 && unit < 0xDC00 && i + 3 < length)
+			{
+				uint32_t low = bigEndian ? be16(p + i + 2) : le16(p + i + 2);
+				if (low >= 0xDC00 && low < 0xE000)
+				{
+					appendUtf8(out, 0x10000 + ((unit - 0xD800) << 10) + (low - 0xDC00));
+					i += 2;
+					continue;
+				}
+			}
+			appendUtf8(out, unit);
+		}
+		return out;
+	}
+
+	/// Decodes ID3v2 text in |encoding| up to its terminator.
+	static std::string decodeId3Text(uint8_t encoding, const uint8_t* p, size_t length)
+	{
+		switch (encoding)
+		{
+		case 1: // UTF-16 with BOM
+			if (length >= 2 && p[0] == 0xFE && p[1] == 0xFF)
+			{
+				return utf16ToUtf8(p + 2, length - 2, true);
+			}
+			if (length >= 2 && p[0] == 0xFF && p[1] == 0xFE)
+			{
+				return utf16ToUtf8(p + 2, length - 2, false);
+			}
+			return utf16ToUtf8(p, length, false);
+		case 2: // UTF-16BE
+			return utf16ToUtf8(p, length, true);
+		case 3: // UTF-8
+			return std::string((const char*)p, std::find(p, p + length, 0) - p);
+		default:
+			return latin1ToUtf8(p, length);
+		}
+	}
+
+	/// Returns the length of the ID3v2 string at |p|, including its terminator.
+	static size_t id3TextLength(uint8_t encoding, const uint8_t* p, size_t length)
+	{
+		if (encoding == 1 || encoding == 2)
+		{
+			for (size_t i = 0; i + 1 < length; i += 2)
+			{
+				if (p[i] == 0 && p[i + 1] == 0)
+				{
+					return i + 2;
+				}
+			}
+			return length;
+		}
+		auto end = std::find(p, p + length, 0);
+		return end == p + length ? length : (size_t)(end - p) + 1;
+	}
+
+	/// Resolves ID3v1 genre numbers, which ID3v2 genres may also refer to as
+	/// "(17)" or "17".
+	static std::string resolveGenre(const std::string& genre)
+	{
+		static const char* const kGenres[] = {
+			"Blues", "Classic Rock", "Country", "Dance", "Disco", "Funk", "Grunge", "Hip-Hop",
+			"Jazz", "Metal", "New Age", "Oldies", "Other", "Pop", "R&B", "Rap",
+			"Reggae", "Rock", "Techno", "Industrial", "Alternative", "Ska", "Death Metal", "Pranks",
+			"Soundtrack", "Euro-Techno", "Ambient", "Trip-Hop", "Vocal", "Jazz+Funk", "Fusion", "Trance",
+			"Classical", "Instrumental", "Acid", "House", "Game", "Sound Clip", "Gospel", "Noise",
+			"AlternRock", "Bass", "Soul", "Punk", "Space", "Meditative", "Instrumental Pop", "Instrumental Rock",
+			"Ethnic", "Gothic", "Darkwave", "Techno-Industrial", "Electronic", "Pop-Folk", "Eurodance", "Dream",
+			"Southern Rock", "Comedy", "Cult", "Gangsta", "Top 40", "Christian Rap", "Pop/Funk", "Jungle",
+			"Native American", "Cabaret", "New Wave", "Psychadelic", "Rave", "Showtunes", "Trailer", "Lo-Fi",
+			"Tribal", "Acid Punk", "Acid Jazz", "Polka", "Retro", "Musical", "Rock & Roll", "Hard Rock",
+		};
+		constexpr size_t kGenreCount = sizeof(kGenres) / sizeof(kGenres[0]);
+
+		auto inner = genre;
+		if (inner.size() > 2 && inner.front() == '(' && inner.find(')') != std::string::npos)
+		{
+			auto close = inner.find(')');
+			// "(17)Rock" carries its own name.
+			if (close + 1 < inner.size())
+			{
+				return inner.substr(close + 1);
+			}
+			inner = inner.substr(1, close - 1);
+		}
+		if (inner.empty() || !std::all_of(inner.begin(), inner.end(), [](char c)
+			{ return std::isdigit((unsigned char)c); }))
+		{
+			return genre;
+		}
+		auto number = parseNumber(inner);
+		if (number && *number >= 0 && (size_t)*number < kGenreCount)
+		{
+			return kGenres[*number];
+		}
+		return genre;
+	}
+
+	void setArtwork(const std::string& mimeType, const uint8_t* p, size_t length, bool frontCover)
+	{
+		// The front cover wins over any other picture.
+		if (!includeArtwork || length == 0 || (metadata.artworkMimeType && !frontCover) || artworkIsFrontCover)
+		{
+			return;
+		}
+		metadata.artworkMimeType = mimeType;
+		metadata.artwork.assign(p, p + length);
+		artworkIsFrontCover = frontCover;
+	}
+
+	static std::string imageMimeType(const std::string& mimeType, const uint8_t* p, size_t length)
+	{
+		if (!mimeType.empty() && mimeType.find('/') != std::string::npos)
+		{
+			return mimeType;
+		}
+		if (length >= 8 && std::memcmp(p, "\x89PNG", 4) == 0)
+		{
+			return "image/png";
+		}
+		return "image/jpeg";
+	}
+
+	/**
+	 * Parses the ID3v2 tag at |tag| and returns its total size, or zero if it is
+	 * malformed.
+	 */
+	size_t parseId3v2(const uint8_t* tag, size_t length)
+	{
+		auto version = tag[3];
+		auto flags = tag[5];
+		if (version < 2 || version > 4)
+		{
+			return 0;
+		}
+		size_t tagSize = (size_t)synchsafe32(tag + 6) + 10 + ((version == 4 && (flags & 0x10)) ? 10 : 0);
+		if (tagSize > length)
+		{
+			tagSize = length;
+		}
+
+		const uint8_t* body = tag + 10;
+		size_t bodySize = std::min<size_t>(synchsafe32(tag + 6), length - 10);
+
+		// Before v2.4, unsynchronisation applies to the whole tag.
+		std::vector<uint8_t> resynchronized{};
+		if (version < 4 && (flags & 0x80))
+		{
+			resynchronized = resynchronize(body, bodySize);
+			body = resynchronized.data();
+			bodySize = resynchronized.size();
+		}
+
+		size_t position = 0;
+		if (flags & 0x40 && version >= 3 && bodySize >= 4)
+		{
+			// Skips the extended header.
+			position = version == 3 ? 4 + (size_t)be32(body) : (size_t)synchsafe32(body);
+		}
+
+		size_t headerSize = version == 2 ? 6 : 10;
+		while (position + headerSize <= bodySize)
+		{
+			auto* frame = body + position;
+			if (frame[0] == 0)
+			{
+				break; // Padding
+			}
+
+			std::string id((const char*)frame, version == 2 ? 3 : 4);
+			size_t frameSize = version == 2 ? be24(frame + 3) : version == 3 ? be32(frame + 4) : synchsafe32(frame + 4);
+			position += headerSize;
+			if (frameSize > bodySize - position)
+			{
+				break;
+			}
+
+			auto* content = body + position;
+			position += frameSize;
+
+			std::vector<uint8_t> frameCopy{};
+			if (version >= 3)
+			{
+				auto formatFlags = frame[9];
+				bool compressed = version == 3 ? (formatFlags & 0x80) : (formatFlags & 0x08);
+				bool encrypted = version == 3 ? (formatFlags & 0x40) : (formatFlags & 0x04);
+				if (compressed || encrypted)
+				{
+					continue;
+				}
+				size_t skip = 0;
+				if (formatFlags & (version == 3 ? 0x20 : 0x40))
+				{
+					skip += 1; // Group identifier
+				}
+				if (version == 4 && (formatFlags & 0x01))
+				{
+					skip += 4; // Data length indicator
+				}
+				if (skip > frameSize)
+				{
+					continue;
+				}
+				content += skip;
+				frameSize -= skip;
+				if (version == 4 && (formatFlags & 0x02))
+				{
+					frameCopy = resynchronize(content, frameSize);
+					content = frameCopy.data();
+					frameSize = frameCopy.size();
+				}
+			}
+
+			parseId3Frame(id, content, frameSize);
+		}
+		return tagSize;
+	}
+
+	/// Undoes ID3v2 unsynchronisation, which inserts a zero after every 0xFF.
+	static std::vector<uint8_t> resynchronize(const uint8_t* p, size_t length)
+	{
+		std::vector<uint8_t> out{};
+		out.reserve(length);
+		for (size_t i = 0; i < length; i++)
+		{
+			out.push_back(p[i]);
+			if (p[i] == 0xFF && i + 1 < length && p[i + 1] == 0)
+			{
+				i++;
+			}
+		}
+		return out;
+	}
+
+	void parseId3Frame(const std::string& id, const uint8_t* content, size_t length)
+	{
+		if (length < 2)
+		{
+			return;
+		}
+
+		if (id == "APIC" || id == "PIC")
+		{
+			parseId3Picture(id == "PIC", content, length);
+			return;
+		}
+		if ((id == "COMM" || id == "COM") && length > 4)
+		{
+			// iTunes keeps the gapless info of MP3 files in a comment.
+			auto encoding = content[0];
+			auto descriptionLength = id3TextLength(encoding, content + 4, length - 4);
+			if (decodeId3Text(encoding, content + 4, descriptionLength) == "iTunSMPB" && 4 + descriptionLength < length)
+			{
+				parseItunSmpb(decodeId3Text(encoding, content + 4 + descriptionLength, length - 4 - descriptionLength), kMp3DecoderDelay);
+			}
+			return;
+		}
+		if (id[0] != 'T')
+		{
+			return;
+		}
+
+		auto text = nonEmpty(decodeId3Text(content[0], content + 1, length - 1));
+		if (!text)
+		{
+			return;
+		}
+
+		if (id == "TIT2" || id == "TT2")
+		{
+			setIfEmpty(metadata.title, text);
+		}
+		else if (id == "TPE1" || id == "TP1")
+		{
+			setIfEmpty(metadata.artist, text);
+		}
+		else if (id == "TALB" || id == "TAL")
+		{
+			setIfEmpty(metadata.album, text);
+		}
+		else if (id == "TPE2" || id == "TP2")
+		{
+			setIfEmpty(metadata.albumArtist, text);
+		}
+		else if (id == "TCON" || id == "TCO")
+		{
+			setIfEmpty(metadata.genre, std::optional<std::string>(resolveGenre(*text)));
+		}
+		else if (id == "TDRC" || id == "TYER" || id == "TYE")
+		{
+			setIfEmpty(metadata.date, text);
+		}
+		else if (id == "TRCK" || id == "TRK")
+		{
+			setIfEmpty(metadata.trackNumber, parseNumber(*text));
+		}
+		else if (id == "TPOS" || id == "TPA")
+		{
+			setIfEmpty(metadata.discNumber, parseNumber(*text));
+		}
+	}
+
+	void parseId3Picture(bool legacy, const uint8_t* content, size_t length)
+	{
+		auto encoding = content[0];
+		size_t position = 1;
+		std::string mimeType{};
+		if (legacy)
+		{
+			// ID3v2.2 has a three letter image format instead of a MIME type.
+			if (length < 5)
+			{
+				return;
+			}
+			std::string format((const char*)content + 1, 3);
+			mimeType = format == "PNG" ? "image/png" : "image/jpeg";
+			position = 4;
+		}
+		else
+		{
+			auto mimeLength = id3TextLength(0, content + position, length - position);
+			mimeType = latin1ToUtf8(content + position, mimeLength);
+			position += mimeLength;
+		}
+		if (position >= length)
+		{
+			return;
+		}
+		auto pictureType = content[position++];
+		position += id3TextLength(encoding, content + position, length - position);
+		if (position >= length)
+		{
+			return;
+		}
+		setArtwork(imageMimeType(mimeType, content + position, length - position), content + position, length - position, pictureType == 3);
+	}
+
+	/// Reads the ID3v1 tag at the end of MP3 files for fields ID3v2 did not set.
+	void parseId3v1()
+	{
+		if (size < 128 || std::memcmp(data + size - 128, "TAG", 3) != 0)
+		{
+			return;
+		}
+		auto* tag = data + size - 128;
+		setIfEmpty(metadata.title, nonEmpty(latin1ToUtf8(tag + 3, 30)));
+		setIfEmpty(metadata.artist, nonEmpty(latin1ToUtf8(tag + 33, 30)));
+		setIfEmpty(metadata.album, nonEmpty(latin1ToUtf8(tag + 63, 30)));
+		setIfEmpty(metadata.date, nonEmpty(latin1ToUtf8(tag + 93, 4)));
+		// ID3v1.1 keeps the track number in the last byte of the comment.
+		if (tag[125] == 0 && tag[126] != 0)
+		{
+			setIfEmpty(metadata.trackNumber, std::optional<int32_t>(tag[126]));
+		}
+		if (tag[127] != 0xFF)
+		{
+			setIfEmpty(metadata.genre, std::optional<std::string>(resolveGenre(std::to_string(tag[127]))));
+		}
+	}
+
+public:
+	// A parsed MPEG audio frame header, also used to index MP3 files for
+	// seeking.
+	struct MpegFrame
+	{
+		// 1 for MPEG-1, 2 for MPEG-2 and 3 for MPEG-2.5.
+		int version;
+		int layer;
+		uint32_t bitrate;
+		uint32_t sampleRate;
+		uint32_t samplesPerFrame;
+		uint32_t length;
+		int channels;
+
+		static std::optional<MpegFrame> parse(const uint8_t* p)
+		{
+			static const uint16_t kBitrates[2][3][15] = {
+				{
+					{ 0, 32, 64, 96, 128, 160, 192, 224, 256, 288, 320, 352, 384, 416, 448 },
+					{ 0, 32, 48, 56, 64, 80, 96, 112, 128, 160, 192, 224, 256, 320, 384 },
+					{ 0, 32, 40, 48, 56, 64, 80, 96, 112, 128, 160, 192, 224, 256, 320 },
+				},
+				{
+					{ 0, 32, 48, 56, 64, 80, 96, 112, 128, 144, 160, 176, 192, 224, 256 },
+					{ 0, 8, 16, 24, 32, 40, 48, 56, 64, 80, 96, 112, 128, 144, 160 },
+					{ 0, 8, 16, 24, 32, 40, 48, 56, 64, 80, 96, 112, 128, 144, 160 },
+				},
+			};
+			static const uint32_t kSampleRates[3] = { 44100, 48000, 32000 };
+
+			if (p[0] != 0xFF || (p[1] & 0xE0) != 0xE0)
+			{
+				return std::nullopt;
+			}
+			auto versionBits = (p[1] >> 3) & 3;
+			auto layerBits = (p[1] >> 1) & 3;
+			auto bitrateIndex = p[2] >> 4;
+			auto sampleRateIndex = (p[2] >> 2) & 3;
+			// Free format bitrates are not supported.
+			if (versionBits == 1 || layerBits == 0 || bitrateIndex == 0 || bitrateIndex == 15 || sampleRateIndex == 3)
+			{
+				return std::nullopt;
+			}
+
+			MpegFrame frame{};
+			frame.version = versionBits == 3 ? 1 : versionBits == 2 ? 2 : 3;
+			frame.layer = 4 - layerBits;
+			frame.bitrate = kBitrates[frame.version == 1 ? 0 : 1][frame.layer - 1][bitrateIndex] * 1000;
+			frame.sampleRate = kSampleRates[sampleRateIndex] >> (frame.version - 1);
+			frame.channels = (p[3] >> 6) == 3 ? 1 : 2;
+			uint32_t padding = (p[2] >> 1) & 1;
+			if (frame.layer == 1)
+			{
+				frame.samplesPerFrame = 384;
+				frame.length = (12 * frame.bitrate / frame.sampleRate + padding) * 4;
+			}
+			else
+			{
+				frame.samplesPerFrame = frame.layer == 3 && frame.version != 1 ? 576 : 1152;
+				frame.length = frame.samplesPerFrame / 8 * frame.bitrate / frame.sampleRate + padding;
+			}
+			return frame;
+		}
+
+		bool matches(const MpegFrame& other) const
+		{
+			return version == other.version && layer == other.layer && sampleRate == other.sampleRate;
+		}
+	};
+
+private:
+	/// Finds the first frame at or after |offset| that is followed by another
+	/// matching frame, which rules out false syncs in leftover tag data.
+	std::optional<std::pair<size_t, MpegFrame>> findMpegSync(size_t offset, size_t limit)
+	{
+		auto end = std::min(size, offset + limit);
+		for (auto position = offset; position + 4 <= end; position++)
+		{
+			if (data[position] != 0xFF)
+			{
+				continue;
+			}
+			auto frame = MpegFrame::parse(data + position);
+			if (!frame)
+			{
+				continue;
+			}
+			auto next = position + frame->length;
+			if (next + 4 > size)
+			{
+				// A single frame at the end of the file.
+				return std::make_pair(position, *frame);
+			}
+			auto nextFrame = MpegFrame::parse(data + next);
+			if (nextFrame && nextFrame->matches(*frame))
+			{
+				return std::make_pair(position, *frame);
+			}
+		}
+		return std::nullopt;
+	}
+
+	/**
+	 * Reads the stream properties of MPEG audio starting at |offset|. The
+	 * duration comes from the Xing/Info or VBRI frame count, minus the encoder
+	 * delay and padding of a LAME tag, or else from counting every frame.
+	 */
+	bool parseMpeg(size_t offset)
+	{
+		// Only sync within the first bytes, so that arbitrary files are rejected.
+		auto sync = findMpegSync(offset, 64 * 1024);
+		if (!sync)
+		{
+			return false;
+		}
+		auto [position, first] = *sync;
+
+		metadata.format = "mp3";
+		metadata.sampleRate = (int32_t)first.sampleRate;
+		metadata.channels = first.channels;
+
+		auto audioStart = position;
+		auto audioEnd = size;
+		if (audioEnd >= audioStart + 128 && std::memcmp(data + audioEnd - 128, "TAG", 3) == 0)
+		{
+			audioEnd -= 128;
+		}
+
+		uint64_t frameCount = 0;
+		uint32_t delay = 0;
+		uint32_t padding = 0;
+		bool headerFrame = false;
+
+		auto frameEnd = std::min<size_t>(size, position + first.length);
+		size_t sideInfo = first.version == 1 ? (first.channels == 1 ? 17 : 32) : (first.channels == 1 ? 9 : 17);
+		auto xing = position + 4 + sideInfo;
+		auto vbri = position + 4 + 32;
+		if (xing + 8 <= frameEnd && (std::memcmp(data + xing, "Xing", 4) == 0 || std::memcmp(data + xing, "Info", 4) == 0))
+		{
+			headerFrame = true;
+			auto flags = be32(data + xing + 4);
+			auto field = xing + 8;
+			if ((flags & 1) && field + 4 <= frameEnd)
+			{
+				frameCount = be32(data + field);
+			}
+			field += (flags & 1 ? 4 : 0) + (flags & 2 ? 4 : 0) + (flags & 4 ? 100 : 0) + (flags & 8 ? 4 : 0);
+
+			// The LAME tag follows with the encoder delay and padding.
+			if (field + 24 <= frameEnd &&
+				(std::memcmp(data + field, "LAME", 4) == 0 || std::memcmp(data + field, "Lavf", 4) == 0 || std::memcmp(data + field, "Lavc", 4) == 0))
+			{
+				delay = be24(data + field + 21) >> 12;
+				padding = be24(data + field + 21) & 0xFFF;
+				metadata.encoderDelay = (int32_t)delay;
+				metadata.encoderPadding = (int32_t)padding;
+			}
+		}
+		else if (vbri + 18 <= frameEnd && std::memcmp(data + vbri, "VBRI", 4) == 0)
+		{
+			headerFrame = true;
+			frameCount = be32(data + vbri + 14);
+		}
+
+		if (headerFrame)
+		{
+			// The header frame is silent and not part of the stream.
+			audioStart += first.length;
+		}
+
+		if (frameCount == 0)
+		{
+			frameCount = countMpegFrames(audioStart, audioEnd, first);
+		}
+
+		uint64_t samples = frameCount * first.samplesPerFrame;
+		samples = samples > delay + padding ? samples - delay - padding : 0;
+		if (samples > 0)
+		{
+			metadata.durationUs = samplesToUs(samples, first.sampleRate);
+			metadata.bitrate = (int32_t)((audioEnd - std::min(audioStart, audioEnd)) * 8 * 1000000 / std::max<int64_t>(*metadata.durationUs, 1));
+		}
+		return true;
+	}
+
+	/// Walks every frame, resynchronizing after damaged ones.
+	uint64_t countMpegFrames(size_t position, size_t end, const MpegFrame& first)
+	{
+		uint64_t count = 0;
+		while (position + 4 <= end)
+		{
+			auto frame = MpegFrame::parse(data + position);
+			if (frame && frame->matches(first) && position + frame->length <= end)
+			{
+				count++;
+				position += frame->length;
+				continue;
+			}
+			if (std::memcmp(data + position, "TAG", 3) == 0 || (position + 8 <= end && std::memcmp(data + position, "APETAGEX", 8) == 0))
+			{
+				break;
+			}
+			auto sync = findMpegSync(position + 1, end - position - 1);
+			if (!sync || !sync->second.matches(first))
+			{
+				break;
+			}
+			position = sync->first;
+		}
+		return count;
+	}
+
+	/// Reads a FLAC stream starting at |stream|, which begins with "fLaC".
+	bool parseFlac(const uint8_t* stream, size_t length)
+	{
+		metadata.format = "flac";
+		size_t position = 4;
+		bool last = false;
+		while (!last && position + 4 <= length)
+		{
+			auto header = stream[position];
+			last = header & 0x80;
+			auto type = header & 0x7F;
+			size_t blockSize = be24(stream + position + 1);
+			position += 4;
+			if (blockSize > length - position)
+			{
+				break;
+			}
+			auto* block = stream + position;
+			position += blockSize;
+
+			if (type == 0 && blockSize >= 18)
+			{
+				auto* info = block + 10;
+				uint32_t sampleRate = (uint32_t)info[0] << 12 | (uint32_t)info[1] << 4 | info[2] >> 4;
+				uint64_t totalSamples = (uint64_t)(info[3] & 0x0F) << 32 | be32(info + 4);
+				metadata.sampleRate = (int32_t)sampleRate;
+				metadata.channels = ((info[2] >> 1) & 7) + 1;
+				if (sampleRate > 0 && totalSamples > 0)
+				{
+					metadata.durationUs = samplesToUs(totalSamples, sampleRate);
+					metadata.bitrate = (int32_t)(length * 8 * 1000000 / std::max<int64_t>(*metadata.durationUs, 1));
+				}
+			}
+			else if (type == 4)
+			{
+				parseVorbisComments(block, blockSize);
+			}
+			else if (type == 6)
+			{
+				parseFlacPicture(block, blockSize);
+			}
+		}
+		return true;
+	}
+
+	/// Reads a FLAC PICTURE block, which Vorbis comments also carry in base64.
+	void parseFlacPicture(const uint8_t* block, size_t length)
+	{
+		if (!includeArtwork || length < 32)
+		{
+			return;
+		}
+		auto pictureType = be32(block);
+		size_t position = 4;
+		size_t mimeLength = be32(block + position);
+		position += 4;
+		if (mimeLength > length - position)
+		{
+			return;
+		}
+		std::string mimeType((const char*)block + position, mimeLength);
+		position += mimeLength;
+		if (position + 4 > length)
+		{
+			return;
+		}
+		size_t descriptionLength = be32(block + position);
+		position += 4;
+		if (descriptionLength > length - position || length - position - descriptionLength < 20)
+		{
+			return;
+		}
+		// Skips the description, width, height, depth and color count.
+		position += descriptionLength + 16;
+		size_t dataLength = be32(block + position);
+		position += 4;
+		if (dataLength > length - position)
+		{
+			return;
+		}
+		setArtwork(imageMimeType(mimeType, block + position, dataLength), block + position, dataLength, pictureType == 3);
+	}
+
+	/// Reads a Vorbis comment header: a vendor string followed by KEY=value
+	/// entries, all with little-endian lengths.
+	void parseVorbisComments(const uint8_t* block, size_t length)
+	{
+		if (length < 8)
+		{
+			return;
+		}
+		size_t position = 0;
+		size_t vendorLength = le32(block);
+		position += 4;
+		if (vendorLength > length - position || length - position - vendorLength < 4)
+		{
+			return;
+		}
+		position += vendorLength;
+		auto count = le32(block + position);
+		position += 4;
+
+		for (uint32_t i = 0; i < count && position + 4 <= length; i++)
+		{
+			size_t entryLength = le32(block + position);
+			position += 4;
+			if (entryLength > length - position)
+			{
+				break;
+			}
+			auto* entry = block + position;
+			position += entryLength;
+
+			auto separator = std::find(entry, entry + entryLength, '=');
+			if (separator == entry + entryLength)
+			{
+				continue;
+			}
+			std::string key((const char*)entry, separator - entry);
+			std::transform(key.begin(), key.end(), key.begin(), [](char c)
+				{ return (char)std::toupper((unsigned char)c); });
+			auto* value = separator + 1;
+			size_t valueLength = entry + entryLength - value;
+
+			if (key == "METADATA_BLOCK_PICTURE")
+			{
+				if (includeArtwork)
+				{
+					auto picture = decodeBase64(value, valueLength);
+					parseFlacPicture(picture.data(), picture.size());
+				}
+				continue;
+			}
+
+			auto text = nonEmpty(std::string((const char*)value, valueLength));
+			if (!text)
+			{
+				continue;
+			}
+			if (key == "TITLE")
+			{
+				setIfEmpty(metadata.title, text);
+			}
+			else if (key == "ARTIST")
+			{
+				setIfEmpty(metadata.artist, text);
+			}
+			else if (key == "ALBUM")
+			{
+				setIfEmpty(metadata.album, text);
+			}
+			else if (key == "ALBUMARTIST" || key == "ALBUM ARTIST")
+			{
+				setIfEmpty(metadata.albumArtist, text);
+			}
+			else if (key == "GENRE")
+			{
+				setIfEmpty(metadata.genre, text);
+			}
+			else if (key == "DATE" || key == "YEAR")
+			{
+				setIfEmpty(metadata.date, text);
+			}
+			else if (key == "TRACKNUMBER")
+			{
+				setIfEmpty(metadata.trackNumber, parseNumber(*text));
+			}
+			else if (key == "DISCNUMBER")
+			{
+				setIfEmpty(metadata.discNumber, parseNumber(*text));
+			}
+		}
+	}
+
+	static std::vector<uint8_t> decodeBase64(const uint8_t* p, size_t length)
+	{
+		std::vector<uint8_t> out{};
+		out.reserve(length / 4 * 3);
+		uint32_t accumulator = 0;
+		int bits = 0;
+		for (size_t i = 0; i < length; i++)
+		{
+			auto c = p[i];
+			int value = c >= 'A' && c <= 'Z' ? c - 'A'
+				: c >= 'a' && c <= 'z' ? c - 'a' + 26
+				: c >= '0' && c <= '9' ? c - '0' + 52
+				: c == '+' ? 62
+				: c == '/' ? 63
+				: -1;
+			if (value < 0)
+			{
+				continue;
+			}
+			accumulator = accumulator << 6 | (uint32_t)value;
+			bits += 6;
+			if (bits >= 8)
+			{
+				bits -= 8;
+				out.push_back((uint8_t)(accumulator >> bits));
+			}
+		}
+		return out;
+	}
+
+	/**
+	 * Reads an Ogg Vorbis or Opus stream. The headers are the first packets of
+	 * the first logical stream; the duration is the granule position of its
+	 * last page.
+	 */
+	bool parseOgg(const uint8_t* stream, size_t length)
+	{
+		uint32_t serial = 0;
+		std::vector<std::vector<uint8_t>> packets(1);
+		size_t position = 0;
+		bool first = true;
+
+		// Reassembles the identification and comment packets, which may span
+		// several pages when the comments hold artwork.
+		while (packets.size() <= 2 && position + 27 <= length && std::memcmp(stream + position, "OggS", 4) == 0)
+		{
+			auto* page = stream + position;
+			size_t segmentCount = page[26];
+			if (position + 27 + segmentCount > length)
+			{
+				break;
+			}
+			auto pageSerial = le32(page + 14);
+			if (first)
+			{
+				serial = pageSerial;
+				first = false;
+			}
+
+			auto* payload = page + 27 + segmentCount;
+			size_t payloadSize = 0;
+			for (size_t i = 0; i < segmentCount; i++)
+			{
+				payloadSize += page[27 + i];
+			}
+			if (payload + payloadSize > stream + length)
+			{
+				break;
+			}
+
+			if (pageSerial == serial)
+			{
+				size_t offset = 0;
+				for (size_t i = 0; i < segmentCount && packets.size() <= 2; i++)
+				{
+					auto segment = page[27 + i];
+					// Comment packets with artwork can be huge; the rest is skipped
+					// unless artwork was asked for.
+					if (includeArtwork || packets.size() < 2 || packets.back().size() < 64 * 1024)
+					{
+						packets.back().insert(packets.back().end(), payload + offset, payload + offset + segment);
+					}
+					offset += segment;
+					if (segment < 255)
+					{
+						packets.emplace_back();
+					}
+				}
+			}
+			position += 27 + segmentCount + payloadSize;
+		}
+
+		if (packets.size() < 2)
+		{
+			return false;
+		}
+
+		auto& identification = packets[0];
+		auto& comments = packets[1];
+		uint64_t preSkip = 0;
+		uint32_t sampleRate = 0;
+		if (identification.size() >= 16 && std::memcmp(identification.data(), "\x01vorbis", 7) == 0)
+		{
+			metadata.format = "vorbis";
+			metadata.channels = identification[11];
+			sampleRate = le32(identification.data() + 12);
+			if (comments.size() > 7 && std::memcmp(comments.data(), "\x03vorbis", 7) == 0)
+			{
+				parseVorbisComments(comments.data() + 7, comments.size() - 7);
+			}
+		}
+		else if (identification.size() >= 19 && std::memcmp(identification.data(), "OpusHead", 8) == 0)
+		{
+			metadata.format = "opus";
+			metadata.channels = identification[9];
+			preSkip = le16(identification.data() + 10);
+			// Opus always decodes at 48kHz; the input rate is informational.
+			sampleRate = 48000;
+			if (comments.size() > 8 && std::memcmp(comments.data(), "OpusTags", 8) == 0)
+			{
+				parseVorbisComments(comments.data() + 8, comments.size() - 8);
+			}
+		}
+		else
+		{
+			return false;
+		}
+		metadata.sampleRate = (int32_t)sampleRate;
+
+		auto granule = lastGranulePosition(stream, length, serial);
+		if (granule && sampleRate > 0 && *granule > preSkip)
+		{
+			metadata.durationUs = samplesToUs(*granule - preSkip, sampleRate);
+			metadata.bitrate = (int32_t)(length * 8 * 1000000 / std::max<int64_t>(*metadata.durationUs, 1));
+		}
+		return true;
+	}
+
+	/// Searches backwards for the last page of |serial| with a granule position.
+	static std::optional<uint64_t> lastGranulePosition(const uint8_t* stream, size_t length, uint32_t serial)
+	{
+		if (length < 27)
+		{
+			return std::nullopt;
+		}
+		for (size_t position = length - 27 + 1; position-- > 0;)
+		{
+			if (stream[position] != 'O' || std::memcmp(stream + position, "OggS", 4) != 0)
+			{
+				continue;
+			}
+			auto granule = le64(stream + position + 6);
+			if (le32(stream + position + 14) == serial && granule != UINT64_MAX)
+			{
+				return granule;
+			}
+		}
+		return std::nullopt;
+	}
+
+	/// Reads the "fmt ", "data" and "LIST"/"INFO" chunks of a WAV file.
+	bool parseWav(const uint8_t* stream, size_t length)
+	{
+		metadata.format = "wav";
+		uint32_t blockAlign = 0;
+		uint32_t sampleRate = 0;
+		uint32_t byteRate = 0;
+		std::optional<uint64_t> dataSize{};
+
+		size_t position = 12;
+		while (position + 8 <= length)
+		{
+			auto* chunk = stream + position;
+			size_t chunkSize = le32(chunk + 4);
+			auto* body = chunk + 8;
+			// The data chunk of a file that is still being written may claim more.
+			auto available = std::min<size_t>(chunkSize, length - position - 8);
+
+			if (std::memcmp(chunk, "fmt ", 4) == 0 && available >= 16)
+			{
+				metadata.channels = (int32_t)le16(body + 2);
+				sampleRate = le32(body + 4);
+				byteRate = le32(body + 8);
+				blockAlign = le16(body + 12);
+				metadata.sampleRate = (int32_t)sampleRate;
+				metadata.bitrate = (int32_t)std::min<uint64_t>((uint64_t)byteRate * 8, INT32_MAX);
+			}
+			else if (std::memcmp(chunk, "data", 4) == 0)
+			{
+				dataSize = available;
+			}
+			else if (std::memcmp(chunk, "LIST", 4) == 0 && available >= 4 && std::memcmp(body, "INFO", 4) == 0)
+			{
+				parseRiffInfo(body + 4, available - 4);
+			}
+			else if ((std::memcmp(chunk, "id3 ", 4) == 0 || std::memcmp(chunk, "ID3 ", 4) == 0) && available >= 10 &&
+				std::memcmp(body, "ID3", 3) == 0)
+			{
+				parseId3v2(body, available);
+			}
+
+			// Chunks are padded to an even size.
+			position += 8 + chunkSize + (chunkSize & 1);
+		}
+
+		if (dataSize && blockAlign > 0 && sampleRate > 0)
+		{
+			metadata.durationUs = samplesToUs(*dataSize / blockAlign, sampleRate);
+		}
+		return true;
+	}
+
+	void parseRiffInfo(const uint8_t* list, size_t length)
+	{
+		size_t position = 0;
+		while (position + 8 <= length)
+		{
+			auto* chunk = list + position;
+			size_t chunkSize = le32(chunk + 4);
+			if (chunkSize > length - position - 8)
+			{
+				break;
+			}
+			auto text = nonEmpty(latin1ToUtf8(chunk + 8, chunkSize));
+			if (std::memcmp(chunk, "INAM", 4) == 0)
+			{
+				setIfEmpty(metadata.title, text);
+			}
+			else if (std::memcmp(chunk, "IART", 4) == 0)
+			{
+				setIfEmpty(metadata.artist, text);
+			}
+			else if (std::memcmp(chunk, "IPRD", 4) == 0)
+			{
+				setIfEmpty(metadata.album, text);
+			}
+			else if (std::memcmp(chunk, "IGNR", 4) == 0)
+			{
+				setIfEmpty(metadata.genre, text);
+			}
+			else if (std::memcmp(chunk, "ICRD", 4) == 0)
+			{
+				setIfEmpty(metadata.date, text);
+			}
+			else if (std::memcmp(chunk, "ITRK", 4) == 0 && text)
+			{
+				setIfEmpty(metadata.trackNumber, parseNumber(*text));
+			}
+			position += 8 + chunkSize + (chunkSize & 1);
+		}
+	}
+
+	// An MP4 box within a parent's payload.
+	struct Mp4Box
+	{
+		const uint8_t* payload;
+		size_t payloadSize;
+		char type[4];
+	};
+
+	/// Calls |visit| for each box in |payload|, stopping if it returns false.
+	template <typename Visit>
+	static void forEachBox(const uint8_t* payload, size_t length, Visit visit)
+	{
+		size_t position = 0;
+		while (position + 8 <= length)
+		{
+			auto* box = payload + position;
+			uint64_t boxSize = be32(box);
+			size_t headerSize = 8;
+			if (boxSize == 1)
+			{
+				if (position + 16 > length)
+				{
+					return;
+				}
+				boxSize = be64(box + 8);
+				headerSize = 16;
+			}
+			else if (boxSize == 0)
+			{
+				boxSize = length - position;
+			}
+			if (boxSize < headerSize || boxSize > length - position)
+			{
+				return;
+			}
+
+			Mp4Box child{ box + headerSize, (size_t)boxSize - headerSize, {} };
+			std::memcpy(child.type, box + 4, 4);
+			if (!visit(child))
+			{
+				return;
+			}
+			position += (size_t)boxSize;
+		}
+	}
+
+	static std::optional<Mp4Box> findBox(const uint8_t* payload, size_t length, const char* type)
+	{
+		std::optional<Mp4Box> found{};
+		forEachBox(payload, length, [&](const Mp4Box& box)
+			{
+				if (std::memcmp(box.type, type, 4) == 0)
+				{
+					found = box;
+					return false;
+				}
+				return true; });
+		return found;
+	}
+
+	/// Reads an MP4/M4A file. The duration comes from the media header of the
+	/// sound track, whose timescale is the sample rate.
+	bool parseMp4(const uint8_t* stream, size_t length)
+	{
+		auto moov = findBox(stream, length, "moov");
+		if (!moov)
+		{
+			return false;
+		}
+		metadata.format = "mp4";
+
+		// The timescale and duration of the movie header, zero without one.
+		std::pair<uint32_t, uint64_t> movieDuration{};
+		forEachBox(moov->payload, moov->payloadSize, [&](const Mp4Box& box)
+			{
+				if (std::memcmp(box.type, "mvhd", 4) == 0)
+				{
+					movieDuration = parseMediaHeader(box).value_or(movieDuration);
+				}
+				else if (std::memcmp(box.type, "trak", 4) == 0 && !metadata.durationUs)
+				{
+					parseMp4Track(box);
+				}
+				else if (std::memcmp(box.type, "udta", 4) == 0)
+				{
+					if (auto meta = findBox(box.payload, box.payloadSize, "meta"))
+					{
+						parseMp4Meta(*meta);
+					}
+				}
+				else if (std::memcmp(box.type, "meta", 4) == 0)
+				{
+					parseMp4Meta(box);
+				}
+				return true; });
+
+		if (!metadata.durationUs && movieDuration.first > 0)
+		{
+			metadata.durationUs = samplesToUs(movieDuration.second, movieDuration.first);
+		}
+		if (metadata.durationUs && *metadata.durationUs > 0)
+		{
+			metadata.bitrate = (int32_t)(length * 8 * 1000000 / *metadata.durationUs);
+		}
+		return true;
+	}
+
+	/// Returns the timescale and duration of an "mvhd" or "mdhd" box.
+	static std::optional<std::pair<uint32_t, uint64_t>> parseMediaHeader(const Mp4Box& box)
+	{
+		if (box.payloadSize < 4)
+		{
+			return std::nullopt;
+		}
+		if (box.payload[0] == 1)
+		{
+			if (box.payloadSize < 32)
+			{
+				return std::nullopt;
+			}
+			return std::make_pair(be32(box.payload + 20), be64(box.payload + 24));
+		}
+		if (box.payloadSize < 20)
+		{
+			return std::nullopt;
+		}
+		return std::make_pair(be32(box.payload + 12), (uint64_t)be32(box.payload + 16));
+	}
+
+	void parseMp4Track(const Mp4Box& trak)
+	{
+		auto mdia = findBox(trak.payload, trak.payloadSize, "mdia");
+		if (!mdia)
+		{
+			return;
+		}
+		auto hdlr = findBox(mdia->payload, mdia->payloadSize, "hdlr");
+		if (!hdlr || hdlr->payloadSize < 12 || std::memcmp(hdlr->payload + 8, "soun", 4) != 0)
+		{
+			return;
+		}
+
+		if (auto mdhd = findBox(mdia->payload, mdia->payloadSize, "mdhd"))
+		{
+			auto header = parseMediaHeader(*mdhd);
+			if (header && header->first > 0)
+			{
+				metadata.durationUs = samplesToUs(header->second, header->first);
+			}
+		}
+
+		// minf/stbl/stsd holds the channel count and sample rate of the first
+		// sample entry.
+		auto minf = findBox(mdia->payload, mdia->payloadSize, "minf");
+		auto stbl = minf ? findBox(minf->payload, minf->payloadSize, "stbl") : std::nullopt;
+		auto stsd = stbl ? findBox(stbl->payload, stbl->payloadSize, "stsd") : std::nullopt;
+		if (stsd && stsd->payloadSize >= 8 + 8 + 28)
+		{
+			auto* entry = stsd->payload + 8 + 8;
+			metadata.channels = (int32_t)be16(entry + 16);
+			metadata.sampleRate = (int32_t)(be32(entry + 24) >> 16);
+		}
+	}
+
+	void parseMp4Meta(const Mp4Box& meta)
+	{
+		// "meta" is a full box in MP4 but not in QuickTime files.
+		auto* payload = meta.payload;
+		auto payloadSize = meta.payloadSize;
+		if (payloadSize >= 12 && be32(payload) == 0 && std::memcmp(payload + 8, "hdlr", 4) == 0)
+		{
+			payload += 4;
+			payloadSize -= 4;
+		}
+		auto ilst = findBox(payload, payloadSize, "ilst");
+		if (!ilst)
+		{
+			return;
+		}
+
+		forEachBox(ilst->payload, ilst->payloadSize, [&](const Mp4Box& item)
+			{
+				if (std::memcmp(item.type, "----", 4) == 0)
+				{
+					parseMp4FreeformItem(item);
+					return true;
+				}
+				forEachBox(item.payload, item.payloadSize, [&](const Mp4Box& dataBox)
+					{
+						if (std::memcmp(dataBox.type, "data", 4) == 0 && dataBox.payloadSize >= 8)
+						{
+							parseMp4Item(item.type, be32(dataBox.payload) & 0xFFFFFF, dataBox.payload + 8, dataBox.payloadSize - 8);
+							return false;
+						}
+						return true; });
+				return true; });
+	}
+
+	/// Reads the "----" items named by a reverse domain, of which only the
+	/// iTunSMPB gapless info is of use.
+	void parseMp4FreeformItem(const Mp4Box& item)
+	{
+		auto name = findBox(item.payload, item.payloadSize, "name");
+		auto value = findBox(item.payload, item.payloadSize, "data");
+		if (name && name->payloadSize >= 4 && value && value->payloadSize >= 8 &&
+			std::string((const char*)name->payload + 4, name->payloadSize - 4) == "iTunSMPB")
+		{
+			parseItunSmpb(std::string((const char*)value->payload + 8, value->payloadSize - 8), 0);
+		}
+	}
+
+	/**
+	 * Reads the encoder delay and padding of iTunSMPB, hexadecimal fields of
+	 * which the second and third are the frames a decoder outputs before and
+	 * after the audio. For MP3 files these include the decoder's own delay,
+	 * |decoderDelay|, which is taken off as the LAME tag does.
+	 */
+	void parseItunSmpb(const std::string& value, int32_t decoderDelay)
+	{
+		int64_t fields[3] = {};
+		size_t i = 0;
+		for (auto& field : fields)
+		{
+			while (i < value.size() && value[i] == ' ')
+			{
+				i++;
+			}
+			auto start = i;
+			while (i < value.size() && std::isxdigit((unsigned char)value[i]) && i - start < 16)
+			{
+				auto digit = (char)std::tolower((unsigned char)value[i]);
+				field = field * 16 + (digit <= '9' ? digit - '0' : digit - 'a' + 10);
+				i++;
+			}
+			if (i == start)
+			{
+				return;
+			}
+		}
+		metadata.encoderDelay = (int32_t)std::clamp<int64_t>(fields[1] - decoderDelay, 0, 0xFFFFFF);
+		metadata.encoderPadding = (int32_t)std::clamp<int64_t>(fields[2] + decoderDelay, 0, 0xFFFFFF);
+	}
+
+	void parseMp4Item(const char* type, uint32_t dataType, const uint8_t* value, size_t length)
+	{
+		auto is = [&](const char* name)
+		{ return std::memcmp(type, name, 4) == 0; };
+		auto text = [&]()
+		{ return nonEmpty(std::string((const char*)value, length)); };
+
+		if (is("\xA9nam"))
+		{
+			setIfEmpty(metadata.title, text());
+		}
+		else if (is("\xA9" "ART"))
+		{
+			setIfEmpty(metadata.artist, text());
+		}
+		else if (is("\xA9" "alb"))
+		{
+			setIfEmpty(metadata.album, text());
+		}
+		else if (is("aART"))
+		{
+			setIfEmpty(metadata.albumArtist, text());
+		}
+		else if (is("\xA9gen"))
+		{
+			setIfEmpty(metadata.genre, text());
+		}
+		else if (is("gnre") && length >= 2 && be16(value) > 0)
+		{
+			// ID3v1 genre numbers, counted from one.
+			setIfEmpty(metadata.genre, std::optional<std::string>(resolveGenre(std::to_string(be16(value) - 1))));
+		}
+		else if (is("\xA9" "day"))
+		{
+			setIfEmpty(metadata.date, text());
+		}
+		else if (is("trkn") && length >= 4)
+		{
+			setIfEmpty(metadata.trackNumber, std::optional<int32_t>((int32_t)be16(value + 2)));
+		}
+		else if (is("disk") && length >= 4)
+		{
+			setIfEmpty(metadata.discNumber, std::optional<int32_t>((int32_t)be16(value + 2)));
+		}
+		else if (is("covr"))
+		{
+			auto mimeType = dataType == 14 ? "image/png" : dataType == 13 ? "image/jpeg" : "";
+			setArtwork(imageMimeType(mimeType, value, length), value, length, true);
+		}
+	}
+
+	const uint8_t* data;
+	size_t size;
+	bool includeArtwork;
+	bool artworkIsFrontCover = false;
+	TrackMetadata metadata{};
+};
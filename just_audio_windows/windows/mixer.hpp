@@ -0,0 +1,845 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <thread>
+#include <vector>
+
+#if defined(_M_X64) || defined(__SSE__)
+#include <xmmintrin.h>
+#define JUST_AUDIO_SSE 1
+#elif defined(_M_ARM64) || defined(__ARM_NEON)
+#include <arm_neon.h>
+#define JUST_AUDIO_NEON 1
+#endif
+
+#include "allocation_guard.hpp"
+#include "audio_decoder.hpp"
+#include "audio_sink.hpp"
+#include "sample_kernels.hpp"
+#include "spsc_ring.hpp"
+
+// Something the mixer pulls audio from, in the mixer's format.
+class MixerInput
+{
+public:
+	virtual ~MixerInput() = default;
+
+	/// Fills |output| with |frames| frames, silence included, returning how
+	/// many were audio. Called from the mixer thread.
+	virtual size_t render(float* output, size_t frames) = 0;
+	/// Whether |frames| frames can be rendered without underrunning. Asked
+	/// when the sink is not real-time, so that rendering waits for decoding,
+	/// and of the voices of a group on any sink. Called from the mixer thread.
+	virtual bool isReady(size_t frames)
+	{
+		return true;
+	}
+	/// Called when a voice with a higher priority took this input's place.
+	/// The input is no longer rendered.
+	virtual void onStolen() {}
+};
+
+// How one voice is mixed.
+struct VoiceSettings
+{
+	float gain = 1.0f;
+	// -1 is left, 1 is right.
+	float pan = 0.0f;
+	// When all voices are taken, a new voice replaces the lowest priority one,
+	// if that is lower than its own.
+	int32_t priority = 0;
+	// Voices of the same group, other than 0, are rendered together or not at
+	// all: while one of them is not ready, the others wait with it, so that
+	// they keep in step. See Mixer::createGroup().
+	uint64_t group = 0;
+};
+
+struct MixerStatistics
+{
+	size_t voices;
+	size_t maxVoices;
+	uint64_t stolenVoices;
+	uint64_t rejectedVoices;
+	uint64_t blocks;
+	// Blocks a group was not rendered in because one of its voices was not
+	// ready.
+	uint64_t groupStalls;
+	// The share of real time spent mixing, from 0 to 1.
+	double load;
+};
+
+// Mixes any number of inputs into one output stream, so that players share a
+// single device stream instead of opening one each.
+//
+// The mixer thread takes no lock. Changes to the voices are queued on a ring
+// of commands that it applies before each block, into storage reserved up
+// front; the control side keeps its own record of the voices for choosing
+// which to steal. Calls that promise an input is no longer rendered wait for
+// the block being mixed, if any, to end.
+class Mixer
+{
+public:
+	static constexpr size_t kDefaultMaxVoices = 64;
+	static constexpr size_t kDefaultBlockFrames = 480;
+	// The quietest gain an exponential ramp starts from or ends at, -80dB.
+	static constexpr float kRampFloor = 0.0001f;
+	// The start frame of a voice that is not rendered until it is started.
+	static constexpr uint64_t kHeld = UINT64_MAX;
+	// Changes to the voices queued and not applied yet before the control
+	// side waits for room.
+	static constexpr size_t kCommandCapacity = 1024;
+
+	/// Mixes into |sink| on a thread of its own. Without a sink, mix() is left
+	/// to the caller, who must keep calling it for changes to the voices to
+	/// take effect. Room for |maxVoices| voices, and at least the default, is
+	/// reserved here.
+	Mixer(AudioFormat format, std::shared_ptr<AudioSink> sink, size_t maxVoices = kDefaultMaxVoices, size_t blockFrames = kDefaultBlockFrames)
+		: format(format), sink(sink), maxVoices(std::max<size_t>(maxVoices, 1)),
+		voiceCapacity(std::max(maxVoices, kDefaultMaxVoices)), blockFrames(blockFrames),
+		scratch(blockFrames * format.channels), output(blockFrames * format.channels), commands(kCommandCapacity)
+	{
+		voices.reserve(voiceCapacity);
+		controlVoices.reserve(voiceCapacity);
+		if (sink)
+		{
+			thread = std::thread([this]()
+				{ run(); });
+		}
+	}
+
+	~Mixer()
+	{
+		close();
+	}
+
+	// Prevent copying.
+	Mixer(Mixer const&) = delete;
+	Mixer& operator=(Mixer const&) = delete;
+
+	AudioFormat getFormat() const
+	{
+		return format;
+	}
+
+	/// How long after rendering a block voices are heard to its end: on a
+	/// real-time sink, the block waits for room, then plays after what the
+	/// sink holds. Read without locking.
+	uint64_t getLatencyFrames() const
+	{
+		if (!sink)
+		{
+			return 0;
+		}
+		return sink->getLatencyFrames() + (sink->isRealtime() ? blockFrames : 0);
+	}
+
+	/// The output frame the next block starts at, counting every frame mixed.
+	/// Read without locking, also from render().
+	uint64_t getFramePosition() const
+	{
+		return framePosition.load(std::memory_order_acquire);
+	}
+
+	/**
+	 * The output frame heard at |hostTimeUs| on the steady clock, from when
+	 * the last block was mixed and the latency behind it, and no earlier than
+	 * the next block. A sink that is not real-time has no time of its own, so
+	 * the next block is taken to be heard now: |nowUs|, or the steady clock's
+	 * time if not given.
+	 */
+	uint64_t frameAtHostTime(int64_t hostTimeUs, std::optional<int64_t> nowUs = std::nullopt)
+	{
+		uint64_t anchorFrame;
+		int64_t anchorUs;
+		uint64_t sequence;
+		while (true)
+		{
+			// A seqlock: odd while the mixer thread writes the anchor.
+			sequence = anchorSequence.load(std::memory_order_acquire);
+			anchorFrame = mixedFrame.load(std::memory_order_relaxed);
+			anchorUs = mixedAtUs.load(std::memory_order_relaxed);
+			std::atomic_thread_fence(std::memory_order_acquire);
+			if (sequence % 2 == 0 && anchorSequence.load(std::memory_order_relaxed) == sequence)
+			{
+				break;
+			}
+			std::this_thread::yield();
+		}
+		auto next = framePosition.load(std::memory_order_acquire);
+		auto heardUs = nowUs ? *nowUs : std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+		if (sink && sink->isRealtime() && sequence > 0)
+		{
+			heardUs = anchorUs + (int64_t)(getLatencyFrames() * 1000000 / format.sampleRate);
+		}
+		else
+		{
+			anchorFrame = next;
+		}
+		auto offset = (double)(hostTimeUs - heardUs) * format.sampleRate / 1000000;
+		auto frame = (int64_t)anchorFrame + (int64_t)std::llround(offset);
+		return (uint64_t)std::max<int64_t>(frame, (int64_t)next);
+	}
+
+	/// Returns a group id for VoiceSettings::group that no other group of
+	/// this mixer has.
+	uint64_t createGroup()
+	{
+		std::lock_guard<std::mutex> lock(controlMutex);
+		return nextGroup++;
+	}
+
+	/**
+	 * Starts mixing |input| at the output frame |startFrame|, counted like
+	 * getFramePosition(), returning the id of its voice. A voice starting in
+	 * the middle of a block is rendered from there, and one added with kHeld
+	 * waits for startGroup(). When every voice is taken, the voice with the
+	 * lowest priority (the oldest among equals) is stolen if its priority is
+	 * lower than |settings.priority|; otherwise 0 is returned and |input| is
+	 * not mixed.
+	 */
+	uint64_t addVoice(MixerInput* input, VoiceSettings settings, uint64_t startFrame = 0)
+	{
+		MixerInput* stolen = nullptr;
+		uint64_t id = 0;
+		{
+			std::lock_guard<std::mutex> lock(controlMutex);
+			if (controlVoices.size() >= maxVoices)
+			{
+				auto victim = std::min_element(controlVoices.begin(), controlVoices.end(), [](const ControlVoice& a, const ControlVoice& b)
+					{ return a.priority < b.priority || (a.priority == b.priority && a.id < b.id); });
+				if (victim == controlVoices.end() || victim->priority >= settings.priority)
+				{
+					rejectedVoices++;
+					return 0;
+				}
+				stolen = victim->input;
+				push(Command{ Command::Type::remove, victim->id });
+				controlVoices.erase(victim);
+				stolenVoices++;
+			}
+			id = nextId++;
+			controlVoices.push_back(ControlVoice{ id, input, settings.priority });
+			push(Command{ Command::Type::add, id, input, settings, VolumeRamp{}, startFrame });
+			if (stolen)
+			{
+				waitForBlock();
+			}
+		}
+		if (stolen)
+		{
+			stolen->onStolen();
+		}
+		return id;
+	}
+
+	/// Stops mixing the voice. Its input is not rendered once this returns.
+	void removeVoice(uint64_t id)
+	{
+		std::lock_guard<std::mutex> lock(controlMutex);
+		controlVoices.erase(std::remove_if(controlVoices.begin(), controlVoices.end(), [&](const ControlVoice& voice)
+			{ return voice.id == id; }), controlVoices.end());
+		push(Command{ Command::Type::remove, id });
+		waitForBlock();
+	}
+
+	/// Changes the settings of the voice. A new gain is reached over |ramp|,
+	/// starting from the gain currently heard.
+	void setVoiceSettings(uint64_t id, VoiceSettings settings, VolumeRamp ramp = VolumeRamp{})
+	{
+		std::lock_guard<std::mutex> lock(controlMutex);
+		for (auto& voice : controlVoices)
+		{
+			if (voice.id == id)
+			{
+				voice.priority = settings.priority;
+			}
+		}
+		push(Command{ Command::Type::settings, id, nullptr, settings, ramp });
+	}
+
+	/**
+	 * Starts the held voices of |group| at the output frame |startFrame|, or
+	 * with the next block if that has been mixed, all at the same frame.
+	 * Returns the frame they start at.
+	 */
+	uint64_t startGroup(uint64_t group, uint64_t startFrame)
+	{
+		std::lock_guard<std::mutex> lock(controlMutex);
+		auto sequence = ++startSequence;
+		push(Command{ Command::Type::start, group, nullptr, VoiceSettings{}, VolumeRamp{}, startFrame, sequence });
+		waitForBlock();
+		// No block has applied the command if it is still unclaimed, and the
+		// block that will starts at the frame position read after the claim
+		// was checked; otherwise the mixer thread claimed it first.
+		auto frame = std::max(startFrame, framePosition.load(std::memory_order_seq_cst));
+		auto expected = sequence - 1;
+		if (!startClaim.compare_exchange_strong(expected, sequence, std::memory_order_seq_cst))
+		{
+			frame = startedFrame.load(std::memory_order_acquire);
+		}
+		return frame;
+	}
+
+	/// Holds every voice of |group| from the next block on, so that they all
+	/// stop after the same frame. Their inputs are not rendered once this
+	/// returns.
+	void holdGroup(uint64_t group)
+	{
+		std::lock_guard<std::mutex> lock(controlMutex);
+		push(Command{ Command::Type::hold, group });
+		waitForBlock();
+	}
+
+	/// At most the number of voices reserved when the mixer was created.
+	void setMaxVoices(size_t value)
+	{
+		std::lock_guard<std::mutex> lock(controlMutex);
+		maxVoices = std::clamp<size_t>(value, 1, voiceCapacity);
+	}
+
+	MixerStatistics getStatistics()
+	{
+		std::lock_guard<std::mutex> lock(controlMutex);
+		auto mixed = blocks.load(std::memory_order_relaxed);
+		auto audioUs = (double)mixed * blockFrames * 1000000 / format.sampleRate;
+		return MixerStatistics{ controlVoices.size(), maxVoices, stolenVoices, rejectedVoices, mixed,
+			groupStalls.load(std::memory_order_relaxed),
+			audioUs > 0 ? (double)mixTimeUs.load(std::memory_order_relaxed) / audioUs : 0.0 };
+	}
+
+	/// Mixes |frames| frames, at most one block, of every voice into |out|.
+	/// Returns the number of voices that rendered audio. Called from one
+	/// thread at a time, and only without a sink.
+	size_t mix(float* out, size_t frames)
+	{
+		BlockScope scope(*this);
+		applyCommands();
+		return mixVoices(out, frames);
+	}
+
+	/// Stops the mixer thread and closes the sink.
+	void close()
+	{
+		if (closed.exchange(true))
+		{
+			return;
+		}
+		if (thread.joinable())
+		{
+			thread.join();
+		}
+		if (sink)
+		{
+			sink->close();
+		}
+	}
+
+	/// Adds |gain| times |input| to |output|, |count| samples each.
+	static void accumulate(float* output, const float* input, size_t count, float gain)
+	{
+		SampleKernels::get().accumulate(output, input, count, gain);
+	}
+
+	/// Adds interleaved stereo |input| to |output| with separate gains for the
+	/// left and right channels.
+	static void accumulateStereo(float* output, const float* input, size_t frames, float left, float right)
+	{
+		size_t i = 0;
+		auto count = frames * 2;
+#ifdef JUST_AUDIO_SSE
+		auto scale = _mm_setr_ps(left, right, left, right);
+		for (; i + 4 <= count; i += 4)
+		{
+			auto sum = _mm_add_ps(_mm_loadu_ps(output + i), _mm_mul_ps(_mm_loadu_ps(input + i), scale));
+			_mm_storeu_ps(output + i, sum);
+		}
+#elif defined(JUST_AUDIO_NEON)
+		const float scales[4] = { left, right, left, right };
+		auto scale = vld1q_f32(scales);
+		for (; i + 4 <= count; i += 4)
+		{
+			vst1q_f32(output + i, vmlaq_f32(vld1q_f32(output + i), vld1q_f32(input + i), scale));
+		}
+#endif
+		for (; i < count; i += 2)
+		{
+			output[i] += input[i] * left;
+			output[i + 1] += input[i + 1] * right;
+		}
+	}
+
+	/**
+	 * Adds |input| to |output| with a gain that starts at |gain| and changes
+	 * every frame, by adding |step| or, if |exponential|, multiplying by it.
+	 * Stereo frames are also scaled by |left| and |right|.
+	 */
+	static void accumulateRamp(float* output, const float* input, size_t frames, uint32_t channels,
+		float gain, float step, bool exponential, float left = 1.0f, float right = 1.0f)
+	{
+		auto next = [&](float value, float times)
+		{
+			return exponential ? value * std::pow(step, times) : value + step * times;
+		};
+		size_t frame = 0;
+#if defined(JUST_AUDIO_SSE) || defined(JUST_AUDIO_NEON)
+		// Four samples at a time: two stereo frames or four mono ones, each
+		// with the gain of its own frame.
+		if (channels <= 2)
+		{
+			auto perVector = (size_t)(4 / channels);
+			float gains[4];
+			float scales[4];
+			for (size_t k = 0; k < 4; k++)
+			{
+				gains[k] = next(gain, (float)(k / channels));
+				scales[k] = channels == 2 ? (k % 2 ? right : left) : 1.0f;
+			}
+			auto advance = exponential ? std::pow(step, (float)perVector) : step * (float)perVector;
+#ifdef JUST_AUDIO_SSE
+			auto gainVector = _mm_loadu_ps(gains);
+			auto scaleVector = _mm_loadu_ps(scales);
+			auto advanceVector = _mm_set1_ps(advance);
+			for (; frame + perVector <= frames; frame += perVector)
+			{
+				auto* out = output + frame * channels;
+				auto sum = _mm_add_ps(_mm_loadu_ps(out), _mm_mul_ps(_mm_loadu_ps(input + frame * channels), _mm_mul_ps(gainVector, scaleVector)));
+				_mm_storeu_ps(out, sum);
+				gainVector = exponential ? _mm_mul_ps(gainVector, advanceVector) : _mm_add_ps(gainVector, advanceVector);
+			}
+			_mm_storeu_ps(gains, gainVector);
+#else
+			auto gainVector = vld1q_f32(gains);
+			auto scaleVector = vld1q_f32(scales);
+			auto advanceVector = vdupq_n_f32(advance);
+			for (; frame + perVector <= frames; frame += perVector)
+			{
+				auto* out = output + frame * channels;
+				vst1q_f32(out, vmlaq_f32(vld1q_f32(out), vld1q_f32(input + frame * channels), vmulq_f32(gainVector, scaleVector)));
+				gainVector = exponential ? vmulq_f32(gainVector, advanceVector) : vaddq_f32(gainVector, advanceVector);
+			}
+			vst1q_f32(gains, gainVector);
+#endif
+			gain = gains[0];
+		}
+#endif
+		for (; frame < frames; frame++)
+		{
+			for (uint32_t c = 0; c < channels; c++)
+			{
+				auto scale = channels == 2 ? (c == 0 ? left : right) : 1.0f;
+				output[frame * channels + c] += input[frame * channels + c] * gain * scale;
+			}
+			gain = next(gain, 1.0f);
+		}
+	}
+
+private:
+	// A change to the voices, made by the control side and applied by the
+	// mixer thread before its next block.
+	struct Command
+	{
+		enum class Type
+		{
+			add,
+			remove,
+			settings,
+			// Starts the held voices of group |id| at |startFrame|.
+			start,
+			// Holds the voices of group |id|.
+			hold,
+		};
+
+		Type type = Type::remove;
+		// The voice, or the group.
+		uint64_t id = 0;
+		MixerInput* input = nullptr;
+		VoiceSettings settings{};
+		VolumeRamp ramp{};
+		uint64_t startFrame = 0;
+		// Numbers start commands, for startClaim.
+		uint64_t sequence = 0;
+	};
+
+	// What the control side knows of a voice.
+	struct ControlVoice
+	{
+		uint64_t id;
+		MixerInput* input;
+		int32_t priority;
+	};
+
+	// Marks a block being mixed: the block count is odd from before commands
+	// are applied until the block is done.
+	class BlockScope
+	{
+	public:
+		explicit BlockScope(Mixer& mixer)
+			: mixer(mixer)
+		{
+			mixer.blockEpoch.fetch_add(1, std::memory_order_seq_cst);
+			// Orders the count before reading the commands, against
+			// waitForBlock() ordering its commands before reading the count.
+			std::atomic_thread_fence(std::memory_order_seq_cst);
+		}
+
+		~BlockScope()
+		{
+			mixer.blockEpoch.fetch_add(1, std::memory_order_release);
+		}
+
+		// Prevent copying.
+		BlockScope(BlockScope const&) = delete;
+		BlockScope& operator=(BlockScope const&) = delete;
+
+	private:
+		Mixer& mixer;
+	};
+
+	struct Voice
+	{
+		uint64_t id;
+		MixerInput* input;
+		VoiceSettings settings;
+		// The gain heard, which differs from |settings.gain| during a ramp.
+		float gain;
+		// The output frame rendering starts at, or kHeld.
+		uint64_t startFrame = 0;
+		// Set for the block being mixed when a voice of its group is not ready.
+		bool stalled = false;
+		float rampStart = 0.0f;
+		VolumeRamp::Curve rampCurve = VolumeRamp::Curve::linear;
+		size_t rampFrames = 0;
+		size_t rampPosition = 0;
+	};
+
+	/// The gain |position| frames into the ramp of |voice|.
+	static double rampGain(const Voice& voice, size_t position)
+	{
+		auto progress = (double)position / voice.rampFrames;
+		if (voice.rampCurve == VolumeRamp::Curve::exponential)
+		{
+			auto start = std::max<double>(voice.rampStart, kRampFloor);
+			auto end = std::max<double>(voice.settings.gain, kRampFloor);
+			return start * std::pow(end / start, progress);
+		}
+		return voice.rampStart + (voice.settings.gain - voice.rampStart) * progress;
+	}
+
+	/// Adds |frames| frames of |input|, rendered by |voice|, to |output|.
+	void mixVoice(Voice& voice, float* output, const float* input, size_t frames)
+	{
+		auto& settings = voice.settings;
+		auto left = 1.0f;
+		auto right = 1.0f;
+		auto panned = format.channels == 2 && settings.pan != 0.0f;
+		if (panned)
+		{
+			// Balance: the far side is attenuated and the near one kept, so
+			// that a centred voice plays at unity gain.
+			auto pan = std::clamp(settings.pan, -1.0f, 1.0f);
+			left = std::min(1.0f, 1.0f - pan);
+			right = std::min(1.0f, 1.0f + pan);
+		}
+
+		if (voice.rampPosition < voice.rampFrames)
+		{
+			// The start of each block is computed afresh, so that rounding
+			// does not build up over a long ramp.
+			auto count = std::min(frames, voice.rampFrames - voice.rampPosition);
+			auto gain = rampGain(voice, voice.rampPosition);
+			auto exponential = voice.rampCurve == VolumeRamp::Curve::exponential;
+			auto step = exponential ? rampGain(voice, voice.rampPosition + 1) / gain : rampGain(voice, voice.rampPosition + 1) - gain;
+			accumulateRamp(output, input, count, format.channels, (float)gain, (float)step, exponential, left, right);
+			voice.rampPosition += count;
+			voice.gain = voice.rampPosition < voice.rampFrames ? (float)rampGain(voice, voice.rampPosition) : settings.gain;
+			output += count * format.channels;
+			input += count * format.channels;
+			frames -= count;
+		}
+		if (frames == 0)
+		{
+			return;
+		}
+		if (panned)
+		{
+			accumulateStereo(output, input, frames, voice.gain * left, voice.gain * right);
+		}
+		else
+		{
+			accumulate(output, input, frames * format.channels, voice.gain);
+		}
+	}
+
+	/// Queues |command| for the mixer thread, waiting for room if it is
+	/// behind. Called with the control mutex held. Once the mixer is closed
+	/// nothing applies commands, so they are dropped.
+	void push(const Command& command)
+	{
+		while (commands.write(&command, 1) == 0)
+		{
+			if (closed.load(std::memory_order_acquire))
+			{
+				return;
+			}
+			std::this_thread::sleep_for(std::chrono::microseconds(200));
+		}
+	}
+
+	/// Waits for the block being mixed, if any, to end. Commands pushed
+	/// before this are applied before any later block renders a voice.
+	void waitForBlock()
+	{
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		auto epoch = blockEpoch.load(std::memory_order_seq_cst);
+		if (epoch % 2 == 0)
+		{
+			return;
+		}
+		while (blockEpoch.load(std::memory_order_acquire) == epoch)
+		{
+			std::this_thread::yield();
+		}
+	}
+
+	/// Applies the queued commands to the voices. Called from the mixer
+	/// thread, in a BlockScope.
+	void applyCommands()
+	{
+		Command command{};
+		while (commands.read(&command, 1) == 1)
+		{
+			switch (command.type)
+			{
+			case Command::Type::add:
+				// The control side keeps to the room reserved.
+				if (voices.size() < voiceCapacity)
+				{
+					voices.push_back(Voice{ command.id, command.input, command.settings, command.settings.gain, command.startFrame });
+				}
+				break;
+			case Command::Type::remove:
+				voices.erase(std::remove_if(voices.begin(), voices.end(), [&](const Voice& voice)
+					{ return voice.id == command.id; }), voices.end());
+				break;
+			case Command::Type::settings:
+				applySettings(command.id, command.settings, command.ramp);
+				break;
+			case Command::Type::start:
+				startHeld(command);
+				break;
+			case Command::Type::hold:
+				for (auto& voice : voices)
+				{
+					if (voice.settings.group == command.id)
+					{
+						voice.startFrame = kHeld;
+					}
+				}
+				break;
+			}
+		}
+	}
+
+	void applySettings(uint64_t id, const VoiceSettings& settings, VolumeRamp ramp)
+	{
+		for (auto& voice : voices)
+		{
+			if (voice.id != id)
+			{
+				continue;
+			}
+			if (settings.gain != voice.settings.gain)
+			{
+				voice.rampStart = voice.gain;
+				voice.rampCurve = ramp.curve;
+				voice.rampFrames = (size_t)std::max<int64_t>(0, ramp.durationUs * format.sampleRate / 1000000);
+				voice.rampPosition = 0;
+				if (voice.rampFrames == 0)
+				{
+					voice.gain = settings.gain;
+				}
+			}
+			voice.settings = settings;
+		}
+	}
+
+	/// Starts the held voices of a group at the frame asked for, or with this
+	/// block. startGroup() computes the same frame unless this claims the
+	/// command first, in which case it reads the frame from here.
+	void startHeld(const Command& command)
+	{
+		auto frame = std::max(command.startFrame, framePosition.load(std::memory_order_relaxed));
+		startedFrame.store(frame, std::memory_order_release);
+		auto expected = command.sequence - 1;
+		startClaim.compare_exchange_strong(expected, command.sequence, std::memory_order_seq_cst);
+		for (auto& voice : voices)
+		{
+			if (voice.settings.group == command.id && voice.startFrame == kHeld)
+			{
+				voice.startFrame = frame;
+			}
+		}
+	}
+
+	/// Whether every voice can render a block, for a sink that is not
+	/// real-time.
+	bool isReady()
+	{
+		return !voices.empty() && std::all_of(voices.begin(), voices.end(), [&](const Voice& voice)
+			{ return voice.input->isReady(blockFrames); });
+	}
+
+	/// Returns the number of voices that rendered audio.
+	size_t mixVoices(float* out, size_t frames)
+	{
+		// Voices render here, on the output's real-time thread.
+		RealtimeScope realtimeScope;
+		auto start = std::chrono::steady_clock::now();
+		frames = std::min(frames, blockFrames);
+		auto count = frames * format.channels;
+		std::fill(out, out + count, 0.0f);
+		auto blockStart = framePosition.load(std::memory_order_relaxed);
+		// Frames of the block before each voice starts.
+		auto offsetOf = [&](const Voice& voice)
+		{
+			return voice.startFrame <= blockStart ? 0 : (size_t)std::min<uint64_t>(voice.startFrame - blockStart, frames);
+		};
+
+		// A group whose voices are not all ready skips the block as a whole.
+		// Voices still to start start a block later with it, so that it stays
+		// in step.
+		for (auto& voice : voices)
+		{
+			voice.stalled = false;
+		}
+		for (auto& voice : voices)
+		{
+			auto group = voice.settings.group;
+			auto offset = offsetOf(voice);
+			if (group == 0 || voice.stalled || offset == frames || voice.input->isReady(frames - offset))
+			{
+				continue;
+			}
+			for (auto& member : voices)
+			{
+				if (member.settings.group == group)
+				{
+					member.stalled = true;
+					if (member.startFrame != kHeld && member.startFrame >= blockStart)
+					{
+						member.startFrame += frames;
+					}
+				}
+			}
+			groupStalls.fetch_add(1, std::memory_order_relaxed);
+		}
+
+		size_t audible = 0;
+		for (auto& voice : voices)
+		{
+			auto offset = offsetOf(voice);
+			if (voice.stalled || offset == frames)
+			{
+				continue;
+			}
+			if (voice.input->render(scratch.data(), frames - offset) == 0)
+			{
+				// Ramps keep time while the voice is silent.
+				if (voice.rampPosition < voice.rampFrames)
+				{
+					voice.rampPosition = std::min(voice.rampFrames, voice.rampPosition + frames - offset);
+					voice.gain = voice.rampPosition < voice.rampFrames ? (float)rampGain(voice, voice.rampPosition) : voice.settings.gain;
+				}
+				continue;
+			}
+			audible++;
+			mixVoice(voice, out + offset * format.channels, scratch.data(), frames - offset);
+		}
+		blocks.fetch_add(1, std::memory_order_relaxed);
+		framePosition.store(blockStart + frames, std::memory_order_seq_cst);
+		anchorSequence.fetch_add(1, std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_release);
+		mixedFrame.store(blockStart + frames, std::memory_order_relaxed);
+		mixedAtUs.store(std::chrono::duration_cast<std::chrono::microseconds>(start.time_since_epoch()).count(), std::memory_order_relaxed);
+		anchorSequence.fetch_add(1, std::memory_order_release);
+		mixTimeUs.fetch_add(std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count(), std::memory_order_relaxed);
+		return audible;
+	}
+
+	void run()
+	{
+		auto realtime = sink->isRealtime();
+		while (!closed.load(std::memory_order_acquire))
+		{
+			size_t audible = 0;
+			{
+				BlockScope scope(*this);
+				applyCommands();
+				// Without a device to keep fed, wait for audio instead of
+				// mixing silence.
+				if (realtime || isReady())
+				{
+					audible = mixVoices(output.data(), blockFrames);
+				}
+			}
+			if (audible == 0 && !realtime)
+			{
+				// Not ready, or every voice has finished; there is nothing to
+				// write.
+				std::this_thread::sleep_for(std::chrono::milliseconds(1));
+				continue;
+			}
+
+			// The sink paces the mixer; voices can be changed meanwhile.
+			sink->write(output.data(), blockFrames);
+		}
+	}
+
+	AudioFormat format;
+	std::shared_ptr<AudioSink> sink;
+	size_t maxVoices;
+	size_t voiceCapacity;
+	size_t blockFrames;
+	std::vector<float> scratch;
+	std::vector<float> output;
+	std::thread thread;
+	std::atomic<bool> closed = false;
+
+	// The control side, serialized by |controlMutex|, the one producer of
+	// |commands|.
+	std::mutex controlMutex;
+	std::vector<ControlVoice> controlVoices{};
+	uint64_t nextId = 1;
+	uint64_t nextGroup = 1;
+	uint64_t stolenVoices = 0;
+	uint64_t rejectedVoices = 0;
+	uint64_t startSequence = 0;
+
+	SpscRing<Command> commands;
+	// Odd while a block is mixed; see BlockScope.
+	std::atomic<uint64_t> blockEpoch = 0;
+	// The last start command resolved, by startGroup() or the mixer thread,
+	// and the frame the mixer thread resolved it to.
+	std::atomic<uint64_t> startClaim = 0;
+	std::atomic<uint64_t> startedFrame = 0;
+
+	// Owned by the mixer thread.
+	std::vector<Voice> voices{};
+	std::atomic<uint64_t> blocks = 0;
+	std::atomic<uint64_t> groupStalls = 0;
+	std::atomic<int64_t> mixTimeUs = 0;
+
+	// The frames mixed, and when the last block was, for placing host times
+	// on the output. |anchorSequence| guards the last two.
+	std::atomic<uint64_t> framePosition = 0;
+	std::atomic<uint64_t> anchorSequence = 0;
+	std::atomic<uint64_t> mixedFrame = 0;
+	std::atomic<int64_t> mixedAtUs = 0;
+};
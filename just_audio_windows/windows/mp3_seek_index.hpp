@@ -0,0 +1,704 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <filesystem>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include "mapped_file.hpp"
+#include "metadata_probe.hpp"
+
+// Where to start decoding to play from a time.
+struct Mp3SeekPoint
+{
+	// The frame holding the time, and the one to start decoding at, earlier by
+	// the frames its bit reservoir reaches back into.
+	uint64_t frame;
+	uint64_t startFrame;
+	// The offset in the file and the time of |startFrame|.
+	uint64_t offset;
+	int64_t timeUs;
+};
+
+// The offsets of the frames of an MPEG audio file, for seeking to a time
+// exactly. Without a seek table, a decoder can only estimate where a time is
+// from the average bitrate, which is wrong by seconds or minutes in variable
+// bitrate files; a Xing or VBRI table of contents only narrows it to a
+// hundredth of the file.
+//
+// Built by reading every frame header once, which over a memory mapping only
+// touches the pages the headers are on. The offset of every kFramesPerPoint
+// frames is kept, about 20 bytes per second of audio; the frames between are
+// found by walking their headers from there.
+class Mp3SeekIndex
+{
+public:
+	static constexpr uint32_t kFramesPerPoint = 32;
+	// The most frames a Layer III bit reservoir of 511 bytes spans, at the
+	// lowest bitrate.
+	static constexpr uint32_t kMaxReservoirFrames = 9;
+
+	/**
+	 * Indexes the MPEG audio in |data|, skipping ID3v2 tags and a Xing, Info or
+	 * VBRI header frame. Returns std::nullopt if it is not MPEG audio, or if
+	 * |cancelled| was set meanwhile.
+	 */
+	static std::optional<Mp3SeekIndex> build(const uint8_t* data, size_t size, const std::atomic<bool>* cancelled = nullptr)
+	{
+		size_t position = 0;
+		while (position + 10 <= size && std::memcmp(data + position, "ID3", 3) == 0)
+		{
+			auto tagSize = 10 + synchsafe32(data + position + 6) + (data[position + 5] & 0x10 ? 10 : 0);
+			if (tagSize > size - position)
+			{
+				return std::nullopt;
+			}
+			position += tagSize;
+		}
+		size_t end = size;
+		if (end >= position + 128 && std::memcmp(data + end - 128, "TAG", 3) == 0)
+		{
+			end -= 128;
+		}
+
+		// Only sync within the first bytes, so that arbitrary files are rejected.
+		auto sync = findSync(data, end, position, std::min<size_t>(end - position, 64 * 1024), std::nullopt);
+		if (!sync)
+		{
+			return std::nullopt;
+		}
+		auto [first, frame] = *sync;
+
+		Mp3SeekIndex index{};
+		index.version = frame.version;
+		index.layer = frame.layer;
+		index.sampleRate = frame.sampleRate;
+		index.samplesPerFrame = frame.samplesPerFrame;
+		index.channels = frame.channels;
+		position = first;
+
+		auto frameEnd = std::min(end, position + frame.length);
+		auto xing = position + 4 + sideInfoSize(frame);
+		auto vbri = position + 4 + 32;
+		if (xing + 8 <= frameEnd && (std::memcmp(data + xing, "Xing", 4) == 0 || std::memcmp(data + xing, "Info", 4) == 0))
+		{
+			index.tableOfContents = (data[xing + 7] & 4) != 0;
+			position += frame.length;
+		}
+		else if (vbri + 4 <= frameEnd && std::memcmp(data + vbri, "VBRI", 4) == 0)
+		{
+			index.tableOfContents = true;
+			position += frame.length;
+		}
+		index.audioStart = position;
+		index.audioEnd = end;
+
+		while (auto next = nextFrame(data, end, position, frame))
+		{
+			if ((index.frameCount & 0xFFFF) == 0 && cancelled && cancelled->load(std::memory_order_relaxed))
+			{
+				return std::nullopt;
+			}
+			if (index.frameCount % kFramesPerPoint == 0)
+			{
+				index.points.push_back(next->first);
+			}
+			if (next->second.bitrate != frame.bitrate)
+			{
+				index.variableBitrate = true;
+			}
+			index.frameCount++;
+			position = next->first + next->second.length;
+		}
+		if (index.frameCount == 0)
+		{
+			return std::nullopt;
+		}
+		return index;
+	}
+
+	uint64_t getFrameCount() const
+	{
+		return frameCount;
+	}
+
+	uint32_t getSampleRate() const
+	{
+		return sampleRate;
+	}
+
+	int64_t getDurationUs() const
+	{
+		return frameTimeUs(frameCount);
+	}
+
+	/// Whether the bitrate changes between frames, so that estimating from
+	/// the average bitrate seeks to the wrong time.
+	bool isVariableBitrate() const
+	{
+		return variableBitrate;
+	}
+
+	/// Whether the file has a Xing or VBRI table of contents.
+	bool hasTableOfContents() const
+	{
+		return tableOfContents;
+	}
+
+	size_t getPointCount() const
+	{
+		return points.size();
+	}
+
+	int64_t frameTimeUs(uint64_t frame) const
+	{
+		return (int64_t)(frame * samplesPerFrame * 1000000 / sampleRate);
+	}
+
+	/**
+	 * Finds where to decode from to play |timeUs| of the file in |data|, which
+	 * must be the file indexed. Returns std::nullopt if the headers are not
+	 * where the index has them, because the file changed.
+	 */
+	std::optional<Mp3SeekPoint> locate(const uint8_t* data, size_t size, int64_t timeUs) const
+	{
+		if (frameCount == 0 || size < audioEnd)
+		{
+			return std::nullopt;
+		}
+		auto frame = std::min<uint64_t>((uint64_t)std::max<int64_t>(timeUs, 0) * sampleRate / 1000000 / samplesPerFrame, frameCount - 1);
+		auto walkFrom = frame - std::min<uint64_t>(frame, kMaxReservoirFrames);
+		auto pointFrame = walkFrom / kFramesPerPoint * kFramesPerPoint;
+
+		// The frames from |walkFrom| to |frame|.
+		std::array<uint64_t, kMaxReservoirFrames + 1> offsets{};
+		std::array<uint32_t, kMaxReservoirFrames + 1> payloads{};
+		auto reference = referenceFrame();
+		uint64_t position = points[pointFrame / kFramesPerPoint];
+		for (auto current = pointFrame; current <= frame; current++)
+		{
+			auto next = nextFrame(data, audioEnd, (size_t)position, reference);
+			if (!next)
+			{
+				return std::nullopt;
+			}
+			if (current >= walkFrom)
+			{
+				offsets[current - walkFrom] = next->first;
+				payloads[current - walkFrom] = payloadSize(data + next->first, next->second);
+			}
+			position = next->first + next->second.length;
+		}
+
+		auto startFrame = frame;
+		if (layer == 3)
+		{
+			// The frame's main data starts this far back in the frames before it.
+			auto* sideInfo = data + offsets[frame - walkFrom] + 4 + (hasCrc(data + offsets[frame - walkFrom]) ? 2 : 0);
+			uint32_t reservoir = version == 1 ? (uint32_t)sideInfo[0] << 1 | sideInfo[1] >> 7 : sideInfo[0];
+			uint32_t reached = 0;
+			while (reached < reservoir && startFrame > walkFrom)
+			{
+				startFrame--;
+				reached += payloads[startFrame - walkFrom];
+			}
+		}
+		return Mp3SeekPoint{ frame, startFrame, offsets[startFrame - walkFrom], frameTimeUs(startFrame) };
+	}
+
+	/// Encodes the index for a cache. Points are stored as the distance from
+	/// the one before, in 4 bytes.
+	std::string serialize() const
+	{
+		std::string buffer{};
+		writeInt(buffer, (uint8_t)version);
+		writeInt(buffer, (uint8_t)layer);
+		writeInt(buffer, (uint8_t)channels);
+		writeInt(buffer, (uint8_t)((variableBitrate ? 1 : 0) | (tableOfContents ? 2 : 0)));
+		writeInt(buffer, sampleRate);
+		writeInt(buffer, samplesPerFrame);
+		writeInt(buffer, frameCount);
+		writeInt(buffer, audioStart);
+		writeInt(buffer, audioEnd);
+		writeInt(buffer, (uint64_t)points.size());
+		uint64_t previous = audioStart;
+		for (auto point : points)
+		{
+			writeInt(buffer, (uint32_t)(point - previous));
+			previous = point;
+		}
+		return buffer;
+	}
+
+	/// Decodes an index written by serialize(), or returns std::nullopt if it
+	/// is malformed.
+	static std::optional<Mp3SeekIndex> deserialize(const std::string& buffer, size_t position = 0)
+	{
+		bool ok = true;
+		Mp3SeekIndex index{};
+		index.version = readInt<uint8_t>(buffer, position, ok);
+		index.layer = readInt<uint8_t>(buffer, position, ok);
+		index.channels = readInt<uint8_t>(buffer, position, ok);
+		auto flags = readInt<uint8_t>(buffer, position, ok);
+		index.variableBitrate = (flags & 1) != 0;
+		index.tableOfContents = (flags & 2) != 0;
+		index.sampleRate = readInt<uint32_t>(buffer, position, ok);
+		index.samplesPerFrame = readInt<uint32_t>(buffer, position, ok);
+		index.frameCount = readInt<uint64_t>(buffer, position, ok);
+		index.audioStart = readInt<uint64_t>(buffer, position, ok);
+		index.audioEnd = readInt<uint64_t>(buffer, position, ok);
+		auto count = readInt<uint64_t>(buffer, position, ok);
+		if (!ok || index.sampleRate == 0 || index.samplesPerFrame == 0 || index.frameCount == 0 ||
+			count != (index.frameCount + kFramesPerPoint - 1) / kFramesPerPoint || (buffer.size() - position) / 4 < count)
+		{
+			return std::nullopt;
+		}
+		index.points.reserve((size_t)count);
+		uint64_t previous = index.audioStart;
+		for (uint64_t i = 0; i < count; i++)
+		{
+			previous += readInt<uint32_t>(buffer, position, ok);
+			if (previous >= index.audioEnd)
+			{
+				return std::nullopt;
+			}
+			index.points.push_back(previous);
+		}
+		return index;
+	}
+
+private:
+	static uint32_t synchsafe32(const uint8_t* p)
+	{
+		return (uint32_t)(p[0] & 0x7F) << 21 | (uint32_t)(p[1] & 0x7F) << 14 | (uint32_t)(p[2] & 0x7F) << 7 | (p[3] & 0x7F);
+	}
+
+	static bool hasCrc(const uint8_t* header)
+	{
+		return (header[1] & 1) == 0;
+	}
+
+	static size_t sideInfoSize(const MetadataProbe::MpegFrame& frame)
+	{
+		if (frame.layer != 3)
+		{
+			return 0;
+		}
+		return frame.version == 1 ? (frame.channels == 1 ? 17 : 32) : (frame.channels == 1 ? 9 : 17);
+	}
+
+	/// The bytes of a frame that a later frame's bit reservoir can use.
+	static uint32_t payloadSize(const uint8_t* header, const MetadataProbe::MpegFrame& frame)
+	{
+		auto overhead = 4 + (hasCrc(header) ? 2 : 0) + sideInfoSize(frame);
+		return frame.length > overhead ? (uint32_t)(frame.length - overhead) : 0;
+	}
+
+	/**
+	 * Finds the first frame within |limit| bytes of |offset| that matches
+	 * |reference|, if given, and is followed by another matching frame or the
+	 * end, which rules out false syncs in damaged data.
+	 */
+	static std::optional<std::pair<size_t, MetadataProbe::MpegFrame>> findSync(const uint8_t* data, size_t end, size_t offset, size_t limit,
+		const std::optional<MetadataProbe::MpegFrame>& reference)
+	{
+		auto last = std::min(end, offset + limit);
+		for (auto position = offset; position + 4 <= last; position++)
+		{
+			if (data[position] != 0xFF)
+			{
+				continue;
+			}
+			auto frame = MetadataProbe::MpegFrame::parse(data + position);
+			if (!frame || (reference && !frame->matches(*reference)) || frame->length > end - position)
+			{
+				continue;
+			}
+			auto next = position + frame->length;
+			if (next + 4 > end)
+			{
+				return std::make_pair(position, *frame);
+			}
+			auto nextFrame = MetadataProbe::MpegFrame::parse(data + next);
+			if (nextFrame && nextFrame->matches(*frame))
+			{
+				return std::make_pair(position, *frame);
+			}
+		}
+		return std::nullopt;
+	}
+
+	/// The frame at |position|, or after damaged data the next one found.
+	/// Stops at trailing APE and ID3v1 tags.
+	static std::optional<std::pair<size_t, MetadataProbe::MpegFrame>> nextFrame(const uint8_t* data, size_t end, size_t position,
+		const MetadataProbe::MpegFrame& reference)
+	{
+		if (position + 4 > end)
+		{
+			return std::nullopt;
+		}
+		auto frame = MetadataProbe::MpegFrame::parse(data + position);
+		if (frame && frame->matches(reference) && frame->length <= end - position)
+		{
+			return std::make_pair(position, *frame);
+		}
+		if (std::memcmp(data + position, "TAG", 3) == 0 || (position + 8 <= end && std::memcmp(data + position, "APETAGEX", 8) == 0))
+		{
+			return std::nullopt;
+		}
+		return findSync(data, end, position + 1, end - position - 1, reference);
+	}
+
+	/// A frame that the frames of the file match.
+	MetadataProbe::MpegFrame referenceFrame() const
+	{
+		MetadataProbe::MpegFrame frame{};
+		frame.version = version;
+		frame.layer = layer;
+		frame.sampleRate = sampleRate;
+		frame.samplesPerFrame = samplesPerFrame;
+		frame.channels = channels;
+		return frame;
+	}
+
+	// Little-endian encoding of the index.
+	template <typename T>
+	static void writeInt(std::string& buffer, T value)
+	{
+		for (size_t i = 0; i < sizeof(T); i++)
+		{
+			buffer.push_back((char)(((uint64_t)value >> (i * 8)) & 0xFF));
+		}
+	}
+
+	/// Reads a T at |position|, clearing |ok| instead of reading past the end.
+	template <typename T>
+	static T readInt(const std::string& buffer, size_t& position, bool& ok)
+	{
+		if (!ok || buffer.size() - position < sizeof(T))
+		{
+			ok = false;
+			return T{};
+		}
+		uint64_t value = 0;
+		for (size_t i = 0; i < sizeof(T); i++)
+		{
+			value |= (uint64_t)(uint8_t)buffer[position + i] << (i * 8);
+		}
+		position += sizeof(T);
+		return (T)value;
+	}
+
+	int version = 1;
+	int layer = 3;
+	int channels = 2;
+	uint32_t sampleRate = 44100;
+	uint32_t samplesPerFrame = 1152;
+	bool variableBitrate = false;
+	bool tableOfContents = false;
+	uint64_t frameCount = 0;
+	// The bytes of audio frames, without tags or a header frame.
+	uint64_t audioStart = 0;
+	uint64_t audioEnd = 0;
+	// The offset of every kFramesPerPoint'th frame.
+	std::vector<uint64_t> points{};
+};
+
+// Keeps seek indexes on disk, a file for each source named after a hash of
+// its path, so that a file is only scanned again once it changes.
+class Mp3SeekIndexCache
+{
+public:
+	explicit Mp3SeekIndexCache(const std::filesystem::path& directory)
+		: directory(directory)
+	{
+		std::error_code error{};
+		std::filesystem::create_directories(directory, error);
+	}
+
+	// Prevent copying.
+	Mp3SeekIndexCache(Mp3SeekIndexCache const&) = delete;
+	Mp3SeekIndexCache& operator=(Mp3SeekIndexCache const&) = delete;
+
+	/// Reads the index of |path| if it was built since the file last changed.
+	std::optional<Mp3SeekIndex> load(const std::string& path, const FileStamp& stamp) const
+	{
+		std::ifstream file(fileFor(path), std::ios::binary);
+		if (!file)
+		{
+			return std::nullopt;
+		}
+		std::string buffer((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+		auto header = makeHeader(path, stamp);
+		if (buffer.size() < header.size() || buffer.compare(0, header.size(), header) != 0)
+		{
+			return std::nullopt;
+		}
+		return Mp3SeekIndex::deserialize(buffer, header.size());
+	}
+
+	/// Writes the index of |path|. The previous one is only replaced once the
+	/// new one is complete.
+	bool save(const std::string& path, const FileStamp& stamp, const Mp3SeekIndex& index) const
+	{
+		auto buffer = makeHeader(path, stamp) + index.serialize();
+		auto indexPath = fileFor(path);
+		auto temporaryPath = indexPath;
+		temporaryPath += ".tmp" + std::to_string(std::hash<std::thread::id>()(std::this_thread::get_id()));
+		{
+			std::ofstream file(temporaryPath, std::ios::binary | std::ios::trunc);
+			file.write(buffer.data(), (std::streamsize)buffer.size());
+			if (!file)
+			{
+				return false;
+			}
+		}
+		std::error_code error{};
+		std::filesystem::rename(temporaryPath, indexPath, error);
+		if (error)
+		{
+			std::filesystem::remove(temporaryPath, error);
+			return false;
+		}
+		return true;
+	}
+
+	/// The size of the index file of |path|, or 0 if there is none.
+	uint64_t sizeOf(const std::string& path) const
+	{
+		std::error_code error{};
+		auto size = std::filesystem::file_size(fileFor(path), error);
+		return error ? 0 : (uint64_t)size;
+	}
+
+private:
+	static constexpr char kMagic[4] = { 'J', 'A', 'S', 'I' };
+	static constexpr uint32_t kVersion = 1;
+
+	std::filesystem::path fileFor(const std::string& path) const
+	{
+		// FNV-1a
+		uint64_t hash = 0xCBF29CE484222325ull;
+		for (auto c : path)
+		{
+			hash = (hash ^ (uint8_t)c) * 0x100000001B3ull;
+		}
+		char name[32];
+		std::snprintf(name, sizeof(name), "%016llx.idx", (unsigned long long)hash);
+		return directory / name;
+	}
+
+	/// What an index file starts with: the path, so that paths of the same
+	/// hash are told apart, and the stamp of the file indexed.
+	static std::string makeHeader(const std::string& path, const FileStamp& stamp)
+	{
+		std::string header(kMagic, 4);
+		auto append = [&](uint64_t value, size_t bytes)
+		{
+			for (size_t i = 0; i < bytes; i++)
+			{
+				header.push_back((char)((value >> (i * 8)) & 0xFF));
+			}
+		};
+		append(kVersion, 4);
+		append(path.size(), 4);
+		header.append(path);
+		append(stamp.size, 8);
+		append((uint64_t)stamp.modifiedTime, 8);
+		return header;
+	}
+
+	std::filesystem::path directory;
+};
+
+// The outcome of indexing one file. |index| is empty if it is not MPEG
+// audio.
+struct Mp3SeekIndexBuild
+{
+	std::shared_ptr<const Mp3SeekIndex> index;
+	// Whether it was read from the cache rather than built.
+	bool cached;
+	int64_t elapsedUs;
+};
+
+// Builds seek indexes on a background thread, going through a
+// Mp3SeekIndexCache, and keeps those of the files played lately in memory.
+// Players request files as they load them, and look an index up when they
+// seek; until it is built, they seek as the decoder does.
+class Mp3SeekIndexer
+{
+public:
+	// The indexes kept in memory, about 100 KB for three hours of audio.
+	static constexpr size_t kMaxLoaded = 16;
+
+	explicit Mp3SeekIndexer(std::shared_ptr<Mp3SeekIndexCache> cache)
+		: cache(cache)
+	{
+		worker = std::thread([this]()
+			{ work(); });
+	}
+
+	/// Stops the worker, abandoning the file it is scanning. Files still
+	/// queued are dropped.
+	~Mp3SeekIndexer()
+	{
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			stopping = true;
+		}
+		wake.notify_all();
+		worker.join();
+	}
+
+	// Prevent copying.
+	Mp3SeekIndexer(Mp3SeekIndexer const&) = delete;
+	Mp3SeekIndexer& operator=(Mp3SeekIndexer const&) = delete;
+
+	/// Returns the index of |path| if it was built since the file last
+	/// changed, from memory or else from the cache. Never scans the file.
+	std::shared_ptr<const Mp3SeekIndex> find(const std::string& path)
+	{
+		auto stamp = MappedFile::stat(path);
+		if (!stamp)
+		{
+			return nullptr;
+		}
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			auto it = loaded.find(path);
+			if (it != loaded.end() && it->second.stamp == *stamp)
+			{
+				it->second.lastUse = ++uses;
+				return it->second.index;
+			}
+		}
+		auto index = cache->load(path, *stamp);
+		if (!index)
+		{
+			return nullptr;
+		}
+		auto shared = std::make_shared<const Mp3SeekIndex>(std::move(*index));
+		remember(path, *stamp, shared);
+		return shared;
+	}
+
+	/// Queues |path| to be indexed in the background, unless it already is.
+	void request(const std::string& path)
+	{
+		if (find(path))
+		{
+			return;
+		}
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			if (!queued.insert(path).second)
+			{
+				return;
+			}
+			jobs.push_back(path);
+		}
+		wake.notify_one();
+	}
+
+	/// Indexes |path| on the calling thread, unless it already is.
+	Mp3SeekIndexBuild get(const std::string& path)
+	{
+		auto start = std::chrono::steady_clock::now();
+		auto elapsedUs = [&]()
+		{
+			return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+		};
+		if (auto index = find(path))
+		{
+			return Mp3SeekIndexBuild{ index, true, elapsedUs() };
+		}
+		auto index = buildFile(path, nullptr);
+		return Mp3SeekIndexBuild{ index, false, elapsedUs() };
+	}
+
+private:
+	struct Loaded
+	{
+		FileStamp stamp;
+		std::shared_ptr<const Mp3SeekIndex> index;
+		uint64_t lastUse;
+	};
+
+	void work()
+	{
+		std::unique_lock<std::mutex> lock(mutex);
+		while (true)
+		{
+			wake.wait(lock, [this]()
+				{ return stopping || !jobs.empty(); });
+			if (stopping)
+			{
+				return;
+			}
+			auto path = jobs.front();
+			jobs.pop_front();
+			lock.unlock();
+			if (!find(path))
+			{
+				buildFile(path, &stopping);
+			}
+			lock.lock();
+			queued.erase(path);
+		}
+	}
+
+	std::shared_ptr<const Mp3SeekIndex> buildFile(const std::string& path, const std::atomic<bool>* cancelled)
+	{
+		MappedFile file(path);
+		if (!file.isOpen() || !file.data())
+		{
+			return nullptr;
+		}
+		auto index = Mp3SeekIndex::build(file.data(), file.size(), cancelled);
+		if (!index)
+		{
+			return nullptr;
+		}
+		cache->save(path, *file.getStamp(), *index);
+		auto shared = std::make_shared<const Mp3SeekIndex>(std::move(*index));
+		remember(path, *file.getStamp(), shared);
+		return shared;
+	}
+
+	void remember(const std::string& path, const FileStamp& stamp, std::shared_ptr<const Mp3SeekIndex> index)
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		loaded[path] = Loaded{ stamp, index, ++uses };
+		if (loaded.size() > kMaxLoaded)
+		{
+			auto oldest = std::min_element(loaded.begin(), loaded.end(), [](const auto& a, const auto& b)
+				{ return a.second.lastUse < b.second.lastUse; });
+			loaded.erase(oldest);
+		}
+	}
+
+	std::shared_ptr<Mp3SeekIndexCache> cache;
+	std::mutex mutex;
+	std::condition_variable wake;
+	std::deque<std::string> jobs{};
+	std::unordered_set<std::string> queued{};
+	std::unordered_map<std::string, Loaded> loaded{};
+	uint64_t uses = 0;
+	std::atomic<bool> stopping = false;
+	std::thread worker;
+};
@@ -0,0 +1,158 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <memory>
+#include <utility>
+#include <vector>
+
+// Hands out float buffers of one size from a free list, so that buffers that
+// come and go reuse the same memory. The heap is only touched when every
+// buffer is out, which reserve() avoids for a known working set. Owned by
+// one thread at a time.
+class BufferPool
+{
+public:
+	explicit BufferPool(size_t bufferSize = 0)
+		: bufferSize(bufferSize)
+	{
+	}
+
+	size_t getBufferSize() const
+	{
+		return bufferSize;
+	}
+
+	/// Makes sure |count| buffers exist in all, allocating the missing ones.
+	void reserve(size_t count)
+	{
+		if (count <= storage.size())
+		{
+			return;
+		}
+		// The free list can then take back every buffer without growing.
+		available.reserve(count);
+		while (storage.size() < count)
+		{
+			storage.push_back(std::make_unique<float[]>(bufferSize));
+			available.push_back(storage.back().get());
+		}
+	}
+
+	/// A buffer of getBufferSize() floats, with undefined contents.
+	float* acquire()
+	{
+		if (available.empty())
+		{
+			reserve(std::max<size_t>(4, storage.size() * 2));
+		}
+		auto* buffer = available.back();
+		available.pop_back();
+		return buffer;
+	}
+
+	/// Returns a buffer from acquire().
+	void release(float* buffer)
+	{
+		available.push_back(buffer);
+	}
+
+	/// The number of buffers allocated, out or not.
+	size_t getCapacity() const
+	{
+		return storage.size();
+	}
+
+private:
+	size_t bufferSize;
+	std::vector<std::unique_ptr<float[]>> storage{};
+	std::vector<float*> available{};
+};
+
+// A first-in first-out queue in a ring that only grows, doubling, when it is
+// full, so that once it has reached its working size pushing and popping
+// never allocate, unlike std::deque, which allocates as it moves through
+// memory.
+template <typename T>
+class RingQueue
+{
+public:
+	explicit RingQueue(size_t capacity = 0)
+	{
+		reserve(capacity);
+	}
+
+	size_t size() const
+	{
+		return count;
+	}
+
+	bool empty() const
+	{
+		return count == 0;
+	}
+
+	/// Makes room for |capacity| items.
+	void reserve(size_t capacity)
+	{
+		if (capacity <= items.size())
+		{
+			return;
+		}
+		std::vector<T> grown(capacity);
+		for (size_t i = 0; i < count; i++)
+		{
+			grown[i] = std::move((*this)[i]);
+		}
+		items = std::move(grown);
+		head = 0;
+	}
+
+	void push_back(T item)
+	{
+		if (count == items.size())
+		{
+			reserve(std::max<size_t>(8, items.size() * 2));
+		}
+		items[(head + count) % items.size()] = std::move(item);
+		count++;
+	}
+
+	void pop_front()
+	{
+		head = (head + 1) % items.size();
+		count--;
+	}
+
+	void clear()
+	{
+		head = 0;
+		count = 0;
+	}
+
+	T& front()
+	{
+		return items[head];
+	}
+
+	T& back()
+	{
+		return (*this)[count - 1];
+	}
+
+	/// The |index|th item from the front.
+	T& operator[](size_t index)
+	{
+		return items[(head + index) % items.size()];
+	}
+
+	const T& operator[](size_t index) const
+	{
+		return items[(head + index) % items.size()];
+	}
+
+private:
+	std::vector<T> items{};
+	size_t head = 0;
+	size_t count = 0;
+};
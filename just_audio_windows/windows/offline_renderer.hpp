@@ -0,0 +1,418 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "audio_backend.hpp"
+#include "audio_decoder.hpp"
+#include "audio_sink.hpp"
+#include "equalizer.hpp"
+#include "loudness_analyzer.hpp"
+#include "loudness_enhancer.hpp"
+#include "mixer.hpp"
+#include "resampler.hpp"
+#include "software_backend.hpp"
+#include "time_stretch.hpp"
+
+// How a playlist is rendered offline, with the settings of a player that
+// would play it.
+struct OfflineRenderOptions
+{
+	std::shared_ptr<DecoderRegistry> decoders = std::make_shared<DecoderRegistry>();
+	// Rendering threads, or one per core if zero.
+	unsigned threads = 0;
+	double volume = 1.0;
+	double speed = 1.0;
+	double pitch = 1.0;
+	std::optional<TimeStretcher::Quality> timeStretchQuality = TimeStretcher::Quality::balanced;
+	Resampler::Quality resamplerQuality = Resampler::Quality::balanced;
+	std::optional<SkipSilenceOptions> skipSilence{};
+	int64_t crossfadeUs = 0;
+	// Files are measured by |loudnessAnalyzer| before rendering, and levelled
+	// to |normalizationTargetLufs|.
+	std::shared_ptr<LoudnessAnalyzer> loudnessAnalyzer = nullptr;
+	std::optional<double> normalizationTargetLufs{};
+	// The gain of each band of the equalizer, which is off if empty.
+	std::vector<double> equalizerGainsDb{};
+	std::optional<double> loudnessEnhancerGainDb{};
+};
+
+struct OfflineRenderResult
+{
+	size_t items;
+	unsigned threads;
+	uint64_t frames;
+	// The length of the output, and how long it took to render.
+	int64_t durationUs;
+	int64_t elapsedUs;
+	// Seconds of output rendered per second.
+	double realtimeFactor;
+};
+
+// Renders a source tree to a sink as fast as it can be decoded, for exports
+// and for benchmarking the whole pipeline. Items are decoded, resampled,
+// stretched, trimmed of silence and levelled by a SoftwareBackend each, on a
+// pool of threads, so that several items render at once. The crossfades,
+// equalizer, loudness enhancer and volume carry state from one item to the
+// next, so they run in order on the calling thread as items finish, the same
+// way a player applies them.
+//
+// Up to two items per thread are held in memory, rendered, ahead of what has
+// been written.
+class OfflineRenderer
+{
+public:
+	explicit OfflineRenderer(OfflineRenderOptions options)
+		: options(options)
+	{
+	}
+
+	/// Flattens |source| into its items in playlist order, as a player does,
+	/// each a leaf wrapped in the clipping that applies to it.
+	static std::vector<AudioSourceSpec> flattenItems(const AudioSourceSpec& source)
+	{
+		std::vector<AudioSourceSpec> items{};
+		flatten(source, 0, std::nullopt, items);
+		return items;
+	}
+
+	/**
+	 * Renders |source| into |output| in its format and closes it. Loop and
+	 * shuffle modes do not apply; each item is rendered once, in order. Throws
+	 * std::runtime_error if an item can not be played, once the items before
+	 * it have been written.
+	 */
+	OfflineRenderResult render(const AudioSourceSpec& source, AudioSink& output)
+	{
+		auto start = std::chrono::steady_clock::now();
+		auto format = output.getFormat();
+		auto items = flattenItems(source);
+		measureLoudness(items);
+		OutputStage stage(options, output);
+		Joiner joiner(format, (size_t)(std::max<int64_t>(options.crossfadeUs, 0) * format.sampleRate / 1000000));
+
+		auto threadCount = options.threads > 0 ? options.threads : std::max(1u, std::thread::hardware_concurrency());
+		threadCount = (unsigned)std::clamp<size_t>(items.size(), 1, threadCount);
+		auto window = (size_t)threadCount * 2;
+		std::vector<Job> jobs(items.size());
+		std::mutex mutex;
+		std::condition_variable changed;
+		size_t next = 0;
+		size_t written = 0;
+		bool stopping = false;
+
+		std::vector<std::thread> workers{};
+		for (unsigned i = 0; i < threadCount; i++)
+		{
+			workers.emplace_back([&]()
+				{
+					std::unique_lock<std::mutex> lock(mutex);
+					while (true)
+					{
+						changed.wait(lock, [&]()
+							{ return stopping || next >= items.size() || next < written + window; });
+						if (stopping || next >= items.size())
+						{
+							return;
+						}
+						auto index = next++;
+						lock.unlock();
+						Job job{};
+						try
+						{
+							job.samples = renderItem(items[index], format);
+						}
+						catch (const std::exception& error)
+						{
+							job.error = error.what();
+						}
+						job.done = true;
+						lock.lock();
+						jobs[index] = std::move(job);
+						changed.notify_all();
+					} });
+		}
+
+		std::string error{};
+		for (size_t i = 0; i < items.size(); i++)
+		{
+			Job job{};
+			{
+				std::unique_lock<std::mutex> lock(mutex);
+				changed.wait(lock, [&]()
+					{ return jobs[i].done; });
+				job = std::move(jobs[i]);
+				written = i + 1;
+			}
+			changed.notify_all();
+			if (!job.error.empty())
+			{
+				error = job.error;
+				break;
+			}
+			joiner.add(job.samples, stage);
+		}
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			stopping = true;
+		}
+		changed.notify_all();
+		for (auto& worker : workers)
+		{
+			worker.join();
+		}
+		joiner.finish(stage);
+		output.close();
+		if (!error.empty())
+		{
+			throw std::runtime_error(error);
+		}
+
+		OfflineRenderResult result{ items.size(), threadCount, stage.getFrames(), 0, 0, 0.0 };
+		result.durationUs = (int64_t)(result.frames * 1000000 / format.sampleRate);
+		result.elapsedUs = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+		result.realtimeFactor = result.elapsedUs > 0 ? (double)result.durationUs / result.elapsedUs : 0.0;
+		return result;
+	}
+
+private:
+	// Each item's backend holds this much ahead of the renderer, which takes a
+	// quarter of it at a time.
+	static constexpr uint32_t kBufferDepthMs = 200;
+
+	struct Job
+	{
+		std::vector<float> samples{};
+		std::string error{};
+		bool done = false;
+	};
+
+	// Applies the effects that follow the crossfades, block by block as a
+	// player's render() does, and writes the result.
+	class OutputStage
+	{
+	public:
+		OutputStage(const OfflineRenderOptions& options, AudioSink& output)
+			: output(output), format(output.getFormat()), gain((float)options.volume),
+			equalizer(format), loudnessEnhancer(format), block(SoftwareBackend::kDefaultBlockFrames * format.channels)
+		{
+			if (!options.equalizerGainsDb.empty())
+			{
+				equalizer.setEnabled(true);
+				for (size_t band = 0; band < options.equalizerGainsDb.size(); band++)
+				{
+					equalizer.setBandGain(band, options.equalizerGainsDb[band]);
+				}
+			}
+			if (options.loudnessEnhancerGainDb)
+			{
+				loudnessEnhancer.setEnabled(true);
+				loudnessEnhancer.setTargetGain(*options.loudnessEnhancerGainDb);
+			}
+		}
+
+		void write(const float* samples, size_t frames)
+		{
+			auto channels = format.channels;
+			auto blockFrames = block.size() / channels;
+			while (frames > 0)
+			{
+				auto count = std::min(frames, blockFrames);
+				std::copy(samples, samples + count * channels, block.begin());
+				equalizer.process(block.data(), count);
+				loudnessEnhancer.process(block.data(), count);
+				if (gain != 1.0f)
+				{
+					std::transform(block.begin(), block.begin() + count * channels, block.begin(), [gain = gain](float sample)
+						{ return sample * gain; });
+				}
+				output.write(block.data(), count);
+				framesWritten += count;
+				samples += count * channels;
+				frames -= count;
+			}
+		}
+
+		uint64_t getFrames() const
+		{
+			return framesWritten;
+		}
+
+	private:
+		AudioSink& output;
+		AudioFormat format;
+		float gain;
+		Equalizer equalizer;
+		LoudnessEnhancer loudnessEnhancer;
+		std::vector<float> block;
+		uint64_t framesWritten = 0;
+	};
+
+	// Joins items end to end, holding back the end of each for an equal power
+	// crossfade into the next like SoftwareBackend: the fade lasts as long as
+	// what was held, and an item shorter than that cuts the rest of it.
+	class Joiner
+	{
+	public:
+		Joiner(AudioFormat format, size_t crossfadeFrames)
+			: channels(format.channels), crossfadeFrames(crossfadeFrames)
+		{
+		}
+
+		void add(const std::vector<float>& samples, OutputStage& stage)
+		{
+			auto frames = samples.size() / channels;
+			size_t mixed = 0;
+			auto fadeFrames = tail.size() / channels;
+			if (fadeFrames > 0)
+			{
+				const double quarterTurn = 1.57079632679489662;
+				mixed = std::min(frames, fadeFrames);
+				for (size_t f = 0; f < mixed; f++)
+				{
+					auto angle = quarterTurn * ((double)f + 0.5) / (double)fadeFrames;
+					auto fadeOut = (float)std::cos(angle);
+					auto fadeIn = (float)std::sin(angle);
+					for (uint32_t c = 0; c < channels; c++)
+					{
+						tail[f * channels + c] = tail[f * channels + c] * fadeOut + samples[f * channels + c] * fadeIn;
+					}
+				}
+				stage.write(tail.data(), mixed);
+				tail.clear();
+			}
+
+			auto held = std::min(crossfadeFrames, frames - mixed);
+			stage.write(samples.data() + mixed * channels, frames - mixed - held);
+			tail.assign(samples.end() - held * channels, samples.end());
+		}
+
+		/// Writes what is held after the last item.
+		void finish(OutputStage& stage)
+		{
+			stage.write(tail.data(), tail.size() / channels);
+			tail.clear();
+		}
+
+	private:
+		uint32_t channels;
+		size_t crossfadeFrames;
+		std::vector<float> tail{};
+	};
+
+	static void flatten(const AudioSourceSpec& source, int64_t startUs, std::optional<int64_t> endUs, std::vector<AudioSourceSpec>& items)
+	{
+		switch (source.type)
+		{
+		case AudioSourceSpec::Type::concatenating:
+			for (auto& child : source.children)
+			{
+				flatten(child, startUs, endUs, items);
+			}
+			break;
+		case AudioSourceSpec::Type::looping:
+			for (int32_t i = 0; i < source.count && !source.children.empty(); i++)
+			{
+				flatten(source.children[0], startUs, endUs, items);
+			}
+			break;
+		case AudioSourceSpec::Type::clipping:
+			if (!source.children.empty())
+			{
+				flatten(source.children[0], source.startUs.value_or(0), source.endUs, items);
+			}
+			break;
+		default:
+			if (startUs == 0 && !endUs)
+			{
+				items.push_back(source);
+				break;
+			}
+			AudioSourceSpec clipping{};
+			clipping.type = AudioSourceSpec::Type::clipping;
+			clipping.startUs = startUs;
+			clipping.endUs = endUs;
+			clipping.children.push_back(source);
+			items.push_back(std::move(clipping));
+			break;
+		}
+	}
+
+	/// Measures the files to be normalized up front, which players do in the
+	/// background.
+	void measureLoudness(const std::vector<AudioSourceSpec>& items)
+	{
+		if (!options.loudnessAnalyzer || !options.normalizationTargetLufs)
+		{
+			return;
+		}
+		std::vector<std::string> paths{};
+		for (auto& item : items)
+		{
+			auto& leaf = item.isLeaf() ? item : item.children[0];
+			if (leaf.type != AudioSourceSpec::Type::progressive)
+			{
+				continue;
+			}
+			auto path = uriToPath(leaf.uri);
+			if (path && std::find(paths.begin(), paths.end(), *path) == paths.end())
+			{
+				paths.push_back(*path);
+			}
+		}
+		LoudnessStatistics statistics{};
+		options.loudnessAnalyzer->analyze(paths, statistics);
+	}
+
+	/// Plays |item| through a backend of its own as fast as it decodes.
+	std::vector<float> renderItem(const AudioSourceSpec& item, AudioFormat format)
+	{
+		SoftwareBackend backend(std::make_shared<Mixer>(format, nullptr), options.decoders, kBufferDepthMs);
+		std::string error{};
+		backend.setErrorListener([&](const std::string&, const std::string& message)
+			{ error = message; });
+		backend.setTimeStretchQuality(options.timeStretchQuality);
+		backend.setResamplerQuality(options.resamplerQuality);
+		backend.setSpeed(options.speed);
+		backend.setPitch(options.pitch);
+		if (options.skipSilence)
+		{
+			backend.setSkipSilence(true, *options.skipSilence);
+		}
+		backend.setLoudnessNormalization(options.loudnessAnalyzer, options.normalizationTargetLufs);
+		backend.load(item, std::nullopt, 0);
+		if (!error.empty())
+		{
+			throw std::runtime_error(error);
+		}
+		backend.play();
+
+		auto channels = format.channels;
+		auto chunkFrames = std::max<size_t>(1, (size_t)format.sampleRate * kBufferDepthMs / 4000);
+		std::vector<float> chunk(chunkFrames * channels);
+		std::vector<float> samples{};
+		while (true)
+		{
+			backend.waitUntilReady(chunkFrames);
+			auto rendered = backend.render(chunk.data(), chunkFrames);
+			if (rendered == 0)
+			{
+				break;
+			}
+			samples.insert(samples.end(), chunk.begin(), chunk.begin() + rendered * channels);
+		}
+		return samples;
+	}
+
+	OfflineRenderOptions options;
+};
@@ -0,0 +1,415 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <functional>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#ifdef _WIN32
+#include <windows.h>
+#endif
+
+#include "audio_backend.hpp"
+#include "audio_decoder.hpp"
+#include "mapped_file.hpp"
+#include "resampler.hpp"
+#include "sample_kernels.hpp"
+
+// A clip decoded in full, in the format of the output it plays on.
+struct PcmSample
+{
+	AudioFormat format;
+	std::vector<float> samples;
+
+	size_t frames() const
+	{
+		return format.channels > 0 ? samples.size() / format.channels : 0;
+	}
+
+	size_t bytes() const
+	{
+		return samples.capacity() * sizeof(float);
+	}
+};
+
+/**
+ * Converts |source|, interleaved in |sourceFormat|, into |format|: channels are
+ * mapped by remapChannels(), and other rates are resampled at the best quality.
+ */
+inline std::shared_ptr<PcmSample> convertSample(std::vector<float>&& source, AudioFormat sourceFormat, AudioFormat format)
+{
+	auto sample = std::make_shared<PcmSample>();
+	sample->format = format;
+	if (sourceFormat == format)
+	{
+		sample->samples = std::move(source);
+		sample->samples.shrink_to_fit();
+		return sample;
+	}
+
+	auto sourceFrames = source.size() / sourceFormat.channels;
+	if (sourceFrames == 0)
+	{
+		return sample;
+	}
+	if (sourceFormat.sampleRate == format.sampleRate)
+	{
+		sample->samples.resize(sourceFrames * format.channels);
+		remapChannels(source.data(), sourceFormat.channels, sample->samples.data(), format.channels, sourceFrames);
+		return sample;
+	}
+	auto step = (double)sourceFormat.sampleRate / format.sampleRate;
+	auto frames = (size_t)((double)sourceFrames / step);
+	Resampler resampler(sourceFormat.channels, Resampler::Quality::best);
+	resampler.setStep(step);
+	// Silence around the clip, for the kernel to read past its ends.
+	auto before = resampler.getFramesBefore();
+	std::vector<float> padded((before + sourceFrames + resampler.getFramesAfter() + 1) * sourceFormat.channels, 0.0f);
+	std::copy(source.begin(), source.begin() + sourceFrames * sourceFormat.channels, padded.begin() + before * sourceFormat.channels);
+	std::vector<float> resampled(frames * sourceFormat.channels);
+	for (size_t i = 0; i < frames; i++)
+	{
+		auto position = i * step;
+		auto index = std::min((size_t)position, sourceFrames - 1);
+		resampler.interpolate(padded.data() + (before + index) * sourceFormat.channels, position - (double)index,
+			resampled.data() + i * sourceFormat.channels);
+	}
+	if (sourceFormat.channels == format.channels)
+	{
+		sample->samples = std::move(resampled);
+	}
+	else
+	{
+		sample->samples.resize(frames * format.channels);
+		remapChannels(resampled.data(), sourceFormat.channels, sample->samples.data(), format.channels, frames);
+	}
+	return sample;
+}
+
+struct PcmCacheMetrics
+{
+	uint64_t hits;
+	uint64_t misses;
+	uint64_t insertions;
+	uint64_t evictions;
+	// Evictions made because the system ran low on memory.
+	uint64_t pressureEvictions;
+	size_t residentBytes;
+	size_t budgetBytes;
+	size_t entries;
+};
+
+// Decoded audio shared by every player in the process, so that short sources
+// played again and again are decoded once. Entries are keyed by the identity
+// of the source and the format they were converted to, and the least recently
+// used are evicted once the cache holds more than its budget.
+//
+// Evicting an entry only drops the cache's reference: players still playing
+// it keep it alive.
+class PcmCache
+{
+public:
+	static constexpr size_t kDefaultBudgetBytes = 64 * 1024 * 1024;
+
+	explicit PcmCache(size_t budgetBytes = kDefaultBudgetBytes)
+		: budgetBytes(budgetBytes)
+	{
+#ifdef _WIN32
+		lowMemory = CreateMemoryResourceNotification(LowMemoryResourceNotification);
+#endif
+	}
+
+	~PcmCache()
+	{
+#ifdef _WIN32
+		if (lowMemory)
+		{
+			CloseHandle(lowMemory);
+		}
+#endif
+	}
+
+	// Prevent copying.
+	PcmCache(PcmCache const&) = delete;
+	PcmCache& operator=(PcmCache const&) = delete;
+
+	/**
+	 * Identifies |source| converted into |format|. Local files are identified by
+	 * their path, size and modification time, so that an entry is not used once
+	 * the file changes.
+	 */
+	static std::string makeKey(const AudioSourceSpec& source, AudioFormat format)
+	{
+		std::string key{};
+		if (source.type == AudioSourceSpec::Type::silence)
+		{
+			key = "silence:" + std::to_string(source.durationUs);
+		}
+		else if (auto path = uriToPath(source.uri))
+		{
+			key = *path;
+			if (auto stamp = MappedFile::stat(*path))
+			{
+				key += "#" + std::to_string(stamp->size) + ":" + std::to_string(stamp->modifiedTime);
+			}
+		}
+		else
+		{
+			key = source.uri;
+		}
+		return key + "@" + std::to_string(format.sampleRate) + "/" + std::to_string(format.channels);
+	}
+
+	/// Returns the entry for |key| and marks it as the most recently used, or
+	/// nullptr.
+	std::shared_ptr<const PcmSample> find(const std::string& key)
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		auto it = index.find(key);
+		if (it == index.end())
+		{
+			misses++;
+			return nullptr;
+		}
+		hits++;
+		entries.splice(entries.begin(), entries, it->second);
+		return it->second->sample;
+	}
+
+	/// Keeps |sample| under |key|, evicting the least recently used entries
+	/// to stay within the budget. Samples larger than getMaxEntryBytes() are
+	/// not kept.
+	void insert(const std::string& key, std::shared_ptr<const PcmSample> sample)
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		if (!sample || sample->bytes() > maxEntryBytesLocked())
+		{
+			return;
+		}
+		auto it = index.find(key);
+		if (it != index.end())
+		{
+			residentBytes -= it->second->sample->bytes();
+			entries.erase(it->second);
+		}
+		entries.push_front(Entry{ key, sample });
+		index[key] = entries.begin();
+		residentBytes += sample->bytes();
+		insertions++;
+
+		if (isMemoryLow())
+		{
+			pressureEvictions += evictLocked(budgetBytes / 2);
+		}
+		evictions += evictLocked(budgetBytes);
+	}
+
+	/// The largest entry kept, a quarter of the budget, so that one long
+	/// source does not flush everything else.
+	size_t getMaxEntryBytes()
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		return maxEntryBytesLocked();
+	}
+
+	void setBudget(size_t bytes)
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		budgetBytes = bytes;
+		evictions += evictLocked(budgetBytes);
+	}
+
+	/// Evicts entries until at most |bytes| are resident. Called when the
+	/// system is low on memory.
+	void trim(size_t bytes)
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		pressureEvictions += evictLocked(bytes);
+	}
+
+	void clear()
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		evictions += evictLocked(0);
+	}
+
+	PcmCacheMetrics getMetrics()
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		return PcmCacheMetrics{ hits, misses, insertions, evictions, pressureEvictions, residentBytes, budgetBytes, entries.size() };
+	}
+
+private:
+	struct Entry
+	{
+		std::string key;
+		std::shared_ptr<const PcmSample> sample;
+	};
+
+	size_t maxEntryBytesLocked() const
+	{
+		return budgetBytes / 4;
+	}
+
+	/// Returns the number of entries evicted.
+	uint64_t evictLocked(size_t bytes)
+	{
+		uint64_t evicted = 0;
+		while (residentBytes > bytes && !entries.empty())
+		{
+			auto& entry = entries.back();
+			residentBytes -= entry.sample->bytes();
+			index.erase(entry.key);
+			entries.pop_back();
+			evicted++;
+		}
+		return evicted;
+	}
+
+	bool isMemoryLow() const
+	{
+#ifdef _WIN32
+		BOOL low = FALSE;
+		return lowMemory && QueryMemoryResourceNotification(lowMemory, &low) && low;
+#else
+		return false;
+#endif
+	}
+
+	std::mutex mutex;
+	size_t budgetBytes;
+	size_t residentBytes = 0;
+	// Most recently used first.
+	std::list<Entry> entries{};
+	std::unordered_map<std::string, std::list<Entry>::iterator> index{};
+	uint64_t hits = 0;
+	uint64_t misses = 0;
+	uint64_t insertions = 0;
+	uint64_t evictions = 0;
+	uint64_t pressureEvictions = 0;
+#ifdef _WIN32
+	HANDLE lowMemory = nullptr;
+#endif
+};
+
+// Plays a cached entry as if it were decoded.
+class PcmDecoder : public AudioDecoder
+{
+public:
+	explicit PcmDecoder(std::shared_ptr<const PcmSample> sample)
+		: sample(sample)
+	{
+	}
+
+	AudioFormat getFormat() const override
+	{
+		return sample->format;
+	}
+
+	std::optional<int64_t> getLength() const override
+	{
+		return (int64_t)sample->frames();
+	}
+
+	size_t read(float* output, size_t frames) override
+	{
+		auto channels = sample->format.channels;
+		auto count = (size_t)std::min<int64_t>((int64_t)frames, (int64_t)sample->frames() - position);
+		auto* input = sample->samples.data() + (size_t)position * channels;
+		std::copy(input, input + count * channels, output);
+		position += (int64_t)count;
+		return count;
+	}
+
+	bool seek(int64_t frame) override
+	{
+		position = std::clamp<int64_t>(frame, 0, (int64_t)sample->frames());
+		return true;
+	}
+
+private:
+	std::shared_ptr<const PcmSample> sample;
+	int64_t position = 0;
+};
+
+// Keeps what another decoder decodes, and hands it over once the source has
+// been read from start to end. Seeking anywhere but the position reached
+// stops recording, since the result would have gaps.
+class RecordingDecoder : public AudioDecoder
+{
+public:
+	using Callback = std::function<void(std::vector<float>&& samples, AudioFormat format)>;
+
+	/// Records at most |maxFrames| frames; longer sources are not handed over.
+	RecordingDecoder(std::unique_ptr<AudioDecoder> decoder, size_t maxFrames, Callback onRecorded)
+		: decoder(std::move(decoder)), maxFrames(maxFrames), onRecorded(onRecorded)
+	{
+	}
+
+	AudioFormat getFormat() const override
+	{
+		return decoder->getFormat();
+	}
+
+	std::optional<int64_t> getLength() const override
+	{
+		return decoder->getLength();
+	}
+
+	size_t read(float* output, size_t frames) override
+	{
+		auto count = decoder->read(output, frames);
+		auto channels = decoder->getFormat().channels;
+		if (recording)
+		{
+			if (count == 0)
+			{
+				recording = false;
+				onRecorded(std::move(recorded), decoder->getFormat());
+			}
+			else if (recorded.size() / channels + count > maxFrames)
+			{
+				stopRecording();
+			}
+			else
+			{
+				recorded.insert(recorded.end(), output, output + count * channels);
+			}
+		}
+		position += (int64_t)count;
+		return count;
+	}
+
+	bool seek(int64_t frame) override
+	{
+		if (!decoder->seek(frame))
+		{
+			return false;
+		}
+		if (frame != position)
+		{
+			stopRecording();
+		}
+		position = frame;
+		return true;
+	}
+
+private:
+	void stopRecording()
+	{
+		recording = false;
+		recorded = std::vector<float>();
+	}
+
+	std::unique_ptr<AudioDecoder> decoder;
+	size_t maxFrames;
+	Callback onRecorded;
+	bool recording = true;
+	std::vector<float> recorded{};
+	int64_t position = 0;
+};
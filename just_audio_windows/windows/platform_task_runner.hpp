@@ -0,0 +1,81 @@
+#pragma once
+
+// This must be included before many other Windows headers.
+#include <windows.h>
+
+#include <flutter/plugin_registrar_windows.h>
+
+#include <functional>
+#include <mutex>
+#include <optional>
+#include <vector>
+
+// Runs tasks on the platform thread, where method results and events must be
+// sent from. Work done on other threads posts its completion here.
+//
+// Tasks are queued and the top-level Flutter window is woken with a private
+// message, which a window procedure delegate handles on the platform thread.
+class PlatformTaskRunner
+{
+public:
+	explicit PlatformTaskRunner(flutter::PluginRegistrarWindows* registrar)
+		: registrar(registrar)
+	{
+		message = RegisterWindowMessageW(L"just_audio_windows.PlatformTask");
+		delegateId = registrar->RegisterTopLevelWindowProcDelegate(
+			[this](HWND, UINT message, WPARAM, LPARAM) -> std::optional<LRESULT>
+			{
+				if (message != this->message)
+				{
+					return std::nullopt;
+				}
+				runPending();
+				return 0;
+			});
+	}
+
+	~PlatformTaskRunner()
+	{
+		registrar->UnregisterTopLevelWindowProcDelegate(delegateId);
+	}
+
+	// Prevent copying.
+	PlatformTaskRunner(PlatformTaskRunner const&) = delete;
+	PlatformTaskRunner& operator=(PlatformTaskRunner const&) = delete;
+
+	/// Queues |task| to run on the platform thread. Safe to call from any thread.
+	void post(std::function<void()> task)
+	{
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			tasks.push_back(std::move(task));
+		}
+
+		auto view = registrar->GetView();
+		if (!view || !PostMessageW(GetAncestor(view->GetNativeWindow(), GA_ROOT), message, 0, 0))
+		{
+			// Without a window there is no platform thread to wake.
+			runPending();
+		}
+	}
+
+private:
+	void runPending()
+	{
+		std::vector<std::function<void()>> pending{};
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			pending.swap(tasks);
+		}
+		for (auto& task : pending)
+		{
+			task();
+		}
+	}
+
+	flutter::PluginRegistrarWindows* registrar;
+	UINT message;
+	int delegateId;
+	std::mutex mutex;
+	std::vector<std::function<void()>> tasks{};
+};
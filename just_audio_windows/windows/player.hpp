@@ -15,12 +15,32 @@
 #include <winrt/Windows.Media.Audio.h>
 #include <winrt/Windows.Media.Core.h>
 #include <winrt/Windows.Media.Playback.h>
+#include <winrt/Windows.Media.Streaming.Adaptive.h>
 #include <winrt/Windows.System.h>
+#include <winrt/Windows.System.Threading.h>
 #include <winrt/Windows.Media.Devices.h>
 #include <winrt/Windows.Devices.Enumeration.h>
 #include <ppltasks.h>
+#include <atomic>
+#include <deque>
+#include <filesystem>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <set>
 #include <string>
 
+#include "adaptive_bitrate.hpp"
+#include "audio_backend.hpp"
+#include "audio_decoder.hpp"
+#include "buffering_controller.hpp"
+#include "icy_metadata.hpp"
+#include "live_stream.hpp"
+#include "loudness_enhancer.hpp"
+#include "mp3_seek_index.hpp"
+#include "platform_task_runner.hpp"
+#include "timeshift_buffer.hpp"
+
 
 
 #define TO_MILLISECONDS(timespan) timespan.count() / 10000
@@ -36,6 +56,8 @@ using namespace concurrency;
 
 
 using winrt::Windows::Media::Core::MediaSource;
+using winrt::Windows::Media::Streaming::Adaptive::AdaptiveMediaSource;
+using winrt::Windows::Media::Streaming::Adaptive::AdaptiveMediaSourceCreationResult;
 
 // Looks for |key| in |map|, returning the associated value if it is present, or
 // a nullptr if not.
@@ -64,6 +86,120 @@ const EncodableValue* ValueOrNull(const EncodableMap& map, const char* key)
 	return &(it->second);
 }
 
+// Looks for the int |key| in |map|. Dart sends ints as int32_t or int64_t
+// depending on their size; anything else is treated as absent.
+std::optional<int64_t> LongValueOrNull(const EncodableMap& map, const char* key)
+{
+	const auto* value = ValueOrNull(map, key);
+	if (value == nullptr || !(std::holds_alternative<int32_t>(*value) || std::holds_alternative<int64_t>(*value)))
+	{
+		return std::nullopt;
+	}
+	return value->LongValue();
+}
+
+// Replies to |method|, which only the software backend implements, with an
+// "unsupported" error, rather than succeeding without changing anything.
+void ReplyUnsupported(flutter::MethodResult<flutter::EncodableValue>& result, const std::string& method)
+{
+	result.Error("unsupported", method + " is unsupported on this backend; pass softwareBackend to init to use it");
+}
+
+// Converts an audio source message into an AudioSourceSpec, throwing
+// std::invalid_argument if it is malformed.
+AudioSourceSpec ParseAudioSource(const EncodableMap& map)
+{
+	const auto* type = std::get_if<std::string>(ValueOrNull(map, "type"));
+	if (!type)
+	{
+		throw std::invalid_argument("audio source type missing");
+	}
+
+	AudioSourceSpec source{};
+	if (const auto* id = std::get_if<std::string>(ValueOrNull(map, "id")))
+	{
+		source.id = *id;
+	}
+
+	if (type->compare("progressive") == 0 || type->compare("dash") == 0 || type->compare("hls") == 0)
+	{
+		source.type = type->compare("progressive") == 0 ? AudioSourceSpec::Type::progressive
+			: type->compare("dash") == 0 ? AudioSourceSpec::Type::dash
+			: AudioSourceSpec::Type::hls;
+		const auto* uri = std::get_if<std::string>(ValueOrNull(map, "uri"));
+		if (!uri)
+		{
+			throw std::invalid_argument("audio source uri missing");
+		}
+		source.uri = *uri;
+		if (const auto* headers = std::get_if<EncodableMap>(ValueOrNull(map, "headers")))
+		{
+			for (auto& [key, value] : *headers)
+			{
+				const auto* name = std::get_if<std::string>(&key);
+				const auto* text = std::get_if<std::string>(&value);
+				if (name && text)
+				{
+					source.headers[*name] = *text;
+				}
+			}
+		}
+	}
+	else if (type->compare("silence") == 0)
+	{
+		source.type = AudioSourceSpec::Type::silence;
+		source.durationUs = LongValueOrNull(map, "duration").value_or(0);
+	}
+	else if (type->compare("concatenating") == 0)
+	{
+		source.type = AudioSourceSpec::Type::concatenating;
+		if (const auto* children = std::get_if<flutter::EncodableList>(ValueOrNull(map, "children")))
+		{
+			for (auto& child : *children)
+			{
+				const auto* childMap = std::get_if<EncodableMap>(&child);
+				if (!childMap)
+				{
+					throw std::invalid_argument("audio source child is not a map");
+				}
+				source.children.push_back(ParseAudioSource(*childMap));
+			}
+		}
+		if (const auto* shuffleOrder = std::get_if<flutter::EncodableList>(ValueOrNull(map, "shuffleOrder")))
+		{
+			for (auto& index : *shuffleOrder)
+			{
+				source.shuffleOrder.push_back((int32_t)index.LongValue());
+			}
+		}
+	}
+	else if (type->compare("clipping") == 0 || type->compare("looping") == 0)
+	{
+		const auto* child = std::get_if<EncodableMap>(ValueOrNull(map, "child"));
+		if (!child)
+		{
+			throw std::invalid_argument("audio source child missing");
+		}
+		source.children.push_back(ParseAudioSource(*child));
+		if (type->compare("clipping") == 0)
+		{
+			source.type = AudioSourceSpec::Type::clipping;
+			source.startUs = LongValueOrNull(map, "start");
+			source.endUs = LongValueOrNull(map, "end");
+		}
+		else
+		{
+			source.type = AudioSourceSpec::Type::looping;
+			source.count = (int32_t)LongValueOrNull(map, "count").value_or(1);
+		}
+	}
+	else
+	{
+		throw std::invalid_argument("Source is unsupported: " + *type);
+	}
+	return source;
+}
+
 // Converts a std::string to std::wstring
 auto TO_WIDESTRING = [](std::string string) -> std::wstring
 	{
@@ -152,6 +288,86 @@ public:
 	std::unique_ptr<AudioEventSink> event_sink_ = nullptr;
 	std::unique_ptr<AudioEventSink> data_sink_ = nullptr;
 
+	// Completes loads whose sources open off the platform thread. See
+	// prepareSources. |lifetime| expires with the player, for completions
+	// that arrive after it closed.
+	std::shared_ptr<PlatformTaskRunner> taskRunner = nullptr;
+	std::shared_ptr<bool> lifetime = std::make_shared<bool>(true);
+	uint64_t loadSerial = 0;
+	// Changes to the playlist apply in the order they were called, though a
+	// load or insertion first opens its sources. While one is being prepared,
+	// |preparingPlaylistChange| is set and the changes called after it wait in
+	// |playlistChanges|. A new load drops those, calling each with false.
+	bool preparingPlaylistChange = false;
+	std::deque<std::function<void(bool current)>> playlistChanges{};
+	// The sources opened for the load or insertion being completed, by URI,
+	// for createMediaSource to take.
+	std::multimap<std::string, AdaptiveMediaSourceCreationResult> preparedAdaptiveSources{};
+	std::multimap<std::string, LiveConnection> preparedLiveConnections{};
+
+	// Adaptive bitrate state, shared by every adaptive source of this player.
+	// Segment downloads complete on background threads.
+	std::mutex bitrateMutex;
+	BandwidthEstimator bandwidthEstimator{};
+	RenditionSelector renditionSelector{};
+	bool automaticallyWaitsToMinimizeStalling = true;
+	// Unless set, live streams stop loading while paused, as on Darwin.
+	// |liveLoadingPaused| is read on the threads reading the streams.
+	bool canUseNetworkResourcesForLiveStreamingWhilePaused = false;
+	std::atomic<bool> liveLoadingPaused = false;
+
+	// ICY metadata of the most recently opened live stream. Metadata blocks are
+	// parsed on background threads. Progressive http(s) sources are only
+	// probed for ICY headers if they are known to be streams, or every one
+	// of them with |icyProbeEnabled|; see setIcyProbe.
+	bool icyProbeEnabled = false;
+	std::set<std::string> knownStreams{};
+	std::mutex icyMutex;
+	std::optional<IcyHeaders> icyHeaders{};
+	std::optional<IcyInfo> icyInfo{};
+
+	// Opt-in recording of a single live stream, so that it can be paused and
+	// rewound. See setTimeshift.
+	bool timeshiftEnabled = false;
+	uint64_t timeshiftCapacity = 64 * 1024 * 1024;
+	double timeshiftCatchUpSpeed = 1.0;
+	int timeshiftCount = 0;
+	winrt::hstring timeshiftContentType{};
+	std::shared_ptr<TimeshiftBuffer> timeshiftBuffer = nullptr;
+	std::unique_ptr<TimeshiftRecorder> timeshiftRecorder = nullptr;
+	winrt::com_ptr<TimeshiftStream> timeshiftStream = nullptr;
+	std::atomic<bool> catchingUp = false;
+	float speed = 1.0f;
+
+	// Exact seeking in a single local MP3 file, through an index built in the
+	// background. Once seeked through the index, the file plays from the frame
+	// found, and positions count from |indexedStartUs|; |indexedItem| is the
+	// item loaded, played again when a seek falls back to the decoder. See
+	// seekIndexed.
+	std::shared_ptr<Mp3SeekIndexer> seekIndexer = nullptr;
+	std::optional<std::string> indexedPath{};
+	Playback::MediaPlaybackItem indexedItem{ nullptr };
+	winrt::com_ptr<FileRangeStream> indexedStream = nullptr;
+	int64_t indexedStartUs = 0;
+	int64_t indexedDurationUs = 0;
+
+	// Buffering policy of the load configuration passed to init. While
+	// |waitingForBuffer|, playback is held back until enough is buffered;
+	// |bufferTimer| re-evaluates the buffer in case no event arrives.
+	std::mutex bufferingMutex;
+	BufferingController bufferingController{};
+	std::atomic<bool> playWhenReady = false;
+	std::atomic<bool> waitingForBuffer = false;
+	std::atomic<bool> seeking = false;
+	std::chrono::steady_clock::time_point bufferWaitStart{};
+	// Set when the player reports the end of the media, and cleared once it
+	// plays, seeks or loads again.
+	std::atomic<bool> ended = false;
+	winrt::Windows::System::Threading::ThreadPoolTimer bufferTimer = nullptr;
+
+	// Plays instead of |mediaPlayer| when set. See setBackend.
+	std::unique_ptr<AudioBackend> backend = nullptr;
+
 	AudioPlayer(std::string idx, flutter::BinaryMessenger* messenger)
 	{
 		id = idx;
@@ -176,7 +392,27 @@ public:
 		/// Set up event callbacks
 		// Playback event
 		mediaPlayer.PlaybackSession().PlaybackStateChanged([=](auto, const auto& args) -> void
-			{ broadcastState(); });
+			{
+				if (mediaPlayer.PlaybackSession().PlaybackState() == Playback::MediaPlaybackState::Playing)
+				{
+					ended = false;
+				}
+				evaluateBuffer();
+				broadcastState(); });
+		mediaPlayer.MediaEnded([=](auto, const auto& args) -> void
+			{
+				ended = true;
+				broadcastState(); });
+
+		// Buffering events
+		mediaPlayer.PlaybackSession().BufferingStarted([=](auto, const auto& args) -> void
+			{ onBufferingStarted(); });
+		mediaPlayer.PlaybackSession().BufferingEnded([=](auto, const auto& args) -> void
+			{ evaluateBuffer(); });
+		mediaPlayer.PlaybackSession().BufferedRangesChanged([=](auto, const auto& args) -> void
+			{ evaluateBuffer(); });
+		mediaPlayer.PlaybackSession().SeekCompleted([=](auto, const auto& args) -> void
+			{ seeking = false; });
 
 		// Player error event
 		mediaPlayer.MediaFailed([=](auto, const Playback::MediaPlayerFailedEventArgs& args) -> void
@@ -239,10 +475,31 @@ public:
 
 				event_sink_->Error(code, message); });
 	}
+
+	/// Seeks in local MP3 files through the indexes built by |indexer|.
+	void setSeekIndexer(std::shared_ptr<Mp3SeekIndexer> indexer)
+	{
+		seekIndexer = indexer;
+	}
+
+	/// Completes loads of DASH and HLS sources through |runner| once their
+	/// manifests are open. Without it, they play without this player's
+	/// rendition selection.
+	void setTaskRunner(std::shared_ptr<PlatformTaskRunner> runner)
+	{
+		taskRunner = runner;
+	}
+
 	~AudioPlayer()
 	{
-		mediaPlayer.Close();
 		closed = true;
+		if (backend)
+		{
+			backend->dispose();
+		}
+		stopBufferTimer();
+		mediaPlayer.Close();
+		stopTimeshift();
 	}
 
 	bool HasPlayerId(std::string playerId)
@@ -258,41 +515,71 @@ public:
 
 		std::cerr << "[just_audio_windows] Called " << method_call.method_name() << std::endl;
 
+		if (backend && handleBackendMethodCall(method_call.method_name(), *args, result))
+		{
+			return;
+		}
+
 		if (method_call.method_name().compare("load") == 0)
 		{
 			const auto* audioSourceData = std::get_if<flutter::EncodableMap>(ValueOrNull(*args, "audioSource"));
-			const auto* initialPosition = std::get_if<int>(ValueOrNull(*args, "initialPosition"));
+			auto initialPosition = LongValueOrNull(*args, "initialPosition");
 			const auto* initialIndex = std::get_if<int>(ValueOrNull(*args, "initialIndex"));
-
-			try
-			{
-				loadSource(*audioSourceData);
-			}
-			catch (char* error)
+			auto index = initialIndex ? std::optional<int>(*initialIndex) : std::nullopt;
+
+			// A later load replaces this one if it comes before the sources
+			// are open, and the changes waiting for the playlist it replaces
+			// no longer apply.
+			auto serial = ++loadSerial;
+			auto dropped = std::move(playlistChanges);
+			playlistChanges.clear();
+			for (auto& change : dropped)
 			{
-				return result->Error("load_error", error);
+				change(false);
 			}
+			preparingPlaylistChange = true;
 
-			if (initialIndex != nullptr)
-			{
-				seekToItem((uint32_t)*initialIndex);
-			}
+			SourceRequests requests{};
+			collectSources(*audioSourceData, requests);
+			std::shared_ptr<flutter::MethodResult<flutter::EncodableValue>> sharedResult = std::move(result);
+			prepareSources(requests, [this, source = *audioSourceData, initialPosition, index, serial, sharedResult](bool alive)
+				{
+					if (!alive || serial != loadSerial)
+					{
+						return sharedResult->Error("abort", "Loading interrupted");
+					}
 
-			if (initialPosition != nullptr)
-			{
-				seekToPosition(*initialPosition);
-			}
+					try
+					{
+						loadSource(source);
+					}
+					catch (char* error)
+					{
+						sharedResult->Error("load_error", error);
+						return finishPlaylistChange();
+					}
 
-			result->Success(flutter::EncodableMap());
+					if (index)
+					{
+						seekToItem((uint32_t)*index);
+					}
+
+					if (initialPosition)
+					{
+						seekToPosition(*initialPosition);
+					}
+
+					sharedResult->Success(flutter::EncodableMap());
+					finishPlaylistChange(); });
 		}
 		else if (method_call.method_name().compare("play") == 0)
 		{
-			mediaPlayer.Play();
+			play();
 			result->Success(flutter::EncodableMap());
 		}
 		else if (method_call.method_name().compare("pause") == 0)
 		{
-			mediaPlayer.Pause();
+			pause();
 			result->Success(flutter::EncodableMap());
 		}
 		else if (method_call.method_name().compare("setVolume") == 0)
@@ -334,15 +621,38 @@ public:
 				return result->Error("speed_error", "speed argument missing");
 			}
 			float speedFloat = (float)*speed;
-			mediaPlayer.PlaybackRate(speedFloat);
+			this->speed = speedFloat;
+			if (!catchingUp)
+			{
+				mediaPlayer.PlaybackRate(speedFloat);
+			}
 			result->Success(flutter::EncodableMap());
 		}
 		else if (method_call.method_name().compare("setPitch") == 0)
 		{
+			const auto* pitch = std::get_if<double>(ValueOrNull(*args, "pitch"));
+			if (!pitch)
+			{
+				return result->Error("pitch_error", "pitch argument missing");
+			}
+			// Only the pitch the Media Player already plays at succeeds.
+			if (*pitch != 1.0)
+			{
+				return ReplyUnsupported(*result, "setPitch");
+			}
 			result->Success(flutter::EncodableMap());
 		}
 		else if (method_call.method_name().compare("setSkipSilence") == 0)
 		{
+			const auto* enabled = std::get_if<bool>(ValueOrNull(*args, "enabled"));
+			if (!enabled)
+			{
+				return result->Error("skipSilence_error", "enabled argument missing");
+			}
+			if (*enabled)
+			{
+				return ReplyUnsupported(*result, "setSkipSilence");
+			}
 			result->Success(flutter::EncodableMap());
 		}
 		else if (method_call.method_name().compare("setLoopMode") == 0)
@@ -362,6 +672,11 @@ public:
 			case 1: // one
 				mediaPlayer.IsLoopingEnabled(true);
 				mediaPlaybackList.AutoRepeatEnabled(false);
+				if (indexedStream)
+				{
+					// Looping would restart from the frame seeked to.
+					seekToPosition(getPosition());
+				}
 				break;
 			case 2: // all
 				mediaPlayer.IsLoopingEnabled(false);
@@ -405,14 +720,43 @@ public:
 		}
 		else if (method_call.method_name().compare("setAutomaticallyWaitsToMinimizeStalling") == 0)
 		{
+			const auto* enabled = std::get_if<bool>(ValueOrNull(*args, "enabled"));
+			if (!enabled)
+			{
+				return result->Error("automaticallyWaitsToMinimizeStalling_error", "enabled argument missing");
+			}
+			{
+				std::lock_guard<std::mutex> lock(bitrateMutex);
+				automaticallyWaitsToMinimizeStalling = *enabled;
+				renditionSelector.setConservative(*enabled);
+			}
 			result->Success(flutter::EncodableMap());
 		}
 		else if (method_call.method_name().compare("setCanUseNetworkResourcesForLiveStreamingWhilePaused") == 0)
 		{
+			const auto* enabled = std::get_if<bool>(ValueOrNull(*args, "enabled"));
+			if (!enabled)
+			{
+				return result->Error("canUseNetworkResourcesForLiveStreamingWhilePaused_error", "enabled argument missing");
+			}
+			setCanUseNetworkResourcesForLiveStreamingWhilePaused(*enabled);
 			result->Success(flutter::EncodableMap());
 		}
 		else if (method_call.method_name().compare("setPreferredPeakBitRate") == 0)
 		{
+			const auto* bitRate = std::get_if<double>(ValueOrNull(*args, "bitRate"));
+			if (!bitRate)
+			{
+				return result->Error("preferredPeakBitRate_error", "bitRate argument missing");
+			}
+			{
+				std::lock_guard<std::mutex> lock(bitrateMutex);
+				renditionSelector.setPreferredPeakBitRate(*bitRate > 0 ? (uint64_t)*bitRate : 0);
+			}
+			for (auto& adaptiveSource : getAdaptiveSources())
+			{
+				selectRendition(adaptiveSource);
+			}
 			result->Success(flutter::EncodableMap());
 		}
 		else if (method_call.method_name().compare("seek") == 0)
@@ -423,10 +767,18 @@ public:
 				seekToItem((uint32_t)*index);
 			}
 
-			const auto* position = std::get_if<int>(ValueOrNull(*args, "position"));
-			if (position != nullptr)
+			// Positions past 35 minutes do not fit in an int.
+			auto position = LongValueOrNull(*args, "position");
+			if (position)
 			{
-				seekToPosition(*position);
+				if (timeshiftBuffer)
+				{
+					seekTimeshift(*position);
+				}
+				else
+				{
+					seekToPosition(*position);
+				}
 			}
 			result->Success(flutter::EncodableMap());
 		}
@@ -435,70 +787,104 @@ public:
 			const auto* index = std::get_if<int>(ValueOrNull(*args, "index"));
 			const auto* children = std::get_if<flutter::EncodableList>(ValueOrNull(*args, "children"));
 
-			auto items = mediaPlaybackList.Items();
+			std::shared_ptr<flutter::MethodResult<flutter::EncodableValue>> sharedResult = std::move(result);
+			queuePlaylistChange([this, index = *index, children = *children, sharedResult](bool current)
+				{
+					if (!current)
+					{
+						return sharedResult->Error("abort", "Loading interrupted");
+					}
 
-			int currentIndex = *index;
-			for (auto& child : *children)
-			{
-				const auto* childMap = std::get_if<flutter::EncodableMap>(&child);
-				auto mediaSource = createMediaPlaybackItem(*childMap);
-				auto item = Playback::MediaPlaybackItem(mediaSource);
+					auto serial = loadSerial;
+					SourceRequests requests{};
+					for (auto& child : children)
+					{
+						collectSources(*std::get_if<flutter::EncodableMap>(&child), requests);
+					}
+					preparingPlaylistChange = true;
+					prepareSources(requests, [this, index, children, serial, sharedResult](bool alive)
+						{
+							// The items belong to a playlist that was replaced meanwhile.
+							if (!alive || serial != loadSerial)
+							{
+								return sharedResult->Error("abort", "Loading interrupted");
+							}
 
-				items.InsertAt(currentIndex, item);
-				currentIndex++;
-			}
+							auto items = mediaPlaybackList.Items();
 
-			result->Success(flutter::EncodableMap());
+							int currentIndex = index;
+							for (auto& child : children)
+							{
+								const auto* childMap = std::get_if<flutter::EncodableMap>(&child);
+								auto mediaSource = createMediaPlaybackItem(*childMap);
+								auto item = Playback::MediaPlaybackItem(mediaSource);
+
+								items.InsertAt(currentIndex, item);
+								currentIndex++;
+							}
+
+							sharedResult->Success(flutter::EncodableMap());
+							finishPlaylistChange(); }); });
 		}
 		else if (method_call.method_name().compare("concatenatingRemoveRange") == 0)
 		{
 			const auto* start = std::get_if<int>(ValueOrNull(*args, "startIndex"));
 			const auto* end = std::get_if<int>(ValueOrNull(*args, "endIndex")); // Does not include this item
 
-			int startIndex = *start;
-			int endIndex = *end;
+			std::shared_ptr<flutter::MethodResult<flutter::EncodableValue>> sharedResult = std::move(result);
+			// The indices count the items inserted before this call.
+			queuePlaylistChange([this, startIndex = *start, endIndex = *end, sharedResult](bool current)
+				{
+					if (!current)
+					{
+						return sharedResult->Error("abort", "Loading interrupted");
+					}
 
-			auto items = mediaPlaybackList.Items();
-			auto size = (int)items.Size();
+					auto items = mediaPlaybackList.Items();
+					auto size = (int)items.Size();
 
-			if (endIndex > startIndex && startIndex >= 0 && endIndex <= size)
-			{
-				int count = endIndex - startIndex;
+					if (endIndex > startIndex && startIndex >= 0 && endIndex <= size)
+					{
+						int count = endIndex - startIndex;
 
-				for (int i = 0; i < count; i++)
-				{
-					// The item to remove should always be located at `startIndex`.
-					items.RemoveAt(startIndex);
-				}
-				return result->Success(flutter::EncodableMap());
-			}
-			else
-			{
-				return result->Error("concatenatingRemoveRange_error", "invalid range");
-			}
+						for (int i = 0; i < count; i++)
+						{
+							// The item to remove should always be located at `startIndex`.
+							items.RemoveAt(startIndex);
+						}
+						return sharedResult->Success(flutter::EncodableMap());
+					}
+					else
+					{
+						return sharedResult->Error("concatenatingRemoveRange_error", "invalid range");
+					} });
 		}
 		else if (method_call.method_name().compare("concatenatingMove") == 0)
 		{
 			const auto* from = std::get_if<int>(ValueOrNull(*args, "currentIndex"));
 			const auto* to = std::get_if<int>(ValueOrNull(*args, "newIndex"));
 
-			auto items = mediaPlaybackList.Items();
-			auto size = (int)items.Size();
-
-			int currentIndex = *from;
-			int newIndex = *to;
-
-			auto item = items.GetAt(currentIndex);
+			std::shared_ptr<flutter::MethodResult<flutter::EncodableValue>> sharedResult = std::move(result);
+			queuePlaylistChange([this, currentIndex = *from, newIndex = *to, sharedResult](bool current)
+				{
+					if (!current)
+					{
+						return sharedResult->Error("abort", "Loading interrupted");
+					}
 
-			if (currentIndex >= size || newIndex > size)
-			{
-				return result->Error("concatenatingMove_error", "index out of bounds");
-			}
+					auto items = mediaPlaybackList.Items();
+					auto size = (int)items.Size();
 
-			items.RemoveAt(currentIndex);
-			items.InsertAt(newIndex, item);
-			// Do nothing if the two equals
-			result->Success(flutter::EncodableMap());
+					if (currentIndex < 0 || currentIndex >= size || newIndex < 0 || newIndex > size)
+					{
+						return sharedResult->Error("concatenatingMove_error", "index out of bounds");
+					}
+
+					auto item = items.GetAt(currentIndex);
+					items.RemoveAt(currentIndex);
+					items.InsertAt(newIndex, item);
+					// Do nothing if the two equals
+					sharedResult->Success(flutter::EncodableMap()); });
 		}
 		else if (method_call.method_name().compare("setAndroidAudioAttributes") == 0)
 		{
@@ -506,24 +892,76 @@ public:
 		}
 		else if (method_call.method_name().compare("audioEffectSetEnabled") == 0)
 		{
+			const auto* type = std::get_if<std::string>(ValueOrNull(*args, "type"));
+			const auto* enabled = std::get_if<bool>(ValueOrNull(*args, "enabled"));
+			if (!type || !enabled)
+			{
+				return result->Error("audioEffect_error", "type or enabled argument missing");
+			}
+			// Turning an effect off is what the Media Player does already.
+			if (*enabled && (type->compare("AndroidEqualizer") == 0 || type->compare("AndroidLoudnessEnhancer") == 0))
+			{
+				return ReplyUnsupported(*result, *type);
+			}
 			result->Success(flutter::EncodableMap());
 		}
 		else if (method_call.method_name().compare("androidLoudnessEnhancerSetTargetGain") == 0)
 		{
-			result->Success(flutter::EncodableMap());
+			ReplyUnsupported(*result, "androidLoudnessEnhancerSetTargetGain");
 		}
 		else if (method_call.method_name().compare("androidEqualizerGetParameters") == 0)
 		{
-			result->Success(flutter::EncodableMap());
+			ReplyUnsupported(*result, "androidEqualizerGetParameters");
 		}
 		else if (method_call.method_name().compare("androidEqualizerBandSetGain") == 0)
 		{
+			ReplyUnsupported(*result, "androidEqualizerBandSetGain");
+		}
+		else if (method_call.method_name().compare("setTimeshift") == 0)
+		{
+			const auto* enabled = std::get_if<bool>(ValueOrNull(*args, "enabled"));
+			if (!enabled)
+			{
+				return result->Error("timeshift_error", "enabled argument missing");
+			}
+			timeshiftEnabled = *enabled;
+
+			const auto* capacity = ValueOrNull(*args, "capacity");
+			if (capacity && !capacity->IsNull())
+			{
+				if (capacity->LongValue() <= 0)
+				{
+					return result->Error("timeshift_error", "capacity must be positive");
+				}
+				timeshiftCapacity = (uint64_t)capacity->LongValue();
+			}
+
+			const auto* catchUpSpeed = std::get_if<double>(ValueOrNull(*args, "catchUpSpeed"));
+			if (catchUpSpeed)
+			{
+				timeshiftCatchUpSpeed = *catchUpSpeed;
+			}
+
+			// Takes effect on the next load.
+			result->Success(flutter::EncodableMap());
+		}
+		else if (method_call.method_name().compare("setIcyProbe") == 0)
+		{
+			const auto* enabled = std::get_if<bool>(ValueOrNull(*args, "enabled"));
+			if (!enabled)
+			{
+				return result->Error("icy_error", "enabled argument missing");
+			}
+			// Takes effect on the next load.
+			icyProbeEnabled = *enabled;
 			result->Success(flutter::EncodableMap());
 		}
 		else if (method_call.method_name().compare("dispose") == 0)
 		{
-			mediaPlayer.Close();
 			closed = true;
+			stopBufferTimer();
+			mediaPlayer.Close();
+			stopTimeshift();
 			result->Success(flutter::EncodableMap());
 		}
 		else if (method_call.method_name().compare("setOutputDevice") == 0)
@@ -623,93 +1061,1307 @@ public:
 		}
 	}
 
-	void loadSource(const flutter::EncodableMap& source) const&
+	/**
+	 * Makes |audioBackend| play instead of the MediaPlayer. Playback, playlist
+	 * and state commands go to the backend and its state is broadcast as
+	 * events; the features of the MediaPlayer path are not available.
+	 */
+	void setBackend(std::unique_ptr<AudioBackend> audioBackend)
 	{
-		auto items = mediaPlaybackList.Items();
-		items.Clear(); // Always clear the list since we are resetting
-
-		const std::string* type = std::get_if<std::string>(ValueOrNull(source, "type"));
-
-		if (type->compare("concatenating") == 0)
-		{
-			const auto* children = std::get_if<flutter::EncodableList>(ValueOrNull(source, "children"));
-
-			for (auto& child : *children)
+		backend = std::move(audioBackend);
+		backend->setStateListener([=]() -> void
+			{ broadcastBackendState(); });
+		backend->setErrorListener([=](const std::string& code, const std::string& message) -> void
 			{
-				const auto* childMap = std::get_if<flutter::EncodableMap>(&child);
-				auto item = createMediaPlaybackItem(*childMap);
-				items.Append(item);
-			}
+				std::cerr << "[just_audio_windows] Backend error: " << message << std::endl;
+				event_sink_->Error(code, message); });
+	}
 
-			mediaPlayer.Source(mediaPlaybackList.as<Playback::IMediaPlaybackSource>());
-		}
-		else
+	/// Keeps the backend in step with the other players of |group|, or lets
+	/// it go without one. Throws std::invalid_argument for players that play
+	/// through the MediaPlayer, which has no frames to keep in step.
+	void setSyncGroup(std::shared_ptr<SyncGroup> group)
+	{
+		if (!backend)
 		{
-			mediaPlayer.Source(createMediaPlaybackItem(source).as<Playback::IMediaPlaybackSource>());
+			throw std::invalid_argument("Only software backend players can join a sync group");
 		}
+		backend->setSyncGroup(group);
 	}
 
 	/**
-	 * Creates a single MediaPlaybackItem, which can be used directly or inside a list.
+	 * Handles |method| with the backend, returning false for methods that the
+	 * MediaPlayer path should handle.
 	 */
-	Playback::MediaPlaybackItem createMediaPlaybackItem(const flutter::EncodableMap& source) const&
+	bool handleBackendMethodCall(
+		const std::string& method,
+		const flutter::EncodableMap& args,
+		std::unique_ptr<flutter::MethodResult<flutter::EncodableValue>>& result)
 	{
-		const std::string* type = std::get_if<std::string>(ValueOrNull(source, "type"));
-
-		if (type->compare("clipping") == 0)
+		try
 		{
-			const auto* child = std::get_if<flutter::EncodableMap>(ValueOrNull(source, "child"));
-			auto childSource = createMediaSource(*child);
-
-			const auto* startUs = std::get_if<int32_t>(ValueOrNull(*child, "start"));
-			const auto* endUs = std::get_if<int32_t>(ValueOrNull(*child, "end"));
-
-			auto start = 0; // Default to 0
-			if (startUs != nullptr)
+			if (method.compare("load") == 0)
 			{
-				start = *startUs;
+				const auto* audioSourceData = std::get_if<flutter::EncodableMap>(ValueOrNull(args, "audioSource"));
+				if (!audioSourceData)
+				{
+					result->Error("load_error", "audioSource argument missing");
+					return true;
+				}
+				auto initialIndex = LongValueOrNull(args, "initialIndex");
+				backend->load(ParseAudioSource(*audioSourceData),
+					initialIndex ? std::optional<int32_t>((int32_t)*initialIndex) : std::nullopt,
+					LongValueOrNull(args, "initialPosition").value_or(0));
+				auto state = backend->getState();
+				auto response = flutter::EncodableMap();
+				if (state.durationUs)
+				{
+					response[flutter::EncodableValue("duration")] = flutter::EncodableValue(*state.durationUs); // int
+				}
+				result->Success(response);
 			}
-
-			if (endUs != nullptr)
+			else if (method.compare("play") == 0)
 			{
-				// We have a duration limit
-				auto duration = *endUs - start;
-
-				return Playback::MediaPlaybackItem(
-					childSource,
-					TimeSpan(std::chrono::microseconds(start)),
-					TimeSpan(std::chrono::microseconds(duration)));
+				backend->play();
+				result->Success(flutter::EncodableMap());
 			}
-			else
+			else if (method.compare("playAt") == 0)
 			{
-				return Playback::MediaPlaybackItem(
-					childSource,
-					TimeSpan(std::chrono::microseconds(start)));
+				auto hostTime = LongValueOrNull(args, "hostTime");
+				if (!hostTime)
+				{
+					result->Error("playAt_error", "hostTime argument missing");
+					return true;
+				}
+				backend->playAt(*hostTime);
+				result->Success(flutter::EncodableMap());
+			}
+			else if (method.compare("pause") == 0)
+			{
+				backend->pause();
+				result->Success(flutter::EncodableMap());
+			}
+			else if (method.compare("setVolume") == 0)
+			{
+				const auto* volume = std::get_if<double>(ValueOrNull(args, "volume"));
+				if (!volume)
+				{
+					result->Error("volume_error", "volume argument missing");
+					return true;
+				}
+				VolumeRamp ramp{};
+				ramp.durationUs = LongValueOrNull(args, "rampDuration").value_or(0);
+				const auto* curve = std::get_if<std::string>(ValueOrNull(args, "rampCurve"));
+				if (curve && curve->compare("exponential") == 0)
+				{
+					ramp.curve = VolumeRamp::Curve::exponential;
+				}
+				backend->setVolume(*volume, ramp);
+				result->Success(flutter::EncodableMap());
+			}
+			else if (method.compare("setPan") == 0)
+			{
+				const auto* pan = std::get_if<double>(ValueOrNull(args, "pan"));
+				if (!pan)
+				{
+					result->Error("pan_error", "pan argument missing");
+					return true;
+				}
+				backend->setPan(*pan);
+				result->Success(flutter::EncodableMap());
+			}
+			else if (method.compare("setCrossfade") == 0)
+			{
+				auto duration = LongValueOrNull(args, "duration");
+				if (!duration)
+				{
+					result->Error("crossfade_error", "duration argument missing");
+					return true;
+				}
+				backend->setCrossfade(*duration);
+				result->Success(flutter::EncodableMap());
+			}
+			else if (method.compare("setVoicePriority") == 0)
+			{
+				auto priority = LongValueOrNull(args, "priority");
+				if (!priority)
+				{
+					result->Error("voicePriority_error", "priority argument missing");
+					return true;
+				}
+				backend->setPriority((int32_t)*priority);
+				result->Success(flutter::EncodableMap());
+			}
+			else if (method.compare("setSpeed") == 0)
+			{
+				const auto* speed = std::get_if<double>(ValueOrNull(args, "speed"));
+				if (!speed)
+				{
+					result->Error("speed_error", "speed argument missing");
+					return true;
+				}
+				backend->setSpeed(*speed);
+				result->Success(flutter::EncodableMap());
+			}
+			else if (method.compare("setPitch") == 0)
+			{
+				const auto* pitch = std::get_if<double>(ValueOrNull(args, "pitch"));
+				if (!pitch)
+				{
+					result->Error("pitch_error", "pitch argument missing");
+					return true;
+				}
+				backend->setPitch(*pitch);
+				result->Success(flutter::EncodableMap());
+			}
+			else if (method.compare("setSkipSilence") == 0)
+			{
+				const auto* enabled = std::get_if<bool>(ValueOrNull(args, "enabled"));
+				if (!enabled)
+				{
+					result->Error("skipSilence_error", "enabled argument missing");
+					return true;
+				}
+				SkipSilenceOptions options{};
+				if (const auto* threshold = std::get_if<double>(ValueOrNull(args, "threshold")))
+				{
+					options.thresholdDb = *threshold;
+				}
+				options.minimumGapUs = LongValueOrNull(args, "minimumGap").value_or(options.minimumGapUs);
+				options.paddingUs = LongValueOrNull(args, "padding").value_or(options.paddingUs);
+				backend->setSkipSilence(*enabled, options);
+				result->Success(flutter::EncodableMap());
+			}
+			else if (method.compare("audioEffectSetEnabled") == 0)
+			{
+				const auto* type = std::get_if<std::string>(ValueOrNull(args, "type"));
+				const auto* enabled = std::get_if<bool>(ValueOrNull(args, "enabled"));
+				if (!type || !enabled)
+				{
+					result->Error("audioEffect_error", "type or enabled argument missing");
+					return true;
+				}
+				if (type->compare("AndroidEqualizer") == 0)
+				{
+					backend->setEqualizerEnabled(*enabled);
+				}
+				else if (type->compare("AndroidLoudnessEnhancer") == 0)
+				{
+					backend->setLoudnessEnhancerEnabled(*enabled);
+				}
+				result->Success(flutter::EncodableMap());
+			}
+			else if (method.compare("androidLoudnessEnhancerSetTargetGain") == 0)
+			{
+				const auto* targetGain = std::get_if<double>(ValueOrNull(args, "targetGain"));
+				if (!targetGain)
+				{
+					result->Error("targetGain_error", "targetGain argument missing");
+					return true;
+				}
+				backend->setLoudnessEnhancerTargetGain(*targetGain);
+				auto attack = LongValueOrNull(args, "attack");
+				auto release = LongValueOrNull(args, "release");
+				if (attack || release)
+				{
+					backend->setLimiterTiming(attack.value_or(LoudnessEnhancer::kDefaultAttackUs), release.value_or(LoudnessEnhancer::kDefaultReleaseUs));
+				}
+				result->Success(flutter::EncodableMap());
+			}
+			else if (method.compare("androidEqualizerGetParameters") == 0)
+			{
+				auto parameters = backend->getEqualizerParameters();
+				auto bands = flutter::EncodableList();
+				for (auto& band : parameters.bands)
+				{
+					auto bandData = flutter::EncodableMap();
+					bandData[flutter::EncodableValue("index")] = flutter::EncodableValue(band.index);                     // int
+					bandData[flutter::EncodableValue("lowerFrequency")] = flutter::EncodableValue(band.lowerFrequency);   // double
+					bandData[flutter::EncodableValue("upperFrequency")] = flutter::EncodableValue(band.upperFrequency);   // double
+					bandData[flutter::EncodableValue("centerFrequency")] = flutter::EncodableValue(band.centerFrequency); // double
+					bandData[flutter::EncodableValue("gain")] = flutter::EncodableValue(band.gainDb);                     // double
+					bands.push_back(flutter::EncodableValue(bandData));
+				}
+				auto parametersData = flutter::EncodableMap();
+				parametersData[flutter::EncodableValue("minDecibels")] = flutter::EncodableValue(parameters.minDecibels);
+				parametersData[flutter::EncodableValue("maxDecibels")] = flutter::EncodableValue(parameters.maxDecibels);
+				parametersData[flutter::EncodableValue("bands")] = flutter::EncodableValue(bands);
+				auto response = flutter::EncodableMap();
+				response[flutter::EncodableValue("parameters")] = flutter::EncodableValue(parametersData);
+				result->Success(response);
+			}
+			else if (method.compare("androidEqualizerBandSetGain") == 0)
+			{
+				auto bandIndex = LongValueOrNull(args, "bandIndex");
+				const auto* gain = std::get_if<double>(ValueOrNull(args, "gain"));
+				if (!bandIndex || !gain)
+				{
+					result->Error("bandGain_error", "bandIndex or gain argument missing");
+					return true;
+				}
+				backend->setEqualizerBandGain((int32_t)*bandIndex, *gain);
+				result->Success(flutter::EncodableMap());
+			}
+			else if (method.compare("setLoopMode") == 0)
+			{
+				const auto* loopMode = std::get_if<int32_t>(ValueOrNull(args, "loopMode"));
+				if (!loopMode || *loopMode < 0 || *loopMode > 2)
+				{
+					result->Error("loopMode_error", "loopMode is invalid");
+					return true;
+				}
+				backend->setLoopMode((LoopMode)*loopMode);
+				result->Success(flutter::EncodableMap());
+			}
+			else if (method.compare("setShuffleMode") == 0)
+			{
+				const auto* shuffleMode = std::get_if<int32_t>(ValueOrNull(args, "shuffleMode"));
+				if (!shuffleMode || *shuffleMode < 0 || *shuffleMode > 1)
+				{
+					result->Error("shuffleMode_error", "shuffleMode is invalid");
+					return true;
+				}
+				backend->setShuffle(*shuffleMode == 1);
+				result->Success(flutter::EncodableMap());
+			}
+			else if (method.compare("setShuffleOrder") == 0)
+			{
+				const auto* source = std::get_if<flutter::EncodableMap>(ValueOrNull(args, "audioSource"));
+				if (source)
+				{
+					backend->setShuffleOrder(ParseAudioSource(*source));
+				}
+				result->Success(flutter::EncodableMap());
+			}
+			else if (method.compare("seek") == 0)
+			{
+				auto index = LongValueOrNull(args, "index");
+				backend->seek(index ? std::optional<int32_t>((int32_t)*index) : std::nullopt,
+					LongValueOrNull(args, "position").value_or(0));
+				result->Success(flutter::EncodableMap());
+			}
+			else if (method.compare("trigger") == 0)
+			{
+				// Starts the sample from |position|; a playing sample player
+				// overlaps the new voice with the ones already playing.
+				backend->seek(std::nullopt, LongValueOrNull(args, "position").value_or(0));
+				if (!backend->getState().playing)
+				{
+					backend->play();
+				}
+				result->Success(flutter::EncodableMap());
+			}
+			else if (method.compare("concatenatingInsertAll") == 0)
+			{
+				const auto* children = std::get_if<flutter::EncodableList>(ValueOrNull(args, "children"));
+				std::vector<AudioSourceSpec> sources{};
+				if (children)
+				{
+					for (auto& child : *children)
+					{
+						sources.push_back(ParseAudioSource(std::get<flutter::EncodableMap>(child)));
+					}
+				}
+				backend->insert((int32_t)LongValueOrNull(args, "index").value_or(0), sources);
+				result->Success(flutter::EncodableMap());
+			}
+			else if (method.compare("concatenatingRemoveRange") == 0)
+			{
+				backend->removeRange((int32_t)LongValueOrNull(args, "startIndex").value_or(0),
+					(int32_t)LongValueOrNull(args, "endIndex").value_or(0));
+				result->Success(flutter::EncodableMap());
+			}
+			else if (method.compare("concatenatingMove") == 0)
+			{
+				backend->move((int32_t)LongValueOrNull(args, "currentIndex").value_or(0),
+					(int32_t)LongValueOrNull(args, "newIndex").value_or(0));
+				result->Success(flutter::EncodableMap());
+			}
+			else if (method.compare("dispose") == 0)
+			{
+				closed = true;
+				backend->dispose();
+				result->Success(flutter::EncodableMap());
+			}
+			else
+			{
+				return false;
+			}
+		}
+		catch (const std::exception& error)
+		{
+			result->Error(method + "_error", error.what());
+		}
+		return true;
+	}
+
+	void broadcastBackendState()
+	{
+		auto state = backend->getState();
+		auto now = std::chrono::system_clock::now();
+
+		auto eventData = flutter::EncodableMap();
+		eventData[flutter::EncodableValue("processingState")] = flutter::EncodableValue((int)state.processingState);
+		eventData[flutter::EncodableValue("updatePosition")] = flutter::EncodableValue(state.positionUs);                    // int
+		eventData[flutter::EncodableValue("updateTime")] = flutter::EncodableValue(TO_MILLISECONDS(now.time_since_epoch())); // int
+		eventData[flutter::EncodableValue("bufferedPosition")] = flutter::EncodableValue(state.bufferedPositionUs);          // int
+		if (state.durationUs)
+		{
+			eventData[flutter::EncodableValue("duration")] = flutter::EncodableValue(*state.durationUs); // int
+		}
+		if (state.currentIndex)
+		{
+			eventData[flutter::EncodableValue("currentIndex")] = flutter::EncodableValue(*state.currentIndex); // int
+		}
+		event_sink_->Success(eventData);
+
+		auto data = flutter::EncodableMap();
+		data[flutter::EncodableValue("playing")] = flutter::EncodableValue(state.playing);
+		data[flutter::EncodableValue("volume")] = flutter::EncodableValue(state.volume);
+		data[flutter::EncodableValue("speed")] = flutter::EncodableValue(state.speed);
+		data[flutter::EncodableValue("pitch")] = flutter::EncodableValue(state.pitch);
+		data[flutter::EncodableValue("loopMode")] = flutter::EncodableValue((int)state.loopMode);
+		data[flutter::EncodableValue("shuffleMode")] = flutter::EncodableValue(state.shuffle ? 1 : 0);
+		data[flutter::EncodableValue("underrunCount")] = flutter::EncodableValue((int64_t)state.underrunCount);   // int
+		data[flutter::EncodableValue("underrunFrames")] = flutter::EncodableValue((int64_t)state.underrunFrames); // int
+		data[flutter::EncodableValue("timeStretchLoad")] = flutter::EncodableValue(state.timeStretchLoad);
+		data[flutter::EncodableValue("skippedSilence")] = flutter::EncodableValue(state.skippedSilenceUs);
+		data[flutter::EncodableValue("gainReduction")] = flutter::EncodableValue(state.gainReductionDb);
+		data_sink_->Success(data);
+	}
+
+	void loadSource(const flutter::EncodableMap& source)
+	{
+		auto items = mediaPlaybackList.Items();
+		items.Clear(); // Always clear the list since we are resetting
+
+		{
+			std::lock_guard<std::mutex> lock(icyMutex);
+			icyHeaders.reset();
+			icyInfo.reset();
+		}
+		stopTimeshift();
+		indexedPath.reset();
+		indexedItem = nullptr;
+		indexedStream = nullptr;
+		indexedStartUs = 0;
+		waitingForBuffer = false;
+		ended = false;
+		stopBufferTimer();
+		{
+			std::lock_guard<std::mutex> lock(bufferingMutex);
+			bufferingController.reset();
+		}
+
+		const std::string* type = std::get_if<std::string>(ValueOrNull(source, "type"));
+
+		if (type->compare("concatenating") == 0)
+		{
+			const auto* children = std::get_if<flutter::EncodableList>(ValueOrNull(source, "children"));
+
+			for (auto& child : *children)
+			{
+				const auto* childMap = std::get_if<flutter::EncodableMap>(&child);
+				auto item = createMediaPlaybackItem(*childMap);
+				items.Append(item);
+			}
+
+			mediaPlayer.Source(mediaPlaybackList.as<Playback::IMediaPlaybackSource>());
+		}
+		else
+		{
+			requestSeekIndex(source);
+			auto item = createMediaPlaybackItem(source, true);
+			if (indexedPath)
+			{
+				indexedItem = item;
+			}
+			mediaPlayer.Source(item.as<Playback::IMediaPlaybackSource>());
+		}
+	}
+
+	/**
+	 * Creates a single MediaPlaybackItem, which can be used directly or inside a list.
+	 * Only an item played on its own may be recorded for timeshift.
+	 */
+	Playback::MediaPlaybackItem createMediaPlaybackItem(const flutter::EncodableMap& source, bool allowTimeshift = false)
+	{
+		const std::string* type = std::get_if<std::string>(ValueOrNull(source, "type"));
+
+		if (type->compare("clipping") == 0)
+		{
+			const auto* child = std::get_if<flutter::EncodableMap>(ValueOrNull(source, "child"));
+			auto childSource = createMediaSource(*child);
+
+			const auto* startUs = std::get_if<int32_t>(ValueOrNull(*child, "start"));
+			const auto* endUs = std::get_if<int32_t>(ValueOrNull(*child, "end"));
+
+			auto start = 0; // Default to 0
+			if (startUs != nullptr)
+			{
+				start = *startUs;
+			}
+
+			if (endUs != nullptr)
+			{
+				// We have a duration limit
+				auto duration = *endUs - start;
+
+				return Playback::MediaPlaybackItem(
+					childSource,
+					TimeSpan(std::chrono::microseconds(start)),
+					TimeSpan(std::chrono::microseconds(duration)));
+			}
+			else
+			{
+				return Playback::MediaPlaybackItem(
+					childSource,
+					TimeSpan(std::chrono::microseconds(start)));
+			}
+		}
+		else
+		{
+			return Playback::MediaPlaybackItem(createMediaSource(source, allowTimeshift));
+		}
+	}
+
+	/**
+	 * Creates a single MediaSource.
+	 */
+	MediaSource createMediaSource(const flutter::EncodableMap& source, bool allowTimeshift = false)
+	{
+		const std::string* type = std::get_if<std::string>(ValueOrNull(source, "type"));
+		if (type->compare("dash") == 0 || type->compare("hls") == 0)
+		{
+			const auto* uri = std::get_if<std::string>(ValueOrNull(source, "uri"));
+			auto prepared = preparedAdaptiveSources.find(*uri);
+			if (prepared != preparedAdaptiveSources.end())
+			{
+				auto adaptiveSource = configureAdaptiveMediaSource(prepared->second);
+				// Each opened source plays in one item only.
+				preparedAdaptiveSources.erase(prepared);
+				if (adaptiveSource)
+				{
+					return MediaSource::CreateFromAdaptiveMediaSource(adaptiveSource);
+				}
+			}
+			return MediaSource::CreateFromUri(
+				Uri(TO_WIDESTRING(*uri)));
+		}
+		else if (type->compare("progressive") == 0)
+		{
+			const auto* uri = std::get_if<std::string>(ValueOrNull(source, "uri"));
+			auto prepared = preparedLiveConnections.find(*uri);
+			if (prepared != preparedLiveConnections.end())
+			{
+				// Plays from the connection the probe opened.
+				auto connection = prepared->second;
+				preparedLiveConnections.erase(prepared);
+				return createLiveMediaSource(connection, allowTimeshift);
+			}
+			return MediaSource::CreateFromUri(
+				Uri(TO_WIDESTRING(*uri)));
+		}
+		else
+		{
+			throw std::invalid_argument("Source is unsupported or can not be nested: " + *type);
+		}
+	}
+
+	/// The request headers of a progressive |source|.
+	static std::map<std::string, std::string> requestHeaders(const flutter::EncodableMap& source)
+	{
+		std::map<std::string, std::string> headers{};
+		if (const auto* headersMap = std::get_if<flutter::EncodableMap>(ValueOrNull(source, "headers")))
+		{
+			for (auto& header : *headersMap)
+			{
+				const auto* name = std::get_if<std::string>(&header.first);
+				const auto* value = std::get_if<std::string>(&header.second);
+				if (name && value)
+				{
+					headers[*name] = *value;
+				}
+			}
+		}
+		return headers;
+	}
+
+	/**
+	 * Creates a MediaSource reading from a LiveStream over |connection|. With
+	 * |allowTimeshift| and timeshift enabled, the stream is recorded and
+	 * played from the recording.
+	 */
+	MediaSource createLiveMediaSource(const LiveConnection& connection, bool allowTimeshift)
+	{
+		{
+			std::lock_guard<std::mutex> lock(icyMutex);
+			icyHeaders = connection.icyHeaders;
+			icyInfo.reset();
+		}
+
+		auto onInfo = [=](const IcyInfo& info)
+		{ onIcyInfo(info); };
+
+		if (allowTimeshift && timeshiftEnabled)
+		{
+			auto path = std::filesystem::temp_directory_path() /
+				("just_audio_timeshift_" + id + "_" + std::to_string(++timeshiftCount) + ".bin");
+			auto buffer = std::make_shared<TimeshiftBuffer>(path.string(), timeshiftCapacity);
+			if (buffer->isOpen())
+			{
+				timeshiftBuffer = buffer;
+				timeshiftContentType = connection.contentType;
+				timeshiftRecorder = std::make_unique<TimeshiftRecorder>(connection, buffer, onInfo);
+				return createTimeshiftMediaSource(0);
+			}
+			std::cerr << "[just_audio_windows] Failed to create timeshift file " << path.string() << std::endl;
+		}
+
+		// Loading stops while paused, unless the network may be used then.
+		// It is only throttled by the buffer for an item played on its own,
+		// since the position of other items is not known.
+		auto bitrate = connection.icyHeaders.bitrate.value_or(0);
+		auto throttled = allowTimeshift && bitrate > 0;
+		std::function<bool(uint64_t)> canRead = [this, bitrate, throttled](uint64_t deliveredBytes)
+		{
+			if (liveLoadingPaused)
+			{
+				return false;
+			}
+			return !throttled || shouldContinueLoading(deliveredBytes, bitrate);
+		};
+
+		auto stream = winrt::make_self<LiveStream>(connection, onInfo, canRead);
+		return MediaSource::CreateFromStream(stream.as<IRandomAccessStream>(), connection.contentType);
+	}
+
+	/// Creates a MediaSource playing the timeshift recording from |offset|.
+	MediaSource createTimeshiftMediaSource(uint64_t offset)
+	{
+		timeshiftStream = winrt::make_self<TimeshiftStream>(timeshiftBuffer, offset, [this, buffer = timeshiftBuffer](uint64_t readOffset)
+			{ onTimeshiftRead(*buffer, readOffset); });
+		return MediaSource::CreateFromStream(timeshiftStream.as<IRandomAccessStream>(), timeshiftContentType);
+	}
+
+	/**
+	 * Seeks within the timeshift window. The recording is reopened at the index
+	 * point closest to |microseconds|, since the decoder can not seek in it.
+	 */
+	void seekTimeshift(int64_t microseconds)
+	{
+		auto offset = timeshiftBuffer->offsetForTime(microseconds);
+		auto wasPlaying = mediaPlayer.PlaybackSession().PlaybackState() == Playback::MediaPlaybackState::Playing;
+		seeking = true;
+		ended = false;
+
+		mediaPlayer.Source(Playback::MediaPlaybackItem(createTimeshiftMediaSource(offset)).as<Playback::IMediaPlaybackSource>());
+		if (wasPlaying)
+		{
+			mediaPlayer.Play();
+		}
+
+		broadcastState();
+	}
+
+	/// Speeds playback up while it is far behind the live edge.
+	void onTimeshiftRead(const TimeshiftBuffer& buffer, uint64_t offset)
+	{
+		if (timeshiftCatchUpSpeed <= 1.0)
+		{
+			return;
+		}
+
+		auto behindUs = buffer.getEndTime() - buffer.timeForOffset(offset);
+		if (!catchingUp && behindUs > 3000000)
+		{
+			catchingUp = true;
+			mediaPlayer.PlaybackRate(std::max((double)speed, timeshiftCatchUpSpeed));
+		}
+		else if (catchingUp && behindUs < 1000000)
+		{
+			catchingUp = false;
+			mediaPlayer.PlaybackRate(speed);
+		}
+	}
+
+	void stopTimeshift()
+	{
+		timeshiftRecorder.reset();
+		timeshiftStream = nullptr;
+		timeshiftBuffer.reset();
+		if (catchingUp)
+		{
+			catchingUp = false;
+			mediaPlayer.PlaybackRate(speed);
+		}
+	}
+
+	/// The playback position, counted from the start of the recording when
+	/// timeshifting.
+	int64_t getPosition()
+	{
+		int64_t position = TO_MICROSECONDS(mediaPlayer.PlaybackSession().Position());
+		auto buffer = timeshiftBuffer;
+		auto stream = timeshiftStream;
+		if (buffer && stream)
+		{
+			position += buffer->timeForOffset(stream->getStartOffset());
+		}
+		if (indexedStream)
+		{
+			position += indexedStartUs;
+		}
+		return position;
+	}
+
+	/**
+	 * Applies the AudioLoadConfigurationMessage passed to init. The Android load
+	 * control drives the buffering controller; the Darwin options map onto the
+	 * equivalent settings of this player.
+	 */
+	void setLoadConfiguration(const flutter::EncodableMap& configuration)
+	{
+		std::optional<LoadControlSettings> settings{};
+
+		if (const auto* loadControl = std::get_if<flutter::EncodableMap>(ValueOrNull(configuration, "androidLoadControl")))
+		{
+			LoadControlSettings androidSettings{};
+			if (auto value = LongValueOrNull(*loadControl, "minBufferDuration"))
+			{
+				androidSettings.minBufferUs = *value;
+			}
+			if (auto value = LongValueOrNull(*loadControl, "maxBufferDuration"))
+			{
+				androidSettings.maxBufferUs = *value;
+			}
+			if (auto value = LongValueOrNull(*loadControl, "bufferForPlaybackDuration"))
+			{
+				androidSettings.bufferForPlaybackUs = *value;
+			}
+			if (auto value = LongValueOrNull(*loadControl, "bufferForPlaybackAfterRebufferDuration"))
+			{
+				androidSettings.bufferForPlaybackAfterRebufferUs = *value;
+			}
+			if (auto value = LongValueOrNull(*loadControl, "targetBufferBytes"))
+			{
+				androidSettings.targetBufferBytes = *value;
+			}
+			if (const auto* prioritize = std::get_if<bool>(ValueOrNull(*loadControl, "prioritizeTimeOverSizeThresholds")))
+			{
+				androidSettings.prioritizeTimeOverSizeThresholds = *prioritize;
+			}
+			settings = androidSettings;
+		}
+
+		if (const auto* loadControl = std::get_if<flutter::EncodableMap>(ValueOrNull(configuration, "darwinLoadControl")))
+		{
+			if (const auto* enabled = std::get_if<bool>(ValueOrNull(*loadControl, "canUseNetworkResourcesForLiveStreamingWhilePaused")))
+			{
+				setCanUseNetworkResourcesForLiveStreamingWhilePaused(*enabled);
+			}
+
+			{
+				std::lock_guard<std::mutex> lock(bitrateMutex);
+				if (const auto* enabled = std::get_if<bool>(ValueOrNull(*loadControl, "automaticallyWaitsToMinimizeStalling")))
+				{
+					automaticallyWaitsToMinimizeStalling = *enabled;
+					renditionSelector.setConservative(*enabled);
+				}
+				if (const auto* bitRate = std::get_if<double>(ValueOrNull(*loadControl, "preferredPeakBitRate")))
+				{
+					renditionSelector.setPreferredPeakBitRate(*bitRate > 0 ? (uint64_t)*bitRate : 0);
+				}
+			}
+
+			// The forward buffer duration is the only size AVFoundation accepts.
+			// It stands in for the maximum buffer unless Android settings exist.
+			auto forwardBuffer = LongValueOrNull(*loadControl, "preferredForwardBufferDuration");
+			if (!settings && forwardBuffer && *forwardBuffer > 0)
+			{
+				settings = LoadControlSettings{};
+				settings->maxBufferUs = *forwardBuffer;
+				settings->minBufferUs = std::min(settings->minBufferUs, *forwardBuffer);
+			}
+		}
+
+		if (settings)
+		{
+			std::lock_guard<std::mutex> lock(bufferingMutex);
+			bufferingController.configure(*settings);
+		}
+	}
+
+	void play()
+	{
+		playWhenReady = true;
+		liveLoadingPaused = false;
+		if (shouldWaitForBuffer())
+		{
+			waitForBuffer();
+		}
+		else
+		{
+			mediaPlayer.Play();
+		}
+	}
+
+	void pause()
+	{
+		playWhenReady = false;
+		liveLoadingPaused = !canUseNetworkResourcesForLiveStreamingWhilePaused;
+		waitingForBuffer = false;
+		stopBufferTimer();
+		mediaPlayer.Pause();
+	}
+
+	/// Whether playback should be held back until the buffering controller
+	/// allows it.
+	bool shouldWaitForBuffer()
+	{
+		{
+			std::lock_guard<std::mutex> lock(bitrateMutex);
+			if (!automaticallyWaitsToMinimizeStalling)
+			{
+				return false;
+			}
+		}
+		std::lock_guard<std::mutex> lock(bufferingMutex);
+		return bufferingController.isEnabled();
+	}
+
+	/// Pauses playback until evaluateBuffer() finds enough buffered.
+	void waitForBuffer()
+	{
+		if (waitingForBuffer.exchange(true))
+		{
+			return;
+		}
+		mediaPlayer.Pause();
+
+		{
+			std::lock_guard<std::mutex> lock(bufferingMutex);
+			bufferWaitStart = std::chrono::steady_clock::now();
+			bufferTimer = winrt::Windows::System::Threading::ThreadPoolTimer::CreatePeriodicTimer([=](auto)
+				{ evaluateBuffer(); },
+				std::chrono::milliseconds(250));
+		}
+
+		evaluateBuffer();
+		broadcastState();
+	}
+
+	void stopBufferTimer()
+	{
+		std::lock_guard<std::mutex> lock(bufferingMutex);
+		if (bufferTimer)
+		{
+			bufferTimer.Cancel();
+			bufferTimer = nullptr;
+		}
+	}
+
+	/// Counts a stall when playback runs out of data, and holds it back until
+	/// the rebuffer threshold is reached.
+	void onBufferingStarted()
+	{
+		// Buffering at the start of an item or after a seek is not a stall.
+		if (closed || !playWhenReady || waitingForBuffer || seeking ||
+			mediaPlayer.PlaybackSession().Position().count() == 0)
+		{
+			return;
+		}
+
+		{
+			std::lock_guard<std::mutex> lock(bufferingMutex);
+			bufferingController.onStall();
+		}
+
+		if (shouldWaitForBuffer())
+		{
+			waitForBuffer();
+		}
+		else
+		{
+			broadcastState();
+		}
+	}
+
+	/**
+	 * Resumes playback held back by waitForBuffer() once the range buffered ahead
+	 * of the position reaches the threshold, the source is fully buffered, or the
+	 * wait took far longer than the threshold itself, which happens with sources
+	 * that do not load while paused.
+	 */
+	void evaluateBuffer()
+	{
+		if (closed || !playWhenReady)
+		{
+			return;
+		}
+
+		try
+		{
+			auto session = mediaPlayer.PlaybackSession();
+
+			if (!waitingForBuffer)
+			{
+				// Playback resumed by itself after a stall.
+				if (session.PlaybackState() == Playback::MediaPlaybackState::Playing)
+				{
+					std::lock_guard<std::mutex> lock(bufferingMutex);
+					bufferingController.onResumed();
+				}
+				return;
+			}
+
+			int64_t position = TO_MICROSECONDS(session.Position());
+			int64_t duration = TO_MICROSECONDS(session.NaturalDuration());
+			auto bufferedAhead = BufferingController::bufferedAhead(position, getBufferedRanges());
+			auto fullyBuffered = session.BufferingProgress() >= 1.0 || (duration > 0 && position + bufferedAhead >= duration);
+
+			bool ready;
+			{
+				std::lock_guard<std::mutex> lock(bufferingMutex);
+				auto& settings = bufferingController.getSettings();
+				auto maxWait = std::chrono::microseconds(std::max(settings.bufferForPlaybackUs, settings.bufferForPlaybackAfterRebufferUs)) + std::chrono::seconds(10);
+				ready = fullyBuffered ||
+					bufferingController.shouldStartPlayback(bufferedAhead) ||
+					std::chrono::steady_clock::now() - bufferWaitStart > maxWait;
+				if (ready)
+				{
+					bufferingController.onResumed();
+				}
 			}
-		}
-		else
-		{
-			return Playback::MediaPlaybackItem(createMediaSource(source));
-		}
-	}
-
-	/**
-	 * Creates a single MediaSource.
-	 */
-	MediaSource createMediaSource(const flutter::EncodableMap& source) const&
-	{
-		const std::string* type = std::get_if<std::string>(ValueOrNull(source, "type"));
-		if (type->compare("progressive") == 0 || type->compare("dash") == 0 || type->compare("hls") == 0)
-		{
-			const auto* uri = std::get_if<std::string>(ValueOrNull(source, "uri"));
-			return MediaSource::CreateFromUri(
-				Uri(TO_WIDESTRING(*uri)));
-		}
-		else
-		{
-			throw std::invalid_argument("Source is unsupported or can not be nested: " + *type);
-		}
-	}
+
+			if (ready && waitingForBuffer.exchange(false))
+			{
+				stopBufferTimer();
+				mediaPlayer.Play();
+				broadcastState();
+			}
+		}
+		catch (winrt::hresult_error const& ex)
+		{
+			std::cerr << "[just_audio_windows] Failed to evaluate buffer: " << winrt::to_string(ex.message()) << std::endl;
+		}
+	}
+
+	/**
+	 * Whether a live stream that delivered |deliveredBytes| should keep reading.
+	 * The decoder does not report how far ahead it has read, so the buffer is
+	 * estimated from the advertised bitrate.
+	 */
+	bool shouldContinueLoading(uint64_t deliveredBytes, int32_t bitrateKbps)
+	{
+		if (closed)
+		{
+			return true;
+		}
+
+		int64_t bytesPerSecond = (int64_t)bitrateKbps * 1000 / 8;
+		int64_t playedUs = TO_MICROSECONDS(mediaPlayer.PlaybackSession().Position());
+
+		std::lock_guard<std::mutex> lock(bufferingMutex);
+		return bufferingController.shouldContinueLoadingStream(deliveredBytes, playedUs, bytesPerSecond);
+	}
+
+	std::vector<BufferedRange> getBufferedRanges()
+	{
+		std::vector<BufferedRange> ranges{};
+		for (auto range : mediaPlayer.PlaybackSession().GetBufferedRanges())
+		{
+			ranges.push_back({ TO_MICROSECONDS(range.Start), TO_MICROSECONDS(range.End) });
+		}
+		return ranges;
+	}
+
+	void onIcyInfo(const IcyInfo& info)
+	{
+		{
+			std::lock_guard<std::mutex> lock(icyMutex);
+			if (icyInfo && *icyInfo == info)
+			{
+				return;
+			}
+			icyInfo = info;
+		}
+		broadcastState();
+	}
+
+	// The sources of a load or insertion that open over the network before
+	// the playlist is built. See prepareSources.
+	struct SourceRequests
+	{
+		std::vector<std::string> adaptiveUris{};
+		// Progressive sources to probe for ICY headers, by URI.
+		std::vector<std::pair<std::string, flutter::EncodableMap>> probes{};
+	};
+
+	/// Whether the progressive source at |uri| is probed for ICY headers.
+	bool shouldProbe(const std::string& uri, const flutter::EncodableMap& source) const
+	{
+		if (uri.rfind("http://", 0) != 0 && uri.rfind("https://", 0) != 0)
+		{
+			return false;
+		}
+		return icyProbeEnabled || knownStreams.count(uri) > 0 || IcyHeaders::isKnownStream(uri, requestHeaders(source));
+	}
+
+	/// Appends the sources in |source| that open over the network to
+	/// |requests|.
+	void collectSources(const flutter::EncodableMap& source, SourceRequests& requests) const
+	{
+		const auto* type = std::get_if<std::string>(ValueOrNull(source, "type"));
+		if (!type)
+		{
+			return;
+		}
+		const auto* uri = std::get_if<std::string>(ValueOrNull(source, "uri"));
+		if ((*type == "dash" || *type == "hls") && uri)
+		{
+			requests.adaptiveUris.push_back(*uri);
+		}
+		else if (*type == "progressive" && uri && shouldProbe(*uri, source))
+		{
+			requests.probes.emplace_back(*uri, source);
+		}
+		else if (const auto* child = std::get_if<flutter::EncodableMap>(ValueOrNull(source, "child")))
+		{
+			collectSources(*child, requests);
+		}
+		else if (const auto* children = std::get_if<flutter::EncodableList>(ValueOrNull(source, "children")))
+		{
+			for (auto& entry : *children)
+			{
+				if (const auto* childMap = std::get_if<flutter::EncodableMap>(&entry))
+				{
+					collectSources(*childMap, requests);
+				}
+			}
+		}
+	}
+
+	/// Applies |change| once the playlist changes called before it have, or
+	/// calls it with false if a load replaces the playlist first. A change
+	/// that prepares sources sets |preparingPlaylistChange| and calls
+	/// finishPlaylistChange once it has applied.
+	void queuePlaylistChange(std::function<void(bool current)> change)
+	{
+		playlistChanges.push_back(change);
+		applyPlaylistChanges();
+	}
+
+	void finishPlaylistChange()
+	{
+		preparingPlaylistChange = false;
+		applyPlaylistChanges();
+	}
+
+	void applyPlaylistChanges()
+	{
+		while (!preparingPlaylistChange && !playlistChanges.empty())
+		{
+			auto change = std::move(playlistChanges.front());
+			playlistChanges.pop_front();
+			change(true);
+		}
+	}
+
+	/// Lets live streams keep loading while paused, or has them stop at the
+	/// next pause. Turning it on while paused resumes loading at once.
+	void setCanUseNetworkResourcesForLiveStreamingWhilePaused(bool enabled)
+	{
+		canUseNetworkResourcesForLiveStreamingWhilePaused = enabled;
+		if (enabled)
+		{
+			liveLoadingPaused = false;
+		}
+	}
+
+	/**
+	 * Opens the manifests and probes the live streams of |requests| without
+	 * blocking the platform thread, then calls |then| on it with what opened
+	 * in |preparedAdaptiveSources| and |preparedLiveConnections|. |alive| is
+	 * false if the player closed meanwhile, and |then| must not touch it.
+	 * With nothing to open, or without a task runner, |then| runs at once.
+	 */
+	void prepareSources(const SourceRequests& requests, std::function<void(bool alive)> then)
+	{
+		using namespace winrt::Windows::Media::Streaming::Adaptive;
+
+		auto count = requests.adaptiveUris.size() + requests.probes.size();
+		if (count == 0 || !taskRunner)
+		{
+			then(true);
+			return;
+		}
+
+		struct Pending
+		{
+			std::mutex mutex;
+			std::multimap<std::string, AdaptiveMediaSourceCreationResult> sources{};
+			std::multimap<std::string, LiveConnection> connections{};
+			size_t remaining = 0;
+		};
+		auto pending = std::make_shared<Pending>();
+		pending->remaining = count;
+		std::weak_ptr<bool> alive = lifetime;
+		auto runner = taskRunner;
+		// Called on a background thread as each source opens or fails.
+		auto complete = [this, pending, alive, runner, then](const std::function<void(Pending&)>& store)
+		{
+			{
+				std::lock_guard<std::mutex> lock(pending->mutex);
+				store(*pending);
+				if (--pending->remaining > 0)
+				{
+					return;
+				}
+			}
+			runner->post([this, pending, alive, then]()
+				{
+					if (alive.expired())
+					{
+						for (auto& connection : pending->connections)
+						{
+							connection.second.close();
+						}
+						return then(false);
+					}
+					for (auto& connection : pending->connections)
+					{
+						if (connection.second.hasIcyHeaders())
+						{
+							knownStreams.insert(connection.first);
+						}
+					}
+					preparedAdaptiveSources = std::move(pending->sources);
+					preparedLiveConnections = std::move(pending->connections);
+					then(true);
+					// Connections no item took, such as those of a failed
+					// load, are not left open.
+					for (auto& connection : preparedLiveConnections)
+					{
+						connection.second.close();
+					}
+					preparedAdaptiveSources.clear();
+					preparedLiveConnections.clear(); });
+		};
+
+		for (auto& uri : requests.adaptiveUris)
+		{
+			try
+			{
+				AdaptiveMediaSource::CreateFromUriAsync(Uri(TO_WIDESTRING(uri))).Completed([uri, complete](const auto& operation, AsyncStatus status)
+					{
+						auto creation = status == AsyncStatus::Completed ? operation.GetResults() : AdaptiveMediaSourceCreationResult{ nullptr };
+						complete([&](Pending& pending)
+							{
+								if (creation)
+								{
+									pending.sources.emplace(uri, creation);
+								} }); });
+			}
+			catch (winrt::hresult_error const& ex)
+			{
+				std::cerr << "[just_audio_windows] Failed to open adaptive source: " << winrt::to_string(ex.message()) << std::endl;
+				complete([](Pending&) {});
+			}
+		}
+
+		for (auto& probe : requests.probes)
+		{
+			// A source known to be a stream plays from the connection even
+			// without ICY headers; a probed file plays from its URI.
+			auto uri = probe.first;
+			auto headers = requestHeaders(probe.second);
+			auto known = IcyHeaders::isKnownStream(uri, headers) || knownStreams.count(uri) > 0;
+			create_task([uri, headers, known]()
+				{ return LiveConnection::open(Uri(TO_WIDESTRING(uri)), headers, !known); })
+				.then([uri, complete](task<std::optional<LiveConnection>> opened)
+					{
+						std::optional<LiveConnection> connection{};
+						try
+						{
+							connection = opened.get();
+						}
+						catch (winrt::hresult_error const& ex)
+						{
+							std::cerr << "[just_audio_windows] Failed to open live stream: " << winrt::to_string(ex.message()) << std::endl;
+						}
+						complete([&](Pending& pending)
+							{
+								if (connection)
+								{
+									pending.connections.emplace(uri, *connection);
+								} }); });
+		}
+	}
+
+	/**
+	 * Returns the AdaptiveMediaSource of |creation|, with its renditions
+	 * picked by this player's bandwidth estimator instead of the platform
+	 * heuristics, or nullptr if the manifest could not be opened.
+	 */
+	AdaptiveMediaSource configureAdaptiveMediaSource(const AdaptiveMediaSourceCreationResult& creation)
+	{
+		using namespace winrt::Windows::Media::Streaming::Adaptive;
+
+		if (creation.Status() != AdaptiveMediaSourceCreationStatus::Success)
+		{
+			std::cerr << "[just_audio_windows] Failed to open adaptive source: " << (int)creation.Status() << std::endl;
+			return nullptr;
+		}
+
+		auto adaptiveSource = creation.MediaSource();
+
+		{
+			std::lock_guard<std::mutex> lock(bitrateMutex);
+			auto bitrate = renditionSelector.select(getBitrates(adaptiveSource), bandwidthEstimator.getEstimate(), 0);
+			if (bitrate != 0)
+			{
+				adaptiveSource.InitialBitrate(bitrate);
+			}
+		}
+		selectRendition(adaptiveSource);
+
+		adaptiveSource.DownloadCompleted([=](const AdaptiveMediaSource& sender, const AdaptiveMediaSourceDownloadCompletedEventArgs& args) -> void
+			{
+				if (args.ResourceType() != AdaptiveMediaSourceResourceType::MediaSegment)
+				{
+					return;
+				}
+
+				auto statistics = args.Statistics();
+				auto timeToLastByte = statistics.TimeToLastByteReceived();
+				if (!timeToLastByte)
+				{
+					return;
+				}
+
+				{
+					std::lock_guard<std::mutex> lock(bitrateMutex);
+					bandwidthEstimator.addSample(
+						statistics.ContentBytesReceivedCount(),
+						(double)TO_MICROSECONDS(timeToLastByte.Value()) / 1000000);
+				}
+				selectRendition(sender);
+			});
+
+		adaptiveSource.PlaybackBitrateChanged([=](auto, const auto& args) -> void
+			{ broadcastState(); });
+
+		return adaptiveSource;
+	}
+
+	/**
+	 * Pins |adaptiveSource| to the rendition chosen for the current bandwidth
+	 * estimate. The platform applies the change at the next segment boundary, so
+	 * switching does not interrupt playback.
+	 */
+	void selectRendition(const AdaptiveMediaSource& adaptiveSource)
+	{
+		try
+		{
+			uint32_t bitrate;
+			{
+				std::lock_guard<std::mutex> lock(bitrateMutex);
+				bitrate = renditionSelector.select(
+					getBitrates(adaptiveSource),
+					bandwidthEstimator.getEstimate(),
+					adaptiveSource.CurrentDownloadBitrate());
+			}
+			if (bitrate == 0)
+			{
+				return;
+			}
+
+			// Min and max are set together so that the platform heuristics can not
+			// pick another rendition, in the order that keeps min at most max.
+			auto desiredMin = adaptiveSource.DesiredMinBitrate();
+			auto currentMin = desiredMin ? std::optional<uint32_t>(desiredMin.Value()) : std::nullopt;
+			if (RenditionSelector::setsMaxFirst(currentMin, bitrate))
+			{
+				adaptiveSource.DesiredMaxBitrate(bitrate);
+				adaptiveSource.DesiredMinBitrate(bitrate);
+			}
+			else
+			{
+				adaptiveSource.DesiredMinBitrate(bitrate);
+				adaptiveSource.DesiredMaxBitrate(bitrate);
+			}
+		}
+		catch (winrt::hresult_error const& ex)
+		{
+			std::cerr << "[just_audio_windows] Failed to select rendition: " << winrt::to_string(ex.message()) << std::endl;
+		}
+	}
+
+	static std::vector<uint32_t> getBitrates(const AdaptiveMediaSource& adaptiveSource)
+	{
+		std::vector<uint32_t> bitrates{};
+		for (auto bitrate : adaptiveSource.AvailableBitrates())
+		{
+			bitrates.push_back(bitrate);
+		}
+		return bitrates;
+	}
+
+	/// Returns the adaptive sources of every loaded item.
+	std::vector<AdaptiveMediaSource> getAdaptiveSources()
+	{
+		std::vector<AdaptiveMediaSource> adaptiveSources{};
+
+		auto addItem = [&](const Playback::MediaPlaybackItem& item)
+		{
+			auto adaptiveSource = item.Source().AdaptiveMediaSource();
+			if (adaptiveSource)
+			{
+				adaptiveSources.push_back(adaptiveSource);
+			}
+		};
+
+		auto source = mediaPlayer.Source();
+		if (!source)
+		{
+			return adaptiveSources;
+		}
+
+		if (auto item = source.try_as<Playback::MediaPlaybackItem>())
+		{
+			addItem(item);
+		}
+		else
+		{
+			for (auto item : mediaPlaybackList.Items())
+			{
+				addItem(item);
+			}
+		}
+		return adaptiveSources;
+	}
+
+	/// Returns the adaptive source of the playing item, or nullptr.
+	AdaptiveMediaSource getCurrentAdaptiveSource()
+	{
+		auto source = mediaPlayer.Source();
+		if (!source)
+		{
+			return nullptr;
+		}
+
+		Playback::MediaPlaybackItem item = source.try_as<Playback::MediaPlaybackItem>();
+		if (!item)
+		{
+			item = mediaPlaybackList.CurrentItem();
+		}
+		if (!item)
+		{
+			return nullptr;
+		}
+		return item.Source().AdaptiveMediaSource();
+	}
 
 	void broadcastState()
 	{
@@ -738,15 +2390,42 @@ public:
 
 		auto eventData = flutter::EncodableMap();
 
-		auto duration = TO_MICROSECONDS(session.NaturalDuration());
+		// The decoder only knows the duration of the rest of the file when it
+		// plays from a frame the seek index found.
+		auto duration = indexedStream ? indexedDurationUs : TO_MICROSECONDS(session.NaturalDuration());
 
 		auto now = std::chrono::system_clock::now();
 
+		// Buffered ranges are relative to the source, which starts at the
+		// recording window when timeshifting.
+		int64_t sessionPosition = TO_MICROSECONDS(session.Position());
+		auto position = getPosition();
+		auto ranges = getBufferedRanges();
+		auto bufferedPosition = ranges.empty()
+			? (int64_t)(duration * session.BufferingProgress())
+			: BufferingController::bufferedPosition(sessionPosition, ranges) + position - sessionPosition;
+
 		eventData[flutter::EncodableValue("processingState")] = flutter::EncodableValue(processingState(session.PlaybackState()));
-		eventData[flutter::EncodableValue("updatePosition")] = flutter::EncodableValue(TO_MICROSECONDS(session.Position()));                 // int
-		eventData[flutter::EncodableValue("updateTime")] = flutter::EncodableValue(TO_MILLISECONDS(now.time_since_epoch()));                 // int
-		eventData[flutter::EncodableValue("bufferedPosition")] = flutter::EncodableValue((int64_t)(duration * session.BufferingProgress())); // int
-		eventData[flutter::EncodableValue("duration")] = flutter::EncodableValue(duration);                                                  // int
+		eventData[flutter::EncodableValue("updatePosition")] = flutter::EncodableValue(position);                             // int
+		eventData[flutter::EncodableValue("updateTime")] = flutter::EncodableValue(TO_MILLISECONDS(now.time_since_epoch())); // int
+		eventData[flutter::EncodableValue("bufferedPosition")] = flutter::EncodableValue(bufferedPosition);                  // int
+		eventData[flutter::EncodableValue("duration")] = flutter::EncodableValue(duration);                                  // int
+
+		auto bufferedRanges = flutter::EncodableList();
+		for (auto& range : ranges)
+		{
+			auto rangeData = flutter::EncodableMap();
+			rangeData[flutter::EncodableValue("start")] = flutter::EncodableValue(range.startUs + position - sessionPosition); // int
+			rangeData[flutter::EncodableValue("end")] = flutter::EncodableValue(range.endUs + position - sessionPosition);     // int
+			bufferedRanges.push_back(flutter::EncodableValue(rangeData));
+		}
+		eventData[flutter::EncodableValue("bufferedRanges")] = flutter::EncodableValue(bufferedRanges);
+
+		{
+			std::lock_guard<std::mutex> lock(bufferingMutex);
+			eventData[flutter::EncodableValue("stallCount")] = flutter::EncodableValue(bufferingController.getStallCount());       // int
+			eventData[flutter::EncodableValue("rebufferCount")] = flutter::EncodableValue(bufferingController.getRebufferCount()); // int
+		}
 
 		int64_t currentIndex = mediaPlaybackList.CurrentItemIndex();
 		if (currentIndex != 4294967295)
@@ -754,13 +2433,38 @@ public:
 			eventData[flutter::EncodableValue("currentIndex")] = flutter::EncodableValue(currentIndex); // int
 		}
 
+		if (auto buffer = timeshiftBuffer)
+		{
+			auto timeshift = flutter::EncodableMap();
+			timeshift[flutter::EncodableValue("start")] = flutter::EncodableValue(buffer->getStartTime()); // int
+			timeshift[flutter::EncodableValue("end")] = flutter::EncodableValue(buffer->getEndTime());     // int
+			eventData[flutter::EncodableValue("timeshift")] = flutter::EncodableValue(timeshift);
+		}
+
+		auto icyMetadata = collectIcyMetadata();
+		if (!icyMetadata.empty())
+		{
+			eventData[flutter::EncodableValue("icyMetadata")] = flutter::EncodableValue(icyMetadata);
+		}
+
+		auto adaptiveSource = getCurrentAdaptiveSource();
+		if (adaptiveSource)
+		{
+			auto bitrate = adaptiveSource.CurrentPlaybackBitrate();
+			auto rendition = flutter::EncodableMap();
+			rendition[flutter::EncodableValue("bitrate")] = flutter::EncodableValue((int64_t)bitrate);                                 // int
+			rendition[flutter::EncodableValue("index")] = flutter::EncodableValue(RenditionSelector::indexOf(getBitrates(adaptiveSource), bitrate)); // int
+			eventData[flutter::EncodableValue("rendition")] = flutter::EncodableValue(rendition);
+
+			std::lock_guard<std::mutex> lock(bitrateMutex);
+			eventData[flutter::EncodableValue("estimatedBandwidth")] = flutter::EncodableValue((int64_t)bandwidthEstimator.getEstimate()); // int
+		}
+
 		event_sink_->Success(eventData);
 	}
 
 	int processingState(Playback::MediaPlaybackState state)
 	{
-		auto session = mediaPlayer.PlaybackSession();
-
 		if (state == Playback::MediaPlaybackState::None)
 		{
 			return 0; // idle
@@ -769,12 +2473,14 @@ public:
 		{
 			return 1; // loading
 		}
-		else if (state == Playback::MediaPlaybackState::Buffering)
+		else if (state == Playback::MediaPlaybackState::Buffering || waitingForBuffer)
 		{
 			return 2; // buffering
 		}
-		else if (session.Position().count() == session.NaturalDuration().count())
+		else if (ended)
 		{
+			// From the end of the media rather than its position, which need
+			// not reach the duration exactly.
 			return 4; // completed
 		}
 		return 3; // ready
@@ -785,7 +2491,8 @@ public:
 		auto session = mediaPlayer.PlaybackSession();
 		auto eventData = flutter::EncodableMap();
 
-		auto isPlaying = session.PlaybackState() == Playback::MediaPlaybackState::Playing;
+		// Playback held back for buffering still counts as playing.
+		auto isPlaying = session.PlaybackState() == Playback::MediaPlaybackState::Playing || waitingForBuffer;
 
 		eventData[flutter::EncodableValue("playing")] = flutter::EncodableValue(isPlaying);
 		eventData[flutter::EncodableValue("volume")] = flutter::EncodableValue(mediaPlayer.Volume());
@@ -825,8 +2532,30 @@ public:
 	{
 		auto icyData = flutter::EncodableMap();
 
-		// TODO: Icy Metadata
-		// mediaPlayer.PlaybackMediaMarkers();
+		auto optionalString = [](const std::optional<std::string>& value)
+		{
+			return value ? flutter::EncodableValue(*value) : flutter::EncodableValue();
+		};
+
+		std::lock_guard<std::mutex> lock(icyMutex);
+		if (icyInfo)
+		{
+			auto info = flutter::EncodableMap();
+			info[flutter::EncodableValue("title")] = optionalString(icyInfo->title);
+			info[flutter::EncodableValue("url")] = optionalString(icyInfo->url);
+			icyData[flutter::EncodableValue("info")] = flutter::EncodableValue(info);
+		}
+		if (icyHeaders)
+		{
+			auto headers = flutter::EncodableMap();
+			headers[flutter::EncodableValue("bitrate")] = icyHeaders->bitrate ? flutter::EncodableValue(*icyHeaders->bitrate) : flutter::EncodableValue();
+			headers[flutter::EncodableValue("genre")] = optionalString(icyHeaders->genre);
+			headers[flutter::EncodableValue("name")] = optionalString(icyHeaders->name);
+			headers[flutter::EncodableValue("metadataInterval")] = icyHeaders->metadataInterval ? flutter::EncodableValue(*icyHeaders->metadataInterval) : flutter::EncodableValue();
+			headers[flutter::EncodableValue("url")] = optionalString(icyHeaders->url);
+			headers[flutter::EncodableValue("isPublic")] = icyHeaders->isPublic ? flutter::EncodableValue(*icyHeaders->isPublic) : flutter::EncodableValue();
+			icyData[flutter::EncodableValue("headers")] = flutter::EncodableValue(headers);
+		}
 
 		return icyData;
 	}
@@ -848,6 +2577,7 @@ public:
 			return;
 		}
 
+		ended = false;
 		try
 		{
 			mediaPlaybackList.MoveTo(index);
@@ -860,13 +2590,106 @@ public:
 		broadcastState();
 	}
 
-	void seekToPosition(int microseconds)
+	void seekToPosition(int64_t microseconds)
 	{
+		if (seekIndexed(microseconds))
+		{
+			return;
+		}
+
+		seeking = true;
+		ended = false;
+		if (indexedStream)
+		{
+			// Playing from a frame the index found, which no longer applies. The
+			// item loaded plays again, for the decoder to seek in.
+			auto wasPlaying = mediaPlayer.PlaybackSession().PlaybackState() == Playback::MediaPlaybackState::Playing;
+			indexedStream = nullptr;
+			indexedStartUs = 0;
+			mediaPlayer.Source(indexedItem.as<Playback::IMediaPlaybackSource>());
+			if (wasPlaying)
+			{
+				mediaPlayer.Play();
+			}
+		}
 		mediaPlayer.Position(TimeSpan(std::chrono::microseconds(microseconds)));
 
 		broadcastState();
 	}
 
+	/// Has the seek index of |source| built in the background if it is a
+	/// local MP3 file, so that seekIndexed can use it.
+	void requestSeekIndex(const flutter::EncodableMap& source)
+	{
+		const auto* type = std::get_if<std::string>(ValueOrNull(source, "type"));
+		const auto* uri = std::get_if<std::string>(ValueOrNull(source, "uri"));
+		if (!seekIndexer || !type || type->compare("progressive") != 0 || !uri)
+		{
+			return;
+		}
+		auto path = uriToPath(*uri);
+		if (!path || path->size() < 4)
+		{
+			return;
+		}
+		auto extension = path->substr(path->size() - 4);
+		std::transform(extension.begin(), extension.end(), extension.begin(), [](char c)
+			{ return (char)std::tolower((unsigned char)c); });
+		if (extension != ".mp3")
+		{
+			return;
+		}
+		indexedPath = *path;
+		seekIndexer->request(*path);
+	}
+
+	/**
+	 * Seeks exactly in a variable bitrate MP3 file through its seek index, if
+	 * it was built, and returns whether it did. The decoder would estimate
+	 * where the time is from the average bitrate; instead, the file is
+	 * reopened at the frame holding |microseconds|, less the frames its bit
+	 * reservoir reaches back into, and seeked within from there. The item
+	 * loaded is kept for seeks that fall back to the decoder.
+	 */
+	bool seekIndexed(int64_t microseconds)
+	{
+		if (!indexedPath || !indexedItem || !seekIndexer || mediaPlayer.IsLoopingEnabled())
+		{
+			return false;
+		}
+		auto index = seekIndexer->find(*indexedPath);
+		if (!index || !index->isVariableBitrate())
+		{
+			return false;
+		}
+		auto file = std::make_shared<MappedFile>(*indexedPath);
+		auto point = file->data() ? index->locate(file->data(), file->size(), microseconds) : std::nullopt;
+		if (!point)
+		{
+			return false;
+		}
+
+		auto wasPlaying = mediaPlayer.PlaybackSession().PlaybackState() == Playback::MediaPlaybackState::Playing;
+		seeking = true;
+		ended = false;
+		indexedStream = winrt::make_self<FileRangeStream>(file, point->offset);
+		indexedStartUs = point->timeUs;
+		indexedDurationUs = index->getDurationUs();
+		auto mediaSource = MediaSource::CreateFromStream(indexedStream.as<IRandomAccessStream>(), L"audio/mpeg");
+		mediaPlayer.Source(Playback::MediaPlaybackItem(mediaSource).as<Playback::IMediaPlaybackSource>());
+		// The few frames from where decoding starts to |microseconds| are
+		// skipped by the decoder, so that playback and the position reported
+		// start at the time requested.
+		mediaPlayer.Position(TimeSpan(std::chrono::microseconds(microseconds - point->timeUs)));
+		if (wasPlaying)
+		{
+			mediaPlayer.Play();
+		}
+
+		broadcastState();
+		return true;
+	}
+
 	void setShuffleOrder(const flutter::EncodableMap& source)
 	{
 		const std::string* type = std::get_if<std::string>(ValueOrNull(source, "type"));
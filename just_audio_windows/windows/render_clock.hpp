@@ -0,0 +1,193 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <thread>
+#include <type_traits>
+
+// Publishes a value that readers on any thread take without locking. Writers
+// make the sequence odd while they store, and readers retry when it was odd
+// or changed while they read; a reader never blocks a writer. The value is
+// kept in atomic words, so that a torn read is only ever thrown away, never
+// undefined.
+//
+// Writers take turns through the sequence itself, so store() spins while
+// another thread stores, and tryStore() gives up instead, which suits a
+// real-time thread.
+template <typename T>
+class Seqlock
+{
+	static_assert(std::is_trivially_copyable<T>::value, "Seqlock values are copied as words");
+
+public:
+	explicit Seqlock(const T& value = T{})
+	{
+		write(value);
+	}
+
+	// Prevent copying.
+	Seqlock(Seqlock const&) = delete;
+	Seqlock& operator=(Seqlock const&) = delete;
+
+	T load() const
+	{
+		uint64_t copy[kWords];
+		while (true)
+		{
+			auto before = sequence.load(std::memory_order_acquire);
+			if ((before & 1) == 0)
+			{
+				for (size_t i = 0; i < kWords; i++)
+				{
+					copy[i] = words[i].load(std::memory_order_relaxed);
+				}
+				std::atomic_thread_fence(std::memory_order_acquire);
+				if (sequence.load(std::memory_order_relaxed) == before)
+				{
+					break;
+				}
+			}
+			std::this_thread::yield();
+		}
+		T value;
+		std::memcpy(&value, copy, sizeof(T));
+		return value;
+	}
+
+	void store(const T& value)
+	{
+		while (!tryStore(value))
+		{
+			std::this_thread::yield();
+		}
+	}
+
+	/// Stores |value| unless another thread is storing. Returns whether it
+	/// did.
+	bool tryStore(const T& value)
+	{
+		return tryStore(value, []()
+			{ return true; });
+	}
+
+	/**
+	 * Stores |value| unless another thread is storing or |check| returns
+	 * false. |check| is called once no other thread can store, so that a
+	 * value found stale by it can not overwrite a newer one stored since.
+	 */
+	template <typename Check>
+	bool tryStore(const T& value, Check check)
+	{
+		auto current = sequence.load(std::memory_order_relaxed);
+		if ((current & 1) != 0 || !sequence.compare_exchange_strong(current, current + 1, std::memory_order_acquire, std::memory_order_relaxed))
+		{
+			return false;
+		}
+		if (!check())
+		{
+			sequence.store(current, std::memory_order_release);
+			return false;
+		}
+		std::atomic_thread_fence(std::memory_order_release);
+		write(value);
+		sequence.store(current + 2, std::memory_order_release);
+		return true;
+	}
+
+private:
+	static constexpr size_t kWords = (sizeof(T) + sizeof(uint64_t) - 1) / sizeof(uint64_t);
+
+	void write(const T& value)
+	{
+		uint64_t copy[kWords] = {};
+		std::memcpy(copy, &value, sizeof(T));
+		for (size_t i = 0; i < kWords; i++)
+		{
+			words[i].store(copy[i], std::memory_order_relaxed);
+		}
+	}
+
+	std::atomic<uint64_t> sequence = 0;
+	std::atomic<uint64_t> words[kWords];
+};
+
+// Where playback has got to, as published by the thread that renders it.
+struct RenderClockSnapshot
+{
+	// The item rendered, and the media time after the last frame rendered of
+	// it. |startUs| is the first frame rendered of it, which it can not be
+	// heard before.
+	uint64_t key = UINT64_MAX;
+	int64_t positionUs = 0;
+	int64_t startUs = 0;
+	int64_t durationUs = -1;
+	// Media time per output time, the speed.
+	double speed = 1.0;
+	// When the frames were rendered, on the steady clock.
+	int64_t renderedAtUs = 0;
+	// Whether the position was rendered, and is still to be heard, rather
+	// than set by a seek.
+	bool rendered = false;
+	// Whether the last frame of the playlist was rendered.
+	bool ended = false;
+};
+
+// The position of a player, which the output's real-time thread publishes
+// as it renders and any thread reads without locking. What was rendered is
+// only heard once the output has played what it holds ahead of it, so reads
+// are corrected for the output's latency.
+class RenderClock
+{
+public:
+	static int64_t nowUs()
+	{
+		return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+	}
+
+	RenderClockSnapshot load() const
+	{
+		return snapshot.load();
+	}
+
+	/// Called by the renderer; see Seqlock::tryStore.
+	template <typename Check>
+	bool tryPublish(const RenderClockSnapshot& value, Check check)
+	{
+		return snapshot.tryStore(value, check);
+	}
+
+	/// Called by other threads, for positions that are not rendered.
+	void publish(const RenderClockSnapshot& value)
+	{
+		snapshot.store(value);
+	}
+
+	/**
+	 * The media time being heard at |nowUs| by an output |latencyUs| behind
+	 * the renderer. What was rendered last is heard |latencyUs| after it was
+	 * rendered, and the output plays on meanwhile, so the position advances
+	 * between publications without passing what was rendered.
+	 */
+	static int64_t heardPositionUs(const RenderClockSnapshot& snapshot, int64_t latencyUs, int64_t nowUs)
+	{
+		if (!snapshot.rendered)
+		{
+			return snapshot.positionUs;
+		}
+		auto pendingUs = std::max<int64_t>(0, latencyUs - (nowUs - snapshot.renderedAtUs));
+		auto behindUs = (int64_t)((double)pendingUs * snapshot.speed);
+		return std::max(snapshot.startUs, snapshot.positionUs - behindUs);
+	}
+
+	/// Whether the end of the playlist has been rendered and heard.
+	static bool isHeardToEnd(const RenderClockSnapshot& snapshot, int64_t latencyUs, int64_t nowUs)
+	{
+		return snapshot.ended && nowUs - snapshot.renderedAtUs >= latencyUs;
+	}
+
+private:
+	Seqlock<RenderClockSnapshot> snapshot{};
+};
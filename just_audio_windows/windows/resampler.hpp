@@ -0,0 +1,188 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+#include "audio_decoder.hpp"
+#include "sample_kernels.hpp"
+
+// Converts interleaved audio between sample rates with a polyphase FIR: a
+// Kaiser-windowed sinc sampled at a number of phases between two frames, and
+// interpolated between the two nearest phases for any other position. Any
+// ratio works, and it can change from one frame to the next, as varispeed
+// needs.
+//
+// Moving on by more than one source frame at a time narrows the passband in
+// proportion, with a kernel as many times wider, so that nothing aliases. The
+// kernels are worked out again only when that factor changes by more than
+// about 1.5%.
+class Resampler
+{
+public:
+	enum class Quality
+	{
+		fast,
+		balanced,
+		best,
+	};
+
+	// The most the passband is narrowed by; faster steps alias.
+	static constexpr double kMaxNarrowing = 8;
+
+	explicit Resampler(uint32_t channels, Quality quality = Quality::balanced)
+		: channels(channels), quality(quality), settings(getSettings(quality))
+	{
+		design(1.0);
+	}
+
+	uint32_t getChannels() const
+	{
+		return channels;
+	}
+
+	Quality getQuality() const
+	{
+		return quality;
+	}
+
+	/// Sets how many source frames each output frame moves on by.
+	void setStep(double step)
+	{
+		// Quantized, so that a gliding speed does not redesign on every call.
+		unity = step == 1.0;
+		auto narrowing = std::min(kMaxNarrowing, std::max(1.0, std::ceil(step * 64) / 64));
+		if (narrowing != currentNarrowing)
+		{
+			design(narrowing);
+		}
+	}
+
+	/// Source frames read before the one interpolated from.
+	size_t getFramesBefore() const
+	{
+		return taps / 2 - 1;
+	}
+
+	/// Source frames read after the one interpolated from.
+	size_t getFramesAfter() const
+	{
+		return taps / 2;
+	}
+
+	/**
+	 * Writes the audio at |fraction| of a frame past |frame| to |out|, one
+	 * sample per channel. getFramesBefore() frames must come before |frame|
+	 * and getFramesAfter() after it.
+	 */
+	void interpolate(const float* frame, double fraction, float* out) const
+	{
+		if (fraction == 0 && unity)
+		{
+			// Nothing to convert; a kernel is not quite a pulse where it is
+			// centered.
+			std::copy(frame, frame + channels, out);
+			return;
+		}
+		auto position = fraction * settings.phases;
+		auto phase = std::min((size_t)position, settings.phases - 1);
+		auto weight = (float)(position - (double)phase);
+		auto rowLength = taps * channels;
+		const float* first = kernels.data() + phase * rowLength;
+		const float* second = first + rowLength;
+		const float* input = frame - getFramesBefore() * channels;
+
+		SampleKernels::get().firInterpolate(input, first, second, rowLength, channels, weight, out);
+	}
+
+private:
+	struct Settings
+	{
+		// Zero crossings of the sinc on each side, at the original rate.
+		size_t zeroCrossings;
+		size_t phases;
+		// The end of the passband, as a share of the lower Nyquist frequency.
+		double cutoff;
+		double kaiserBeta;
+	};
+
+	static Settings getSettings(Quality quality)
+	{
+		switch (quality)
+		{
+		case Quality::fast:
+			return Settings{ 4, 32, 0.85, 6.0 };
+		case Quality::best:
+			return Settings{ 16, 128, 0.95, 10.5 };
+		default:
+			return Settings{ 8, 64, 0.91, 8.6 };
+		}
+	}
+
+	/// The zeroth order modified Bessel function of the first kind.
+	static double besselI0(double x)
+	{
+		double sum = 1;
+		double term = 1;
+		for (int k = 1; k < 50 && term > sum * 1e-12; k++)
+		{
+			term *= (x / (2 * k)) * (x / (2 * k));
+			sum += term;
+		}
+		return sum;
+	}
+
+	/// Samples the kernel for a passband narrowed by |narrowing| at every
+	/// phase, repeating each tap for every channel, with one more phase at
+	/// the end to interpolate towards.
+	void design(double narrowing)
+	{
+		const double pi = 3.14159265358979323846;
+		currentNarrowing = narrowing;
+		auto halfWidth = (double)settings.zeroCrossings * narrowing;
+		// A multiple of 8 keeps every lane busy.
+		taps = ((size_t)std::ceil(halfWidth * 2) + 7) / 8 * 8;
+		auto cutoff = settings.cutoff / narrowing;
+		auto besselBeta = besselI0(settings.kaiserBeta);
+
+		kernels.assign((settings.phases + 1) * taps * channels, 0.0f);
+		std::vector<double> row(taps);
+		for (size_t phase = 0; phase <= settings.phases; phase++)
+		{
+			auto fraction = (double)phase / settings.phases;
+			double sum = 0;
+			for (size_t k = 0; k < taps; k++)
+			{
+				auto x = (double)k - (double)getFramesBefore() - fraction;
+				auto windowPosition = x / halfWidth;
+				if (std::abs(windowPosition) >= 1)
+				{
+					row[k] = 0;
+					continue;
+				}
+				auto sinc = x == 0 ? 1.0 : std::sin(pi * cutoff * x) / (pi * cutoff * x);
+				auto window = besselI0(settings.kaiserBeta * std::sqrt(1 - windowPosition * windowPosition)) / besselBeta;
+				row[k] = sinc * window;
+				sum += row[k];
+			}
+			// Every phase passes a constant through unchanged.
+			auto* target = kernels.data() + phase * taps * channels;
+			for (size_t k = 0; k < taps; k++)
+			{
+				for (uint32_t c = 0; c < channels; c++)
+				{
+					target[k * channels + c] = (float)(row[k] / sum);
+				}
+			}
+		}
+	}
+
+	uint32_t channels;
+	Quality quality;
+	Settings settings;
+	bool unity = true;
+	double currentNarrowing = 0;
+	size_t taps = 0;
+	std::vector<float> kernels{};
+};
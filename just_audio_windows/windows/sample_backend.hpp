@@ -0,0 +1,568 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+#include "audio_backend.hpp"
+#include "equalizer.hpp"
+#include "loudness_enhancer.hpp"
+#include "mixer.hpp"
+#include "sample_pool.hpp"
+#include "spsc_ring.hpp"
+
+// Plays a short clip as a sound effect. The clip is decoded once into a
+// SamplePool, and each trigger starts one of a fixed set of preallocated
+// voices from render(), so that a trigger is heard at the start of the next
+// mixer block. Triggers overlap: a clip can play over itself up to the
+// polyphony, after which the oldest voice is reused.
+//
+// play() triggers from the current position. seek() while playing triggers
+// another voice from the new position, which is how the Dart API restarts a
+// playing player. playAt() triggers a voice that render() starts at the
+// frame of the output heard then.
+class SampleBackend : public AudioBackend, public MixerInput
+{
+public:
+	static constexpr size_t kDefaultPolyphony = 8;
+
+	SampleBackend(std::shared_ptr<Mixer> mixer, std::shared_ptr<SamplePool> pool, size_t polyphony = kDefaultPolyphony)
+		: mixer(mixer), pool(pool), format(mixer->getFormat()), slots(std::max<size_t>(polyphony, 1)),
+		commands(64), equalizer(format), loudnessEnhancer(format)
+	{
+		notifyThread = std::thread([this]()
+			{ runNotifications(); });
+	}
+
+	/// Plays into |sink| through a mixer of its own, which is closed with the
+	/// player. |blockFrames| bounds the trigger latency.
+	SampleBackend(std::shared_ptr<AudioSink> sink, std::shared_ptr<SamplePool> pool,
+		size_t polyphony = kDefaultPolyphony, size_t blockFrames = Mixer::kDefaultBlockFrames)
+		: SampleBackend(std::make_shared<Mixer>(sink->getFormat(), sink, 1, blockFrames), pool, polyphony)
+	{
+		ownsMixer = true;
+	}
+
+	~SampleBackend()
+	{
+		dispose();
+	}
+
+	// Prevent copying.
+	SampleBackend(SampleBackend const&) = delete;
+	SampleBackend& operator=(SampleBackend const&) = delete;
+
+	void load(const AudioSourceSpec& source, std::optional<int32_t> initialIndex, int64_t initialPositionUs) override
+	{
+		// A clip of a clip is trimmed after decoding.
+		auto* leaf = &source;
+		int64_t startUs = 0;
+		std::optional<int64_t> endUs{};
+		if (source.type == AudioSourceSpec::Type::clipping && !source.children.empty())
+		{
+			leaf = &source.children[0];
+			startUs = source.startUs.value_or(0);
+			endUs = source.endUs;
+		}
+		if (!leaf->isLeaf())
+		{
+			throw std::invalid_argument("Samples must be a single source");
+		}
+
+		auto decoded = pool->get(*leaf, format);
+		std::lock_guard<std::mutex> lock(mutex);
+		// The voices may still refer to the previous clip.
+		releaseVoice();
+		playing = false;
+		sample = decoded;
+		auto frames = (int64_t)sample->frames();
+		startFrame = std::clamp<int64_t>(startUs * format.sampleRate / 1000000, 0, frames);
+		endFrame = endUs ? std::clamp<int64_t>(*endUs * format.sampleRate / 1000000, startFrame, frames) : frames;
+		positionUs = std::max<int64_t>(initialPositionUs, 0);
+		processingState = ProcessingState::ready;
+	}
+
+	void play() override
+	{
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			if (!sample)
+			{
+				return;
+			}
+			if (voice == 0)
+			{
+				voice = mixer->addVoice(this, voiceSettings);
+			}
+			playing = voice != 0;
+			if (playing)
+			{
+				trigger(positionUs);
+			}
+		}
+		notifyState();
+	}
+
+	void playAt(int64_t hostTimeUs) override
+	{
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			if (!sample)
+			{
+				return;
+			}
+			if (voice == 0)
+			{
+				voice = mixer->addVoice(this, voiceSettings);
+			}
+			playing = voice != 0;
+			if (playing)
+			{
+				trigger(positionUs, mixer->frameAtHostTime(hostTimeUs));
+			}
+		}
+		notifyState();
+	}
+
+	void pause() override
+	{
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			playing = false;
+			releaseVoice();
+		}
+		notifyState();
+	}
+
+	void seek(std::optional<int32_t> index, int64_t value) override
+	{
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			positionUs = std::max<int64_t>(value, 0);
+			if (playing)
+			{
+				trigger(positionUs);
+			}
+		}
+		notifyState();
+	}
+
+	void setVolume(double value, VolumeRamp ramp) override
+	{
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			voiceSettings.gain = (float)value;
+			updateVoice(ramp);
+		}
+		notifyState();
+	}
+
+	void setPan(double value) override
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		voiceSettings.pan = (float)std::clamp(value, -1.0, 1.0);
+		updateVoice();
+	}
+
+	void setPriority(int32_t value) override
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		voiceSettings.priority = value;
+		updateVoice();
+	}
+
+	void setSpeed(double value) override
+	{
+		// Samples play at their own speed; the value is only reported.
+		std::lock_guard<std::mutex> lock(mutex);
+		speed = value;
+	}
+
+	void setPitch(double value) override
+	{
+		// Likewise.
+		std::lock_guard<std::mutex> lock(mutex);
+		pitch = value;
+	}
+
+	void setSkipSilence(bool, SkipSilenceOptions) override
+	{
+		// Samples are short enough to be trimmed before they are loaded.
+	}
+
+	void setEqualizerEnabled(bool enabled) override
+	{
+		equalizer.setEnabled(enabled);
+	}
+
+	void setEqualizerBandGain(int32_t band, double gainDb) override
+	{
+		if (band < 0)
+		{
+			throw std::out_of_range("band index out of range");
+		}
+		equalizer.setBandGain((size_t)band, gainDb);
+	}
+
+	EqualizerParameters getEqualizerParameters() override
+	{
+		return equalizer.getParameters();
+	}
+
+	void setLoudnessEnhancerEnabled(bool enabled) override
+	{
+		loudnessEnhancer.setEnabled(enabled);
+	}
+
+	void setLoudnessEnhancerTargetGain(double gainDb) override
+	{
+		loudnessEnhancer.setTargetGain(gainDb);
+	}
+
+	void setLimiterTiming(int64_t attackUs, int64_t releaseUs) override
+	{
+		loudnessEnhancer.setTiming(attackUs, releaseUs);
+	}
+
+	void setCrossfade(int64_t) override
+	{
+		// A sample player plays a single clip.
+	}
+
+	void setLoopMode(LoopMode value) override
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		loopMode = value;
+		looping = value != LoopMode::off;
+	}
+
+	void setShuffle(bool enabled) override
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		shuffle = enabled;
+	}
+
+	void setShuffleOrder(const AudioSourceSpec& source) override {}
+
+	void insert(int32_t index, const std::vector<AudioSourceSpec>& children) override
+	{
+		throw std::invalid_argument("Samples do not support playlists");
+	}
+
+	void removeRange(int32_t start, int32_t end) override
+	{
+		throw std::invalid_argument("Samples do not support playlists");
+	}
+
+	void move(int32_t from, int32_t to) override
+	{
+		throw std::invalid_argument("Samples do not support playlists");
+	}
+
+	void setSyncGroup(std::shared_ptr<SyncGroup> group) override
+	{
+		if (group)
+		{
+			throw std::invalid_argument("Samples can not join a sync group");
+		}
+	}
+
+	BackendState getState() override
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		BackendState state{};
+		state.playing = playing;
+		state.volume = voiceSettings.gain;
+		state.speed = speed;
+		state.pitch = pitch;
+		state.gainReductionDb = loudnessEnhancer.getGainReductionDb();
+		state.loopMode = loopMode;
+		state.shuffle = shuffle;
+		if (sample)
+		{
+			// Completed once every triggered voice has finished.
+			auto done = triggers > 0 && startedTriggers.load(std::memory_order_acquire) == triggers && activeVoices.load() == 0;
+			state.processingState = playing && done ? ProcessingState::completed : processingState;
+			state.currentIndex = 0;
+			state.durationUs = (endFrame - startFrame) * 1000000 / format.sampleRate;
+			state.positionUs = activeVoices > 0 ? latestPositionUs.load() : positionUs;
+			state.bufferedPositionUs = *state.durationUs;
+		}
+		return state;
+	}
+
+	void dispose() override
+	{
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			if (disposed)
+			{
+				return;
+			}
+			disposed = true;
+			playing = false;
+			releaseVoice();
+		}
+		changed.notify_all();
+		if (notifyThread.joinable())
+		{
+			notifyThread.join();
+		}
+		if (ownsMixer)
+		{
+			mixer->close();
+		}
+	}
+
+	/// Mixes the playing voices into |out|. Starting a voice only claims a
+	/// preallocated slot, so this never locks or allocates.
+	size_t render(float* out, size_t frames) override
+	{
+		auto channels = format.channels;
+		std::fill(out, out + frames * channels, 0.0f);
+
+		auto blockStart = mixer->getFramePosition();
+		Command command{};
+		while (commands.read(&command, 1) == 1)
+		{
+			// Reuse the oldest voice when all of them are playing.
+			auto slot = std::find_if(slots.begin(), slots.end(), [](const Slot& slot)
+				{ return slot.sample == nullptr; });
+			if (slot == slots.end())
+			{
+				slot = std::min_element(slots.begin(), slots.end(), [](const Slot& a, const Slot& b)
+					{ return a.started < b.started; });
+			}
+			auto delay = command.atFrame > blockStart ? (int64_t)(command.atFrame - blockStart) : 0;
+			*slot = Slot{ command.sample, command.frame, command.startFrame, command.endFrame, command.loop, ++started, delay };
+			if (command.atFrame == 0)
+			{
+				recordLatency(command.triggeredAt);
+			}
+		}
+
+		size_t active = 0;
+		int64_t latestFrame = 0;
+		uint64_t latestStart = 0;
+		for (auto& slot : slots)
+		{
+			if (!slot.sample)
+			{
+				continue;
+			}
+			// A scheduled voice starts within a later block, or part way through
+			// this one.
+			auto done = (size_t)std::min<int64_t>(slot.delayFrames, (int64_t)frames);
+			slot.delayFrames -= (int64_t)done;
+			while (done < frames && slot.sample)
+			{
+				auto count = (size_t)std::min<int64_t>((int64_t)(frames - done), slot.endFrame - slot.frame);
+				Mixer::accumulate(out + done * channels, slot.sample->samples.data() + slot.frame * channels, count * channels, 1.0f);
+				slot.frame += (int64_t)count;
+				done += count;
+				if (slot.frame >= slot.endFrame)
+				{
+					if (slot.loop && slot.endFrame > slot.startFrame)
+					{
+						slot.frame = slot.startFrame;
+					}
+					else
+					{
+						slot.sample = nullptr;
+					}
+				}
+			}
+			if (slot.sample)
+			{
+				active++;
+				if (slot.started > latestStart)
+				{
+					latestStart = slot.started;
+					latestFrame = slot.frame - slot.startFrame;
+				}
+			}
+		}
+
+		if (active == 0 && lastActive > 0)
+		{
+			finished.store(true, std::memory_order_release);
+		}
+		lastActive = active;
+		activeVoices.store(active, std::memory_order_relaxed);
+		latestPositionUs.store(latestFrame * 1000000 / format.sampleRate, std::memory_order_relaxed);
+		startedTriggers.store(started, std::memory_order_release);
+		equalizer.process(out, frames);
+		loudnessEnhancer.process(out, frames);
+		return active > 0 ? frames : 0;
+	}
+
+	struct TriggerLatency
+	{
+		uint64_t count;
+		double meanUs;
+		double maxUs;
+	};
+
+	/// How long triggers waited for render() to start their voice.
+	TriggerLatency getTriggerLatency() const
+	{
+		auto count = latencyCount.load();
+		return TriggerLatency{ count, count > 0 ? (double)latencySumUs.load() / count : 0.0, (double)latencyMaxUs.load() };
+	}
+
+private:
+	// A voice started by render(). The backend holds |sample| and only replaces
+	// it once the mixer voice is released, so render() never frees the clip.
+	struct Slot
+	{
+		const PcmSample* sample;
+		int64_t frame;
+		int64_t startFrame;
+		int64_t endFrame;
+		bool loop;
+		uint64_t started;
+		// Frames of output to wait before starting.
+		int64_t delayFrames;
+	};
+
+	struct Command
+	{
+		const PcmSample* sample;
+		int64_t frame;
+		int64_t startFrame;
+		int64_t endFrame;
+		bool loop;
+		std::chrono::steady_clock::time_point triggeredAt;
+		// The output frame to start at, or 0 for the next block.
+		uint64_t atFrame;
+	};
+
+	void trigger(int64_t fromUs, uint64_t atFrame = 0)
+	{
+		auto frame = std::clamp<int64_t>(startFrame + fromUs * format.sampleRate / 1000000, startFrame, endFrame);
+		Command command{ sample.get(), frame, startFrame, endFrame, looping, std::chrono::steady_clock::now(), atFrame };
+		if (commands.write(&command, 1) == 1)
+		{
+			triggers++;
+		}
+	}
+
+	void recordLatency(std::chrono::steady_clock::time_point triggeredAt)
+	{
+		auto latencyUs = (uint64_t)std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - triggeredAt).count();
+		latencyCount.fetch_add(1, std::memory_order_relaxed);
+		latencySumUs.fetch_add(latencyUs, std::memory_order_relaxed);
+		auto max = latencyMaxUs.load(std::memory_order_relaxed);
+		while (latencyUs > max && !latencyMaxUs.compare_exchange_weak(max, latencyUs, std::memory_order_relaxed))
+		{
+		}
+	}
+
+	/// Stops every voice. Once the mixer voice is removed render() is not
+	/// running, so its state can be reset from here.
+	void releaseVoice()
+	{
+		if (voice != 0)
+		{
+			mixer->removeVoice(voice);
+			voice = 0;
+		}
+		Command command{};
+		while (commands.read(&command, 1) == 1)
+		{
+		}
+		for (auto& slot : slots)
+		{
+			slot.sample = nullptr;
+		}
+		started = 0;
+		lastActive = 0;
+		triggers = 0;
+		startedTriggers = 0;
+		activeVoices = 0;
+	}
+
+	void updateVoice(VolumeRamp ramp = VolumeRamp{})
+	{
+		if (voice != 0)
+		{
+			mixer->setVoiceSettings(voice, voiceSettings, ramp);
+		}
+	}
+
+	void onStolen() override
+	{
+		// Called by another player's play(), which may hold its own lock but
+		// not this one.
+		voice = 0;
+		playing = false;
+		finished = true;
+		changed.notify_all();
+	}
+
+	/// Reports voices finishing, which render() can not do itself.
+	void runNotifications()
+	{
+		std::unique_lock<std::mutex> lock(mutex);
+		while (!disposed)
+		{
+			changed.wait_for(lock, std::chrono::milliseconds(20));
+			if (finished.exchange(false) && !disposed)
+			{
+				lock.unlock();
+				notifyState();
+				lock.lock();
+			}
+		}
+	}
+
+	std::shared_ptr<Mixer> mixer;
+	bool ownsMixer = false;
+	std::shared_ptr<SamplePool> pool;
+	AudioFormat format;
+
+	std::mutex mutex;
+	std::condition_variable changed;
+	std::thread notifyThread;
+	bool disposed = false;
+
+	std::shared_ptr<const PcmSample> sample = nullptr;
+	int64_t startFrame = 0;
+	int64_t endFrame = 0;
+	int64_t positionUs = 0;
+	ProcessingState processingState = ProcessingState::idle;
+	std::atomic<bool> playing = false;
+	uint64_t triggers = 0;
+	bool looping = false;
+	double speed = 1.0;
+	double pitch = 1.0;
+	LoopMode loopMode = LoopMode::off;
+	bool shuffle = false;
+	VoiceSettings voiceSettings{};
+	std::atomic<uint64_t> voice = 0;
+
+	// Owned by render() while the mixer voice exists.
+	std::vector<Slot> slots;
+	uint64_t started = 0;
+	size_t lastActive = 0;
+
+	SpscRing<Command> commands;
+	std::atomic<size_t> activeVoices = 0;
+	std::atomic<uint64_t> startedTriggers = 0;
+	std::atomic<int64_t> latestPositionUs = 0;
+	std::atomic<bool> finished = false;
+	std::atomic<uint64_t> latencyCount = 0;
+	std::atomic<uint64_t> latencySumUs = 0;
+	std::atomic<uint64_t> latencyMaxUs = 0;
+
+	// Set from any thread and applied by render(), which they never block.
+	Equalizer equalizer;
+	LoudnessEnhancer loudnessEnhancer;
+};
@@ -0,0 +1,844 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+#if defined(_M_X64) || defined(__x86_64__)
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#ifndef JUST_AUDIO_SSE
+#define JUST_AUDIO_SSE 1
+#endif
+#define JUST_AUDIO_SSE2 1
+#elif defined(_M_ARM64) || defined(__ARM_NEON)
+#include <arm_neon.h>
+#ifndef JUST_AUDIO_NEON
+#define JUST_AUDIO_NEON 1
+#endif
+#endif
+
+// Functions built for AVX2 in a binary that does not require it, and only
+// called once the CPU is known to support it. MSVC compiles the intrinsics
+// without this.
+#if defined(JUST_AUDIO_SSE2) && (defined(__GNUC__) || defined(__clang__))
+#define JUST_AUDIO_TARGET_AVX2 __attribute__((target("avx2")))
+#else
+#define JUST_AUDIO_TARGET_AVX2
+#endif
+
+enum class SimdLevel
+{
+	scalar,
+	sse2,
+	avx2,
+	neon,
+};
+
+// The conversions and channel layouts on the paths that run for every sample:
+// integer PCM to float, planar to interleaved and back, mono and stereo to
+// each other, 5.1 down to stereo, mixing with a gain, and the filter of the
+// resampler. Each has a scalar
+// version and versions for SSE2 and AVX2 on x64 or NEON on ARM64; get()
+// picks the fastest the CPU supports once, on first use. Integer conversions
+// give the same floats at every level.
+//
+// 5.1 is in the WAVE channel order (L, R, C, LFE, Ls, Rs) and is mixed down
+// as ITU-R BS.775 describes, without the LFE, scaled so that a full-scale
+// signal in every channel does not clip.
+struct SampleKernels
+{
+	static constexpr float kDownmixCenter = 0.70710678f;
+	static constexpr float kDownmixScale = 1.0f / (1.0f + 2 * kDownmixCenter);
+
+	SimdLevel level;
+	// |count| little-endian samples to floats from -1 to 1.
+	void (*int16ToFloat)(const uint8_t* input, float* output, size_t count);
+	void (*int24ToFloat)(const uint8_t* input, float* output, size_t count);
+	void (*int32ToFloat)(const uint8_t* input, float* output, size_t count);
+	void (*interleave)(const float* const* planes, uint32_t channels, size_t frames, float* output);
+	void (*deinterleave)(const float* input, uint32_t channels, size_t frames, float* const* planes);
+	void (*monoToStereo)(const float* input, float* output, size_t frames);
+	// Averages the two channels.
+	void (*stereoToMono)(const float* input, float* output, size_t frames);
+	void (*downmix51)(const float* input, float* output, size_t frames);
+	// Adds |gain| times |input| to |output|, |count| samples each.
+	void (*accumulate)(float* output, const float* input, size_t count, float gain);
+	// Filters |count| interleaved samples of |channels| channels with taps
+	// |weight| of the way from |first| to |second|, writing one sum per
+	// channel to |out|. |count| is a multiple of |channels|.
+	void (*firInterpolate)(const float* input, const float* first, const float* second, size_t count,
+		uint32_t channels, float weight, float* out);
+
+	/// The kernels for the CPU this runs on.
+	static const SampleKernels& get()
+	{
+		static const SampleKernels& kernels = forLevel(detect());
+		return kernels;
+	}
+
+	/// Whether the CPU this runs on supports |level|.
+	static bool isSupported(SimdLevel level)
+	{
+		switch (level)
+		{
+		case SimdLevel::scalar:
+			return true;
+#ifdef JUST_AUDIO_SSE2
+		case SimdLevel::sse2:
+			return true;
+		case SimdLevel::avx2:
+			return detect() == SimdLevel::avx2;
+#endif
+#ifdef JUST_AUDIO_NEON
+		case SimdLevel::neon:
+			return true;
+#endif
+		default:
+			return false;
+		}
+	}
+
+	/// The kernels for |level|, which must be supported.
+	static const SampleKernels& forLevel(SimdLevel level);
+
+private:
+	static SimdLevel detect()
+	{
+#if defined(JUST_AUDIO_SSE2) && defined(_MSC_VER)
+		int info[4];
+		__cpuid(info, 0);
+		if (info[0] >= 7)
+		{
+			__cpuid(info, 1);
+			// The OS must also save the upper halves of the AVX registers.
+			auto osxsave = (info[2] & (1 << 27)) != 0;
+			auto avx = (info[2] & (1 << 28)) != 0;
+			__cpuidex(info, 7, 0);
+			auto avx2 = (info[1] & (1 << 5)) != 0;
+			if (osxsave && avx && avx2 && (_xgetbv(0) & 6) == 6)
+			{
+				return SimdLevel::avx2;
+			}
+		}
+		return SimdLevel::sse2;
+#elif defined(JUST_AUDIO_SSE2)
+		__builtin_cpu_init();
+		return __builtin_cpu_supports("avx2") ? SimdLevel::avx2 : SimdLevel::sse2;
+#elif defined(JUST_AUDIO_NEON)
+		return SimdLevel::neon;
+#else
+		return SimdLevel::scalar;
+#endif
+	}
+};
+
+// The scalar kernels, which the others fall back on for what is left over.
+struct ScalarSampleKernels
+{
+	static void int16ToFloat(const uint8_t* input, float* output, size_t count)
+	{
+		for (size_t i = 0; i < count; i++)
+		{
+			output[i] = (int16_t)(input[i * 2 + 1] << 8 | input[i * 2]) / 32768.0f;
+		}
+	}
+
+	static void int24ToFloat(const uint8_t* input, float* output, size_t count)
+	{
+		for (size_t i = 0; i < count; i++)
+		{
+			auto* p = input + i * 3;
+			int32_t value = (int32_t)((uint32_t)p[2] << 24 | (uint32_t)p[1] << 16 | (uint32_t)p[0] << 8) >> 8;
+			output[i] = value / 8388608.0f;
+		}
+	}
+
+	static void int32ToFloat(const uint8_t* input, float* output, size_t count)
+	{
+		for (size_t i = 0; i < count; i++)
+		{
+			auto* p = input + i * 4;
+			output[i] = (int32_t)((uint32_t)p[3] << 24 | (uint32_t)p[2] << 16 | (uint32_t)p[1] << 8 | p[0]) / 2147483648.0f;
+		}
+	}
+
+	static void interleave(const float* const* planes, uint32_t channels, size_t frames, float* output)
+	{
+		for (size_t f = 0; f < frames; f++)
+		{
+			for (uint32_t c = 0; c < channels; c++)
+			{
+				output[f * channels + c] = planes[c][f];
+			}
+		}
+	}
+
+	static void deinterleave(const float* input, uint32_t channels, size_t frames, float* const* planes)
+	{
+		for (size_t f = 0; f < frames; f++)
+		{
+			for (uint32_t c = 0; c < channels; c++)
+			{
+				planes[c][f] = input[f * channels + c];
+			}
+		}
+	}
+
+	static void monoToStereo(const float* input, float* output, size_t frames)
+	{
+		for (size_t f = 0; f < frames; f++)
+		{
+			output[f * 2] = input[f];
+			output[f * 2 + 1] = input[f];
+		}
+	}
+
+	static void stereoToMono(const float* input, float* output, size_t frames)
+	{
+		for (size_t f = 0; f < frames; f++)
+		{
+			output[f] = (input[f * 2] + input[f * 2 + 1]) * 0.5f;
+		}
+	}
+
+	static void downmix51(const float* input, float* output, size_t frames)
+	{
+		for (size_t f = 0; f < frames; f++)
+		{
+			auto* frame = input + f * 6;
+			output[f * 2] = (frame[0] + (frame[2] + frame[4]) * SampleKernels::kDownmixCenter) * SampleKernels::kDownmixScale;
+			output[f * 2 + 1] = (frame[1] + (frame[2] + frame[5]) * SampleKernels::kDownmixCenter) * SampleKernels::kDownmixScale;
+		}
+	}
+
+	static void accumulate(float* output, const float* input, size_t count, float gain)
+	{
+		for (size_t i = 0; i < count; i++)
+		{
+			output[i] += input[i] * gain;
+		}
+	}
+
+	static void firInterpolate(const float* input, const float* first, const float* second, size_t count,
+		uint32_t channels, float weight, float* out)
+	{
+		std::fill(out, out + channels, 0.0f);
+		for (size_t i = 0; i < count; i++)
+		{
+			out[i % channels] += input[i] * (first[i] + (second[i] - first[i]) * weight);
+		}
+	}
+
+	/// Adds the sums of |lanes| lanes, each of channel |lane| % |channels|,
+	/// to |out|, filtered as firInterpolate() does.
+	static void addLanes(const float* firstSums, const float* secondSums, size_t lanes, uint32_t channels,
+		float weight, float* out)
+	{
+		for (size_t lane = 0; lane < lanes; lane++)
+		{
+			out[lane % channels] += firstSums[lane] + (secondSums[lane] - firstSums[lane]) * weight;
+		}
+	}
+};
+
+#ifdef JUST_AUDIO_SSE2
+struct Sse2SampleKernels
+{
+	static void int16ToFloat(const uint8_t* input, float* output, size_t count)
+	{
+		size_t i = 0;
+		auto scale = _mm_set1_ps(1.0f / 32768);
+		for (; i + 8 <= count; i += 8)
+		{
+			auto samples = _mm_loadu_si128((const __m128i*)(input + i * 2));
+			// Each sample into the top half of a 32-bit lane, shifted back down
+			// with its sign.
+			auto low = _mm_srai_epi32(_mm_unpacklo_epi16(samples, samples), 16);
+			auto high = _mm_srai_epi32(_mm_unpackhi_epi16(samples, samples), 16);
+			_mm_storeu_ps(output + i, _mm_mul_ps(_mm_cvtepi32_ps(low), scale));
+			_mm_storeu_ps(output + i + 4, _mm_mul_ps(_mm_cvtepi32_ps(high), scale));
+		}
+		ScalarSampleKernels::int16ToFloat(input + i * 2, output + i, count - i);
+	}
+
+	static void int24ToFloat(const uint8_t* input, float* output, size_t count)
+	{
+		// SSE2 has no byte shuffle, so only the conversion is vectorized.
+		size_t i = 0;
+		auto scale = _mm_set1_ps(1.0f / 8388608);
+		for (; i + 4 <= count; i += 4)
+		{
+			auto* p = input + i * 3;
+			auto samples = _mm_setr_epi32(
+				(int32_t)((uint32_t)p[2] << 24 | (uint32_t)p[1] << 16 | (uint32_t)p[0] << 8),
+				(int32_t)((uint32_t)p[5] << 24 | (uint32_t)p[4] << 16 | (uint32_t)p[3] << 8),
+				(int32_t)((uint32_t)p[8] << 24 | (uint32_t)p[7] << 16 | (uint32_t)p[6] << 8),
+				(int32_t)((uint32_t)p[11] << 24 | (uint32_t)p[10] << 16 | (uint32_t)p[9] << 8));
+			_mm_storeu_ps(output + i, _mm_mul_ps(_mm_cvtepi32_ps(_mm_srai_epi32(samples, 8)), scale));
+		}
+		ScalarSampleKernels::int24ToFloat(input + i * 3, output + i, count - i);
+	}
+
+	static void int32ToFloat(const uint8_t* input, float* output, size_t count)
+	{
+		size_t i = 0;
+		auto scale = _mm_set1_ps(1.0f / 2147483648.0f);
+		for (; i + 4 <= count; i += 4)
+		{
+			auto samples = _mm_loadu_si128((const __m128i*)(input + i * 4));
+			_mm_storeu_ps(output + i, _mm_mul_ps(_mm_cvtepi32_ps(samples), scale));
+		}
+		ScalarSampleKernels::int32ToFloat(input + i * 4, output + i, count - i);
+	}
+
+	static void interleave(const float* const* planes, uint32_t channels, size_t frames, float* output)
+	{
+		if (channels != 2)
+		{
+			ScalarSampleKernels::interleave(planes, channels, frames, output);
+			return;
+		}
+		size_t f = 0;
+		for (; f + 4 <= frames; f += 4)
+		{
+			auto left = _mm_loadu_ps(planes[0] + f);
+			auto right = _mm_loadu_ps(planes[1] + f);
+			_mm_storeu_ps(output + f * 2, _mm_unpacklo_ps(left, right));
+			_mm_storeu_ps(output + f * 2 + 4, _mm_unpackhi_ps(left, right));
+		}
+		const float* rest[2] = { planes[0] + f, planes[1] + f };
+		ScalarSampleKernels::interleave(rest, 2, frames - f, output + f * 2);
+	}
+
+	static void deinterleave(const float* input, uint32_t channels, size_t frames, float* const* planes)
+	{
+		if (channels != 2)
+		{
+			ScalarSampleKernels::deinterleave(input, channels, frames, planes);
+			return;
+		}
+		size_t f = 0;
+		for (; f + 4 <= frames; f += 4)
+		{
+			auto first = _mm_loadu_ps(input + f * 2);
+			auto second = _mm_loadu_ps(input + f * 2 + 4);
+			_mm_storeu_ps(planes[0] + f, _mm_shuffle_ps(first, second, _MM_SHUFFLE(2, 0, 2, 0)));
+			_mm_storeu_ps(planes[1] + f, _mm_shuffle_ps(first, second, _MM_SHUFFLE(3, 1, 3, 1)));
+		}
+		float* rest[2] = { planes[0] + f, planes[1] + f };
+		ScalarSampleKernels::deinterleave(input + f * 2, 2, frames - f, rest);
+	}
+
+	static void monoToStereo(const float* input, float* output, size_t frames)
+	{
+		size_t f = 0;
+		for (; f + 4 <= frames; f += 4)
+		{
+			auto samples = _mm_loadu_ps(input + f);
+			_mm_storeu_ps(output + f * 2, _mm_unpacklo_ps(samples, samples));
+			_mm_storeu_ps(output + f * 2 + 4, _mm_unpackhi_ps(samples, samples));
+		}
+		ScalarSampleKernels::monoToStereo(input + f, output + f * 2, frames - f);
+	}
+
+	static void stereoToMono(const float* input, float* output, size_t frames)
+	{
+		size_t f = 0;
+		auto half = _mm_set1_ps(0.5f);
+		for (; f + 4 <= frames; f += 4)
+		{
+			auto first = _mm_loadu_ps(input + f * 2);
+			auto second = _mm_loadu_ps(input + f * 2 + 4);
+			auto left = _mm_shuffle_ps(first, second, _MM_SHUFFLE(2, 0, 2, 0));
+			auto right = _mm_shuffle_ps(first, second, _MM_SHUFFLE(3, 1, 3, 1));
+			_mm_storeu_ps(output + f, _mm_mul_ps(_mm_add_ps(left, right), half));
+		}
+		ScalarSampleKernels::stereoToMono(input + f * 2, output + f, frames - f);
+	}
+
+	static void downmix51(const float* input, float* output, size_t frames)
+	{
+		size_t f = 0;
+		auto center = _mm_set1_ps(SampleKernels::kDownmixCenter);
+		auto scale = _mm_set1_ps(SampleKernels::kDownmixScale);
+		// Two frames, three vectors: L0 R0 C0 LFE0, Ls0 Rs0 L1 R1, C1 LFE1 Ls1 Rs1.
+		for (; f + 2 <= frames; f += 2)
+		{
+			auto a = _mm_loadu_ps(input + f * 6);
+			auto b = _mm_loadu_ps(input + f * 6 + 4);
+			auto c = _mm_loadu_ps(input + f * 6 + 8);
+			auto front = _mm_shuffle_ps(a, b, _MM_SHUFFLE(3, 2, 1, 0));
+			auto middle = _mm_shuffle_ps(a, c, _MM_SHUFFLE(0, 0, 2, 2));
+			auto surround = _mm_shuffle_ps(b, c, _MM_SHUFFLE(3, 2, 1, 0));
+			auto mixed = _mm_add_ps(front, _mm_mul_ps(_mm_add_ps(middle, surround), center));
+			_mm_storeu_ps(output + f * 2, _mm_mul_ps(mixed, scale));
+		}
+		ScalarSampleKernels::downmix51(input + f * 6, output + f * 2, frames - f);
+	}
+
+	static void accumulate(float* output, const float* input, size_t count, float gain)
+	{
+		size_t i = 0;
+		auto scale = _mm_set1_ps(gain);
+		for (; i + 4 <= count; i += 4)
+		{
+			_mm_storeu_ps(output + i, _mm_add_ps(_mm_loadu_ps(output + i), _mm_mul_ps(_mm_loadu_ps(input + i), scale)));
+		}
+		ScalarSampleKernels::accumulate(output + i, input + i, count - i, gain);
+	}
+
+	static void firInterpolate(const float* input, const float* first, const float* second, size_t count,
+		uint32_t channels, float weight, float* out)
+	{
+		// Each lane sums one channel when the channels divide the lanes.
+		if (4 % channels != 0)
+		{
+			ScalarSampleKernels::firInterpolate(input, first, second, count, channels, weight, out);
+			return;
+		}
+		size_t i = 0;
+		auto firstSum = _mm_setzero_ps();
+		auto secondSum = _mm_setzero_ps();
+		for (; i + 4 <= count; i += 4)
+		{
+			auto samples = _mm_loadu_ps(input + i);
+			firstSum = _mm_add_ps(firstSum, _mm_mul_ps(samples, _mm_loadu_ps(first + i)));
+			secondSum = _mm_add_ps(secondSum, _mm_mul_ps(samples, _mm_loadu_ps(second + i)));
+		}
+		float sums[2][4];
+		_mm_storeu_ps(sums[0], firstSum);
+		_mm_storeu_ps(sums[1], secondSum);
+		ScalarSampleKernels::firInterpolate(input + i, first + i, second + i, count - i, channels, weight, out);
+		ScalarSampleKernels::addLanes(sums[0], sums[1], 4, channels, weight, out);
+	}
+};
+
+// 5.1 downmixing, which does not fit eight lanes, stays with SSE2.
+struct Avx2SampleKernels
+{
+	JUST_AUDIO_TARGET_AVX2 static void int16ToFloat(const uint8_t* input, float* output, size_t count)
+	{
+		size_t i = 0;
+		auto scale = _mm256_set1_ps(1.0f / 32768);
+		for (; i + 8 <= count; i += 8)
+		{
+			auto samples = _mm256_cvtepi16_epi32(_mm_loadu_si128((const __m128i*)(input + i * 2)));
+			_mm256_storeu_ps(output + i, _mm256_mul_ps(_mm256_cvtepi32_ps(samples), scale));
+		}
+		ScalarSampleKernels::int16ToFloat(input + i * 2, output + i, count - i);
+	}
+
+	JUST_AUDIO_TARGET_AVX2 static void int24ToFloat(const uint8_t* input, float* output, size_t count)
+	{
+		size_t i = 0;
+		auto scale = _mm256_set1_ps(1.0f / 8388608);
+		// Bytes 12 to 23 move to the upper half, then each sample goes to the top
+		// three bytes of its lane, to be shifted back down with its sign.
+		auto spread = _mm256_setr_epi32(0, 1, 2, 3, 3, 4, 5, 6);
+		auto place = _mm256_setr_epi8(
+			-1, 0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11,
+			-1, 0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11);
+		// Eight samples take 24 bytes, but 32 are read.
+		for (; i + 11 <= count; i += 8)
+		{
+			auto bytes = _mm256_loadu_si256((const __m256i*)(input + i * 3));
+			auto samples = _mm256_shuffle_epi8(_mm256_permutevar8x32_epi32(bytes, spread), place);
+			_mm256_storeu_ps(output + i, _mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_srai_epi32(samples, 8)), scale));
+		}
+		ScalarSampleKernels::int24ToFloat(input + i * 3, output + i, count - i);
+	}
+
+	JUST_AUDIO_TARGET_AVX2 static void int32ToFloat(const uint8_t* input, float* output, size_t count)
+	{
+		size_t i = 0;
+		auto scale = _mm256_set1_ps(1.0f / 2147483648.0f);
+		for (; i + 8 <= count; i += 8)
+		{
+			auto samples = _mm256_loadu_si256((const __m256i*)(input + i * 4));
+			_mm256_storeu_ps(output + i, _mm256_mul_ps(_mm256_cvtepi32_ps(samples), scale));
+		}
+		ScalarSampleKernels::int32ToFloat(input + i * 4, output + i, count - i);
+	}
+
+	JUST_AUDIO_TARGET_AVX2 static void interleave(const float* const* planes, uint32_t channels, size_t frames, float* output)
+	{
+		if (channels != 2)
+		{
+			ScalarSampleKernels::interleave(planes, channels, frames, output);
+			return;
+		}
+		size_t f = 0;
+		for (; f + 8 <= frames; f += 8)
+		{
+			auto left = _mm256_loadu_ps(planes[0] + f);
+			auto right = _mm256_loadu_ps(planes[1] + f);
+			// Unpacking works within each half: L0 R0 L1 R1 | L4 R4 L5 R5.
+			auto low = _mm256_unpacklo_ps(left, right);
+			auto high = _mm256_unpackhi_ps(left, right);
+			_mm256_storeu_ps(output + f * 2, _mm256_permute2f128_ps(low, high, 0x20));
+			_mm256_storeu_ps(output + f * 2 + 8, _mm256_permute2f128_ps(low, high, 0x31));
+		}
+		const float* rest[2] = { planes[0] + f, planes[1] + f };
+		ScalarSampleKernels::interleave(rest, 2, frames - f, output + f * 2);
+	}
+
+	JUST_AUDIO_TARGET_AVX2 static void deinterleave(const float* input, uint32_t channels, size_t frames, float* const* planes)
+	{
+		if (channels != 2)
+		{
+			ScalarSampleKernels::deinterleave(input, channels, frames, planes);
+			return;
+		}
+		size_t f = 0;
+		for (; f + 8 <= frames; f += 8)
+		{
+			__m256 left;
+			__m256 right;
+			split(input + f * 2, &left, &right);
+			_mm256_storeu_ps(planes[0] + f, left);
+			_mm256_storeu_ps(planes[1] + f, right);
+		}
+		float* rest[2] = { planes[0] + f, planes[1] + f };
+		ScalarSampleKernels::deinterleave(input + f * 2, 2, frames - f, rest);
+	}
+
+	JUST_AUDIO_TARGET_AVX2 static void monoToStereo(const float* input, float* output, size_t frames)
+	{
+		size_t f = 0;
+		for (; f + 8 <= frames; f += 8)
+		{
+			auto samples = _mm256_loadu_ps(input + f);
+			auto low = _mm256_unpacklo_ps(samples, samples);
+			auto high = _mm256_unpackhi_ps(samples, samples);
+			_mm256_storeu_ps(output + f * 2, _mm256_permute2f128_ps(low, high, 0x20));
+			_mm256_storeu_ps(output + f * 2 + 8, _mm256_permute2f128_ps(low, high, 0x31));
+		}
+		ScalarSampleKernels::monoToStereo(input + f, output + f * 2, frames - f);
+	}
+
+	JUST_AUDIO_TARGET_AVX2 static void stereoToMono(const float* input, float* output, size_t frames)
+	{
+		size_t f = 0;
+		auto half = _mm256_set1_ps(0.5f);
+		for (; f + 8 <= frames; f += 8)
+		{
+			__m256 left;
+			__m256 right;
+			split(input + f * 2, &left, &right);
+			_mm256_storeu_ps(output + f, _mm256_mul_ps(_mm256_add_ps(left, right), half));
+		}
+		ScalarSampleKernels::stereoToMono(input + f * 2, output + f, frames - f);
+	}
+
+	JUST_AUDIO_TARGET_AVX2 static void accumulate(float* output, const float* input, size_t count, float gain)
+	{
+		size_t i = 0;
+		auto scale = _mm256_set1_ps(gain);
+		for (; i + 8 <= count; i += 8)
+		{
+			_mm256_storeu_ps(output + i, _mm256_add_ps(_mm256_loadu_ps(output + i), _mm256_mul_ps(_mm256_loadu_ps(input + i), scale)));
+		}
+		ScalarSampleKernels::accumulate(output + i, input + i, count - i, gain);
+	}
+
+	JUST_AUDIO_TARGET_AVX2 static void firInterpolate(const float* input, const float* first, const float* second, size_t count,
+		uint32_t channels, float weight, float* out)
+	{
+		if (8 % channels != 0)
+		{
+			Sse2SampleKernels::firInterpolate(input, first, second, count, channels, weight, out);
+			return;
+		}
+		size_t i = 0;
+		auto firstSum = _mm256_setzero_ps();
+		auto secondSum = _mm256_setzero_ps();
+		for (; i + 8 <= count; i += 8)
+		{
+			auto samples = _mm256_loadu_ps(input + i);
+			firstSum = _mm256_add_ps(firstSum, _mm256_mul_ps(samples, _mm256_loadu_ps(first + i)));
+			secondSum = _mm256_add_ps(secondSum, _mm256_mul_ps(samples, _mm256_loadu_ps(second + i)));
+		}
+		float sums[2][8];
+		_mm256_storeu_ps(sums[0], firstSum);
+		_mm256_storeu_ps(sums[1], secondSum);
+		ScalarSampleKernels::firInterpolate(input + i, first + i, second + i, count - i, channels, weight, out);
+		ScalarSampleKernels::addLanes(sums[0], sums[1], 8, channels, weight, out);
+	}
+
+private:
+	/// Splits eight interleaved stereo frames into their two channels.
+	JUST_AUDIO_TARGET_AVX2 static void split(const float* input, __m256* left, __m256* right)
+	{
+		auto first = _mm256_loadu_ps(input);
+		auto second = _mm256_loadu_ps(input + 8);
+		// Shuffling works within each half, which leaves pairs of frames out of
+		// order: 0 1 | 4 5 with 2 3 | 6 7.
+		auto evens = _mm256_shuffle_ps(first, second, _MM_SHUFFLE(2, 0, 2, 0));
+		auto odds = _mm256_shuffle_ps(first, second, _MM_SHUFFLE(3, 1, 3, 1));
+		*left = _mm256_castpd_ps(_mm256_permute4x64_pd(_mm256_castps_pd(evens), _MM_SHUFFLE(3, 1, 2, 0)));
+		*right = _mm256_castpd_ps(_mm256_permute4x64_pd(_mm256_castps_pd(odds), _MM_SHUFFLE(3, 1, 2, 0)));
+	}
+};
+#endif
+
+#ifdef JUST_AUDIO_NEON
+struct NeonSampleKernels
+{
+	static void int16ToFloat(const uint8_t* input, float* output, size_t count)
+	{
+		size_t i = 0;
+		for (; i + 8 <= count; i += 8)
+		{
+			auto samples = vld1q_s16((const int16_t*)(input + i * 2));
+			vst1q_f32(output + i, vmulq_n_f32(vcvtq_f32_s32(vmovl_s16(vget_low_s16(samples))), 1.0f / 32768));
+			vst1q_f32(output + i + 4, vmulq_n_f32(vcvtq_f32_s32(vmovl_s16(vget_high_s16(samples))), 1.0f / 32768));
+		}
+		ScalarSampleKernels::int16ToFloat(input + i * 2, output + i, count - i);
+	}
+
+	static void int24ToFloat(const uint8_t* input, float* output, size_t count)
+	{
+		size_t i = 0;
+		for (; i + 8 <= count; i += 8)
+		{
+			// Loads the three bytes of eight samples into three registers.
+			auto bytes = vld3_u8(input + i * 3);
+			auto low = vshll_n_u8(bytes.val[0], 8);
+			auto middle = vshll_n_u8(bytes.val[1], 8);
+			auto high = vshll_n_u8(bytes.val[2], 8);
+			for (int half = 0; half < 2; half++)
+			{
+				auto lowWords = half ? vget_high_u16(low) : vget_low_u16(low);
+				auto middleWords = half ? vget_high_u16(middle) : vget_low_u16(middle);
+				auto highWords = half ? vget_high_u16(high) : vget_low_u16(high);
+				auto value = vorrq_u32(vorrq_u32(vshll_n_u16(highWords, 16), vshll_n_u16(middleWords, 8)), vmovl_u16(lowWords));
+				auto samples = vshrq_n_s32(vreinterpretq_s32_u32(value), 8);
+				vst1q_f32(output + i + half * 4, vmulq_n_f32(vcvtq_f32_s32(samples), 1.0f / 8388608));
+			}
+		}
+		ScalarSampleKernels::int24ToFloat(input + i * 3, output + i, count - i);
+	}
+
+	static void int32ToFloat(const uint8_t* input, float* output, size_t count)
+	{
+		size_t i = 0;
+		for (; i + 4 <= count; i += 4)
+		{
+			auto samples = vld1q_s32((const int32_t*)(input + i * 4));
+			vst1q_f32(output + i, vmulq_n_f32(vcvtq_f32_s32(samples), 1.0f / 2147483648.0f));
+		}
+		ScalarSampleKernels::int32ToFloat(input + i * 4, output + i, count - i);
+	}
+
+	static void interleave(const float* const* planes, uint32_t channels, size_t frames, float* output)
+	{
+		if (channels != 2)
+		{
+			ScalarSampleKernels::interleave(planes, channels, frames, output);
+			return;
+		}
+		size_t f = 0;
+		for (; f + 4 <= frames; f += 4)
+		{
+			float32x4x2_t pair = { vld1q_f32(planes[0] + f), vld1q_f32(planes[1] + f) };
+			vst2q_f32(output + f * 2, pair);
+		}
+		const float* rest[2] = { planes[0] + f, planes[1] + f };
+		ScalarSampleKernels::interleave(rest, 2, frames - f, output + f * 2);
+	}
+
+	static void deinterleave(const float* input, uint32_t channels, size_t frames, float* const* planes)
+	{
+		if (channels != 2)
+		{
+			ScalarSampleKernels::deinterleave(input, channels, frames, planes);
+			return;
+		}
+		size_t f = 0;
+		for (; f + 4 <= frames; f += 4)
+		{
+			auto pair = vld2q_f32(input + f * 2);
+			vst1q_f32(planes[0] + f, pair.val[0]);
+			vst1q_f32(planes[1] + f, pair.val[1]);
+		}
+		float* rest[2] = { planes[0] + f, planes[1] + f };
+		ScalarSampleKernels::deinterleave(input + f * 2, 2, frames - f, rest);
+	}
+
+	static void monoToStereo(const float* input, float* output, size_t frames)
+	{
+		size_t f = 0;
+		for (; f + 4 <= frames; f += 4)
+		{
+			auto samples = vld1q_f32(input + f);
+			float32x4x2_t pair = { samples, samples };
+			vst2q_f32(output + f * 2, pair);
+		}
+		ScalarSampleKernels::monoToStereo(input + f, output + f * 2, frames - f);
+	}
+
+	static void stereoToMono(const float* input, float* output, size_t frames)
+	{
+		size_t f = 0;
+		for (; f + 4 <= frames; f += 4)
+		{
+			auto pair = vld2q_f32(input + f * 2);
+			vst1q_f32(output + f, vmulq_n_f32(vaddq_f32(pair.val[0], pair.val[1]), 0.5f));
+		}
+		ScalarSampleKernels::stereoToMono(input + f * 2, output + f, frames - f);
+	}
+
+	static void downmix51(const float* input, float* output, size_t frames)
+	{
+		size_t f = 0;
+		for (; f + 4 <= frames; f += 4)
+		{
+			// Deinterleaves six channels as three pairs: L C Ls and R LFE Rs.
+			auto pairs = vld2q_f32(input + f * 6);
+			auto more = vld2q_f32(input + f * 6 + 8);
+			auto last = vld2q_f32(input + f * 6 + 16);
+			float evens[12];
+			float odds[12];
+			vst1q_f32(evens, pairs.val[0]);
+			vst1q_f32(evens + 4, more.val[0]);
+			vst1q_f32(evens + 8, last.val[0]);
+			vst1q_f32(odds, pairs.val[1]);
+			vst1q_f32(odds + 4, more.val[1]);
+			vst1q_f32(odds + 8, last.val[1]);
+			auto channels = vld3q_f32(evens);
+			auto others = vld3q_f32(odds);
+			// channels: L, C, Ls; others: R, LFE, Rs.
+			auto left = vmulq_n_f32(vaddq_f32(channels.val[0], vmulq_n_f32(vaddq_f32(channels.val[1], channels.val[2]), SampleKernels::kDownmixCenter)), SampleKernels::kDownmixScale);
+			auto right = vmulq_n_f32(vaddq_f32(others.val[0], vmulq_n_f32(vaddq_f32(channels.val[1], others.val[2]), SampleKernels::kDownmixCenter)), SampleKernels::kDownmixScale);
+			float32x4x2_t stereo = { left, right };
+			vst2q_f32(output + f * 2, stereo);
+		}
+		ScalarSampleKernels::downmix51(input + f * 6, output + f * 2, frames - f);
+	}
+
+	static void accumulate(float* output, const float* input, size_t count, float gain)
+	{
+		size_t i = 0;
+		auto scale = vdupq_n_f32(gain);
+		for (; i + 4 <= count; i += 4)
+		{
+			vst1q_f32(output + i, vmlaq_f32(vld1q_f32(output + i), vld1q_f32(input + i), scale));
+		}
+		ScalarSampleKernels::accumulate(output + i, input + i, count - i, gain);
+	}
+
+	static void firInterpolate(const float* input, const float* first, const float* second, size_t count,
+		uint32_t channels, float weight, float* out)
+	{
+		if (4 % channels != 0)
+		{
+			ScalarSampleKernels::firInterpolate(input, first, second, count, channels, weight, out);
+			return;
+		}
+		size_t i = 0;
+		auto firstSum = vdupq_n_f32(0.0f);
+		auto secondSum = vdupq_n_f32(0.0f);
+		for (; i + 4 <= count; i += 4)
+		{
+			auto samples = vld1q_f32(input + i);
+			firstSum = vmlaq_f32(firstSum, samples, vld1q_f32(first + i));
+			secondSum = vmlaq_f32(secondSum, samples, vld1q_f32(second + i));
+		}
+		float sums[2][4];
+		vst1q_f32(sums[0], firstSum);
+		vst1q_f32(sums[1], secondSum);
+		ScalarSampleKernels::firInterpolate(input + i, first + i, second + i, count - i, channels, weight, out);
+		ScalarSampleKernels::addLanes(sums[0], sums[1], 4, channels, weight, out);
+	}
+};
+#endif
+
+inline const SampleKernels& SampleKernels::forLevel(SimdLevel level)
+{
+	static const SampleKernels scalar{ SimdLevel::scalar, ScalarSampleKernels::int16ToFloat, ScalarSampleKernels::int24ToFloat,
+		ScalarSampleKernels::int32ToFloat, ScalarSampleKernels::interleave, ScalarSampleKernels::deinterleave,
+		ScalarSampleKernels::monoToStereo, ScalarSampleKernels::stereoToMono, ScalarSampleKernels::downmix51,
+		ScalarSampleKernels::accumulate, ScalarSampleKernels::firInterpolate };
+#ifdef JUST_AUDIO_SSE2
+	static const SampleKernels sse2{ SimdLevel::sse2, Sse2SampleKernels::int16ToFloat, Sse2SampleKernels::int24ToFloat,
+		Sse2SampleKernels::int32ToFloat, Sse2SampleKernels::interleave, Sse2SampleKernels::deinterleave,
+		Sse2SampleKernels::monoToStereo, Sse2SampleKernels::stereoToMono, Sse2SampleKernels::downmix51,
+		Sse2SampleKernels::accumulate, Sse2SampleKernels::firInterpolate };
+	static const SampleKernels avx2{ SimdLevel::avx2, Avx2SampleKernels::int16ToFloat, Avx2SampleKernels::int24ToFloat,
+		Avx2SampleKernels::int32ToFloat, Avx2SampleKernels::interleave, Avx2SampleKernels::deinterleave,
+		Avx2SampleKernels::monoToStereo, Avx2SampleKernels::stereoToMono, Sse2SampleKernels::downmix51,
+		Avx2SampleKernels::accumulate, Avx2SampleKernels::firInterpolate };
+	if (level == SimdLevel::sse2)
+	{
+		return sse2;
+	}
+	if (level == SimdLevel::avx2)
+	{
+		return avx2;
+	}
+#endif
+#ifdef JUST_AUDIO_NEON
+	static const SampleKernels neon{ SimdLevel::neon, NeonSampleKernels::int16ToFloat, NeonSampleKernels::int24ToFloat,
+		NeonSampleKernels::int32ToFloat, NeonSampleKernels::interleave, NeonSampleKernels::deinterleave,
+		NeonSampleKernels::monoToStereo, NeonSampleKernels::stereoToMono, NeonSampleKernels::downmix51,
+		NeonSampleKernels::accumulate, NeonSampleKernels::firInterpolate };
+	if (level == SimdLevel::neon)
+	{
+		return neon;
+	}
+#endif
+	return scalar;
+}
+
+/**
+ * Converts |frames| interleaved frames of |inputChannels| channels into
+ * |outputChannels|: mono and stereo into each other, 5.1 down to stereo, and
+ * anything else into mono by averaging or otherwise by repeating the
+ * channels in order. |input| and |output| must not overlap.
+ */
+inline void remapChannels(const float* input, uint32_t inputChannels, float* output, uint32_t outputChannels, size_t frames)
+{
+	auto& kernels = SampleKernels::get();
+	if (inputChannels == outputChannels)
+	{
+		std::copy(input, input + frames * inputChannels, output);
+	}
+	else if (inputChannels == 1 && outputChannels == 2)
+	{
+		kernels.monoToStereo(input, output, frames);
+	}
+	else if (inputChannels == 2 && outputChannels == 1)
+	{
+		kernels.stereoToMono(input, output, frames);
+	}
+	else if (inputChannels == 6 && outputChannels == 2)
+	{
+		kernels.downmix51(input, output, frames);
+	}
+	else if (outputChannels == 1)
+	{
+		for (size_t f = 0; f < frames; f++)
+		{
+			float sum = 0;
+			for (uint32_t c = 0; c < inputChannels; c++)
+			{
+				sum += input[f * inputChannels + c];
+			}
+			output[f] = sum / (float)inputChannels;
+		}
+	}
+	else
+	{
+		for (size_t f = 0; f < frames; f++)
+		{
+			for (uint32_t c = 0; c < outputChannels; c++)
+			{
+				output[f * outputChannels + c] = input[f * inputChannels + c % inputChannels];
+			}
+		}
+	}
+}
@@ -0,0 +1,125 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "audio_backend.hpp"
+#include "audio_decoder.hpp"
+#include "pcm_cache.hpp"
+
+/**
+ * Decodes all of |decoder| into |format|. Throws std::invalid_argument for
+ * sources longer than |maxFrames| frames of output.
+ */
+inline std::shared_ptr<PcmSample> decodeSample(AudioDecoder& decoder, AudioFormat format, size_t maxFrames)
+{
+	auto sourceFormat = decoder.getFormat();
+	std::vector<float> source{};
+	std::vector<float> chunk(4096 * sourceFormat.channels);
+	auto maxSourceFrames = (uint64_t)maxFrames * sourceFormat.sampleRate / format.sampleRate + 1;
+	while (auto count = decoder.read(chunk.data(), 4096))
+	{
+		source.insert(source.end(), chunk.begin(), chunk.begin() + count * sourceFormat.channels);
+		if (source.size() / sourceFormat.channels > maxSourceFrames)
+		{
+			throw std::invalid_argument("The source is too long to be played as a sample");
+		}
+	}
+	return convertSample(std::move(source), sourceFormat, format);
+}
+
+// Decoded clips shared by every sample player. A clip is decoded once and
+// stays in the pool for as long as a player holds it, and in |cache| while
+// it fits in its budget after that.
+class SamplePool
+{
+public:
+	// Samples are meant for short effects.
+	static constexpr uint32_t kMaxSampleSeconds = 30;
+
+	explicit SamplePool(std::shared_ptr<PcmCache> cache = std::make_shared<PcmCache>(),
+		std::shared_ptr<DecoderRegistry> decoders = std::make_shared<DecoderRegistry>())
+		: cache(cache), decoders(decoders)
+	{
+	}
+
+	/// Returns |source| decoded into |format|, decoding it unless it is already
+	/// held. Throws if it can not be decoded.
+	std::shared_ptr<const PcmSample> get(const AudioSourceSpec& source, AudioFormat format)
+	{
+		auto key = PcmCache::makeKey(source, format);
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			auto sample = samples[key].lock();
+			if (!sample)
+			{
+				sample = cache->find(key);
+				samples[key] = sample;
+			}
+			if (sample)
+			{
+				hits++;
+				return sample;
+			}
+		}
+
+		// Decoding happens unlocked, so one long clip does not hold up others.
+		// Two players asking for the same clip at once both decode it.
+		auto decoder = decoders->open(source, format);
+		std::shared_ptr<const PcmSample> sample = decodeSample(*decoder, format, (size_t)format.sampleRate * kMaxSampleSeconds);
+
+		cache->insert(key, sample);
+		std::lock_guard<std::mutex> lock(mutex);
+		misses++;
+		samples[key] = sample;
+		return sample;
+	}
+
+	/// The bytes and seconds of audio held by players.
+	std::pair<size_t, double> getResidentSize()
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		size_t bytes = 0;
+		double seconds = 0;
+		for (auto it = samples.begin(); it != samples.end();)
+		{
+			if (auto sample = it->second.lock())
+			{
+				bytes += sample->bytes();
+				seconds += (double)sample->frames() / sample->format.sampleRate;
+				++it;
+			}
+			else
+			{
+				it = samples.erase(it);
+			}
+		}
+		return std::make_pair(bytes, seconds);
+	}
+
+	uint64_t getHits()
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		return hits;
+	}
+
+	uint64_t getMisses()
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		return misses;
+	}
+
+private:
+	std::shared_ptr<PcmCache> cache;
+	std::shared_ptr<DecoderRegistry> decoders;
+	std::mutex mutex;
+	std::map<std::string, std::weak_ptr<const PcmSample>> samples{};
+	uint64_t hits = 0;
+	uint64_t misses = 0;
+};
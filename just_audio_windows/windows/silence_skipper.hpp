@@ -0,0 +1,414 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+#if defined(_M_X64) || defined(__SSE__)
+#include <xmmintrin.h>
+#ifndef JUST_AUDIO_SSE
+#define JUST_AUDIO_SSE 1
+#endif
+#elif defined(_M_ARM64) || defined(__ARM_NEON)
+#include <arm_neon.h>
+#ifndef JUST_AUDIO_NEON
+#define JUST_AUDIO_NEON 1
+#endif
+#endif
+
+#include "audio_backend.hpp"
+#include "audio_decoder.hpp"
+#include "object_pool.hpp"
+
+// Shortens the silent stretches of interleaved audio. Audio is analysed in
+// blocks of a few milliseconds; a run of silent blocks at least as long as
+// the minimum gap keeps some silence at each end, and the two ends are
+// crossfaded together. Shorter runs are left alone, so runs are held back
+// until they are known to be long enough.
+//
+// Every frame keeps the media time it was written with, so that positions
+// still refer to the source after a skip.
+//
+// Held blocks come from a pool and output goes through one buffer, both
+// sized by setOptions(), so that skipping does not allocate as it runs.
+class SilenceSkipper
+{
+public:
+	SilenceSkipper(AudioFormat format, SkipSilenceOptions options = SkipSilenceOptions{})
+		: format(format), blocks(getBlockFrames() * format.channels)
+	{
+		setOptions(options);
+	}
+
+	void setOptions(SkipSilenceOptions options)
+	{
+		threshold = (float)std::pow(10.0, options.thresholdDb / 20);
+		minimumGapFrames = toFrames(options.minimumGapUs);
+		// Each end keeps at least the crossfade.
+		crossfadeFrames = std::max<size_t>(1, toFrames(options.crossfadeUs));
+		paddingFrames = std::max(toFrames(options.paddingUs), crossfadeFrames);
+		minimumGapFrames = std::max(minimumGapFrames, paddingFrames * 2);
+
+		// A run is held until it reaches the minimum gap, and its kept ends
+		// are at most the padding long.
+		auto runBlocks = minimumGapFrames / getBlockFrames() + 2;
+		blocks.reserve(runBlocks);
+		held.reserve(runBlocks);
+		output.reserve(runBlocks);
+		outputSamples.reserve((minimumGapFrames + getBlockFrames() * 4) * format.channels);
+		fadeOut.reserve(paddingFrames * format.channels);
+		tail.reserve((paddingFrames + getBlockFrames()) * format.channels);
+	}
+
+	/// How many frames write() expects at a time.
+	size_t getBlockFrames() const
+	{
+		return (size_t)format.sampleRate / 100;
+	}
+
+	/// Takes |frames| frames, at most getBlockFrames(), starting at
+	/// |positionUs| in the media, each lasting |usPerFrame| of it.
+	void write(const float* samples, size_t frames, int64_t positionUs, double usPerFrame)
+	{
+		frames = std::min(frames, getBlockFrames());
+		if (frames == 0)
+		{
+			return;
+		}
+		if (!isSilent(samples, frames))
+		{
+			endRun();
+			emitSamples(samples, frames, positionUs, usPerFrame);
+			return;
+		}
+
+		auto* buffer = blocks.acquire();
+		std::copy(samples, samples + frames * format.channels, buffer);
+		runFrames += frames;
+		held.push_back(Block{ buffer, frames, positionUs, usPerFrame });
+		if (!skipping && runFrames >= minimumGapFrames)
+		{
+			// Long enough: keep the start, except what fades into the end.
+			skipping = true;
+			auto headFrames = paddingFrames - crossfadeFrames;
+			size_t offset = 0;
+			for (size_t i = 0; i < held.size(); i++)
+			{
+				auto& run = held[i];
+				auto count = std::min(run.frames, headFrames - std::min(headFrames, offset));
+				emit(run, 0, count);
+				auto fadeCount = std::min(run.frames - count, paddingFrames - (offset + count));
+				if (fadeOut.empty() && fadeCount > 0)
+				{
+					fadePositionUs = run.positionUs + (int64_t)(count * run.usPerFrame);
+					fadeUsPerFrame = run.usPerFrame;
+				}
+				fadeOut.insert(fadeOut.end(), run.samples + count * format.channels, run.samples + (count + fadeCount) * format.channels);
+				offset += count + fadeCount;
+				if (offset >= paddingFrames)
+				{
+					break;
+				}
+			}
+		}
+		if (skipping)
+		{
+			// Only the end of the run is kept from here on.
+			while (!held.empty() && heldFrames() - held.front().frames >= paddingFrames)
+			{
+				blocks.release(held.front().samples);
+				held.pop_front();
+			}
+		}
+	}
+
+	/// Releases what is held once the input has ended. A silent run at the
+	/// end is cut after its start.
+	void finish()
+	{
+		if (skipping)
+		{
+			releaseHeld();
+			skipping = false;
+			runFrames = 0;
+			if (!fadeOut.empty())
+			{
+				emitSamples(fadeOut.data(), fadeOut.size() / format.channels, fadePositionUs, fadeUsPerFrame);
+				fadeOut.clear();
+			}
+		}
+		endRun();
+		finished = true;
+	}
+
+	/**
+	 * Moves up to |frames| frames into |samples|, all contiguous in the media,
+	 * and sets |positionUs| to the time of the first. Returns how many.
+	 */
+	size_t read(float* samples, size_t frames, int64_t& positionUs)
+	{
+		if (output.empty())
+		{
+			return 0;
+		}
+		auto& chunk = output.front();
+		auto channels = format.channels;
+		auto count = std::min(frames, chunk.frames - chunk.read);
+		positionUs = chunk.positionUs + (int64_t)(chunk.read * chunk.usPerFrame);
+		auto* from = outputSamples.data() + outputRead * channels;
+		std::copy(from, from + count * channels, samples);
+		chunk.read += count;
+		outputRead += count;
+		if (chunk.read == chunk.frames)
+		{
+			output.pop_front();
+		}
+		if (output.empty())
+		{
+			outputSamples.clear();
+			outputRead = 0;
+		}
+		return count;
+	}
+
+	bool hasOutput() const
+	{
+		return !output.empty();
+	}
+
+	/// Whether nothing is held or waiting to be read.
+	bool isEmpty() const
+	{
+		return output.empty() && held.empty() && fadeOut.empty();
+	}
+
+	/// Whether finish() was called and everything has been read.
+	bool isDrained() const
+	{
+		return finished && output.empty();
+	}
+
+	void reset()
+	{
+		releaseHeld();
+		output.clear();
+		outputSamples.clear();
+		outputRead = 0;
+		fadeOut.clear();
+		runFrames = 0;
+		skipping = false;
+		finished = false;
+	}
+
+	/// Media time removed so far.
+	int64_t getSkippedUs() const
+	{
+		return skippedUs;
+	}
+
+	/// Adds the squares of |count| samples to |sumSquares| and raises |peak|
+	/// to the largest magnitude among them.
+	static void measure(const float* samples, size_t count, float& sumSquares, float& peak)
+	{
+		size_t i = 0;
+#ifdef JUST_AUDIO_SSE
+		auto sumVector = _mm_setzero_ps();
+		auto peakVector = _mm_setzero_ps();
+		auto signMask = _mm_set1_ps(-0.0f);
+		for (; i + 4 <= count; i += 4)
+		{
+			auto value = _mm_loadu_ps(samples + i);
+			sumVector = _mm_add_ps(sumVector, _mm_mul_ps(value, value));
+			peakVector = _mm_max_ps(peakVector, _mm_andnot_ps(signMask, value));
+		}
+		float sums[4];
+		float peaks[4];
+		_mm_storeu_ps(sums, sumVector);
+		_mm_storeu_ps(peaks, peakVector);
+		sumSquares += sums[0] + sums[1] + sums[2] + sums[3];
+		peak = std::max({ peak, peaks[0], peaks[1], peaks[2], peaks[3] });
+#elif defined(JUST_AUDIO_NEON)
+		auto sumVector = vdupq_n_f32(0.0f);
+		auto peakVector = vdupq_n_f32(0.0f);
+		for (; i + 4 <= count; i += 4)
+		{
+			auto value = vld1q_f32(samples + i);
+			sumVector = vmlaq_f32(sumVector, value, value);
+			peakVector = vmaxq_f32(peakVector, vabsq_f32(value));
+		}
+		float sums[4];
+		float peaks[4];
+		vst1q_f32(sums, sumVector);
+		vst1q_f32(peaks, peakVector);
+		sumSquares += sums[0] + sums[1] + sums[2] + sums[3];
+		peak = std::max({ peak, peaks[0], peaks[1], peaks[2], peaks[3] });
+#endif
+		for (; i < count; i++)
+		{
+			sumSquares += samples[i] * samples[i];
+			peak = std::max(peak, std::abs(samples[i]));
+		}
+	}
+
+private:
+	// A silent block, in a buffer from |blocks|.
+	struct Block
+	{
+		float* samples;
+		size_t frames;
+		int64_t positionUs;
+		double usPerFrame;
+	};
+
+	// Frames of |outputSamples| contiguous in the media.
+	struct Chunk
+	{
+		size_t frames;
+		int64_t positionUs;
+		double usPerFrame;
+		size_t read;
+	};
+
+	size_t toFrames(int64_t us) const
+	{
+		return (size_t)std::max<int64_t>(0, us * format.sampleRate / 1000000);
+	}
+
+	/// Quiet on average, with no peak more than 12dB above the threshold.
+	bool isSilent(const float* samples, size_t frames) const
+	{
+		float sumSquares = 0;
+		float peak = 0;
+		auto count = frames * format.channels;
+		measure(samples, count, sumSquares, peak);
+		return std::sqrt(sumSquares / count) <= threshold && peak <= threshold * 4;
+	}
+
+	size_t heldFrames() const
+	{
+		size_t frames = 0;
+		for (size_t i = 0; i < held.size(); i++)
+		{
+			frames += held[i].frames;
+		}
+		return frames;
+	}
+
+	void releaseHeld()
+	{
+		for (size_t i = 0; i < held.size(); i++)
+		{
+			blocks.release(held[i].samples);
+		}
+		held.clear();
+	}
+
+	/// Ends the silent run before a block that is not silent.
+	void endRun()
+	{
+		if (!skipping)
+		{
+			// Too short to skip.
+			for (size_t i = 0; i < held.size(); i++)
+			{
+				emit(held[i], 0, held[i].frames);
+			}
+		}
+		else
+		{
+			// Fade the end of the kept start into the last of the run.
+			tail.clear();
+			int64_t tailPositionUs = 0;
+			double tailUsPerFrame = 0;
+			auto skip = heldFrames() - std::min(heldFrames(), paddingFrames);
+			for (size_t i = 0; i < held.size(); i++)
+			{
+				auto& block = held[i];
+				auto from = std::min(skip, block.frames);
+				skip -= from;
+				if (from == block.frames)
+				{
+					continue;
+				}
+				if (tail.empty())
+				{
+					tailPositionUs = block.positionUs + (int64_t)(from * block.usPerFrame);
+					tailUsPerFrame = block.usPerFrame;
+				}
+				tail.insert(tail.end(), block.samples + from * format.channels, block.samples + block.frames * format.channels);
+			}
+			auto fadeFrames = std::min(fadeOut.size(), tail.size()) / format.channels;
+			for (size_t i = 0; i < fadeFrames * format.channels; i++)
+			{
+				auto weight = (float)(i / format.channels) / (float)fadeFrames;
+				tail[i] = fadeOut[i] + (tail[i] - fadeOut[i]) * weight;
+			}
+			skippedUs += tailPositionUs - fadePositionUs;
+			emitSamples(tail.data(), tail.size() / format.channels, tailPositionUs, tailUsPerFrame);
+			fadeOut.clear();
+			skipping = false;
+		}
+		releaseHeld();
+		runFrames = 0;
+	}
+
+	void emit(const Block& block, size_t from, size_t frames)
+	{
+		emitSamples(block.samples + from * format.channels, frames, block.positionUs + (int64_t)(from * block.usPerFrame), block.usPerFrame);
+	}
+
+	/// Queues frames for read(), joining them to the last chunk when they
+	/// follow it in the media.
+	void emitSamples(const float* samples, size_t frames, int64_t positionUs, double usPerFrame)
+	{
+		if (frames == 0)
+		{
+			return;
+		}
+		auto channels = format.channels;
+		// What was read is dropped once it is the larger part, so that the
+		// buffer stays within what it reserved.
+		if (outputRead > 0 && outputRead * channels * 2 >= outputSamples.size())
+		{
+			outputSamples.erase(outputSamples.begin(), outputSamples.begin() + outputRead * channels);
+			outputRead = 0;
+		}
+		outputSamples.insert(outputSamples.end(), samples, samples + frames * channels);
+		if (!output.empty())
+		{
+			auto& last = output.back();
+			auto endUs = last.positionUs + (int64_t)(last.frames * last.usPerFrame);
+			if (last.usPerFrame == usPerFrame && std::abs(endUs - positionUs) <= 1)
+			{
+				last.frames += frames;
+				return;
+			}
+		}
+		output.push_back(Chunk{ frames, positionUs, usPerFrame, 0 });
+	}
+
+	AudioFormat format;
+	float threshold = 0;
+	size_t minimumGapFrames = 0;
+	size_t paddingFrames = 0;
+	size_t crossfadeFrames = 0;
+
+	// The silent run being measured, or the end of the one being skipped.
+	BufferPool blocks;
+	RingQueue<Block> held{};
+	size_t runFrames = 0;
+	bool skipping = false;
+	// The end of the kept start of a skipped run, faded into its end.
+	std::vector<float> fadeOut{};
+	int64_t fadePositionUs = 0;
+	double fadeUsPerFrame = 0;
+
+	// The start of the run kept by endRun(), and what waits to be read.
+	std::vector<float> tail{};
+	std::vector<float> outputSamples{};
+	size_t outputRead = 0;
+	RingQueue<Chunk> output{};
+	bool finished = false;
+	int64_t skippedUs = 0;
+};
@@ -0,0 +1,1714 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <stdexcept>
+#include <vector>
+
+#include "audio_backend.hpp"
+#include "audio_decoder.hpp"
+#include "audio_sink.hpp"
+#include "decode_scheduler.hpp"
+#include "equalizer.hpp"
+#include "loudness_analyzer.hpp"
+#include "loudness_enhancer.hpp"
+#include "mixer.hpp"
+#include "object_pool.hpp"
+#include "pcm_cache.hpp"
+#include "render_clock.hpp"
+#include "resampler.hpp"
+#include "silence_skipper.hpp"
+#include "spsc_ring.hpp"
+#include "sync_group.hpp"
+#include "time_stretch.hpp"
+
+// Plays audio sources in software. The decoder decodes the current item,
+// converts it to the output format and fills a ring of PCM; render() drains
+// the ring from the output's real-time thread without locking or allocating.
+// The ring's depth is the latency between the two, and what the decoder has
+// to keep ahead of the output by. The decoder runs as a job of a
+// DecodeScheduler, whose threads are shared with other players, and the
+// time the ring runs out is its deadline.
+//
+// Players are voices of a Mixer, which calls render() and carries the
+// volume, pan and priority. Given a sink instead, a player gets a mixer of its
+// own. With a NullSink, WavFileSink or CaptureSink, this runs headless and
+// needs nothing from the platform.
+//
+// Players of one mixer can join a SyncGroup, which their play, pause, seek
+// and speed commands then go to, so that they stay in step.
+class SoftwareBackend : public AudioBackend, public MixerInput, public SyncGroupMember
+{
+public:
+	static constexpr size_t kDefaultBlockFrames = 480;
+	static constexpr uint32_t kDefaultBufferDepthMs = 100;
+	// The most blocks decoded in one run of the scheduler.
+	static constexpr size_t kBlocksPerRun = 4;
+
+	/// Plays as a voice of |mixer|, which may be shared with other players,
+	/// decoding on the threads of |scheduler|.
+	SoftwareBackend(std::shared_ptr<Mixer> mixer,
+		std::shared_ptr<DecoderRegistry> decoders = std::make_shared<DecoderRegistry>(),
+		uint32_t bufferDepthMs = kDefaultBufferDepthMs,
+		size_t blockFrames = kDefaultBlockFrames,
+		std::shared_ptr<DecodeScheduler> scheduler = DecodeScheduler::shared())
+		: mixer(mixer), decoders(decoders), format(mixer->getFormat()), blockFrames(blockFrames),
+		block(blockFrames * format.channels), scheduler(scheduler),
+		samples(std::max<size_t>((size_t)format.sampleRate * bufferDepthMs / 1000, blockFrames) * format.channels),
+		segments(samples.capacity() / format.channels / blockFrames * 4 + 8),
+		stretcher(std::make_unique<TimeStretcher>(format)), stretchBlock(blockFrames * format.channels),
+		skipper(format), skipBlock(skipper.getBlockFrames() * format.channels), equalizer(format), loudnessEnhancer(format)
+	{
+		// Polled this often for the room render() makes in the ring, and for
+		// what it has reached.
+		pollIntervalUs = std::max<int64_t>(1000, (int64_t)(samples.capacity() / format.channels * 250000 / format.sampleRate));
+		decodeJob = scheduler->add([this]()
+			{ return decode(); });
+	}
+
+	/// Plays into |sink| through a mixer of its own, which is closed with the
+	/// player.
+	SoftwareBackend(std::shared_ptr<AudioSink> sink,
+		std::shared_ptr<DecoderRegistry> decoders = std::make_shared<DecoderRegistry>(),
+		uint32_t bufferDepthMs = kDefaultBufferDepthMs,
+		size_t blockFrames = kDefaultBlockFrames,
+		std::shared_ptr<DecodeScheduler> scheduler = DecodeScheduler::shared())
+		: SoftwareBackend(std::make_shared<Mixer>(sink->getFormat(), sink, 1), decoders, bufferDepthMs, blockFrames, scheduler)
+	{
+		ownsMixer = true;
+	}
+
+	~SoftwareBackend()
+	{
+		dispose();
+	}
+
+	// Prevent copying.
+	SoftwareBackend(SoftwareBackend const&) = delete;
+	SoftwareBackend& operator=(SoftwareBackend const&) = delete;
+
+	void load(const AudioSourceSpec& source, std::optional<int32_t> initialIndex, int64_t initialPositionUs) override
+	{
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			root = source;
+			childSerials.clear();
+			auto childCount = root.type == AudioSourceSpec::Type::concatenating ? root.children.size() : 1;
+			for (size_t i = 0; i < childCount; i++)
+			{
+				childSerials.push_back(nextSerial++);
+			}
+			current.reset();
+			rebuildItems();
+			requestLoudness(root);
+
+			closeItem();
+			if (!items.empty())
+			{
+				auto index = initialIndex && *initialIndex >= 0 && (size_t)*initialIndex < items.size()
+					? (size_t)*initialIndex
+					: order.front();
+				openItem(index, initialPositionUs);
+			}
+			else
+			{
+				processingState = ProcessingState::idle;
+			}
+			flush();
+		}
+		wakeDecoder();
+		reportError();
+		notifyState();
+	}
+
+	void play() override
+	{
+		if (auto group = getSyncGroup())
+		{
+			group->play(std::nullopt);
+			return;
+		}
+		startVoice(0);
+	}
+
+	void playAt(int64_t hostTimeUs) override
+	{
+		if (auto group = getSyncGroup())
+		{
+			group->play(hostTimeUs);
+			return;
+		}
+		startVoice(mixer->frameAtHostTime(hostTimeUs));
+	}
+
+	void pause() override
+	{
+		if (auto group = getSyncGroup())
+		{
+			group->pause();
+			return;
+		}
+		pauseHeld();
+	}
+
+	void seek(std::optional<int32_t> index, int64_t positionUs) override
+	{
+		if (auto group = getSyncGroup())
+		{
+			group->seek(index, positionUs);
+			return;
+		}
+		seekHeld(index, positionUs);
+	}
+
+	void setSyncGroup(std::shared_ptr<SyncGroup> group) override
+	{
+		if (group && group->getMixer() != mixer)
+		{
+			throw std::invalid_argument("Players of a sync group must share a mixer");
+		}
+		std::shared_ptr<SyncGroup> previous;
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			previous = syncGroup;
+			syncGroup = group;
+			voiceSettings.group = group ? group->getId() : 0;
+			updateVoice();
+		}
+		// The group locks itself before its members, so it is not called with
+		// this player locked.
+		if (previous && previous != group)
+		{
+			previous->remove(this);
+		}
+		if (group)
+		{
+			group->add(this);
+		}
+	}
+
+	bool isPlaying() override
+	{
+		return playing;
+	}
+
+	bool holdToPlay() override
+	{
+		return startVoice(Mixer::kHeld);
+	}
+
+	void pauseHeld() override
+	{
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			playing = false;
+			releaseVoice();
+		}
+		wakeDecoder();
+		notifyState();
+	}
+
+	void seekHeld(std::optional<int32_t> index, int64_t positionUs) override
+	{
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			auto target = index && *index >= 0 && (size_t)*index < items.size() ? std::optional<size_t>((size_t)*index) : playedItem();
+			if (target)
+			{
+				if (target != current || !decoder)
+				{
+					openItem(*target, positionUs);
+				}
+				else
+				{
+					seekItem(positionUs);
+				}
+				flush();
+			}
+		}
+		wakeDecoder();
+		reportError();
+		notifyState();
+	}
+
+	void setSpeedHeld(double value) override
+	{
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			speed = value > 0 ? value : 1.0;
+			// Decoded again from the last frame rendered, so that the new speed
+			// is heard from the same frame in every member.
+			auto played = clock.load();
+			auto target = playedItem();
+			if (target && !played.ended)
+			{
+				if (target != current || !decoder)
+				{
+					openItem(*target, played.positionUs);
+				}
+				else
+				{
+					seekItem(played.positionUs);
+				}
+				flush();
+			}
+		}
+		wakeDecoder();
+		reportError();
+		notifyState();
+	}
+
+	void onGroupDissolved() override
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		syncGroup = nullptr;
+		voiceSettings.group = 0;
+		updateVoice();
+	}
+
+	void setVolume(double value, VolumeRamp ramp) override
+	{
+		{
+			// Applied by the mixer, so it is heard without the latency of the
+			// ring.
+			std::lock_guard<std::mutex> lock(mutex);
+			voiceSettings.gain = (float)value;
+			updateVoice(ramp);
+		}
+		notifyState();
+	}
+
+	void setPan(double value) override
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		voiceSettings.pan = (float)std::clamp(value, -1.0, 1.0);
+		updateVoice();
+	}
+
+	void setPriority(int32_t value) override
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		voiceSettings.priority = value;
+		updateVoice();
+	}
+
+	void setSpeed(double value) override
+	{
+		if (auto group = getSyncGroup())
+		{
+			group->setSpeed(value);
+			return;
+		}
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			speed = value > 0 ? value : 1.0;
+		}
+		notifyState();
+	}
+
+	void setPitch(double value) override
+	{
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			pitch = value > 0 ? value : 1.0;
+		}
+		notifyState();
+	}
+
+	/// Changes speed without changing pitch at |quality|, or, without one, by
+	/// playing faster or slower like a tape, which ignores the pitch.
+	void setTimeStretchQuality(std::optional<TimeStretcher::Quality> quality)
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		stretcher = quality ? std::make_unique<TimeStretcher>(format, *quality) : nullptr;
+	}
+
+	/// Resamples other rates, and speeds without a stretcher, at |quality|.
+	void setResamplerQuality(Resampler::Quality quality)
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		resamplerQuality = quality;
+		resampler = decoder ? std::make_unique<Resampler>(sourceFormat.channels, quality) : nullptr;
+	}
+
+	void setSkipSilence(bool enabled, SkipSilenceOptions options) override
+	{
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			skipSilence = enabled;
+			skipper.setOptions(options);
+		}
+		notifyState();
+	}
+
+	void setEqualizerEnabled(bool enabled) override
+	{
+		// Applied by render(), so it is heard without the latency of the ring.
+		equalizer.setEnabled(enabled);
+	}
+
+	void setEqualizerBandGain(int32_t band, double gainDb) override
+	{
+		if (band < 0)
+		{
+			throw std::out_of_range("band index out of range");
+		}
+		equalizer.setBandGain((size_t)band, gainDb);
+	}
+
+	EqualizerParameters getEqualizerParameters() override
+	{
+		return equalizer.getParameters();
+	}
+
+	void setLoudnessEnhancerEnabled(bool enabled) override
+	{
+		loudnessEnhancer.setEnabled(enabled);
+	}
+
+	void setLoudnessEnhancerTargetGain(double gainDb) override
+	{
+		loudnessEnhancer.setTargetGain(gainDb);
+	}
+
+	void setLimiterTiming(int64_t attackUs, int64_t releaseUs) override
+	{
+		loudnessEnhancer.setTiming(attackUs, releaseUs);
+	}
+
+	/**
+	 * Plays each file item at |targetLufs| as measured by |analyzer|, which
+	 * measures the files of a playlist in the background once it is loaded.
+	 * Items are played unchanged until they have been measured, and without a
+	 * target.
+	 */
+	void setLoudnessNormalization(std::shared_ptr<LoudnessAnalyzer> analyzer, std::optional<double> targetLufs)
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		loudnessAnalyzer = analyzer;
+		normalizationTargetLufs = targetLufs;
+		requestLoudness(root);
+	}
+
+	void setCrossfade(int64_t durationUs) override
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		crossfadeFrames = (size_t)(std::max<int64_t>(durationUs, 0) * format.sampleRate / 1000000);
+		// The tail holds the crossfade and the blocks rendered past it, and
+		// is compacted before it doubles, so that holding it does not
+		// allocate as it plays.
+		tail.reserve((crossfadeFrames + blockFrames * 4) * 2 * format.channels);
+		tailSegments.reserve(16);
+	}
+
+	void setLoopMode(LoopMode value) override
+	{
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			loopMode = value;
+		}
+		notifyState();
+	}
+
+	void setShuffle(bool enabled) override
+	{
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			shuffle = enabled;
+			rebuildItems();
+		}
+		notifyState();
+	}
+
+	void setShuffleOrder(const AudioSourceSpec& source) override
+	{
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			if (root.type == AudioSourceSpec::Type::concatenating && source.type == AudioSourceSpec::Type::concatenating)
+			{
+				root.shuffleOrder = source.shuffleOrder;
+				rebuildItems();
+			}
+		}
+		notifyState();
+	}
+
+	void insert(int32_t index, const std::vector<AudioSourceSpec>& children) override
+	{
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			requireConcatenating();
+			auto position = (size_t)std::clamp<int32_t>(index, 0, (int32_t)root.children.size());
+			root.children.insert(root.children.begin() + position, children.begin(), children.end());
+			for (size_t i = 0; i < children.size(); i++)
+			{
+				childSerials.insert(childSerials.begin() + position + i, nextSerial++);
+				requestLoudness(children[i]);
+			}
+			rebuildItems();
+		}
+		wakeDecoder();
+		notifyState();
+	}
+
+	void removeRange(int32_t start, int32_t end) override
+	{
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			requireConcatenating();
+			if (start < 0 || end > (int32_t)root.children.size() || start >= end)
+			{
+				throw std::invalid_argument("invalid range");
+			}
+			root.children.erase(root.children.begin() + start, root.children.begin() + end);
+			childSerials.erase(childSerials.begin() + start, childSerials.begin() + end);
+			rebuildItems();
+		}
+		wakeDecoder();
+		reportError();
+		notifyState();
+	}
+
+	void move(int32_t from, int32_t to) override
+	{
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			requireConcatenating();
+			auto size = (int32_t)root.children.size();
+			if (from < 0 || from >= size || to < 0 || to >= size)
+			{
+				throw std::invalid_argument("index out of bounds");
+			}
+			auto child = std::move(root.children[from]);
+			root.children.erase(root.children.begin() + from);
+			root.children.insert(root.children.begin() + to, std::move(child));
+			auto serial = childSerials[from];
+			childSerials.erase(childSerials.begin() + from);
+			childSerials.insert(childSerials.begin() + to, serial);
+			rebuildItems();
+		}
+		notifyState();
+	}
+
+	BackendState getState() override
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		BackendState state{};
+		state.processingState = processingState;
+		state.playing = playing;
+		state.volume = voiceSettings.gain;
+		state.speed = speed;
+		state.pitch = pitch;
+		state.gainReductionDb = loudnessEnhancer.getGainReductionDb();
+		state.loopMode = loopMode;
+		state.shuffle = shuffle;
+		state.underrunCount = underrunCount;
+		state.underrunFrames = underrunFrames;
+		if (stretcher)
+		{
+			auto cost = stretcher->getCost();
+			state.timeStretchLoad = cost.second > 0 ? (double)cost.first / 1000 * format.sampleRate / cost.second / 1000000 : 0.0;
+		}
+		state.skippedSilenceUs = skipper.getSkippedUs();
+		if (auto index = playedItem())
+		{
+			state.currentIndex = (int32_t)*index;
+			auto played = clock.load();
+			state.positionUs = RenderClock::heardPositionUs(played, getLatencyUs(), RenderClock::nowUs());
+			auto durationUs = played.durationUs;
+			if (durationUs >= 0)
+			{
+				state.durationUs = durationUs;
+			}
+			// Local sources are available in full.
+			state.bufferedPositionUs = state.durationUs.value_or(state.positionUs);
+		}
+		return state;
+	}
+
+	void dispose() override
+	{
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			if (disposed)
+			{
+				return;
+			}
+			disposed = true;
+			playing = false;
+			releaseVoice();
+		}
+		changed.notify_all();
+		setSyncGroup(nullptr);
+		scheduler->remove(decodeJob);
+		if (ownsMixer)
+		{
+			mixer->close();
+		}
+	}
+
+	AudioFormat getFormat() const
+	{
+		return format;
+	}
+
+	/// The media time being heard, read without locking from any thread.
+	int64_t getHeardPositionUs() const
+	{
+		return RenderClock::heardPositionUs(clock.load(), getLatencyUs(), RenderClock::nowUs());
+	}
+
+	/// Plays sources found in |cache| from memory, and keeps short sources in
+	/// it once they have been decoded from start to end.
+	void setPcmCache(std::shared_ptr<PcmCache> cache)
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		pcmCache = cache;
+	}
+
+	/**
+	 * Fills |out| with |frames| frames of output, returning how many came from
+	 * the ring; the rest is silence. Called from the mixer's real-time thread,
+	 * so it only touches atomics and the ring: it never locks, allocates or
+	 * waits.
+	 */
+	size_t render(float* out, size_t frames) override
+	{
+		auto channels = format.channels;
+		size_t taken = 0;
+		if (playing.load(std::memory_order_acquire))
+		{
+			taken = samples.read(out, frames * channels) / channels;
+			consumeSegments(taken);
+			equalizer.process(out, taken);
+			loudnessEnhancer.process(out, taken);
+
+			if (taken < frames && streaming.load(std::memory_order_acquire))
+			{
+				underrunCount.fetch_add(1, std::memory_order_relaxed);
+				underrunFrames.fetch_add(frames - taken, std::memory_order_relaxed);
+			}
+		}
+		else
+		{
+			// Let a flush made while paused free the ring for the decoder.
+			samples.readAvailable();
+		}
+		std::fill(out + taken * channels, out + frames * channels, 0.0f);
+		return taken;
+	}
+
+	bool isReady(size_t frames) override
+	{
+		return samples.readAvailable() >= frames * format.channels || !streaming;
+	}
+
+	/**
+	 * Waits until render() can take |frames| frames, or the rest of the
+	 * playlist, for callers that render faster than real time. The decoder is
+	 * woken for the room the last render() made, rather than finding it when
+	 * it next polls.
+	 */
+	void waitUntilReady(size_t frames)
+	{
+		std::unique_lock<std::mutex> lock(mutex);
+		wakeDecoder();
+		changed.wait(lock, [&]()
+			{ return disposed || isReady(frames); });
+	}
+
+	void onStolen() override
+	{
+		// Called by another player's play(), which may hold its own lock but
+		// not this one.
+		voice = 0;
+		playing = false;
+		stolen = true;
+		wakeDecoder();
+	}
+
+private:
+	// A leaf of the source tree in playback order. |key| identifies it across
+	// playlist changes.
+	struct Item
+	{
+		const AudioSourceSpec* source;
+		int64_t startUs;
+		std::optional<int64_t> endUs;
+		uint64_t key;
+	};
+
+	// Describes the next |frames| frames of the ring, so that render() can
+	// tell which item and position is being heard. A segment with |end| marks
+	// the end of the playlist.
+	struct Segment
+	{
+		uint64_t key;
+		int64_t positionUs;
+		int64_t durationUs;
+		double usPerFrame;
+		size_t frames;
+		bool end;
+	};
+
+	static uint64_t makeKey(uint64_t serial, size_t repeat)
+	{
+		return serial << 24 | (uint64_t)repeat;
+	}
+
+	std::shared_ptr<SyncGroup> getSyncGroup()
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		return syncGroup;
+	}
+
+	/// Plays from the output frame |startFrame|, or from the next block if it
+	/// is 0. Returns whether the player has a voice to play with.
+	bool startVoice(uint64_t startFrame)
+	{
+		bool started;
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			if (voice == 0)
+			{
+				voice = mixer->addVoice(this, voiceSettings, startFrame);
+			}
+			// Without a voice, every other voice outranks this player.
+			playing = voice != 0;
+			started = playing;
+		}
+		wakeDecoder();
+		notifyState();
+		return started;
+	}
+
+	/// Has decode() run as soon as the scheduler can, rather than when it next
+	/// polls.
+	void wakeDecoder()
+	{
+		scheduler->wake(decodeJob);
+	}
+
+	void releaseVoice()
+	{
+		if (voice != 0)
+		{
+			mixer->removeVoice(voice);
+			voice = 0;
+		}
+	}
+
+	void updateVoice(VolumeRamp ramp = VolumeRamp{})
+	{
+		if (voice != 0)
+		{
+			mixer->setVoiceSettings(voice, voiceSettings, ramp);
+		}
+	}
+
+	void requireConcatenating()
+	{
+		if (root.type != AudioSourceSpec::Type::concatenating)
+		{
+			throw std::invalid_argument("The loaded source is not a concatenating source");
+		}
+	}
+
+	/// The index of the item being heard, which trails the item being decoded
+	/// by the depth of the ring.
+	std::optional<size_t> playedItem() const
+	{
+		auto key = clock.load().key;
+		auto found = std::find_if(items.begin(), items.end(), [&](const Item& item)
+			{ return item.key == key; });
+		if (found != items.end())
+		{
+			return (size_t)(found - items.begin());
+		}
+		return current;
+	}
+
+	/// Flattens the source tree into items and the shuffled playback order,
+	/// keeping the current item if it still exists.
+	void rebuildItems()
+	{
+		std::optional<uint64_t> currentKey{};
+		if (current && *current < items.size())
+		{
+			currentKey = items[*current].key;
+		}
+
+		items.clear();
+		std::vector<std::vector<size_t>> childItems{};
+		if (root.type == AudioSourceSpec::Type::concatenating)
+		{
+			for (size_t i = 0; i < root.children.size(); i++)
+			{
+				childItems.emplace_back();
+				size_t repeat = 0;
+				flatten(root.children[i], 0, std::nullopt, childSerials[i], repeat, childItems.back());
+			}
+		}
+		else
+		{
+			childItems.emplace_back();
+			size_t repeat = 0;
+			flatten(root, 0, std::nullopt, childSerials.empty() ? 0 : childSerials[0], repeat, childItems.back());
+		}
+
+		// Shuffling applies to the children of the top-level source; the items
+		// of a child stay together.
+		order.clear();
+		auto& shuffleOrder = root.shuffleOrder;
+		bool useShuffleOrder = shuffle && shuffleOrder.size() == childItems.size() &&
+			std::all_of(shuffleOrder.begin(), shuffleOrder.end(), [&](int32_t i)
+				{ return i >= 0 && (size_t)i < childItems.size(); });
+		for (size_t i = 0; i < childItems.size(); i++)
+		{
+			auto child = useShuffleOrder ? (size_t)shuffleOrder[i] : i;
+			order.insert(order.end(), childItems[child].begin(), childItems[child].end());
+		}
+
+		if (currentKey)
+		{
+			auto found = std::find_if(items.begin(), items.end(), [&](const Item& item)
+				{ return item.key == *currentKey; });
+			if (found != items.end())
+			{
+				current = (size_t)(found - items.begin());
+			}
+			else
+			{
+				// The current item was removed.
+				closeItem();
+				if (!order.empty())
+				{
+					openItem(order.front(), 0);
+				}
+				else
+				{
+					current.reset();
+					processingState = ProcessingState::idle;
+				}
+				flush();
+			}
+		}
+	}
+
+	void flatten(const AudioSourceSpec& source, int64_t startUs, std::optional<int64_t> endUs, uint64_t serial, size_t& repeat, std::vector<size_t>& indices)
+	{
+		switch (source.type)
+		{
+		case AudioSourceSpec::Type::concatenating:
+			for (auto& child : source.children)
+			{
+				flatten(child, startUs, endUs, serial, repeat, indices);
+			}
+			break;
+		case AudioSourceSpec::Type::looping:
+			for (int32_t i = 0; i < source.count && !source.children.empty(); i++)
+			{
+				flatten(source.children[0], startUs, endUs, serial, repeat, indices);
+			}
+			break;
+		case AudioSourceSpec::Type::clipping:
+			if (!source.children.empty())
+			{
+				flatten(source.children[0], source.startUs.value_or(0), source.endUs, serial, repeat, indices);
+			}
+			break;
+		default:
+			indices.push_back(items.size());
+			items.push_back(Item{ &source, startUs, endUs, makeKey(serial, repeat++) });
+			break;
+		}
+	}
+
+	/// Opens the item at |index| and moves to |positionUs| within it. Failures
+	/// are reported and leave the player idle.
+	void openItem(size_t index, int64_t positionUs)
+	{
+		closeItem();
+		current = index;
+		try
+		{
+			decoder = openDecoder(*items[index].source);
+			sourceFormat = decoder->getFormat();
+			if (!resampler || resampler->getChannels() != sourceFormat.channels)
+			{
+				resampler = std::make_unique<Resampler>(sourceFormat.channels, resamplerQuality);
+			}
+			itemGain = normalizationGain(*items[index].source);
+			seekItem(positionUs);
+			processingState = ProcessingState::ready;
+		}
+		catch (const std::exception& error)
+		{
+			decoder.reset();
+			processingState = ProcessingState::idle;
+			playing = false;
+			pendingError = error.what();
+		}
+	}
+
+	/// Opens |source| from the cache if it is there. Otherwise a source short
+	/// enough to be cached is recorded as it is decoded.
+	std::unique_ptr<AudioDecoder> openDecoder(const AudioSourceSpec& source)
+	{
+		auto decoder = decoders->open(source, format);
+		if (!pcmCache || source.type == AudioSourceSpec::Type::silence)
+		{
+			return decoder;
+		}
+		auto sourceFormat = decoder->getFormat();
+		auto length = decoder->getLength();
+		auto maxFrames = pcmCache->getMaxEntryBytes() / sizeof(float) / std::max(format.channels, sourceFormat.channels) * sourceFormat.sampleRate / format.sampleRate;
+		if (!length || *length > (int64_t)maxFrames)
+		{
+			return decoder;
+		}
+
+		auto key = PcmCache::makeKey(source, format);
+		if (auto sample = pcmCache->find(key))
+		{
+			return std::make_unique<PcmDecoder>(sample);
+		}
+		return std::make_unique<RecordingDecoder>(std::move(decoder), maxFrames,
+			[cache = pcmCache, key, format = format](std::vector<float>&& samples, AudioFormat sourceFormat)
+			{ cache->insert(key, convertSample(std::move(samples), sourceFormat, format)); });
+	}
+
+	/// Queues the files under |source| to be measured for normalization.
+	void requestLoudness(const AudioSourceSpec& source)
+	{
+		if (!loudnessAnalyzer || !normalizationTargetLufs)
+		{
+			return;
+		}
+		if (source.type == AudioSourceSpec::Type::progressive)
+		{
+			if (auto path = uriToPath(source.uri))
+			{
+				loudnessAnalyzer->request(*path);
+			}
+		}
+		for (auto& child : source.children)
+		{
+			requestLoudness(child);
+		}
+	}
+
+	/// The gain that plays |source| at the normalization target, or 1 if it has
+	/// not been measured yet.
+	float normalizationGain(const AudioSourceSpec& source)
+	{
+		if (!loudnessAnalyzer || !normalizationTargetLufs || source.type != AudioSourceSpec::Type::progressive)
+		{
+			return 1.0f;
+		}
+		auto path = uriToPath(source.uri);
+		if (!path)
+		{
+			return 1.0f;
+		}
+		auto result = loudnessAnalyzer->find(*path);
+		if (!result)
+		{
+			loudnessAnalyzer->request(*path);
+			return 1.0f;
+		}
+		return (float)std::pow(10.0, loudnessNormalizationGainDb(*result, *normalizationTargetLufs) / 20);
+	}
+
+	/// Reports the failure of the last item opened, if it failed. Called without
+	/// the lock held.
+	void reportError()
+	{
+		std::string error{};
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			error.swap(pendingError);
+		}
+		if (!error.empty())
+		{
+			notifyError("sourceNotSupported", error);
+		}
+	}
+
+	void closeItem()
+	{
+		decoder.reset();
+		if (stretcher)
+		{
+			stretcher->reset();
+		}
+		skipper.reset();
+		sourceBuffer.clear();
+		sourceFrames = 0;
+		sourceCursor = 0;
+		sourceEnded = false;
+	}
+
+	void seekItem(int64_t positionUs)
+	{
+		if (!decoder)
+		{
+			return;
+		}
+		auto& item = items[*current];
+		auto frame = (item.startUs + std::max<int64_t>(positionUs, 0)) * sourceFormat.sampleRate / 1000000;
+		decoder->seek(frame);
+		if (stretcher)
+		{
+			stretcher->reset();
+		}
+		skipper.reset();
+		sourceBase = frame;
+		sourceFrames = 0;
+		sourceCursor = 0;
+		sourceEnded = false;
+	}
+
+	/// Drops what the ring holds after the decoder has jumped, and shows the
+	/// new item and position until render() reaches them.
+	void flush()
+	{
+		samples.discard();
+		segments.discard();
+		flushGeneration.fetch_add(1, std::memory_order_release);
+		tail.clear();
+		tailStart = 0;
+		tailSegments.clear();
+		fadeFrames = 0;
+		fadeRemaining = 0;
+		renderedToEnd = false;
+		decodedToEnd = false;
+		streaming = decoder != nullptr;
+		if (processingState == ProcessingState::completed)
+		{
+			processingState = ProcessingState::ready;
+		}
+		auto shown = clock.load();
+		shown.rendered = false;
+		shown.ended = false;
+		if (current)
+		{
+			shown.key = items[*current].key;
+			shown.positionUs = getPositionUs();
+			shown.startUs = shown.positionUs;
+			shown.durationUs = getDurationUs().value_or(-1);
+		}
+		clock.publish(shown);
+	}
+
+	/// How long the output takes to play what it is given.
+	int64_t getLatencyUs() const
+	{
+		return (int64_t)(mixer->getLatencyFrames() * 1000000 / format.sampleRate);
+	}
+
+	int64_t getPositionUs() const
+	{
+		if (!decoder || sourceFormat.sampleRate == 0)
+		{
+			return 0;
+		}
+		auto frame = sourceBase + (int64_t)sourceCursor;
+		return std::max<int64_t>(0, frame * 1000000 / sourceFormat.sampleRate - items[*current].startUs);
+	}
+
+	std::optional<int64_t> getDurationUs() const
+	{
+		auto& item = items[*current];
+		std::optional<int64_t> endUs = item.endUs;
+		if (decoder && sourceFormat.sampleRate > 0)
+		{
+			if (auto length = decoder->getLength())
+			{
+				auto lengthUs = *length * 1000000 / sourceFormat.sampleRate;
+				endUs = endUs ? std::min(*endUs, lengthUs) : lengthUs;
+			}
+		}
+		if (!endUs)
+		{
+			return std::nullopt;
+		}
+		return std::max<int64_t>(0, *endUs - item.startUs);
+	}
+
+	/// Keeps the source frames from |keepFrom|, which the resampler reads
+	/// back from, and decodes more after them,
+	/// stopping at the end of the clip.
+	void refill(size_t keepFrom)
+	{
+		auto channels = sourceFormat.channels;
+		auto kept = sourceFrames - std::min(keepFrom, sourceFrames);
+		if (keepFrom > 0 && kept > 0)
+		{
+			std::copy(sourceBuffer.begin() + keepFrom * channels, sourceBuffer.begin() + sourceFrames * channels, sourceBuffer.begin());
+		}
+		sourceBase += (int64_t)std::min(keepFrom, sourceFrames);
+		sourceCursor -= (double)std::min(keepFrom, sourceFrames);
+		sourceFrames = kept;
+
+		auto want = blockFrames * 2;
+		auto& item = items[*current];
+		if (item.endUs)
+		{
+			auto endFrame = *item.endUs * sourceFormat.sampleRate / 1000000;
+			want = (size_t)std::clamp<int64_t>(endFrame - sourceBase - (int64_t)sourceFrames, 0, (int64_t)want);
+		}
+		sourceBuffer.resize((sourceFrames + want) * channels);
+		auto decoded = want > 0 ? decoder->read(sourceBuffer.data() + sourceFrames * channels, want) : 0;
+		sourceFrames += decoded;
+		if (decoded == 0)
+		{
+			sourceEnded = true;
+		}
+	}
+
+	/// Renders up to |frames| frames of the current item into |out| in the
+	/// output format, resampling the source for other rates and speeds.
+	/// Returns fewer frames at the end of the item.
+	size_t renderItem(float* out, size_t frames)
+	{
+		auto sourceChannels = sourceFormat.channels;
+		auto channels = format.channels;
+		// With a stretcher, the speed is changed afterwards and this only shifts
+		// the pitch.
+		auto step = (double)sourceFormat.sampleRate / format.sampleRate * (stretcher ? pitch : speed);
+		resampler->setStep(step);
+		auto before = resampler->getFramesBefore();
+		auto after = resampler->getFramesAfter();
+		// Resampled in the source's layout, then mapped to the output's.
+		float* resampledFrames = out;
+		if (sourceChannels != channels)
+		{
+			resampled.resize(frames * sourceChannels);
+			resampledFrames = resampled.data();
+		}
+
+		size_t produced = 0;
+		while (produced < frames)
+		{
+			auto index = (size_t)sourceCursor;
+			if (index + after >= sourceFrames && !sourceEnded)
+			{
+				refill(index - std::min(index, before));
+				continue;
+			}
+			if (index >= sourceFrames)
+			{
+				break;
+			}
+
+			// The kernel reaches past the frames decoded at the start and the end
+			// of the item, where it reads silence.
+			const float* window = sourceBuffer.data() + index * sourceChannels;
+			if (index < before || index + after >= sourceFrames)
+			{
+				resampleWindow.assign((before + after + 1) * sourceChannels, 0.0f);
+				auto first = index - std::min(index, before);
+				auto last = std::min(index + after + 1, sourceFrames);
+				std::copy(sourceBuffer.begin() + first * sourceChannels, sourceBuffer.begin() + last * sourceChannels,
+					resampleWindow.begin() + (first + before - index) * sourceChannels);
+				window = resampleWindow.data() + before * sourceChannels;
+			}
+			resampler->interpolate(window, sourceCursor - (double)index, resampledFrames + produced * sourceChannels);
+			sourceCursor += step;
+			produced++;
+		}
+		if (sourceChannels != channels)
+		{
+			remapChannels(resampledFrames, sourceChannels, out, channels, produced);
+		}
+		return produced;
+	}
+
+	/**
+	 * Renders like renderItem(), through the stretcher when the speed or pitch
+	 * is changed. Returns fewer frames once the stretcher has played out the
+	 * end of the item.
+	 */
+	size_t renderStretched(float* out, size_t frames)
+	{
+		auto channels = format.channels;
+		auto bypass = !stretcher || (speed == 1.0 && pitch == 1.0);
+		if (bypass && (!stretcher || stretcher->isEmpty()))
+		{
+			return renderItem(out, frames);
+		}
+		if (!bypass)
+		{
+			stretcher->setTempo(speed / pitch);
+		}
+
+		size_t produced = 0;
+		while (produced < frames)
+		{
+			produced += stretcher->read(out + produced * channels, frames - produced);
+			if (produced == frames)
+			{
+				break;
+			}
+			if (stretcher->isDrained())
+			{
+				// Back to normal speed, once what was stretched has played.
+				stretcher->reset();
+				if (bypass)
+				{
+					produced += renderItem(out + produced * channels, frames - produced);
+				}
+				break;
+			}
+			auto rendered = bypass ? 0 : renderItem(stretchBlock.data(), blockFrames);
+			if (rendered == 0)
+			{
+				stretcher->finish();
+			}
+			else
+			{
+				stretcher->write(stretchBlock.data(), rendered);
+			}
+		}
+		return produced;
+	}
+
+	/// The position of the next frame to come out of renderStretched(), which
+	/// trails the source by what the stretcher holds.
+	int64_t getPlayedPositionUs() const
+	{
+		auto positionUs = getPositionUs();
+		if (stretcher && !stretcher->isEmpty())
+		{
+			positionUs -= (int64_t)(stretcher->getLatencyFrames() * pitch * 1000000 / format.sampleRate);
+		}
+		return std::max<int64_t>(positionUs, 0);
+	}
+
+	/**
+	 * Renders like renderStretched(), leaving out long silences while silence
+	 * is skipped. Returns frames that follow each other in the media, from
+	 * |positionUs|, and sets |itemEnded| once the item has played out.
+	 */
+	size_t renderSkipping(float* out, size_t frames, int64_t& positionUs, bool& itemEnded)
+	{
+		if (!skipSilence && skipper.isEmpty())
+		{
+			positionUs = getPlayedPositionUs();
+			auto rendered = renderStretched(out, frames);
+			itemEnded = rendered < frames;
+			return rendered;
+		}
+
+		auto skipFrames = skipper.getBlockFrames();
+		while (!skipper.hasOutput() && !skipper.isDrained())
+		{
+			if (!skipSilence)
+			{
+				// Plays out what is held before going back to renderStretched().
+				skipper.finish();
+				break;
+			}
+			auto blockPositionUs = getPlayedPositionUs();
+			auto rendered = renderStretched(skipBlock.data(), skipFrames);
+			skipper.write(skipBlock.data(), rendered, blockPositionUs, 1000000.0 / format.sampleRate * speed);
+			if (rendered < skipFrames)
+			{
+				skipper.finish();
+			}
+		}
+		auto rendered = skipper.read(out, frames, positionUs);
+		itemEnded = false;
+		if (skipper.isDrained())
+		{
+			itemEnded = skipSilence;
+			skipper.reset();
+		}
+		return rendered;
+	}
+
+	/// Moves on from the item that just ended. Returns false once the whole
+	/// playlist has been decoded.
+	bool advance()
+	{
+		if (loopMode == LoopMode::one)
+		{
+			seekItem(0);
+			return true;
+		}
+
+		auto position = std::find(order.begin(), order.end(), *current);
+		if (position != order.end() && position + 1 != order.end())
+		{
+			openItem(*(position + 1), 0);
+			return decoder != nullptr;
+		}
+		if (loopMode == LoopMode::all && !order.empty())
+		{
+			openItem(order.front(), 0);
+			return decoder != nullptr;
+		}
+		return false;
+	}
+
+	/// Decodes one block into the ring, with a segment for each item in it.
+	void decodeBlock()
+	{
+		size_t produced = 0;
+		size_t emptyItems = 0;
+		// The crossfade holds back at most three blocks more for each block
+		// written, so that the ring keeps filling while it does.
+		auto growth = blockFrames * 3;
+		// A few segment slots stay free for the end of the playlist and for
+		// those the crossfade releases.
+		while (produced < blockFrames && segments.writeAvailable() > 4)
+		{
+			auto* rendering = block.data() + produced * format.channels;
+			if (renderedToEnd)
+			{
+				produced += releaseTail(rendering, blockFrames - produced);
+				decodedToEnd = tailFrames() == 0;
+				break;
+			}
+			if (!decoder)
+			{
+				break;
+			}
+
+			Segment segment{ items[*current].key, 0, getDurationUs().value_or(-1),
+				1000000.0 / format.sampleRate * speed, 0, false };
+			bool itemEnded = false;
+			auto rendered = renderSkipping(rendering, blockFrames - produced, segment.positionUs, itemEnded);
+			if (itemGain != 1.0f)
+			{
+				std::transform(rendering, rendering + rendered * format.channels, rendering, [gain = itemGain](float sample)
+					{ return sample * gain; });
+			}
+			produced += crossfade(rendering, rendered, segment, growth);
+			if (itemEnded)
+			{
+				// A looping playlist of empty items would never fill the block.
+				emptyItems = rendered > 0 ? 0 : emptyItems + 1;
+				if (emptyItems > items.size() || !advance())
+				{
+					renderedToEnd = true;
+					continue;
+				}
+				startFade();
+			}
+		}
+		samples.write(block.data(), produced * format.channels);
+
+		if (decodedToEnd || (!decoder && !renderedToEnd))
+		{
+			streaming = false;
+			if (decodedToEnd)
+			{
+				Segment end{ 0, 0, -1, 0, 0, true };
+				segments.write(&end, 1);
+			}
+		}
+	}
+
+	size_t tailFrames() const
+	{
+		return tail.size() / format.channels - tailStart;
+	}
+
+	/**
+	 * Passes |frames| frames just rendered at |samples|, described by
+	 * |segment|, on to the ring. While a crossfade is set, the end of the
+	 * item is held back, and mixed with the start of the next once that
+	 * opens. Leaves the frames to write at |samples|, writes their segments
+	 * and returns how many there are.
+	 */
+	size_t crossfade(float* samples, size_t frames, Segment segment, size_t& growth)
+	{
+		auto channels = format.channels;
+		size_t mixed = 0;
+		if (fadeRemaining > 0 && frames > 0)
+		{
+			// Equal power, so that the level holds between unrelated items.
+			const double quarterTurn = 1.57079632679489662;
+			mixed = std::min(frames, fadeRemaining);
+			const float* outgoing = tail.data() + tailStart * channels;
+			for (size_t f = 0; f < mixed; f++)
+			{
+				auto angle = quarterTurn * ((double)(fadeFrames - fadeRemaining + f) + 0.5) / (double)fadeFrames;
+				auto fadeOut = (float)std::cos(angle);
+				auto fadeIn = (float)std::sin(angle);
+				for (uint32_t c = 0; c < channels; c++)
+				{
+					samples[f * channels + c] = outgoing[f * channels + c] * fadeOut + samples[f * channels + c] * fadeIn;
+				}
+			}
+			popTail(mixed, nullptr);
+			fadeRemaining -= mixed;
+			Segment part = segment;
+			part.frames = mixed;
+			segments.write(&part, 1);
+			segment.positionUs += (int64_t)(mixed * segment.usPerFrame);
+		}
+
+		auto rest = frames - mixed;
+		if (rest == 0)
+		{
+			return mixed;
+		}
+		if (crossfadeFrames == 0 && tailFrames() == 0)
+		{
+			segment.frames = rest;
+			segments.write(&segment, 1);
+			return frames;
+		}
+
+		auto* input = samples + mixed * channels;
+		pushTail(input, rest, segment);
+		auto held = tailFrames();
+		auto release = std::min(held - std::min(held, crossfadeFrames), rest);
+		if (rest > release + growth)
+		{
+			release = rest - growth;
+		}
+		growth -= rest - release;
+		popTail(release, input);
+		return mixed + release;
+	}
+
+	/// Starts mixing what was held back of the item that just ended with the
+	/// next one.
+	void startFade()
+	{
+		if (fadeRemaining > 0)
+		{
+			// The item was shorter than the crossfade, which cuts the rest of
+			// the one before.
+			popTail(fadeRemaining, nullptr);
+		}
+		fadeFrames = tailFrames();
+		fadeRemaining = fadeFrames;
+	}
+
+	/// Moves up to |frames| frames held back at the end of the playlist to
+	/// |out|, returning how many.
+	size_t releaseTail(float* out, size_t frames)
+	{
+		if (fadeRemaining > 0)
+		{
+			popTail(fadeRemaining, nullptr);
+			fadeRemaining = 0;
+		}
+		auto count = std::min(frames, tailFrames());
+		popTail(count, out);
+		return count;
+	}
+
+	void pushTail(const float* samples, size_t frames, Segment segment)
+	{
+		auto channels = format.channels;
+		if (tailStart > 0 && tailStart * 2 >= tail.size() / channels)
+		{
+			tail.erase(tail.begin(), tail.begin() + tailStart * channels);
+			tailStart = 0;
+		}
+		tail.insert(tail.end(), samples, samples + frames * channels);
+
+		// Frames that follow the last segment extend it, so that few segments
+		// are held however the item was rendered.
+		if (!tailSegments.empty())
+		{
+			auto& last = tailSegments.back();
+			auto endUs = last.positionUs + (int64_t)(last.frames * last.usPerFrame);
+			if (last.key == segment.key && last.usPerFrame == segment.usPerFrame && std::abs(endUs - segment.positionUs) <= 1)
+			{
+				last.frames += frames;
+				return;
+			}
+		}
+		segment.frames = frames;
+		tailSegments.push_back(segment);
+	}
+
+	/// Takes |frames| frames from the front of the tail, moving them to |out|
+	/// and writing their segments, or dropping them if |out| is null.
+	void popTail(size_t frames, float* out)
+	{
+		auto channels = format.channels;
+		if (out)
+		{
+			std::copy(tail.begin() + tailStart * channels, tail.begin() + (tailStart + frames) * channels, out);
+		}
+		tailStart += frames;
+		if (tailStart * channels == tail.size())
+		{
+			tail.clear();
+			tailStart = 0;
+		}
+		while (frames > 0 && !tailSegments.empty())
+		{
+			auto& front = tailSegments.front();
+			auto taken = std::min(frames, front.frames);
+			if (out)
+			{
+				Segment part = front;
+				part.frames = taken;
+				segments.write(&part, 1);
+			}
+			front.frames -= taken;
+			front.positionUs += (int64_t)(taken * front.usPerFrame);
+			if (front.frames == 0)
+			{
+				tailSegments.pop_front();
+			}
+			frames -= taken;
+		}
+	}
+
+	/// Called by render() for the |frames| frames it took from the ring, and
+	/// publishes where they reached to |clock|.
+	void consumeSegments(size_t frames)
+	{
+		auto generation = flushGeneration.load(std::memory_order_acquire);
+		if (generation != consumedGeneration)
+		{
+			consumedGeneration = generation;
+			segmentRemaining = 0;
+			// Heard from the position the decoder jumped to.
+			rendered.rendered = false;
+			rendered.ended = false;
+			renderedChanged = false;
+		}
+
+		while (true)
+		{
+			if (segmentRemaining == 0)
+			{
+				if (segments.read(&segment, 1) == 0)
+				{
+					break;
+				}
+				if (segment.end)
+				{
+					rendered.ended = true;
+					renderedChanged = true;
+					continue;
+				}
+				segmentRemaining = segment.frames;
+				segmentOffset = 0;
+				if (segment.key != rendered.key || !rendered.rendered)
+				{
+					rendered.key = segment.key;
+					rendered.startUs = segment.positionUs;
+				}
+				rendered.positionUs = segment.positionUs;
+				rendered.durationUs = segment.durationUs;
+				rendered.speed = segment.usPerFrame * format.sampleRate / 1000000;
+				rendered.rendered = true;
+				rendered.ended = false;
+				renderedChanged = true;
+			}
+			if (frames == 0)
+			{
+				break;
+			}
+			auto count = std::min(frames, segmentRemaining);
+			segmentOffset += count;
+			segmentRemaining -= count;
+			frames -= count;
+			rendered.positionUs = segment.positionUs + (int64_t)(segmentOffset * segment.usPerFrame);
+			// Published even when the segment ends here and the next is not
+			// decoded yet.
+			renderedChanged = true;
+		}
+
+		if (renderedChanged)
+		{
+			// A flush since the generation was read publishes a newer position,
+			// which this must not overwrite. Left to the next call when another
+			// thread is publishing.
+			rendered.renderedAtUs = RenderClock::nowUs();
+			renderedChanged = !clock.tryPublish(rendered, [&]()
+				{ return flushGeneration.load(std::memory_order_acquire) == consumedGeneration; });
+		}
+	}
+
+	/**
+	 * Run by the scheduler: decodes a few blocks into the ring, reports what
+	 * changed, and says when to run again. While playing, the deadline is
+	 * when render() empties the ring.
+	 */
+	DecodeScheduler::Next decode()
+	{
+		std::unique_lock<std::mutex> lock(mutex);
+		auto pending = [&]()
+		{ return !disposed && (decoder || renderedToEnd) && !decodedToEnd; };
+		// A few blocks at a time, so that players closer to running out take
+		// their turn.
+		for (size_t i = 0; i < kBlocksPerRun && pending() && samples.writeAvailable() >= block.size(); i++)
+		{
+			decodeBlock();
+		}
+		// Wakes waitUntilReady().
+		changed.notify_all();
+
+		bool stateChanged = false;
+		auto played = clock.load();
+		// Completed once the end of the playlist has been heard.
+		if (decodedToEnd && processingState != ProcessingState::completed && RenderClock::isHeardToEnd(played, getLatencyUs(), RenderClock::nowUs()))
+		{
+			processingState = ProcessingState::completed;
+			stateChanged = true;
+		}
+		if (stolen.exchange(false))
+		{
+			stateChanged = true;
+		}
+		if (played.key != notifiedKey)
+		{
+			notifiedKey = played.key;
+			stateChanged = true;
+		}
+		if (!disposed && (stateChanged || !pendingError.empty()))
+		{
+			lock.unlock();
+			reportError();
+			if (stateChanged)
+			{
+				notifyState();
+			}
+			lock.lock();
+		}
+
+		auto nowUs = DecodeScheduler::nowUs();
+		DecodeScheduler::Next next{ nowUs + pollIntervalUs, std::nullopt };
+		if (pending())
+		{
+			if (samples.writeAvailable() >= block.size())
+			{
+				next.notBeforeUs = nowUs;
+			}
+			if (playing)
+			{
+				next.deadlineUs = nowUs + (int64_t)(samples.readAvailable() / format.channels * 1000000 / format.sampleRate);
+			}
+		}
+		return next;
+	}
+
+	std::shared_ptr<Mixer> mixer;
+	bool ownsMixer = false;
+	std::shared_ptr<DecoderRegistry> decoders;
+	std::shared_ptr<PcmCache> pcmCache = nullptr;
+	AudioFormat format;
+	size_t blockFrames;
+	std::vector<float> block;
+
+	std::mutex mutex;
+	std::condition_variable changed;
+	std::atomic<bool> disposed = false;
+
+	// Runs decode() on the scheduler's threads.
+	std::shared_ptr<DecodeScheduler> scheduler;
+	uint64_t decodeJob = 0;
+	int64_t pollIntervalUs = 0;
+	uint64_t notifiedKey = UINT64_MAX;
+
+	AudioSourceSpec root{};
+	std::vector<uint64_t> childSerials{};
+	uint64_t nextSerial = 0;
+	std::vector<Item> items{};
+	std::vector<size_t> order{};
+	std::optional<size_t> current{};
+
+	ProcessingState processingState = ProcessingState::idle;
+	std::atomic<bool> playing = false;
+	VoiceSettings voiceSettings{};
+	std::atomic<uint64_t> voice = 0;
+	std::atomic<bool> stolen = false;
+	std::shared_ptr<SyncGroup> syncGroup = nullptr;
+	double speed = 1.0;
+	double pitch = 1.0;
+	LoopMode loopMode = LoopMode::off;
+	bool shuffle = false;
+	std::string pendingError{};
+
+	// The decoded frames of the current item, starting at frame |sourceBase|,
+	// and the fractional read position within them.
+	std::unique_ptr<AudioDecoder> decoder = nullptr;
+	AudioFormat sourceFormat{};
+	std::vector<float> sourceBuffer{};
+	int64_t sourceBase = 0;
+	size_t sourceFrames = 0;
+	double sourceCursor = 0;
+	bool sourceEnded = false;
+
+	// Converts the source to the output's rate, and to the speed without a
+	// stretcher, with the frames around each position it reads.
+	Resampler::Quality resamplerQuality = Resampler::Quality::balanced;
+	std::unique_ptr<Resampler> resampler = nullptr;
+	std::vector<float> resampleWindow{};
+	std::vector<float> resampled{};
+	bool decodedToEnd = false;
+
+	// The ring between the decoder thread and render(). |streaming| is set
+	// while more is to come, so that running dry counts as an underrun.
+	SpscRing<float> samples;
+	SpscRing<Segment> segments;
+	std::atomic<uint64_t> flushGeneration = 0;
+	std::atomic<bool> streaming = false;
+
+	// Changes the speed of the resampled item without changing its pitch.
+	// Without it, the speed is changed by resampling.
+	std::unique_ptr<TimeStretcher> stretcher;
+	std::vector<float> stretchBlock;
+
+	// Shortens silent gaps while |skipSilence| is set, and plays out what it
+	// holds once it is cleared.
+	SilenceSkipper skipper;
+	std::vector<float> skipBlock;
+	bool skipSilence = false;
+
+	// Levels each item to |normalizationTargetLufs| by |itemGain|, once the
+	// analyzer has measured it.
+	std::shared_ptr<LoudnessAnalyzer> loudnessAnalyzer = nullptr;
+	std::optional<double> normalizationTargetLufs{};
+	float itemGain = 1.0f;
+
+	// The end of the current item, held back for a crossfade of
+	// |crossfadeFrames| into the next, and the segments describing it. Once
+	// the next item opens, the first |fadeFrames| of it are mixed with what
+	// was held, |fadeRemaining| of them still to come. |renderedToEnd| is set
+	// once the last item ended and only what is held is left.
+	size_t crossfadeFrames = 0;
+	std::vector<float> tail{};
+	size_t tailStart = 0;
+	RingQueue<Segment> tailSegments{};
+	size_t fadeFrames = 0;
+	size_t fadeRemaining = 0;
+	bool renderedToEnd = false;
+
+	// Set from any thread and applied by render(), which they never block.
+	Equalizer equalizer;
+	LoudnessEnhancer loudnessEnhancer;
+
+	// Owned by render().
+	uint64_t consumedGeneration = 0;
+	Segment segment{};
+	size_t segmentRemaining = 0;
+	size_t segmentOffset = 0;
+	RenderClockSnapshot rendered{};
+	bool renderedChanged = false;
+
+	// Where render() got to, published for the other threads; flush() shows
+	// where the decoder jumped to until render() gets there.
+	RenderClock clock{};
+	std::atomic<uint64_t> underrunCount = 0;
+	std::atomic<uint64_t> underrunFrames = 0;
+};
@@ -0,0 +1,110 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// A wait-free ring of |T| between exactly one producer thread and one
+// consumer thread. Neither side locks or allocates after construction, so the
+// consumer may be a real-time audio callback.
+//
+// Each index is written by one side only and sits on its own cache line, so
+// the two threads do not invalidate each other's lines on every access.
+template <typename T>
+class SpscRing
+{
+public:
+	static constexpr size_t kCacheLineSize = 64;
+
+	/// Holds at least |capacity| items; the capacity is rounded up to a power
+	/// of two.
+	explicit SpscRing(size_t capacity)
+	{
+		size_t size = 1;
+		while (size < capacity)
+		{
+			size <<= 1;
+		}
+		buffer.resize(size);
+		mask = size - 1;
+	}
+
+	// Prevent copying.
+	SpscRing(SpscRing const&) = delete;
+	SpscRing& operator=(SpscRing const&) = delete;
+
+	size_t capacity() const
+	{
+		return buffer.size();
+	}
+
+	/// Producer: copies up to |count| items in, returning how many fit.
+	size_t write(const T* items, size_t count)
+	{
+		auto writeIndex = writePosition.load(std::memory_order_relaxed);
+		auto used = (size_t)(writeIndex - readPosition.load(std::memory_order_acquire));
+		auto accepted = std::min(count, buffer.size() - used);
+		for (size_t i = 0; i < accepted; i++)
+		{
+			buffer[(size_t)(writeIndex + i) & mask] = items[i];
+		}
+		writePosition.store(writeIndex + accepted, std::memory_order_release);
+		return accepted;
+	}
+
+	/// Producer: the number of items write() would accept now.
+	size_t writeAvailable() const
+	{
+		auto writeIndex = writePosition.load(std::memory_order_relaxed);
+		return buffer.size() - (size_t)(writeIndex - readPosition.load(std::memory_order_acquire));
+	}
+
+	/// Producer: makes the consumer skip everything written so far. The space
+	/// is reclaimed the next time the consumer reads.
+	void discard()
+	{
+		discardPosition.store(writePosition.load(std::memory_order_relaxed), std::memory_order_release);
+	}
+
+	/// Consumer: moves up to |count| items into |items|, returning how many.
+	size_t read(T* items, size_t count)
+	{
+		auto readIndex = skipDiscarded();
+		auto available = (size_t)(writePosition.load(std::memory_order_acquire) - readIndex);
+		auto taken = std::min(count, available);
+		for (size_t i = 0; i < taken; i++)
+		{
+			items[i] = buffer[(size_t)(readIndex + i) & mask];
+		}
+		readPosition.store(readIndex + taken, std::memory_order_release);
+		return taken;
+	}
+
+	/// Consumer: the number of items read() would return now.
+	size_t readAvailable()
+	{
+		auto readIndex = skipDiscarded();
+		return (size_t)(writePosition.load(std::memory_order_acquire) - readIndex);
+	}
+
+private:
+	uint64_t skipDiscarded()
+	{
+		auto readIndex = readPosition.load(std::memory_order_relaxed);
+		auto discardIndex = discardPosition.load(std::memory_order_acquire);
+		if (discardIndex > readIndex)
+		{
+			readIndex = discardIndex;
+			readPosition.store(readIndex, std::memory_order_release);
+		}
+		return readIndex;
+	}
+
+	alignas(kCacheLineSize) std::atomic<uint64_t> writePosition = 0;
+	alignas(kCacheLineSize) std::atomic<uint64_t> discardPosition = 0;
+	alignas(kCacheLineSize) std::atomic<uint64_t> readPosition = 0;
+	alignas(kCacheLineSize) std::vector<T> buffer{};
+	size_t mask = 0;
+};
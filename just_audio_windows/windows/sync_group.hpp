@@ -0,0 +1,168 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <vector>
+
+#include "mixer.hpp"
+
+// A player that a SyncGroup keeps in step with others. The group calls these
+// with its own lock held and the voices of its members held by the mixer, so
+// that nothing is rendered between the first member's change and the last.
+class SyncGroupMember
+{
+public:
+	virtual ~SyncGroupMember() = default;
+
+	virtual bool isPlaying() = 0;
+	/// Plays, with a voice held until the group starts it. Returns false when
+	/// the member got no voice.
+	virtual bool holdToPlay() = 0;
+	virtual void pauseHeld() = 0;
+	virtual void seekHeld(std::optional<int32_t> index, int64_t positionUs) = 0;
+	/// Changes the speed from where rendering stopped, dropping what was
+	/// decoded ahead at the old one.
+	virtual void setSpeedHeld(double speed) = 0;
+	/// Called once the group no longer counts the member in.
+	virtual void onGroupDissolved() = 0;
+};
+
+// Players that play, pause, seek and change speed together, to the frame.
+// Every member is a voice of one mixer, whose output is the clock they share:
+// the mixer renders the voices of a group together or not at all, and the
+// group changes them only between two blocks. A group starts at a frame of
+// the output rather than when each member gets to it, and a member that runs
+// dry holds the others back with it instead of falling behind.
+class SyncGroup
+{
+public:
+	explicit SyncGroup(std::shared_ptr<Mixer> mixer)
+		: mixer(mixer), id(mixer->createGroup())
+	{
+	}
+
+	// Prevent copying.
+	SyncGroup(SyncGroup const&) = delete;
+	SyncGroup& operator=(SyncGroup const&) = delete;
+
+	std::shared_ptr<Mixer> getMixer() const
+	{
+		return mixer;
+	}
+
+	/// The group of the members' VoiceSettings.
+	uint64_t getId() const
+	{
+		return id;
+	}
+
+	size_t getMemberCount()
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		return members.size();
+	}
+
+	void add(SyncGroupMember* member)
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		if (std::find(members.begin(), members.end(), member) == members.end())
+		{
+			members.push_back(member);
+		}
+	}
+
+	void remove(SyncGroupMember* member)
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		members.erase(std::remove(members.begin(), members.end(), member), members.end());
+	}
+
+	/**
+	 * Starts the members that are not playing at the output frame heard at
+	 * |hostTimeUs|, or without one, as soon as all of them are ready. Returns
+	 * the frame they start at, which is later if one of them is not ready by
+	 * then. See Mixer::frameAtHostTime for |nowUs|.
+	 */
+	uint64_t play(std::optional<int64_t> hostTimeUs, std::optional<int64_t> nowUs = std::nullopt)
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		auto frame = hostTimeUs ? mixer->frameAtHostTime(*hostTimeUs, nowUs) : 0;
+		for (auto* member : members)
+		{
+			member->holdToPlay();
+		}
+		return mixer->startGroup(id, frame);
+	}
+
+	void pause()
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		mixer->holdGroup(id);
+		for (auto* member : members)
+		{
+			member->pauseHeld();
+		}
+	}
+
+	/// Seeks every member to |positionUs| in the item at |index|, or in its
+	/// current item, and plays on from there together.
+	void seek(std::optional<int32_t> index, int64_t positionUs)
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		auto playing = holdAll();
+		for (auto* member : members)
+		{
+			member->seekHeld(index, positionUs);
+		}
+		if (playing)
+		{
+			mixer->startGroup(id, 0);
+		}
+	}
+
+	/// Changes the speed of every member from the frame they are held at, and
+	/// plays on together.
+	void setSpeed(double speed)
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		auto playing = holdAll();
+		for (auto* member : members)
+		{
+			member->setSpeedHeld(speed);
+		}
+		if (playing)
+		{
+			mixer->startGroup(id, 0);
+		}
+	}
+
+	/// Lets every member go its own way.
+	void dissolve()
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		for (auto* member : members)
+		{
+			member->onGroupDissolved();
+		}
+		members.clear();
+	}
+
+private:
+	/// Holds the members' voices, returning whether any was playing.
+	bool holdAll()
+	{
+		auto playing = std::any_of(members.begin(), members.end(), [](SyncGroupMember* member)
+			{ return member->isPlaying(); });
+		mixer->holdGroup(id);
+		return playing;
+	}
+
+	std::shared_ptr<Mixer> mixer;
+	uint64_t id;
+
+	std::mutex mutex;
+	std::vector<SyncGroupMember*> members{};
+};
@@ -0,0 +1,92 @@
+#include <gtest/gtest.h>
+
+#include <cmath>
+#include <cstdint>
+#include <functional>
+#include <optional>
+#include <vector>
+
+#include "adaptive_bitrate.hpp"
+
+namespace {
+
+const std::vector<uint32_t> kRenditions = {128000, 256000, 512000, 1024000};
+const double kSegmentSeconds = 4;
+
+// Plays segments of the rendition the selector picks over a link whose
+// throughput, in bits per second, follows |trace| in media time. Returns the
+// rendition of each segment.
+std::vector<uint32_t> Simulate(const std::function<double(double)> &trace, double seconds) {
+  BandwidthEstimator estimator;
+  RenditionSelector selector;
+  std::vector<uint32_t> chosen;
+  uint32_t current = 0;
+  for (double time = 0; time < seconds; time += kSegmentSeconds) {
+    current = selector.select(kRenditions, estimator.getEstimate(), current);
+    chosen.push_back(current);
+    auto bytes = (uint64_t)(current * kSegmentSeconds / 8);
+    estimator.addSample(bytes, bytes * 8 / trace(time));
+  }
+  return chosen;
+}
+
+TEST(AdaptiveBitrateTest, SwitchesDownWhenThroughputDropsAndBackUpWhenItRecovers) {
+  // 3 Mbit/s, then 400 kbit/s for a minute, then 3 Mbit/s again.
+  auto chosen = Simulate([](double time) { return time >= 60 && time < 120 ? 400000.0 : 3000000.0; }, 200);
+  auto segment = [](double time) { return (size_t)(time / kSegmentSeconds); };
+
+  // Up to the top once the estimate is trusted.
+  EXPECT_EQ(chosen[segment(40)], 1024000u);
+  // Down within two segments of the drop, and never above the link after.
+  for (auto i = segment(60) + 2; i < segment(120); i++) {
+    ASSERT_LE(chosen[i], 256000u) << "at segment " << i;
+  }
+  // Climbs back without stepping down, and is at the top within 40 seconds:
+  // segments downloaded quickly weigh little in the estimate.
+  for (auto i = segment(120) + 1; i < chosen.size(); i++) {
+    ASSERT_GE(chosen[i], chosen[i - 1]) << "at segment " << i;
+  }
+  EXPECT_EQ(chosen[segment(160)], 1024000u);
+}
+
+TEST(AdaptiveBitrateTest, HoldsOneRenditionOnANoisyLink) {
+  // 1 Mbit/s within 10%, alternating every segment.
+  auto chosen = Simulate([](double time) { return (int)(time / kSegmentSeconds) % 2 ? 1100000.0 : 900000.0; }, 300);
+  int switches = 0;
+  for (size_t i = 8; i < chosen.size(); i++) {
+    switches += chosen[i] != chosen[i - 1];
+  }
+  EXPECT_EQ(switches, 0);
+  EXPECT_EQ(chosen.back(), 512000u);
+}
+
+TEST(AdaptiveBitrateTest, NeverPicksARenditionOverThePeak) {
+  BandwidthEstimator estimator;
+  for (int i = 0; i < 10; i++) {
+    estimator.addSample(1000000, 1);
+  }
+  RenditionSelector selector;
+  selector.setPreferredPeakBitRate(300000);
+  EXPECT_EQ(selector.select(kRenditions, estimator.getEstimate(), 0), 256000u);
+}
+
+TEST(AdaptiveBitrateTest, PinsTheWindowWithoutMinAboveMax) {
+  // The desired bitrates of a source, which rejects a min above its max.
+  std::optional<uint32_t> min;
+  std::optional<uint32_t> max;
+  auto check = [&]() { return !min || !max || *min <= *max; };
+  for (auto bitrate : {512000u, 1024000u, 128000u, 256000u, 256000u, 1024000u}) {
+    if (RenditionSelector::setsMaxFirst(min, bitrate)) {
+      max = bitrate;
+      ASSERT_TRUE(check()) << "raising to " << bitrate;
+      min = bitrate;
+    } else {
+      min = bitrate;
+      ASSERT_TRUE(check()) << "lowering to " << bitrate;
+      max = bitrate;
+    }
+    ASSERT_TRUE(check());
+  }
+}
+
+}  // namespace
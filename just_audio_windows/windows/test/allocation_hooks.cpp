@@ -0,0 +1,49 @@
+#include <cstdlib>
+#include <new>
+
+#include "allocation_guard.hpp"
+
+#ifdef JUST_AUDIO_ALLOCATION_GUARD
+// Reports every allocation and free made by the tests to the guard, as the
+// plugin does in Debug builds, so that the render path fails the tests where
+// it allocates.
+void *operator new(std::size_t size) {
+  AllocationGuard::onAllocation();
+  if (void *pointer = std::malloc(size ? size : 1)) {
+    return pointer;
+  }
+  throw std::bad_alloc();
+}
+
+void *operator new[](std::size_t size) {
+  return operator new(size);
+}
+
+void *operator new(std::size_t size, const std::nothrow_t &) noexcept {
+  AllocationGuard::onAllocation();
+  return std::malloc(size ? size : 1);
+}
+
+void *operator new[](std::size_t size, const std::nothrow_t &tag) noexcept {
+  return operator new(size, tag);
+}
+
+void operator delete(void *pointer) noexcept {
+  if (pointer) {
+    AllocationGuard::onAllocation();
+  }
+  std::free(pointer);
+}
+
+void operator delete[](void *pointer) noexcept {
+  operator delete(pointer);
+}
+
+void operator delete(void *pointer, std::size_t) noexcept {
+  operator delete(pointer);
+}
+
+void operator delete[](void *pointer, std::size_t) noexcept {
+  operator delete(pointer);
+}
+#endif
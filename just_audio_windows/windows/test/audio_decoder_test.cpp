@@ -0,0 +1,86 @@
+#include <gtest/gtest.h>
+
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "audio_decoder.hpp"
+#include "generated_decoder.hpp"
+
+namespace {
+
+class DecoderRegistryTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    directory_ = std::filesystem::temp_directory_path() /
+                 ("just_audio_windows_decoder_" + std::to_string(::testing::UnitTest::GetInstance()->random_seed()));
+    std::filesystem::create_directories(directory_);
+  }
+
+  void TearDown() override {
+    std::error_code error;
+    std::filesystem::remove_all(directory_, error);
+  }
+
+  // Writes a 16-bit mono WAV file of |samples| at 8 kHz.
+  std::string WriteWav(const std::string &name, const std::vector<int16_t> &samples) {
+    auto path = (directory_ / name).string();
+    std::ofstream file(path, std::ios::binary);
+    auto put32 = [&](uint32_t value) {
+      for (int i = 0; i < 4; i++) file.put((char)(value >> (i * 8)));
+    };
+    auto put16 = [&](uint16_t value) {
+      file.put((char)value);
+      file.put((char)(value >> 8));
+    };
+    auto data_size = (uint32_t)(samples.size() * 2);
+    file.write("RIFF", 4);
+    put32(36 + data_size);
+    file.write("WAVEfmt ", 8);
+    put32(16);
+    put16(1);
+    put16(1);
+    put32(8000);
+    put32(16000);
+    put16(2);
+    put16(16);
+    file.write("data", 4);
+    put32(data_size);
+    for (auto sample : samples) put16((uint16_t)sample);
+    return path;
+  }
+
+  std::filesystem::path directory_;
+};
+
+// The plugin adds Media Foundation to the registry, which can open WAV files
+// too; the native decoder must still be the one to open them.
+TEST_F(DecoderRegistryTest, OpensWavFilesNativelyAheadOfAddedDecoders) {
+  auto path = WriteWav("clip.wav", {0, 16384, -16384, 32767});
+  DecoderRegistry decoders;
+  int platform_opens = 0;
+  decoders.add([&](const AudioSourceSpec &) -> std::unique_ptr<AudioDecoder> {
+    platform_opens++;
+    return std::make_unique<GeneratedDecoder>(AudioFormat{48000, 2}, 48000, [](int64_t) { return 0.0f; });
+  });
+
+  AudioSourceSpec source;
+  source.uri = path;
+  auto decoder = decoders.open(source, AudioFormat{48000, 2});
+  EXPECT_EQ(platform_opens, 0);
+  EXPECT_EQ(decoder->getFormat().sampleRate, 8000u);
+  EXPECT_EQ(decoder->getFormat().channels, 1u);
+  std::vector<float> samples(4);
+  ASSERT_EQ(decoder->read(samples.data(), 4), 4u);
+  EXPECT_FLOAT_EQ(samples[1], 0.5f);
+  EXPECT_FLOAT_EQ(samples[2], -0.5f);
+
+  source.uri = (directory_ / "clip.mp3").string();
+  decoders.open(source, AudioFormat{48000, 2});
+  EXPECT_EQ(platform_opens, 1);
+}
+
+}  // namespace
@@ -0,0 +1,324 @@
+// Runs the benchmarks of the native audio pipeline from the command line:
+//
+//   just_audio_windows_benchmark <benchmark> [option=value ...]
+//
+// Each prints its results as "key: value" lines. Without a benchmark, lists
+// them with their options.
+
+#include <cstdlib>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "benchmarks/equalizer_benchmark.hpp"
+#include "benchmarks/icy_metadata_benchmark.hpp"
+#include "benchmarks/loudness_benchmark.hpp"
+#include "benchmarks/mixer_benchmark.hpp"
+#include "benchmarks/mp3_seek_index_benchmark.hpp"
+#include "benchmarks/offline_render_benchmark.hpp"
+#include "benchmarks/resampler_benchmark.hpp"
+#include "benchmarks/sample_backend_benchmark.hpp"
+#include "benchmarks/sample_kernels_benchmark.hpp"
+#include "benchmarks/software_backend_benchmark.hpp"
+#include "benchmarks/time_stretch_benchmark.hpp"
+
+namespace {
+
+using Options = std::map<std::string, std::string>;
+
+double Number(const Options &options, const char *name, double fallback) {
+  auto it = options.find(name);
+  return it != options.end() ? std::strtod(it->second.c_str(), nullptr) : fallback;
+}
+
+std::string Text(const Options &options, const char *name, const char *fallback) {
+  auto it = options.find(name);
+  return it != options.end() ? it->second : fallback;
+}
+
+template <typename T>
+void Print(const std::string &key, const T &value) {
+  std::cout << key << ": " << value << std::endl;
+}
+
+bool ParseResamplerQuality(const std::string &name, Resampler::Quality *quality) {
+  if (name.compare("fast") == 0) {
+    *quality = Resampler::Quality::fast;
+  } else if (name.compare("balanced") == 0) {
+    *quality = Resampler::Quality::balanced;
+  } else if (name.compare("best") == 0) {
+    *quality = Resampler::Quality::best;
+  } else {
+    return false;
+  }
+  return true;
+}
+
+int RunIcy(const Options &options) {
+  auto benchmark = benchmarkIcyMetadata(std::max(Number(options, "megabytes", 64.0), 0.1),
+                                        (uint32_t)std::max(Number(options, "metaint", 16000), 1.0));
+  Print("megabytes", benchmark.megabytes);
+  Print("titles", benchmark.titles);
+  Print("readerNsPerMegabyte", benchmark.readerNsPerMegabyte);
+  Print("stripNsPerMegabyte", benchmark.stripNsPerMegabyte);
+  Print("copyNsPerMegabyte", benchmark.copyNsPerMegabyte);
+  Print("overheadNsPerMegabyte", benchmark.overheadNsPerMegabyte);
+  Print("mismatches", benchmark.mismatches);
+  return benchmark.mismatches == 0 ? 0 : 1;
+}
+
+int RunMixer(const Options &options) {
+  auto seconds = Number(options, "seconds", 2.0);
+  std::stringstream counts(Text(options, "voices", "1,32,256"));
+  std::string count;
+  while (std::getline(counts, count, ',')) {
+    auto benchmark = benchmarkMixer((size_t)std::max(std::atoi(count.c_str()), 0), seconds);
+    auto prefix = std::to_string(benchmark.voices) + ".";
+    Print(prefix + "cpuPerVoice", benchmark.cpuUsPerVoiceSecond);
+    Print(prefix + "realtimeFactor", benchmark.realtimeFactor);
+  }
+  return 0;
+}
+
+int RunSamples(const Options &options) {
+  auto benchmark = benchmarkSampleTriggers((size_t)std::max(Number(options, "triggers", 100), 1.0),
+                                           (size_t)std::max(Number(options, "blockFrames", (double)Mixer::kDefaultBlockFrames), 1.0));
+  Print("triggers", benchmark.triggers);
+  Print("meanLatency", benchmark.meanLatencyUs);
+  Print("maxLatency", benchmark.maxLatencyUs);
+  Print("bytesPerSecond", benchmark.bytesPerSecond);
+  return 0;
+}
+
+int RunGainRamps(const Options &options) {
+  auto duration = (int64_t)std::max(Number(options, "rampDuration", 10000), 1.0);
+  for (auto curve : {VolumeRamp::Curve::linear, VolumeRamp::Curve::exponential}) {
+    auto benchmark = benchmarkGainRamp(duration, curve);
+    std::string prefix = curve == VolumeRamp::Curve::linear ? "linear." : "exponential.";
+    Print(prefix + "maxStep", benchmark.maxStep);
+    Print(prefix + "expectedMaxStep", benchmark.expectedMaxStep);
+    Print(prefix + "nsPerFrame", benchmark.nsPerFrame);
+  }
+  return 0;
+}
+
+int RunTimeStretch(const Options &options) {
+  auto quality_name = Text(options, "quality", "balanced");
+  TimeStretcher::Quality quality;
+  if (quality_name.compare("fast") == 0) {
+    quality = TimeStretcher::Quality::fast;
+  } else if (quality_name.compare("balanced") == 0) {
+    quality = TimeStretcher::Quality::balanced;
+  } else if (quality_name.compare("best") == 0) {
+    quality = TimeStretcher::Quality::best;
+  } else {
+    std::cerr << "unknown quality " << quality_name << std::endl;
+    return 2;
+  }
+  auto benchmark = benchmarkTimeStretch((size_t)std::max(Number(options, "streams", 16), 1.0), quality,
+                                        Number(options, "speed", 1.5), Number(options, "seconds", 2.0));
+  Print("streams", benchmark.streams);
+  Print("cpuPerStream", benchmark.cpuUsPerStreamSecond);
+  Print("realtimeFactor", benchmark.realtimeFactor);
+  return 0;
+}
+
+int RunEqualizer(const Options &options) {
+  auto benchmark = benchmarkEqualizer(Number(options, "seconds", 10.0));
+  Print("bands", benchmark.bands);
+  Print("nsPerFrameBand", benchmark.nsPerFrameBand);
+  Print("realtimeFactor", benchmark.realtimeFactor);
+  return 0;
+}
+
+int RunLoudness(const Options &options) {
+  auto benchmark = benchmarkLoudness(Number(options, "seconds", 60.0), (unsigned)std::max(Number(options, "threads", 0), 0.0));
+  Print("threads", benchmark.threads);
+  Print("realtimeFactor", benchmark.realtimeFactor);
+  Print("poolRealtimeFactor", benchmark.poolRealtimeFactor);
+  return 0;
+}
+
+int RunTransition(const Options &options) {
+  auto benchmark = benchmarkTransition((int64_t)std::max(Number(options, "crossfade", 0), 0.0));
+  Print("gapFrames", benchmark.gapFrames);
+  Print("overlapFrames", benchmark.overlapFrames);
+  Print("minLevel", benchmark.minLevel);
+  Print("maxLevel", benchmark.maxLevel);
+  Print("underruns", benchmark.underruns);
+  return 0;
+}
+
+int RunResampler(const Options &options) {
+  auto from_rate = (uint32_t)std::max(Number(options, "fromRate", 44100), 1.0);
+  auto to_rate = (uint32_t)std::max(Number(options, "toRate", 48000), 1.0);
+  for (const char *name : {"fast", "balanced", "best"}) {
+    Resampler::Quality quality;
+    ParseResamplerQuality(name, &quality);
+    auto benchmark = benchmarkResampler(quality, from_rate, to_rate, Number(options, "frequency", 1000.0), Number(options, "seconds", 2.0));
+    std::string prefix = std::string(name) + ".";
+    Print(prefix + "nsPerFrame", benchmark.nsPerFrame);
+    Print(prefix + "realtimeFactor", benchmark.realtimeFactor);
+    Print(prefix + "thdN", benchmark.thdNDb);
+  }
+  return 0;
+}
+
+int RunSampleKernels(const Options &options) {
+  const std::pair<SimdLevel, const char *> levels[] = {
+      {SimdLevel::scalar, "scalar"}, {SimdLevel::sse2, "sse2"}, {SimdLevel::avx2, "avx2"}, {SimdLevel::neon, "neon"}};
+  for (const auto &[level, name] : levels) {
+    if (SampleKernels::get().level == level) {
+      Print("selected", name);
+    }
+    auto benchmark = benchmarkSampleKernels(level, Number(options, "seconds", 1.0));
+    if (!benchmark.supported) {
+      continue;
+    }
+    std::string prefix = std::string(name) + ".";
+    Print(prefix + "mismatches", benchmark.mismatches);
+    Print(prefix + "int16ToFloat", benchmark.int16ToFloat);
+    Print(prefix + "int24ToFloat", benchmark.int24ToFloat);
+    Print(prefix + "int32ToFloat", benchmark.int32ToFloat);
+    Print(prefix + "interleave", benchmark.interleave);
+    Print(prefix + "deinterleave", benchmark.deinterleave);
+    Print(prefix + "monoToStereo", benchmark.monoToStereo);
+    Print(prefix + "stereoToMono", benchmark.stereoToMono);
+    Print(prefix + "downmix51", benchmark.downmix51);
+    Print(prefix + "accumulate", benchmark.accumulate);
+    Print(prefix + "firInterpolate", benchmark.firInterpolate);
+  }
+  return 0;
+}
+
+int RunRenderClock(const Options &options) {
+  auto benchmark = benchmarkRenderClock(std::max(Number(options, "seconds", 3.0), 0.1),
+                                        (unsigned)std::max(Number(options, "readers", 4), 1.0),
+                                        (int64_t)std::max(Number(options, "latency", 40000), 1.0));
+  Print("reads", benchmark.reads);
+  Print("nsPerRead", benchmark.nsPerRead);
+  Print("meanError", benchmark.meanErrorUs);
+  Print("maxError", benchmark.maxErrorUs);
+  Print("backwardReads", benchmark.backwardReads);
+  Print("maxBackward", benchmark.maxBackwardUs);
+  Print("completionDelay", benchmark.completionDelayUs);
+  return 0;
+}
+
+int RunOfflineRender(const Options &options) {
+  auto benchmark = benchmarkOfflineRender(std::max(Number(options, "seconds", 600.0), 1.0), (unsigned)std::max(Number(options, "threads", 0), 0.0));
+  Print("threads", benchmark.threads);
+  Print("seconds", benchmark.seconds);
+  Print("realtimeFactor", benchmark.realtimeFactor);
+  Print("poolRealtimeFactor", benchmark.poolRealtimeFactor);
+  return 0;
+}
+
+int RunDecodeLoad(const Options &options) {
+  auto benchmark = benchmarkDecodeLoad((size_t)std::max(Number(options, "streams", 200), 1.0),
+                                       std::max(Number(options, "seconds", 10.0), 0.1),
+                                       (unsigned)std::max(Number(options, "threads", 0), 0.0));
+  Print("streams", benchmark.streams);
+  Print("threads", benchmark.threads);
+  Print("seconds", benchmark.seconds);
+  Print("underruns", benchmark.underruns);
+  Print("underrunFrames", benchmark.underrunFrames);
+  Print("runs", benchmark.runs);
+  Print("steals", benchmark.steals);
+  Print("deadlineMisses", benchmark.deadlineMisses);
+  Print("maxQueueDepth", benchmark.maxQueueDepth);
+  Print("mixerLoad", benchmark.mixerLoad);
+  return 0;
+}
+
+int RunSeekIndex(const Options &options) {
+  auto benchmark = benchmarkMp3SeekIndex(std::max(Number(options, "seconds", 3 * 3600.0), 1.0), (size_t)std::max(Number(options, "seeks", 1000), 1.0));
+  Print("seconds", benchmark.seconds);
+  Print("fileBytes", benchmark.fileBytes);
+  Print("frames", benchmark.frames);
+  Print("indexBytes", benchmark.indexBytes);
+  Print("build", benchmark.buildUs);
+  Print("realtimeFactor", benchmark.realtimeFactor);
+  Print("megabytesPerSecond", benchmark.megabytesPerSecond);
+  Print("load", benchmark.loadUs);
+  Print("seeks", benchmark.seeks);
+  Print("meanSeek", benchmark.meanSeekUs);
+  Print("maxSeek", benchmark.maxSeekUs);
+  Print("mismatches", benchmark.mismatches);
+  Print("meanScanSeek", benchmark.meanScanSeekUs);
+  Print("meanEstimateError", benchmark.meanEstimateErrorUs);
+  Print("maxEstimateError", benchmark.maxEstimateErrorUs);
+  return 0;
+}
+
+int RunSyncGroup(const Options &options) {
+  auto benchmark = benchmarkSyncGroup((size_t)std::max(Number(options, "players", 8), 2.0), std::max(Number(options, "seconds", 3600.0), 1.0));
+  Print("players", benchmark.players);
+  Print("seconds", benchmark.seconds);
+  Print("commands", benchmark.commands);
+  Print("maxSkew", benchmark.maxSkewUs);
+  Print("finalSkew", benchmark.finalSkewUs);
+  Print("starts", benchmark.starts);
+  Print("startErrors", benchmark.startErrors);
+  Print("groupStalls", benchmark.groupStalls);
+  Print("ungroupedMaxSkew", benchmark.ungroupedMaxSkewUs);
+  Print("ungroupedFinalSkew", benchmark.ungroupedFinalSkewUs);
+  Print("ungroupedUnderruns", benchmark.ungroupedUnderruns);
+  return 0;
+}
+
+struct Benchmark {
+  const char *name;
+  const char *options;
+  int (*run)(const Options &);
+};
+
+const Benchmark kBenchmarks[] = {
+    {"icy", "megabytes=64 metaint=16000", RunIcy},
+    {"mixer", "voices=1,32,256 seconds=2", RunMixer},
+    {"samples", "triggers=100 blockFrames=480", RunSamples},
+    {"gainRamps", "rampDuration=10000", RunGainRamps},
+    {"timeStretch", "streams=16 quality=balanced speed=1.5 seconds=2", RunTimeStretch},
+    {"equalizer", "seconds=10", RunEqualizer},
+    {"loudness", "seconds=60 threads=0", RunLoudness},
+    {"transition", "crossfade=0", RunTransition},
+    {"resampler", "fromRate=44100 toRate=48000 frequency=1000 seconds=2", RunResampler},
+    {"sampleKernels", "seconds=1", RunSampleKernels},
+    {"renderClock", "seconds=3 readers=4 latency=40000", RunRenderClock},
+    {"offlineRender", "seconds=600 threads=0", RunOfflineRender},
+    {"decodeLoad", "streams=200 seconds=10 threads=0", RunDecodeLoad},
+    {"seekIndex", "seconds=10800 seeks=1000", RunSeekIndex},
+    {"syncGroup", "players=8 seconds=3600", RunSyncGroup},
+};
+
+}  // namespace
+
+int main(int argc, char **argv) {
+  if (argc < 2) {
+    std::cerr << "usage: just_audio_windows_benchmark <benchmark> [option=value ...]" << std::endl;
+    for (const auto &benchmark : kBenchmarks) {
+      std::cerr << "  " << benchmark.name << " " << benchmark.options << std::endl;
+    }
+    return 2;
+  }
+
+  Options options;
+  for (int i = 2; i < argc; i++) {
+    std::string option = argv[i];
+    auto equals = option.find('=');
+    if (equals == std::string::npos) {
+      std::cerr << "expected option=value, got " << option << std::endl;
+      return 2;
+    }
+    options[option.substr(0, equals)] = option.substr(equals + 1);
+  }
+  for (const auto &benchmark : kBenchmarks) {
+    if (std::string(argv[1]).compare(benchmark.name) == 0) {
+      return benchmark.run(options);
+    }
+  }
+  std::cerr << "unknown benchmark " << argv[1] << std::endl;
+  return 2;
+}
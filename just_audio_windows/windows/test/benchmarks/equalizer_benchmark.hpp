@@ -0,0 +1,54 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <vector>
+
+#include "equalizer.hpp"
+
+struct EqualizerBenchmarkResult
+{
+	size_t bands;
+	// Nanoseconds spent filtering each frame, for each band.
+	double nsPerFrameBand;
+	// Seconds of audio equalized per second of CPU time.
+	double realtimeFactor;
+};
+
+/// Times equalizing |seconds| of a tone with every band boosted or cut.
+inline EqualizerBenchmarkResult benchmarkEqualizer(double seconds, AudioFormat format = AudioFormat{ 48000, 2 })
+{
+	size_t blockFrames = 480;
+	Equalizer equalizer(format);
+	equalizer.setEnabled(true);
+	for (size_t i = 0; i < Equalizer::kBands; i++)
+	{
+		equalizer.setBandGain(i, i % 2 ? -6.0 : 6.0);
+	}
+	std::vector<float> tone(blockFrames * format.channels);
+	for (size_t i = 0; i < tone.size(); i++)
+	{
+		tone[i] = 0.2f * std::sin((float)(i / format.channels) * 0.05f);
+	}
+	std::vector<float> block(tone);
+	auto blocks = std::max<size_t>(1, (size_t)(seconds * format.sampleRate / blockFrames));
+	// Lets the gains settle first, so that only filtering is timed.
+	for (size_t b = 0; b < 10; b++)
+	{
+		equalizer.process(block.data(), blockFrames);
+	}
+
+	auto start = std::chrono::steady_clock::now();
+	for (size_t b = 0; b < blocks; b++)
+	{
+		std::copy(tone.begin(), tone.end(), block.begin());
+		equalizer.process(block.data(), blockFrames);
+	}
+	auto elapsedUs = (double)std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+	auto audioSeconds = (double)blocks * blockFrames / format.sampleRate;
+
+	return EqualizerBenchmarkResult{ Equalizer::kBands,
+		elapsedUs * 1000 / ((double)blocks * blockFrames) / Equalizer::kBands,
+		elapsedUs > 0 ? audioSeconds * 1000000 / elapsedUs : 0.0 };
+}
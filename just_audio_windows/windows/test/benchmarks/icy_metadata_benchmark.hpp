@@ -0,0 +1,119 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "icy_metadata.hpp"
+
+struct IcyMetadataBenchmarkResult
+{
+	double megabytes;
+	size_t titles;
+	// Nanoseconds spent on each megabyte of audio read through an
+	// IcyStreamReader, as LiveStream reads for the decoder, and stripped in
+	// place by IcyParser, as the timeshift recorder does.
+	double readerNsPerMegabyte;
+	double stripNsPerMegabyte;
+	// The same audio copied from the connection without any metadata.
+	double copyNsPerMegabyte;
+	// What parsing adds to reading, per megabyte.
+	double overheadNsPerMegabyte;
+	// Audio bytes that came out different from what was sent.
+	size_t mismatches;
+};
+
+/// Times removing the metadata from |megabytes| of an ICY stream with a block
+/// every |metadataInterval| audio bytes and a new title every tenth, read in
+/// |readSize| byte reads from a connection that delivers |chunkSize| bytes at
+/// a time.
+inline IcyMetadataBenchmarkResult benchmarkIcyMetadata(double megabytes, uint32_t metadataInterval = 16000,
+	size_t readSize = 64 * 1024, size_t chunkSize = 16 * 1024)
+{
+	auto audioSize = std::max<size_t>(metadataInterval, (size_t)(megabytes * 1024 * 1024));
+	std::vector<uint8_t> audio(audioSize);
+	for (size_t i = 0; i < audio.size(); i++)
+	{
+		audio[i] = (uint8_t)(i * 31 + 7);
+	}
+	std::vector<uint8_t> stream{};
+	stream.reserve(audio.size() + audio.size() / metadataInterval * 64);
+	for (size_t offset = 0; offset < audio.size(); offset += metadataInterval)
+	{
+		auto end = std::min(audio.size(), offset + metadataInterval);
+		stream.insert(stream.end(), audio.begin() + offset, audio.begin() + end);
+		if (end - offset == metadataInterval)
+		{
+			auto block = offset / metadataInterval;
+			std::string text = block % 10 == 0 ? "StreamTitle='Artist - Song " + std::to_string(block / 10) + "';StreamUrl='';" : "";
+			auto length = (text.size() + 15) / 16;
+			stream.push_back((uint8_t)length);
+			text.resize(length * 16, '\0');
+			stream.insert(stream.end(), text.begin(), text.end());
+		}
+	}
+
+	// A connection delivering at most |chunkSize| bytes a read, as a socket
+	// does.
+	auto connection = [&](const std::vector<uint8_t>& source, size_t& offset)
+	{
+		return [&source, &offset, chunkSize](uint8_t* data, size_t length) -> size_t
+		{
+			auto count = std::min({ length, chunkSize, source.size() - offset });
+			std::memcpy(data, source.data() + offset, count);
+			offset += count;
+			return count;
+		};
+	};
+	auto elapsedNs = [](std::chrono::steady_clock::time_point start)
+	{
+		return (double)std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+	};
+
+	std::vector<uint8_t> output(audio.size() + readSize);
+	size_t titles = 0;
+	size_t streamOffset = 0;
+	IcyStreamReader reader(metadataInterval, connection(stream, streamOffset), [&](const IcyInfo&)
+		{ titles++; });
+	auto start = std::chrono::steady_clock::now();
+	size_t read = 0;
+	while (auto length = reader.read(output.data() + read, readSize))
+	{
+		read += length;
+	}
+	auto readerNs = elapsedNs(start);
+	size_t mismatches = read == audio.size() ? 0 : std::max(read, audio.size()) - std::min(read, audio.size());
+	for (size_t i = 0; i < std::min(read, audio.size()); i++)
+	{
+		mismatches += output[i] != audio[i];
+	}
+
+	size_t audioOffset = 0;
+	auto copy = connection(audio, audioOffset);
+	start = std::chrono::steady_clock::now();
+	read = 0;
+	while (auto length = copy(output.data() + read, readSize))
+	{
+		read += length;
+	}
+	auto copyNs = elapsedNs(start);
+
+	IcyParser parser(metadataInterval);
+	std::vector<uint8_t> chunk(chunkSize);
+	start = std::chrono::steady_clock::now();
+	for (size_t offset = 0; offset < stream.size(); offset += chunkSize)
+	{
+		auto length = std::min(chunkSize, stream.size() - offset);
+		std::memcpy(chunk.data(), stream.data() + offset, length);
+		parser.strip(chunk.data(), length);
+	}
+	auto stripNs = elapsedNs(start);
+
+	auto audioMegabytes = (double)audio.size() / (1024 * 1024);
+	return IcyMetadataBenchmarkResult{ audioMegabytes, titles,
+		readerNs / audioMegabytes, stripNs / audioMegabytes, copyNs / audioMegabytes,
+		(readerNs - copyNs) / audioMegabytes, mismatches };
+}
@@ -0,0 +1,66 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <thread>
+#include <vector>
+
+#include "loudness_analyzer.hpp"
+
+struct LoudnessBenchmarkResult
+{
+	unsigned threads;
+	// Seconds of audio one thread measures per second.
+	double realtimeFactor;
+	// Seconds of audio all the threads measure per second.
+	double poolRealtimeFactor;
+};
+
+/// Measures |seconds| of noise on one thread, then on |threads| threads at
+/// once, or one per core if zero.
+inline LoudnessBenchmarkResult benchmarkLoudness(double seconds, unsigned threads = 0, AudioFormat format = AudioFormat{ 48000, 2 })
+{
+	if (threads == 0)
+	{
+		threads = std::max(1u, std::thread::hardware_concurrency());
+	}
+	size_t blockFrames = 4096;
+	std::vector<float> noise(blockFrames * format.channels);
+	uint32_t seed = 1;
+	for (auto& sample : noise)
+	{
+		seed = seed * 1664525u + 1013904223u;
+		sample = ((float)(seed >> 8) / (float)(1 << 24) - 0.5f) * 0.5f;
+	}
+	auto blocks = std::max<size_t>(1, (size_t)(seconds * format.sampleRate / blockFrames));
+	auto audioSeconds = (double)blocks * blockFrames / format.sampleRate;
+	auto measure = [&]()
+	{
+		LoudnessMeter meter(format);
+		for (size_t b = 0; b < blocks; b++)
+		{
+			meter.process(noise.data(), blockFrames);
+		}
+		return meter.getIntegratedLufs();
+	};
+
+	auto start = std::chrono::steady_clock::now();
+	measure();
+	auto elapsedUs = (double)std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+
+	start = std::chrono::steady_clock::now();
+	std::vector<std::thread> workers{};
+	for (unsigned i = 0; i < threads; i++)
+	{
+		workers.emplace_back(measure);
+	}
+	for (auto& worker : workers)
+	{
+		worker.join();
+	}
+	auto poolElapsedUs = (double)std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+
+	return LoudnessBenchmarkResult{ threads,
+		elapsedUs > 0 ? audioSeconds * 1000000 / elapsedUs : 0.0,
+		poolElapsedUs > 0 ? audioSeconds * threads * 1000000 / poolElapsedUs : 0.0 };
+}
@@ -0,0 +1,151 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <memory>
+#include <vector>
+
+#include "mixer.hpp"
+
+struct MixerBenchmarkResult
+{
+	size_t voices;
+	// Microseconds of CPU time spent per second of audio, per voice.
+	double cpuUsPerVoiceSecond;
+	// Seconds of audio mixed per second of CPU time.
+	double realtimeFactor;
+};
+
+/**
+ * Measures the cost of mixing |voices| voices for |seconds| of audio, with no
+ * device and inputs that only copy a prepared tone. Every other voice is
+ * panned, so that both mixing paths are taken.
+ */
+inline MixerBenchmarkResult benchmarkMixer(size_t voices, double seconds, AudioFormat format = AudioFormat{ 48000, 2 })
+{
+	// Repeats one block of a tone, so that inputs cost as little as possible.
+	class ToneInput : public MixerInput
+	{
+	public:
+		explicit ToneInput(const std::vector<float>& tone) : tone(tone) {}
+
+		size_t render(float* output, size_t frames) override
+		{
+			auto count = std::min(frames * 2, tone.size());
+			std::copy(tone.begin(), tone.begin() + count, output);
+			return count / 2;
+		}
+
+	private:
+		const std::vector<float>& tone;
+	};
+
+	auto blockFrames = Mixer::kDefaultBlockFrames;
+	Mixer mixer(format, nullptr, std::max<size_t>(voices, 1), blockFrames);
+	std::vector<float> tone(blockFrames * format.channels);
+	for (size_t i = 0; i < tone.size(); i++)
+	{
+		tone[i] = 0.1f * std::sin((float)(i / format.channels) * 0.05f);
+	}
+	std::vector<std::unique_ptr<ToneInput>> inputs{};
+	for (size_t i = 0; i < voices; i++)
+	{
+		inputs.push_back(std::make_unique<ToneInput>(tone));
+		VoiceSettings settings{};
+		settings.gain = 0.5f;
+		settings.pan = i % 2 ? 0.5f : 0.0f;
+		mixer.addVoice(inputs.back().get(), settings);
+	}
+
+	std::vector<float> output(blockFrames * format.channels);
+	auto blocks = std::max<size_t>(1, (size_t)(seconds * format.sampleRate / blockFrames));
+	auto start = std::chrono::steady_clock::now();
+	for (size_t i = 0; i < blocks; i++)
+	{
+		mixer.mix(output.data(), blockFrames);
+	}
+	auto elapsedUs = (double)std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+	auto audioSeconds = (double)blocks * blockFrames / format.sampleRate;
+
+	return MixerBenchmarkResult{ voices,
+		voices > 0 ? elapsedUs / audioSeconds / voices : 0.0,
+		elapsedUs > 0 ? audioSeconds * 1000000 / elapsedUs : 0.0 };
+}
+
+struct GainRampBenchmarkResult
+{
+	// The largest change from one sample to the next while ramping a
+	// full-scale constant from silence, which is what would click.
+	double maxStep;
+	// The largest step of an exact ramp of the same length and curve.
+	double expectedMaxStep;
+	// Nanoseconds spent mixing each ramped frame.
+	double nsPerFrame;
+};
+
+/**
+ * Ramps a constant input up from silence over |durationUs| and measures the
+ * largest step between samples, then times ramps back and forth for a second
+ * of audio.
+ */
+inline GainRampBenchmarkResult benchmarkGainRamp(int64_t durationUs, VolumeRamp::Curve curve, AudioFormat format = AudioFormat{ 48000, 2 })
+{
+	class ConstantInput : public MixerInput
+	{
+	public:
+		explicit ConstantInput(uint32_t channels) : channels(channels) {}
+
+		size_t render(float* output, size_t frames) override
+		{
+			std::fill(output, output + frames * channels, 1.0f);
+			return frames;
+		}
+
+	private:
+		uint32_t channels;
+	};
+
+	auto blockFrames = Mixer::kDefaultBlockFrames;
+	ConstantInput input(format.channels);
+	Mixer mixer(format, nullptr, 1, blockFrames);
+	VoiceSettings settings{};
+	settings.gain = 0.0f;
+	auto voice = mixer.addVoice(&input, settings);
+	VolumeRamp ramp{ durationUs, curve };
+	settings.gain = 1.0f;
+	mixer.setVoiceSettings(voice, settings, ramp);
+
+	auto rampFrames = (size_t)std::max<int64_t>(1, durationUs * format.sampleRate / 1000000);
+	std::vector<float> output(blockFrames * format.channels);
+	double maxStep = 0;
+	float previous = 0;
+	for (size_t mixed = 0; mixed < rampFrames + blockFrames; mixed += blockFrames)
+	{
+		mixer.mix(output.data(), blockFrames);
+		for (size_t i = 0; i < blockFrames; i++)
+		{
+			auto sample = output[i * format.channels];
+			maxStep = std::max(maxStep, (double)std::abs(sample - previous));
+			previous = sample;
+		}
+	}
+	auto expectedMaxStep = curve == VolumeRamp::Curve::exponential ? 1.0 - std::pow((double)Mixer::kRampFloor, 1.0 / rampFrames) : 1.0 / rampFrames;
+
+	auto blocks = std::max<size_t>(1, format.sampleRate / blockFrames);
+	size_t ramps = 0;
+	auto start = std::chrono::steady_clock::now();
+	for (size_t i = 0; i < blocks; i++)
+	{
+		if (i * blockFrames >= ramps * rampFrames)
+		{
+			settings.gain = ramps % 2 ? 1.0f : 0.25f;
+			mixer.setVoiceSettings(voice, settings, ramp);
+			ramps++;
+		}
+		mixer.mix(output.data(), blockFrames);
+	}
+	auto elapsedNs = (double)std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+
+	return GainRampBenchmarkResult{ maxStep, expectedMaxStep, elapsedNs / (blocks * blockFrames) };
+}
@@ -0,0 +1,204 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "mp3_seek_index.hpp"
+
+struct Mp3SeekIndexBenchmarkResult
+{
+	double seconds;
+	uint64_t fileBytes;
+	uint64_t frames;
+	// The index on disk.
+	uint64_t indexBytes;
+	// Building the index from the file in the page cache, how many times
+	// faster than real time, and reading it back from the cache.
+	int64_t buildUs;
+	double realtimeFactor;
+	double megabytesPerSecond;
+	int64_t loadUs;
+	// Seeks to random times through the index, and those that did not land
+	// on the right frame, which should be 0.
+	uint64_t seeks;
+	double meanSeekUs;
+	double maxSeekUs;
+	uint64_t mismatches;
+	// Seeking by walking every frame header from the start instead.
+	double meanScanSeekUs;
+	// How far from the time sought estimating from the average bitrate lands.
+	double meanEstimateErrorUs;
+	double maxEstimateErrorUs;
+};
+
+/**
+ * Writes |seconds| of variable bitrate MP3 frames without a table of
+ * contents to a temporary file, indexes it and seeks in it to |seeks| random
+ * times, checking each against where the frames were written. The frames
+ * are silent, with a bitrate that drifts as it does over music, and with bit
+ * reservoirs reaching back up to 300 bytes.
+ */
+inline Mp3SeekIndexBenchmarkResult benchmarkMp3SeekIndex(double seconds = 3 * 3600, size_t seeks = 1000)
+{
+	const uint32_t sampleRate = 44100;
+	const uint32_t samplesPerFrame = 1152;
+	static const uint32_t kBitrates[15] = { 0, 32, 40, 48, 56, 64, 80, 96, 112, 128, 160, 192, 224, 256, 320 };
+	auto frameCount = (uint64_t)(seconds * sampleRate / samplesPerFrame);
+
+	auto directory = std::filesystem::temp_directory_path() /
+		("just_audio_seek_benchmark_" + std::to_string(std::hash<std::thread::id>()(std::this_thread::get_id())));
+	std::error_code error{};
+	std::filesystem::create_directories(directory, error);
+	auto path = (directory / "long.mp3").u8string();
+
+	Mp3SeekIndexBenchmarkResult result{};
+	result.seconds = (double)frameCount * samplesPerFrame / sampleRate;
+	result.frames = frameCount;
+	std::vector<uint64_t> offsets{};
+	std::vector<uint16_t> reservoirs{};
+	std::vector<uint32_t> payloads{};
+	offsets.reserve((size_t)frameCount);
+	reservoirs.reserve((size_t)frameCount);
+	payloads.reserve((size_t)frameCount);
+	{
+		std::ofstream file(path, std::ios::binary | std::ios::trunc);
+		// An empty ID3v2 tag with padding, as taggers leave.
+		std::vector<uint8_t> tag(1024 + 10, 0);
+		std::memcpy(tag.data(), "ID3\x04\x00\x00", 6);
+		tag[8] = 1024 >> 7;
+		tag[9] = 1024 & 0x7F;
+		file.write((const char*)tag.data(), (std::streamsize)tag.size());
+
+		std::mt19937 random(49);
+		int bitrateIndex = 9;
+		uint64_t offset = tag.size();
+		uint32_t available = 0;
+		std::vector<uint8_t> frame(1441, 0);
+		std::vector<uint8_t> chunk{};
+		chunk.reserve(1 << 20);
+		for (uint64_t i = 0; i < frameCount; i++)
+		{
+			if (i % 200 == 0)
+			{
+				bitrateIndex = std::clamp(bitrateIndex + (int)(random() % 5) - 2, 5, 14);
+			}
+			auto padding = (uint32_t)(random() % 2);
+			auto length = 144 * kBitrates[bitrateIndex] * 1000 / sampleRate + padding;
+			std::fill(frame.begin(), frame.begin() + length, 0);
+			// MPEG-1 Layer III without CRC, 44100 Hz, joint stereo.
+			frame[0] = 0xFF;
+			frame[1] = 0xFB;
+			frame[2] = (uint8_t)(bitrateIndex << 4 | padding << 1);
+			frame[3] = 0x64;
+			auto reservoir = (uint16_t)std::min<uint32_t>(available, random() % 301);
+			frame[4] = (uint8_t)(reservoir >> 1);
+			frame[5] = (uint8_t)((reservoir & 1) << 7);
+			offsets.push_back(offset);
+			reservoirs.push_back(reservoir);
+			payloads.push_back(length - 4 - 32);
+			available = std::min<uint32_t>(511, length - 4 - 32);
+			chunk.insert(chunk.end(), frame.begin(), frame.begin() + length);
+			offset += length;
+			if (chunk.size() >= (1 << 20) - 1441)
+			{
+				file.write((const char*)chunk.data(), (std::streamsize)chunk.size());
+				chunk.clear();
+			}
+		}
+		file.write((const char*)chunk.data(), (std::streamsize)chunk.size());
+		result.fileBytes = offset;
+	}
+
+	auto elapsedUs = [](std::chrono::steady_clock::time_point start)
+	{
+		return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+	};
+	{
+		MappedFile file(path);
+		auto start = std::chrono::steady_clock::now();
+		auto built = Mp3SeekIndex::build(file.data(), file.size());
+		result.buildUs = elapsedUs(start);
+		result.realtimeFactor = result.buildUs > 0 ? result.seconds * 1000000 / result.buildUs : 0;
+		result.megabytesPerSecond = result.buildUs > 0 ? (double)result.fileBytes / result.buildUs : 0;
+
+		Mp3SeekIndexCache cache(directory / "index");
+		if (built && built->getFrameCount() == frameCount)
+		{
+			cache.save(path, *file.getStamp(), *built);
+			result.indexBytes = cache.sizeOf(path);
+			start = std::chrono::steady_clock::now();
+			auto loaded = cache.load(path, *file.getStamp());
+			result.loadUs = elapsedUs(start);
+
+			auto& index = loaded ? *loaded : *built;
+			std::mt19937 random(7);
+			double totalSeekUs = 0;
+			double totalErrorUs = 0;
+			auto audioStart = offsets.front();
+			auto audioBytes = (double)(result.fileBytes - audioStart);
+			for (size_t i = 0; i < seeks; i++)
+			{
+				auto timeUs = (int64_t)(random() % (uint64_t)(result.seconds * 1000000));
+				start = std::chrono::steady_clock::now();
+				auto point = index.locate(file.data(), file.size(), timeUs);
+				auto seekUs = (double)std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count() / 1000;
+				totalSeekUs += seekUs;
+				result.maxSeekUs = std::max(result.maxSeekUs, seekUs);
+				result.seeks++;
+
+				// The frame holding the time, and the latest one its reservoir
+				// is found from.
+				auto frame = (uint64_t)timeUs * sampleRate / 1000000 / samplesPerFrame;
+				auto startFrame = frame;
+				uint32_t reached = 0;
+				while (reached < reservoirs[frame] && startFrame > 0)
+				{
+					reached += payloads[--startFrame];
+				}
+				if (!point || point->frame != frame || point->startFrame != startFrame || point->offset != offsets[startFrame])
+				{
+					result.mismatches++;
+				}
+
+				auto estimate = (uint64_t)(audioStart + audioBytes * timeUs / (result.seconds * 1000000));
+				auto landed = (uint64_t)(std::upper_bound(offsets.begin(), offsets.end(), estimate) - offsets.begin()) - 1;
+				auto errorUs = std::abs((double)index.frameTimeUs(landed) - (double)timeUs);
+				totalErrorUs += errorUs;
+				result.maxEstimateErrorUs = std::max(result.maxEstimateErrorUs, errorUs);
+			}
+			result.meanSeekUs = result.seeks > 0 ? totalSeekUs / result.seeks : 0;
+			result.meanEstimateErrorUs = result.seeks > 0 ? totalErrorUs / result.seeks : 0;
+
+			// A few seeks by scanning, which take long.
+			const size_t scans = 10;
+			start = std::chrono::steady_clock::now();
+			uint64_t found = 0;
+			for (size_t i = 0; i < scans; i++)
+			{
+				auto target = random() % frameCount;
+				size_t position = (size_t)audioStart;
+				for (uint64_t frame = 0; frame < target; frame++)
+				{
+					position += MetadataProbe::MpegFrame::parse(file.data() + position)->length;
+				}
+				found += position == offsets[target] ? 1 : 0;
+			}
+			result.meanScanSeekUs = (double)elapsedUs(start) / scans;
+			result.mismatches += scans - found;
+		}
+		else
+		{
+			result.mismatches = seeks;
+		}
+	}
+	std::filesystem::remove_all(directory, error);
+	return result;
+}
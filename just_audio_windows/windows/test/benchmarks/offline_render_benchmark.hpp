@@ -0,0 +1,80 @@
+#pragma once
+
+#include <cmath>
+#include <memory>
+#include <string>
+
+#include "generated_decoder.hpp"
+#include "offline_renderer.hpp"
+
+struct OfflineRenderBenchmarkResult
+{
+	unsigned threads;
+	double seconds;
+	// Seconds of output rendered per second, on one thread and on all.
+	double realtimeFactor;
+	double poolRealtimeFactor;
+};
+
+/**
+ * Renders a playlist of |seconds| of tone at another rate, clipped and
+ * looped, with every effect on, on one thread, then on |threads| threads,
+ * or one per core if zero. The output is discarded.
+ */
+inline OfflineRenderBenchmarkResult benchmarkOfflineRender(double seconds = 600, unsigned threads = 0, AudioFormat format = AudioFormat{ 48000, 2 })
+{
+	const size_t itemCount = 16;
+	auto itemFrames = (int64_t)(seconds * 44100 / itemCount);
+	auto decoders = std::make_shared<DecoderRegistry>();
+	decoders->add([=](const AudioSourceSpec& source) -> std::unique_ptr<AudioDecoder>
+		{
+			if (source.uri.rfind("tone:", 0) != 0)
+			{
+				return nullptr;
+			}
+			// Every fifth second is silent, for the silence skipper to find.
+			return std::make_unique<GeneratedDecoder>(AudioFormat{ 44100, format.channels }, itemFrames, [](int64_t frame)
+				{ return frame / 44100 % 5 == 4 ? 0.0f : 0.3f * (float)std::sin(2 * 3.14159265358979 * 440 * frame / 44100); }); });
+
+	// Half of the items are looped twice, clipped to half their length.
+	AudioSourceSpec playlist{};
+	playlist.type = AudioSourceSpec::Type::concatenating;
+	for (size_t i = 0; i < itemCount; i++)
+	{
+		AudioSourceSpec item{};
+		item.uri = "tone:" + std::to_string(i);
+		if (i % 2 == 0)
+		{
+			playlist.children.push_back(item);
+			continue;
+		}
+		AudioSourceSpec clipping{};
+		clipping.type = AudioSourceSpec::Type::clipping;
+		clipping.endUs = itemFrames * 1000000 / 44100 / 2;
+		clipping.children.push_back(item);
+		AudioSourceSpec looping{};
+		looping.type = AudioSourceSpec::Type::looping;
+		looping.count = 2;
+		looping.children.push_back(clipping);
+		playlist.children.push_back(looping);
+	}
+
+	OfflineRenderOptions options{};
+	options.decoders = decoders;
+	options.volume = 0.8;
+	options.speed = 1.25;
+	options.skipSilence = SkipSilenceOptions{};
+	options.crossfadeUs = 500000;
+	options.equalizerGainsDb = { 0, 6, 0, -4, 0 };
+	options.loudnessEnhancerGainDb = 6;
+	auto render = [&](unsigned threadCount)
+	{
+		options.threads = threadCount;
+		NullSink output(format);
+		return OfflineRenderer(options).render(playlist, output);
+	};
+
+	auto single = render(1);
+	auto pool = render(threads);
+	return OfflineRenderBenchmarkResult{ pool.threads, (double)pool.durationUs / 1000000, single.realtimeFactor, pool.realtimeFactor };
+}
@@ -0,0 +1,108 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <vector>
+
+#include "resampler.hpp"
+
+struct ResamplerBenchmarkResult
+{
+	double nsPerFrame;
+	double realtimeFactor;
+	// Total harmonic distortion and noise of a sine, relative to the sine.
+	double thdNDb;
+};
+
+/**
+ * Converts a stereo sine at |frequency| from |fromRate| to |toRate| at
+ * |quality| for |seconds| of output, timing it and measuring its THD+N: what
+ * is left once the best fitting sine at that frequency is taken out.
+ */
+inline ResamplerBenchmarkResult benchmarkResampler(Resampler::Quality quality, uint32_t fromRate, uint32_t toRate,
+	double frequency = 1000, double seconds = 2)
+{
+	const double pi = 3.14159265358979323846;
+	const uint32_t channels = 2;
+	Resampler resampler(channels, quality);
+	auto step = (double)fromRate / toRate;
+	resampler.setStep(step);
+
+	auto outputFrames = std::max<size_t>(1, (size_t)(seconds * toRate));
+	auto before = resampler.getFramesBefore();
+	auto after = resampler.getFramesAfter();
+	auto sourceFrames = (size_t)(outputFrames * step) + before + after + 2;
+	std::vector<float> source(sourceFrames * channels);
+	for (size_t f = 0; f < sourceFrames; f++)
+	{
+		auto value = (float)(0.5 * std::sin(2 * pi * frequency * ((double)f - (double)before) / fromRate));
+		source[f * channels] = value;
+		source[f * channels + 1] = value;
+	}
+
+	std::vector<float> output(outputFrames * channels);
+	auto start = std::chrono::steady_clock::now();
+	double cursor = 0;
+	for (size_t f = 0; f < outputFrames; f++)
+	{
+		auto index = (size_t)cursor;
+		resampler.interpolate(source.data() + (index + before) * channels, cursor - (double)index, output.data() + f * channels);
+		cursor += step;
+	}
+	auto elapsedNs = (double)std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+
+	// A least squares fit of the sine, its quadrature and an offset.
+	double sums[3][3] = {};
+	double targets[3] = {};
+	for (size_t f = 0; f < outputFrames; f++)
+	{
+		auto angle = 2 * pi * frequency * (double)f / toRate;
+		double basis[3] = { std::sin(angle), std::cos(angle), 1.0 };
+		for (int i = 0; i < 3; i++)
+		{
+			for (int j = 0; j < 3; j++)
+			{
+				sums[i][j] += basis[i] * basis[j];
+			}
+			targets[i] += basis[i] * output[f * channels];
+		}
+	}
+	// Gaussian elimination of the 3x3 normal equations.
+	for (int i = 0; i < 3; i++)
+	{
+		for (int j = i + 1; j < 3; j++)
+		{
+			auto factor = sums[j][i] / sums[i][i];
+			for (int k = i; k < 3; k++)
+			{
+				sums[j][k] -= factor * sums[i][k];
+			}
+			targets[j] -= factor * targets[i];
+		}
+	}
+	double fit[3];
+	for (int i = 2; i >= 0; i--)
+	{
+		fit[i] = targets[i];
+		for (int k = i + 1; k < 3; k++)
+		{
+			fit[i] -= sums[i][k] * fit[k];
+		}
+		fit[i] /= sums[i][i];
+	}
+	double signal = 0;
+	double residual = 0;
+	for (size_t f = 0; f < outputFrames; f++)
+	{
+		auto angle = 2 * pi * frequency * (double)f / toRate;
+		auto fitted = fit[0] * std::sin(angle) + fit[1] * std::cos(angle) + fit[2];
+		signal += fitted * fitted;
+		auto error = output[f * channels] - fitted;
+		residual += error * error;
+	}
+
+	return ResamplerBenchmarkResult{ elapsedNs / outputFrames,
+		elapsedNs > 0 ? seconds * 1e9 / elapsedNs : 0.0,
+		10 * std::log10(std::max(residual, 1e-30) / std::max(signal, 1e-30)) };
+}
@@ -0,0 +1,48 @@
+#pragma once
+
+#include <chrono>
+#include <memory>
+#include <optional>
+#include <thread>
+
+#include "sample_backend.hpp"
+
+struct SampleBenchmarkResult
+{
+	uint64_t triggers;
+	double meanLatencyUs;
+	double maxLatencyUs;
+	// Memory held by the pool per second of decoded audio.
+	double bytesPerSecond;
+};
+
+/**
+ * Triggers a one-second clip |triggers| times, 7ms apart, on a mixer paced
+ * like a device with blocks of |blockFrames| frames, and measures how long
+ * each trigger waited to be heard.
+ */
+inline SampleBenchmarkResult benchmarkSampleTriggers(size_t triggers, size_t blockFrames, AudioFormat format = AudioFormat{ 48000, 2 })
+{
+	auto mixer = std::make_shared<Mixer>(format, std::make_shared<NullSink>(format, true), Mixer::kDefaultMaxVoices, blockFrames);
+	auto pool = std::make_shared<SamplePool>();
+	SampleBackend backend(mixer, pool);
+
+	AudioSourceSpec source{};
+	source.type = AudioSourceSpec::Type::silence;
+	source.durationUs = 1000000;
+	backend.load(source, std::nullopt, 0);
+	backend.play();
+	for (size_t i = 1; i < triggers; i++)
+	{
+		std::this_thread::sleep_for(std::chrono::milliseconds(7));
+		backend.seek(std::nullopt, 0);
+	}
+	std::this_thread::sleep_for(std::chrono::milliseconds(20));
+
+	auto latency = backend.getTriggerLatency();
+	auto resident = pool->getResidentSize();
+	backend.dispose();
+	mixer->close();
+	return SampleBenchmarkResult{ latency.count, latency.meanUs, latency.maxUs,
+		resident.second > 0 ? (double)resident.first / resident.second : 0.0 };
+}
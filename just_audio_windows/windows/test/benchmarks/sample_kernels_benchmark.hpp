@@ -0,0 +1,198 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <vector>
+
+#include "sample_kernels.hpp"
+
+struct SampleKernelBenchmarkResult
+{
+	SimdLevel level;
+	bool supported;
+	// Outputs that differ from the scalar kernels: any for the integer
+	// conversions, by more than a rounding error for the rest.
+	uint64_t mismatches;
+	// Millions of samples written per second by each kernel.
+	double int16ToFloat;
+	double int24ToFloat;
+	double int32ToFloat;
+	double interleave;
+	double deinterleave;
+	double monoToStereo;
+	double stereoToMono;
+	double downmix51;
+	double accumulate;
+	double firInterpolate;
+};
+
+/**
+ * Checks the kernels for |level| against the scalar ones, over every 16-bit
+ * and 24-bit sample, a spread of 32-bit ones and every length up to 64 for
+ * each, then times each kernel over blocks of |blockFrames| stereo frames
+ * for about |seconds| in all.
+ */
+inline SampleKernelBenchmarkResult benchmarkSampleKernels(SimdLevel level, double seconds = 1, size_t blockFrames = 4096)
+{
+	SampleKernelBenchmarkResult result{};
+	result.level = level;
+	result.supported = SampleKernels::isSupported(level);
+	if (!result.supported)
+	{
+		return result;
+	}
+	auto& kernels = SampleKernels::forLevel(level);
+	auto& reference = SampleKernels::forLevel(SimdLevel::scalar);
+
+	auto compare = [&](const std::vector<float>& actual, const std::vector<float>& expected, bool exact)
+	{
+		for (size_t i = 0; i < expected.size(); i++)
+		{
+			auto tolerance = exact ? 0.0f : 1e-6f;
+			if (!(std::abs(actual[i] - expected[i]) <= tolerance))
+			{
+				result.mismatches++;
+			}
+		}
+	};
+	using Conversion = void (*)(const uint8_t*, float*, size_t);
+	auto checkConversion = [&](Conversion kernel, Conversion expectedKernel, const std::vector<uint8_t>& bytes, size_t width)
+	{
+		auto count = bytes.size() / width;
+		std::vector<float> actual(count);
+		std::vector<float> expected(count);
+		kernel(bytes.data(), actual.data(), count);
+		expectedKernel(bytes.data(), expected.data(), count);
+		compare(actual, expected, true);
+		// Every remainder, at every offset into a vector.
+		for (size_t length = 0; length <= 64 && length <= count; length++)
+		{
+			std::fill(actual.begin(), actual.begin() + length, 2.0f);
+			kernel(bytes.data() + width * 3, actual.data(), std::min(length, count - 3));
+			expectedKernel(bytes.data() + width * 3, expected.data(), std::min(length, count - 3));
+			for (size_t i = 0; i < std::min(length, count - 3); i++)
+			{
+				result.mismatches += actual[i] != expected[i];
+			}
+		}
+	};
+
+	std::vector<uint8_t> bytes(65536 * 2);
+	for (uint32_t value = 0; value < 65536; value++)
+	{
+		bytes[value * 2] = (uint8_t)value;
+		bytes[value * 2 + 1] = (uint8_t)(value >> 8);
+	}
+	checkConversion(kernels.int16ToFloat, reference.int16ToFloat, bytes, 2);
+	bytes.resize((size_t)(1 << 24) * 3);
+	for (uint32_t value = 0; value < (1u << 24); value++)
+	{
+		bytes[value * 3] = (uint8_t)value;
+		bytes[value * 3 + 1] = (uint8_t)(value >> 8);
+		bytes[value * 3 + 2] = (uint8_t)(value >> 16);
+	}
+	checkConversion(kernels.int24ToFloat, reference.int24ToFloat, bytes, 3);
+	// 16M 32-bit values spread over the whole range.
+	bytes.resize((size_t)(1 << 24) * 4);
+	for (uint32_t i = 0; i < (1u << 24); i++)
+	{
+		auto value = i * 251u + (i >> 8);
+		std::memcpy(bytes.data() + i * 4, &value, 4);
+	}
+	checkConversion(kernels.int32ToFloat, reference.int32ToFloat, bytes, 4);
+
+	std::vector<float> source(blockFrames * 6);
+	uint32_t seed = 1;
+	for (auto& sample : source)
+	{
+		seed = seed * 1664525 + 1013904223;
+		sample = (float)(int32_t)seed / 2147483648.0f;
+	}
+	for (size_t frames = 0; frames <= 67; frames += frames < 20 ? 1 : 47)
+	{
+		std::vector<float> actual(frames * 2 + 1);
+		std::vector<float> expected(frames * 2 + 1);
+		std::vector<float> left(frames);
+		std::vector<float> right(frames);
+		std::vector<float> expectedLeft(frames);
+		std::vector<float> expectedRight(frames);
+		float* planes[2] = { left.data(), right.data() };
+		float* expectedPlanes[2] = { expectedLeft.data(), expectedRight.data() };
+		const float* inputPlanes[2] = { source.data(), source.data() + blockFrames };
+
+		kernels.interleave(inputPlanes, 2, frames, actual.data());
+		reference.interleave(inputPlanes, 2, frames, expected.data());
+		compare(actual, expected, true);
+		kernels.deinterleave(source.data(), 2, frames, planes);
+		reference.deinterleave(source.data(), 2, frames, expectedPlanes);
+		compare(left, expectedLeft, true);
+		compare(right, expectedRight, true);
+		kernels.monoToStereo(source.data(), actual.data(), frames);
+		reference.monoToStereo(source.data(), expected.data(), frames);
+		compare(actual, expected, true);
+		kernels.stereoToMono(source.data(), actual.data(), frames);
+		reference.stereoToMono(source.data(), expected.data(), frames);
+		compare(actual, expected, false);
+		kernels.downmix51(source.data(), actual.data(), frames);
+		reference.downmix51(source.data(), expected.data(), frames);
+		compare(actual, expected, false);
+		std::fill(actual.begin(), actual.end(), 0.25f);
+		std::fill(expected.begin(), expected.end(), 0.25f);
+		kernels.accumulate(actual.data(), source.data(), frames * 2, 0.7f);
+		reference.accumulate(expected.data(), source.data(), frames * 2, 0.7f);
+		compare(actual, expected, false);
+		// Sums of that many products round differently in another order.
+		for (uint32_t channels : { 1u, 2u, 3u, 6u, 8u })
+		{
+			auto count = frames / channels * channels;
+			std::vector<float> sums(channels);
+			std::vector<float> expectedSums(channels);
+			kernels.firInterpolate(source.data(), source.data() + blockFrames, source.data() + blockFrames * 2, count, channels, 0.3f, sums.data());
+			reference.firInterpolate(source.data(), source.data() + blockFrames, source.data() + blockFrames * 2, count, channels, 0.3f, expectedSums.data());
+			for (uint32_t c = 0; c < channels; c++)
+			{
+				if (!(std::abs(sums[c] - expectedSums[c]) <= 1e-5f))
+				{
+					result.mismatches++;
+				}
+			}
+		}
+	}
+
+	// Each kernel gets an equal share of the time.
+	std::vector<float> output(blockFrames * 6);
+	std::vector<float> left(blockFrames);
+	std::vector<float> right(blockFrames);
+	float* planes[2] = { left.data(), right.data() };
+	const float* inputPlanes[2] = { left.data(), right.data() };
+	auto time = [&](auto&& run, size_t samplesPerRun)
+	{
+		auto budget = std::chrono::duration<double>(seconds / 10);
+		auto start = std::chrono::steady_clock::now();
+		size_t runs = 0;
+		do
+		{
+			for (int i = 0; i < 16; i++)
+			{
+				run();
+			}
+			runs += 16;
+		} while (std::chrono::steady_clock::now() - start < budget);
+		auto elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+		return (double)runs * samplesPerRun / elapsed / 1e6;
+	};
+	auto samples = blockFrames * 2;
+	result.int16ToFloat = time([&]() { kernels.int16ToFloat(bytes.data(), output.data(), samples); }, samples);
+	result.int24ToFloat = time([&]() { kernels.int24ToFloat(bytes.data(), output.data(), samples); }, samples);
+	result.int32ToFloat = time([&]() { kernels.int32ToFloat(bytes.data(), output.data(), samples); }, samples);
+	result.interleave = time([&]() { kernels.interleave(inputPlanes, 2, blockFrames, output.data()); }, samples);
+	result.deinterleave = time([&]() { kernels.deinterleave(source.data(), 2, blockFrames, planes); }, samples);
+	result.monoToStereo = time([&]() { kernels.monoToStereo(source.data(), output.data(), blockFrames); }, samples);
+	result.stereoToMono = time([&]() { kernels.stereoToMono(source.data(), output.data(), blockFrames); }, blockFrames);
+	result.downmix51 = time([&]() { kernels.downmix51(source.data(), output.data(), blockFrames); }, samples);
+	result.accumulate = time([&]() { kernels.accumulate(output.data(), source.data(), samples, 0.5f); }, samples);
+	result.firInterpolate = time([&]() { kernels.firInterpolate(source.data(), source.data() + samples, source.data() + samples * 2, samples, 2, 0.3f, output.data()); }, samples);
+	return result;
+}
@@ -0,0 +1,652 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "generated_decoder.hpp"
+#include "software_backend.hpp"
+
+struct TransitionBenchmarkResult
+{
+	// Frames between the two items quieter than either.
+	int64_t gapFrames;
+	// Frames by which the joined output is shorter than the two items.
+	int64_t overlapFrames;
+	// The lowest and highest level across the join, relative to the items'.
+	double minLevel;
+	double maxLevel;
+	uint64_t underruns;
+};
+
+/**
+ * Plays two constant items of |itemFrames| frames each into a CaptureSink,
+ * joined by a crossfade of |crossfadeUs|, and measures the join. A gapless
+ * join has no gap, no overlap and a level of 1 throughout.
+ */
+inline TransitionBenchmarkResult benchmarkTransition(int64_t crossfadeUs, size_t itemFrames = 14407, AudioFormat format = AudioFormat{ 48000, 2 })
+{
+	const float level = 0.5f;
+	// Plays "tone:" URIs as a constant, so that no file is needed.
+	class ConstantDecoder : public AudioDecoder
+	{
+	public:
+		ConstantDecoder(AudioFormat format, int64_t length, float level)
+			: format(format), length(length), level(level)
+		{
+		}
+
+		AudioFormat getFormat() const override
+		{
+			return format;
+		}
+
+		std::optional<int64_t> getLength() const override
+		{
+			return length;
+		}
+
+		size_t read(float* output, size_t frames) override
+		{
+			auto count = (size_t)std::min<int64_t>((int64_t)frames, length - position);
+			std::fill(output, output + count * format.channels, level);
+			position += (int64_t)count;
+			return count;
+		}
+
+		bool seek(int64_t frame) override
+		{
+			position = std::clamp<int64_t>(frame, 0, length);
+			return true;
+		}
+
+	private:
+		AudioFormat format;
+		int64_t length;
+		float level;
+		int64_t position = 0;
+	};
+
+	auto decoders = std::make_shared<DecoderRegistry>();
+	decoders->add([=](const AudioSourceSpec& source) -> std::unique_ptr<AudioDecoder>
+		{
+			if (source.uri.rfind("tone:", 0) != 0)
+			{
+				return nullptr;
+			}
+			return std::make_unique<ConstantDecoder>(format, (int64_t)itemFrames, level); });
+
+	auto totalFrames = itemFrames * 2 + format.sampleRate;
+	auto sink = std::make_shared<CaptureSink>(format, totalFrames);
+	TransitionBenchmarkResult result{};
+	{
+		SoftwareBackend backend(sink, decoders);
+		backend.setCrossfade(crossfadeUs);
+		AudioSourceSpec playlist{};
+		playlist.type = AudioSourceSpec::Type::concatenating;
+		for (auto uri : { "tone:a", "tone:b" })
+		{
+			AudioSourceSpec item{};
+			item.uri = uri;
+			playlist.children.push_back(item);
+		}
+		backend.load(playlist, std::nullopt, 0);
+		backend.play();
+		auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(10);
+		while (backend.getState().processingState != ProcessingState::completed && std::chrono::steady_clock::now() < deadline)
+		{
+			std::this_thread::sleep_for(std::chrono::milliseconds(1));
+		}
+		result.underruns = backend.getState().underrunCount;
+	}
+
+	std::vector<float> output(totalFrames * format.channels);
+	auto frames = sink->read(output.data(), totalFrames);
+	int64_t first = -1;
+	int64_t last = -1;
+	for (size_t f = 0; f < frames; f++)
+	{
+		if (output[f * format.channels] > level / 100)
+		{
+			first = first < 0 ? (int64_t)f : first;
+			last = (int64_t)f;
+		}
+	}
+	result.minLevel = first < 0 ? 0.0 : 1e9;
+	for (auto f = first; f >= 0 && f <= last; f++)
+	{
+		auto value = output[(size_t)f * format.channels] / level;
+		result.gapFrames += value < 0.5f ? 1 : 0;
+		result.minLevel = std::min(result.minLevel, (double)value);
+		result.maxLevel = std::max(result.maxLevel, (double)value);
+	}
+	result.overlapFrames = (int64_t)itemFrames * 2 - (first < 0 ? 0 : last - first + 1);
+	return result;
+}
+
+struct RenderClockBenchmarkResult
+{
+	// Lock-free position reads across all readers, and their cost.
+	uint64_t reads;
+	double nsPerRead;
+	// How far the position read was from what the output was playing.
+	double meanErrorUs;
+	double maxErrorUs;
+	// Reads that went back from the reader's previous one, which the time
+	// between renders varying makes happen, and by how much at most.
+	uint64_t backwardReads;
+	int64_t maxBackwardUs;
+	// From the last frame being heard to the completed state, or -1 if it
+	// never completed.
+	int64_t completionDelayUs;
+};
+
+/**
+ * Plays |seconds| of audio into an output that holds |latencyUs| ahead of
+ * what it plays, like a device, while |readers| threads read the position
+ * without pause. Every frame carries its own index, so the output knows what
+ * is being heard at any time, and the position read is compared with it.
+ */
+inline RenderClockBenchmarkResult benchmarkRenderClock(double seconds = 3, unsigned readers = 4, int64_t latencyUs = 40000, AudioFormat format = AudioFormat{ 48000, 2 })
+{
+	// Takes frames once the device has room for them, playing them at the
+	// sample rate from the first write, and records each one's index.
+	class DeviceSink : public AudioSink
+	{
+	public:
+		DeviceSink(AudioFormat format, uint64_t bufferFrames, size_t capacityFrames)
+			: format(format), bufferFrames(bufferFrames)
+		{
+			played.reserve(capacityFrames);
+		}
+
+		AudioFormat getFormat() const override
+		{
+			return format;
+		}
+
+		bool isRealtime() const override
+		{
+			return true;
+		}
+
+		void write(const float* samples, size_t frames) override
+		{
+			if (framesWritten == 0)
+			{
+				start = std::chrono::steady_clock::now();
+			}
+			auto room = start + std::chrono::microseconds((int64_t)((framesWritten + frames - std::min<uint64_t>(framesWritten + frames, bufferFrames)) * 1000000 / format.sampleRate));
+			std::this_thread::sleep_until(room);
+			{
+				std::lock_guard<std::mutex> lock(mutex);
+				for (size_t f = 0; f < frames && played.size() < played.capacity(); f++)
+				{
+					played.push_back(samples[f * format.channels]);
+				}
+			}
+			framesWritten += frames;
+			latencyFrames = framesWritten - std::min<uint64_t>(framesWritten, playedFrames(std::chrono::steady_clock::now()));
+		}
+
+		uint64_t getLatencyFrames() const override
+		{
+			return latencyFrames;
+		}
+
+		/// The value of the frame heard at |time|, or nothing before the first
+		/// or after the last.
+		std::optional<float> heardAt(std::chrono::steady_clock::time_point time)
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			auto frame = playedFrames(time);
+			if (framesWritten == 0 || frame >= played.size())
+			{
+				return std::nullopt;
+			}
+			return played[frame];
+		}
+
+		/// When the last frame that is not silent was heard.
+		std::optional<std::chrono::steady_clock::time_point> lastHeard()
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			auto last = std::find_if(played.rbegin(), played.rend(), [](float value)
+				{ return value != 0.0f; });
+			if (last == played.rend())
+			{
+				return std::nullopt;
+			}
+			auto frame = (uint64_t)(played.rend() - last);
+			return start + std::chrono::microseconds((int64_t)(frame * 1000000 / format.sampleRate));
+		}
+
+	private:
+		uint64_t playedFrames(std::chrono::steady_clock::time_point time) const
+		{
+			return (uint64_t)std::max<int64_t>(0, std::chrono::duration_cast<std::chrono::microseconds>(time - start).count() * format.sampleRate / 1000000);
+		}
+
+		AudioFormat format;
+		uint64_t bufferFrames;
+		std::atomic<uint64_t> latencyFrames = 0;
+		std::chrono::steady_clock::time_point start{};
+		std::mutex mutex;
+		std::vector<float> played{};
+	};
+
+	auto itemFrames = (int64_t)(seconds * format.sampleRate);
+	auto decoders = std::make_shared<DecoderRegistry>();
+	decoders->add([=](const AudioSourceSpec& source) -> std::unique_ptr<AudioDecoder>
+		{
+			if (source.uri.rfind("tone:", 0) != 0)
+			{
+				return nullptr;
+			}
+			// Counts from 1, so that silence is told apart.
+			return std::make_unique<GeneratedDecoder>(format, itemFrames, [](int64_t frame)
+				{ return (float)(frame + 1); }); });
+
+	auto bufferFrames = (uint64_t)(latencyUs * format.sampleRate / 1000000);
+	auto sink = std::make_shared<DeviceSink>(format, bufferFrames, (size_t)itemFrames + format.sampleRate * 5);
+	RenderClockBenchmarkResult result{};
+	result.completionDelayUs = -1;
+	{
+		SoftwareBackend backend(sink, decoders);
+		AudioSourceSpec item{};
+		item.uri = "tone:";
+		backend.load(item, std::nullopt, 0);
+		backend.play();
+
+		std::atomic<bool> done = false;
+		std::atomic<uint64_t> reads = 0;
+		std::atomic<uint64_t> readNs = 0;
+		std::atomic<uint64_t> backwardReads = 0;
+		std::atomic<int64_t> maxBackwardUs = 0;
+		std::vector<std::thread> threads;
+		for (unsigned i = 0; i < readers; i++)
+		{
+			threads.emplace_back([&]()
+				{
+					uint64_t count = 0;
+					uint64_t backward = 0;
+					int64_t maxBackward = 0;
+					int64_t last = 0;
+					auto start = std::chrono::steady_clock::now();
+					while (!done)
+					{
+						auto position = backend.getHeardPositionUs();
+						if (position < last)
+						{
+							backward++;
+							maxBackward = std::max(maxBackward, last - position);
+						}
+						last = position;
+						count++;
+					}
+					readNs += (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+					reads += count;
+					backwardReads += backward;
+					auto max = maxBackwardUs.load();
+					while (maxBackward > max && !maxBackwardUs.compare_exchange_weak(max, maxBackward))
+					{
+					} });
+		}
+
+		double errorSumUs = 0;
+		uint64_t errors = 0;
+		std::optional<std::chrono::steady_clock::time_point> completedAt{};
+		auto deadline = std::chrono::steady_clock::now() + std::chrono::microseconds((int64_t)(seconds * 1000000)) + std::chrono::seconds(5);
+		while (!completedAt && std::chrono::steady_clock::now() < deadline)
+		{
+			std::this_thread::sleep_for(std::chrono::milliseconds(1));
+			auto positionUs = backend.getHeardPositionUs();
+			auto heard = sink->heardAt(std::chrono::steady_clock::now());
+			if (heard && *heard > 0)
+			{
+				auto errorUs = std::abs((double)positionUs - (*heard - 1) * 1000000 / format.sampleRate);
+				errorSumUs += errorUs;
+				result.maxErrorUs = std::max(result.maxErrorUs, errorUs);
+				errors++;
+			}
+			if (backend.getState().processingState == ProcessingState::completed)
+			{
+				completedAt = std::chrono::steady_clock::now();
+			}
+		}
+		done = true;
+		for (auto& thread : threads)
+		{
+			thread.join();
+		}
+		result.reads = reads;
+		result.nsPerRead = reads > 0 ? (double)readNs / reads : 0.0;
+		result.backwardReads = backwardReads;
+		result.maxBackwardUs = maxBackwardUs;
+		result.meanErrorUs = errors > 0 ? errorSumUs / errors : 0.0;
+		auto lastHeard = sink->lastHeard();
+		if (completedAt && lastHeard)
+		{
+			result.completionDelayUs = std::chrono::duration_cast<std::chrono::microseconds>(*completedAt - *lastHeard).count();
+		}
+	}
+	return result;
+}
+
+struct DecodeLoadBenchmarkResult
+{
+	size_t streams;
+	unsigned threads;
+	double seconds;
+	// Summed over all streams.
+	uint64_t underruns;
+	uint64_t underrunFrames;
+	// From the scheduler the streams decoded on.
+	uint64_t runs;
+	uint64_t steals;
+	uint64_t deadlineMisses;
+	size_t maxQueueDepth;
+	// The share of real time the mixer spent mixing, from 0 to 1.
+	double mixerLoad;
+};
+
+/**
+ * Plays |streams| tones at once for |seconds|, mixed into an output that
+ * takes audio at the sample rate, with every stream decoding on one
+ * scheduler of |threads| threads, 0 for one per core. Every other stream is
+ * at a rate other than the output's, so that half of them resample too.
+ */
+inline DecodeLoadBenchmarkResult benchmarkDecodeLoad(size_t streams = 200, double seconds = 10, unsigned threads = 0, AudioFormat format = AudioFormat{ 48000, 2 })
+{
+	streams = std::max<size_t>(streams, 1);
+	auto decoders = std::make_shared<DecoderRegistry>();
+	decoders->add([=](const AudioSourceSpec& source) -> std::unique_ptr<AudioDecoder>
+		{
+			if (source.uri.rfind("tone:", 0) != 0)
+			{
+				return nullptr;
+			}
+			auto index = std::stoi(source.uri.substr(5));
+			auto rate = index % 2 == 0 ? format.sampleRate : 44100;
+			auto frequency = 220.0 + index;
+			// Longer than the benchmark, so that no stream ends during it.
+			return std::make_unique<GeneratedDecoder>(AudioFormat{ rate, format.channels }, (int64_t)((seconds + 1) * rate), [=](int64_t frame)
+				{ return 0.001f * (float)std::sin(2 * 3.14159265358979 * frequency * frame / rate); }); });
+
+	auto scheduler = std::make_shared<DecodeScheduler>(threads);
+	auto mixer = std::make_shared<Mixer>(format, std::make_shared<NullSink>(format, true), streams);
+	std::vector<std::unique_ptr<SoftwareBackend>> backends;
+	for (size_t i = 0; i < streams; i++)
+	{
+		auto backend = std::make_unique<SoftwareBackend>(mixer, decoders, SoftwareBackend::kDefaultBufferDepthMs, SoftwareBackend::kDefaultBlockFrames, scheduler);
+		AudioSourceSpec source{};
+		source.uri = "tone:" + std::to_string(i);
+		backend->load(source, std::nullopt, 0);
+		backends.push_back(std::move(backend));
+	}
+	// Buffered before any plays, so that only running dry while playing counts.
+	for (auto& backend : backends)
+	{
+		backend->waitUntilReady(SoftwareBackend::kDefaultBlockFrames * 4);
+	}
+	for (auto& backend : backends)
+	{
+		backend->play();
+	}
+	std::this_thread::sleep_for(std::chrono::microseconds((int64_t)(seconds * 1000000)));
+
+	DecodeLoadBenchmarkResult result{ streams, 0, seconds, 0, 0, 0, 0, 0, 0, 0.0 };
+	for (auto& backend : backends)
+	{
+		auto state = backend->getState();
+		result.underruns += state.underrunCount;
+		result.underrunFrames += state.underrunFrames;
+	}
+	result.mixerLoad = mixer->getStatistics().load;
+	auto statistics = scheduler->getStatistics();
+	result.threads = statistics.threads;
+	result.runs = statistics.runs;
+	result.steals = statistics.steals;
+	result.deadlineMisses = statistics.deadlineMisses;
+	result.maxQueueDepth = statistics.maxQueueDepth;
+	for (auto& backend : backends)
+	{
+		backend->dispose();
+	}
+	return result;
+}
+
+struct SyncGroupBenchmarkResult
+{
+	size_t players;
+	// Output played, and the commands sent meanwhile.
+	double seconds;
+	uint64_t commands;
+	// How far apart the positions of two players of the group were after any
+	// block, and after the last, in microseconds. At most 1, from rounding,
+	// when they keep in step.
+	int64_t maxSkewUs;
+	int64_t finalSkewUs;
+	// Starts at a host time, and those first heard at another frame than the
+	// one scheduled.
+	uint64_t starts;
+	uint64_t startErrors;
+	// Blocks the group waited for a player that was not ready.
+	uint64_t groupStalls;
+	// The same commands sent to each player in turn, without a group.
+	int64_t ungroupedMaxSkewUs;
+	int64_t ungroupedFinalSkewUs;
+	uint64_t ungroupedUnderruns;
+};
+
+/**
+ * Plays |players| stems of |seconds| of output through a mixer paced by the
+ * caller, as a headless sink's is, once in a SyncGroup and once as players
+ * commanded in turn. About every minute of output a command pauses the
+ * stems and starts them again at a host time a second later, seeks them or
+ * changes their speed. Every 40th block on average is mixed without waiting
+ * for the decoders, as a device does when they run late, so that players
+ * run dry at different times. After each block, the positions of the
+ * players are compared. Without |ungrouped|, only the group plays.
+ */
+inline SyncGroupBenchmarkResult benchmarkSyncGroup(size_t players = 8, double seconds = 3600, AudioFormat format = AudioFormat{ 48000, 2 },
+	bool ungrouped = true)
+{
+	players = std::max<size_t>(players, 2);
+	const uint32_t rate = 44100;
+	// Long enough for the whole run at the fastest speed, seeks included.
+	auto stemFrames = (int64_t)((seconds * 1.5 + 600) * rate);
+	auto decoders = std::make_shared<DecoderRegistry>();
+	decoders->add([=](const AudioSourceSpec& source) -> std::unique_ptr<AudioDecoder>
+		{
+			if (source.uri.rfind("stem:", 0) != 0)
+			{
+				return nullptr;
+			}
+			auto frequency = 110.0 * (std::stoi(source.uri.substr(5)) + 1);
+			// Never silent, so that the first frame played shows in the output.
+			return std::make_unique<GeneratedDecoder>(AudioFormat{ rate, format.channels }, stemFrames, [=](int64_t frame)
+				{ return 0.01f + 0.005f * (float)std::sin(2 * 3.14159265358979 * frequency * frame / rate); }); });
+
+	auto blockFrames = Mixer::kDefaultBlockFrames;
+	auto totalBlocks = (uint64_t)(seconds * format.sampleRate / blockFrames);
+	SyncGroupBenchmarkResult result{ players, (double)totalBlocks * blockFrames / format.sampleRate, 0, 0, 0, 0, 0, 0, 0, 0, 0 };
+
+	auto run = [&](bool grouped)
+	{
+		auto mixer = std::make_shared<Mixer>(format, nullptr, players, blockFrames);
+		auto sink = std::make_shared<NullSink>(format);
+		auto group = grouped ? std::make_shared<SyncGroup>(mixer) : nullptr;
+		std::vector<std::unique_ptr<SoftwareBackend>> backends;
+		for (size_t i = 0; i < players; i++)
+		{
+			auto backend = std::make_unique<SoftwareBackend>(mixer, decoders);
+			AudioSourceSpec source{};
+			source.uri = "stem:" + std::to_string(i);
+			backend->load(source, std::nullopt, 0);
+			backend->setSyncGroup(group);
+			backend->waitUntilReady(blockFrames * 4);
+			backends.push_back(std::move(backend));
+		}
+
+		// The same commands at the same blocks in both runs.
+		std::mt19937 random(12345);
+		auto commandInterval = [&]()
+		{
+			return (uint64_t)((30 + random() % 60) * format.sampleRate / blockFrames);
+		};
+		const double speeds[] = { 0.75, 1.0, 1.25, 1.5 };
+		auto nextCommand = commandInterval();
+		std::optional<uint64_t> resumeBlock{};
+		std::optional<uint64_t> scheduledFrame{};
+		std::vector<float> output(blockFrames * format.channels);
+		int64_t maxSkewUs = 0;
+		int64_t skewUs = 0;
+
+		backends.front()->play();
+		if (!grouped)
+		{
+			for (size_t i = 1; i < players; i++)
+			{
+				backends[i]->play();
+			}
+		}
+		for (uint64_t b = 0; b < totalBlocks; b++)
+		{
+			if (b == nextCommand)
+			{
+				nextCommand += commandInterval();
+				result.commands++;
+				switch (random() % 3)
+				{
+				case 0:
+					for (auto& backend : backends)
+					{
+						backend->pause();
+						if (grouped)
+						{
+							break;
+						}
+					}
+					resumeBlock = b + format.sampleRate / blockFrames;
+					break;
+				case 1:
+				{
+					auto positionUs = (int64_t)(random() % (uint64_t)(seconds * 1000000));
+					for (auto& backend : backends)
+					{
+						backend->seek(std::nullopt, positionUs);
+						if (grouped)
+						{
+							break;
+						}
+					}
+					break;
+				}
+				default:
+				{
+					auto speed = speeds[random() % 4];
+					for (auto& backend : backends)
+					{
+						backend->setSpeed(speed);
+						if (grouped)
+						{
+							break;
+						}
+					}
+					break;
+				}
+				}
+			}
+			if (resumeBlock && b == *resumeBlock)
+			{
+				resumeBlock.reset();
+				result.commands++;
+				auto hostTimeUs = RenderClock::nowUs() + 5000 + (int64_t)(random() % 45000);
+				if (grouped)
+				{
+					scheduledFrame = group->play(hostTimeUs);
+					result.starts++;
+				}
+				else
+				{
+					for (auto& backend : backends)
+					{
+						backend->playAt(hostTimeUs);
+					}
+				}
+			}
+
+			if (random() % 40 != 0)
+			{
+				for (auto& backend : backends)
+				{
+					backend->waitUntilReady(blockFrames);
+				}
+			}
+			auto blockStart = mixer->getFramePosition();
+			mixer->mix(output.data(), blockFrames);
+			sink->write(output.data(), blockFrames);
+
+			if (scheduledFrame)
+			{
+				auto first = std::find_if(output.begin(), output.end(), [](float sample)
+					{ return sample != 0.0f; });
+				if (first != output.end())
+				{
+					auto heardFrame = blockStart + (uint64_t)(first - output.begin()) / format.channels;
+					result.startErrors += heardFrame != *scheduledFrame ? 1 : 0;
+					scheduledFrame.reset();
+				}
+			}
+
+			int64_t lowest = INT64_MAX;
+			int64_t highest = INT64_MIN;
+			for (auto& backend : backends)
+			{
+				auto positionUs = backend->getHeardPositionUs();
+				lowest = std::min(lowest, positionUs);
+				highest = std::max(highest, positionUs);
+			}
+			skewUs = highest - lowest;
+			maxSkewUs = std::max(maxSkewUs, skewUs);
+		}
+
+		uint64_t underruns = 0;
+		for (auto& backend : backends)
+		{
+			underruns += backend->getState().underrunCount;
+			backend->dispose();
+		}
+		if (grouped)
+		{
+			result.maxSkewUs = maxSkewUs;
+			result.finalSkewUs = skewUs;
+			result.groupStalls = mixer->getStatistics().groupStalls;
+		}
+		else
+		{
+			result.ungroupedMaxSkewUs = maxSkewUs;
+			result.ungroupedFinalSkewUs = skewUs;
+			result.ungroupedUnderruns = underruns;
+		}
+	};
+
+	run(true);
+	if (ungrouped)
+	{
+		// Counted once, for the group.
+		auto commands = result.commands;
+		run(false);
+		result.commands = commands;
+	}
+	return result;
+}
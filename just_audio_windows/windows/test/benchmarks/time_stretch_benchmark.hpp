@@ -0,0 +1,63 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <memory>
+#include <vector>
+
+#include "time_stretch.hpp"
+
+struct TimeStretchBenchmarkResult
+{
+	size_t streams;
+	// Microseconds of CPU time spent per second of audio, per stream.
+	double cpuUsPerStreamSecond;
+	// Seconds of audio stretched for all streams per second of CPU time, on
+	// one thread. Above 1, they play in real time on one core.
+	double realtimeFactor;
+};
+
+/**
+ * Measures the cost of stretching |streams| streams of a chord to |tempo| for
+ * |seconds| of input each, on the calling thread.
+ */
+inline TimeStretchBenchmarkResult benchmarkTimeStretch(size_t streams, TimeStretcher::Quality quality, double tempo, double seconds, AudioFormat format = AudioFormat{ 48000, 2 })
+{
+	size_t blockFrames = 480;
+	std::vector<float> block(blockFrames * format.channels);
+	std::vector<float> output(blockFrames * 4 * format.channels);
+	std::vector<std::unique_ptr<TimeStretcher>> stretchers{};
+	for (size_t i = 0; i < streams; i++)
+	{
+		stretchers.push_back(std::make_unique<TimeStretcher>(format, quality));
+		stretchers.back()->setTempo(tempo);
+	}
+
+	auto blocks = std::max<size_t>(1, (size_t)(seconds * format.sampleRate / blockFrames));
+	uint64_t produced = 0;
+	auto start = std::chrono::steady_clock::now();
+	for (size_t b = 0; b < blocks; b++)
+	{
+		for (size_t i = 0; i < blockFrames * format.channels; i++)
+		{
+			auto t = (float)(b * blockFrames + i / format.channels) / format.sampleRate;
+			block[i] = 0.2f * (std::sin(t * 1382.3f) + std::sin(t * 1741.6f) + std::sin(t * 2073.5f));
+		}
+		for (auto& stretcher : stretchers)
+		{
+			stretcher->write(block.data(), blockFrames);
+			while (auto count = stretcher->read(output.data(), blockFrames * 4))
+			{
+				produced += count;
+			}
+		}
+	}
+	auto elapsedUs = (double)std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+	// Stretched audio plays for as long as the output it produced.
+	auto audioSeconds = (double)produced / streams / format.sampleRate;
+
+	return TimeStretchBenchmarkResult{ streams,
+		audioSeconds > 0 ? elapsedUs / audioSeconds / streams : 0.0,
+		elapsedUs > 0 ? audioSeconds * 1000000 / elapsedUs : 0.0 };
+}
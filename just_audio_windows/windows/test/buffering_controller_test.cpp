@@ -0,0 +1,261 @@
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "buffering_controller.hpp"
+#include "icy_metadata.hpp"
+
+namespace {
+
+const int64_t kTickUs = 10000;
+// A 128 kbit/s stream.
+const int64_t kBytesPerSecond = 16000;
+
+struct Playback {
+  int64_t start_us = -1;
+  int64_t played_us = 0;
+  int64_t max_ahead_us = 0;
+  int loading_bursts = 0;
+  // How far ahead was buffered each time playback started or resumed.
+  std::vector<int64_t> resumed_ahead_us;
+};
+
+// Plays a stream from a local source throttled to |source_bytes_per_second|
+// for |seconds|, the way the player does: the source reads while the
+// controller says to keep loading, and playback waits for it to say that
+// enough is buffered, at the start and after each stall.
+Playback Simulate(BufferingController &controller, int64_t source_bytes_per_second, double seconds) {
+  Playback playback;
+  int64_t delivered = 0;
+  bool playing = false;
+  bool loading = true;
+  for (int64_t now = 0; now < (int64_t)(seconds * 1000000); now += kTickUs) {
+    auto played_bytes = playback.played_us * kBytesPerSecond / 1000000;
+    auto buffered_bytes = delivered - played_bytes;
+    auto ahead_us = buffered_bytes * 1000000 / kBytesPerSecond;
+    auto keep_loading = controller.shouldContinueLoading(ahead_us, buffered_bytes);
+    if (keep_loading && !loading) {
+      playback.loading_bursts++;
+    }
+    loading = keep_loading;
+    if (loading) {
+      delivered += source_bytes_per_second * kTickUs / 1000000;
+    }
+
+    ahead_us = (delivered - played_bytes) * 1000000 / kBytesPerSecond;
+    playback.max_ahead_us = std::max(playback.max_ahead_us, ahead_us);
+    if (!playing && controller.shouldStartPlayback(ahead_us)) {
+      playing = true;
+      controller.onResumed();
+      playback.resumed_ahead_us.push_back(ahead_us);
+      if (playback.start_us < 0) {
+        playback.start_us = now;
+      }
+    }
+    if (playing) {
+      auto step = std::min(kTickUs, ahead_us);
+      playback.played_us += step;
+      if (step < kTickUs) {
+        playing = false;
+        controller.onStall();
+      }
+    }
+  }
+  return playback;
+}
+
+LoadControlSettings Settings() {
+  LoadControlSettings settings;
+  settings.minBufferUs = 15000000;
+  settings.maxBufferUs = 30000000;
+  settings.bufferForPlaybackUs = 2500000;
+  settings.bufferForPlaybackAfterRebufferUs = 5000000;
+  return settings;
+}
+
+TEST(BufferingControllerTest, WaitsForTheThresholdsOnASlowSource) {
+  BufferingController controller;
+  controller.configure(Settings());
+  // The source delivers 80% of the bitrate, so playback keeps stalling.
+  auto playback = Simulate(controller, kBytesPerSecond * 8 / 10, 600);
+
+  // 2.5 s of audio at 80% speed take 3.125 s to arrive.
+  EXPECT_NEAR(playback.start_us, 3125000, kTickUs);
+  ASSERT_GE(playback.resumed_ahead_us.size(), 3u);
+  EXPECT_GE(playback.resumed_ahead_us[0], 2500000);
+  for (size_t i = 1; i < playback.resumed_ahead_us.size(); i++) {
+    EXPECT_GE(playback.resumed_ahead_us[i], 5000000) << "after stall " << i;
+  }
+  EXPECT_EQ(controller.getStallCount(), (int64_t)playback.resumed_ahead_us.size() - (controller.isRebuffering() ? 0 : 1));
+  EXPECT_EQ(controller.getRebufferCount(), (int64_t)playback.resumed_ahead_us.size() - 1);
+  // Everything delivered is played, apart from what is buffered at the end.
+  EXPECT_NEAR(playback.played_us, 600000000LL * 8 / 10, 6000000);
+}
+
+TEST(BufferingControllerTest, LoadsInBurstsBetweenTheMinimumAndMaximumOnAFastSource) {
+  BufferingController controller;
+  controller.configure(Settings());
+  auto playback = Simulate(controller, kBytesPerSecond * 4, 600);
+
+  EXPECT_EQ(controller.getStallCount(), 0);
+  EXPECT_LE(playback.max_ahead_us, 30000000 + kTickUs * 4);
+  // Each burst refills 15 s at three times real time, then waits 15 s for
+  // playback to drain it: about one burst every 20 seconds.
+  EXPECT_GE(playback.loading_bursts, 25);
+  EXPECT_LE(playback.loading_bursts, 30);
+  EXPECT_NEAR(playback.played_us, 600000000LL - playback.start_us, kTickUs);
+}
+
+TEST(BufferingControllerTest, StopsAtTheTargetBytesUnlessTimeComesFirst) {
+  auto settings = Settings();
+  settings.targetBufferBytes = kBytesPerSecond * 10;
+  settings.prioritizeTimeOverSizeThresholds = false;
+  BufferingController controller;
+  controller.configure(settings);
+  auto playback = Simulate(controller, kBytesPerSecond * 4, 120);
+  EXPECT_LE(playback.max_ahead_us, 10000000 + kTickUs * 4);
+
+  settings.prioritizeTimeOverSizeThresholds = true;
+  controller.configure(settings);
+  playback = Simulate(controller, kBytesPerSecond * 4, 120);
+  // Loads up to the minimum buffer whatever the bytes.
+  EXPECT_GE(playback.max_ahead_us, 15000000);
+}
+
+// An ICY radio stream of |seconds| of audio at kBytesPerSecond, with a
+// metadata block every |interval| bytes and a title in every tenth.
+std::vector<uint8_t> IcyStream(int64_t seconds, uint32_t interval) {
+  std::vector<uint8_t> stream;
+  auto audio = (size_t)(seconds * kBytesPerSecond);
+  for (size_t offset = 0; offset < audio; offset++) {
+    stream.push_back((uint8_t)(offset * 31 + 7));
+    if ((offset + 1) % interval == 0) {
+      auto block = offset / interval;
+      std::string text = block % 10 == 0 ? "StreamTitle='Song " + std::to_string(block / 10) + "';" : "";
+      auto length = (text.size() + 15) / 16;
+      stream.push_back((uint8_t)length);
+      text.resize(length * 16, '\0');
+      stream.insert(stream.end(), text.begin(), text.end());
+    }
+  }
+  return stream;
+}
+
+struct LiveStreamPlayback {
+  int64_t played_us = 0;
+  int64_t max_ahead_us = 0;
+  int loading_bursts = 0;
+  size_t titles = 0;
+  size_t mismatches = 0;
+};
+
+// Plays |stream| from a connection limited to |source_bytes_per_second| for
+// |seconds|, through the same steps as the player's LiveStream: the decoder
+// reads through an IcyStreamReader whenever it can, and a read at the live
+// edge waits while shouldContinueLoadingStream says to stop.
+LiveStreamPlayback SimulateLiveStream(BufferingController &controller, const std::vector<uint8_t> &stream,
+                                      uint32_t interval, int64_t source_bytes_per_second, double seconds) {
+  LiveStreamPlayback playback;
+  size_t sent = 0;
+  int64_t allowance = 0;
+  IcyStreamReader reader(
+      interval,
+      [&](uint8_t *data, size_t length) -> size_t {
+        auto count = (size_t)std::min<int64_t>({(int64_t)length, allowance, (int64_t)(stream.size() - sent)});
+        std::memcpy(data, stream.data() + sent, count);
+        sent += count;
+        allowance -= count;
+        return count;
+      },
+      [&](const IcyInfo &) { playback.titles++; });
+
+  std::vector<uint8_t> buffer(4096);
+  bool playing = false;
+  bool loading = true;
+  for (int64_t now = 0; now < (int64_t)(seconds * 1000000); now += kTickUs) {
+    allowance = source_bytes_per_second * kTickUs / 1000000;
+    while (allowance > 0 && sent < stream.size()) {
+      auto keep_loading = !reader.atLiveEdge() ||
+                          controller.shouldContinueLoadingStream(reader.getLivePosition(), playback.played_us,
+                                                                 kBytesPerSecond);
+      if (keep_loading && !loading) {
+        playback.loading_bursts++;
+      }
+      loading = keep_loading;
+      if (!loading) {
+        break;
+      }
+      auto start = reader.getPosition();
+      auto length = reader.read(buffer.data(), buffer.size());
+      for (size_t i = 0; i < length; i++) {
+        playback.mismatches += buffer[i] != (uint8_t)((start + i) * 31 + 7);
+      }
+    }
+
+    auto ahead_us = ((int64_t)reader.getLivePosition() * 1000000 / kBytesPerSecond) - playback.played_us;
+    playback.max_ahead_us = std::max(playback.max_ahead_us, ahead_us);
+    if (!playing && controller.shouldStartPlayback(ahead_us)) {
+      playing = true;
+      controller.onResumed();
+    }
+    if (playing) {
+      auto step = std::min(kTickUs, ahead_us);
+      playback.played_us += step;
+      if (step < kTickUs) {
+        playing = false;
+        controller.onStall();
+      }
+    }
+  }
+  return playback;
+}
+
+TEST(BufferingControllerTest, ThrottlesALiveStreamFromAFastConnection) {
+  const uint32_t kInterval = 8000;
+  auto stream = IcyStream(300, kInterval);
+  BufferingController controller;
+  controller.configure(Settings());
+  auto playback = SimulateLiveStream(controller, stream, kInterval, kBytesPerSecond * 4, 240);
+
+  EXPECT_EQ(controller.getStallCount(), 0);
+  EXPECT_EQ(playback.mismatches, 0u);
+  // Reads stop at the maximum buffer, though the connection could deliver the
+  // whole stream in 75 seconds.
+  EXPECT_GE(playback.max_ahead_us, 30000000);
+  EXPECT_LE(playback.max_ahead_us, 30000000 + kTickUs * 4);
+  EXPECT_GE(playback.loading_bursts, 9);
+  EXPECT_LE(playback.loading_bursts, 12);
+  // Titles arrive as the stream is read, not as it could have been sent.
+  auto read_blocks = (size_t)((playback.played_us + playback.max_ahead_us) * kBytesPerSecond / 1000000 / kInterval);
+  EXPECT_LE(playback.titles, read_blocks / 10 + 1);
+  EXPECT_GE(playback.titles, (size_t)(playback.played_us * kBytesPerSecond / 1000000 / kInterval / 10));
+}
+
+TEST(BufferingControllerTest, RebuffersALiveStreamFromASlowConnection) {
+  const uint32_t kInterval = 8000;
+  auto stream = IcyStream(300, kInterval);
+  BufferingController controller;
+  controller.configure(Settings());
+  // The connection delivers 90% of the bitrate, and metadata on top.
+  auto playback = SimulateLiveStream(controller, stream, kInterval, kBytesPerSecond * 9 / 10, 240);
+
+  EXPECT_EQ(playback.mismatches, 0u);
+  EXPECT_GE(controller.getStallCount(), 2);
+  EXPECT_GE(controller.getRebufferCount(), controller.getStallCount() - 1);
+  // Never more than the 5 s rebuffer threshold ahead: loading never stops.
+  EXPECT_LE(playback.max_ahead_us, 5000000 + kTickUs);
+  EXPECT_NEAR(playback.played_us, 240000000LL * 9 / 10, 6000000);
+}
+
+TEST(BufferingControllerTest, MergesTouchingRangesAheadOfThePosition) {
+  std::vector<BufferedRange> ranges = {{20, 30}, {0, 10}, {10, 15}, {40, 50}};
+  EXPECT_EQ(BufferingController::bufferedPosition(5, ranges), 15);
+  EXPECT_EQ(BufferingController::bufferedAhead(25, ranges), 5);
+  EXPECT_EQ(BufferingController::bufferedPosition(35, ranges), 35);
+}
+
+}  // namespace
@@ -0,0 +1,100 @@
+#include <gtest/gtest.h>
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "benchmarks/software_backend_benchmark.hpp"
+#include "decode_scheduler.hpp"
+
+namespace {
+
+const int64_t kNeverUs = INT64_MAX / 2;
+
+bool WaitFor(const std::function<bool()> &condition) {
+  auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+  while (!condition() && std::chrono::steady_clock::now() < deadline) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+  return condition();
+}
+
+TEST(DecodeSchedulerTest, RunsDueJobsInOrderOfTheirDeadline) {
+  DecodeScheduler scheduler(1);
+  std::mutex mutex;
+  std::vector<int> order;
+  // All fall due together, with deadlines in the reverse order of adding.
+  auto due_us = DecodeScheduler::nowUs() + 50000;
+  const int kJobs = 5;
+  for (int i = 0; i < kJobs; i++) {
+    auto runs = std::make_shared<int>(0);
+    scheduler.add([&, i, runs]() -> DecodeScheduler::Next {
+      if ((*runs)++ == 0) {
+        return {due_us, due_us + 1000000 - i * 1000};
+      }
+      std::lock_guard<std::mutex> lock(mutex);
+      order.push_back(i);
+      return {kNeverUs, std::nullopt};
+    });
+  }
+  ASSERT_TRUE(WaitFor([&]() {
+    std::lock_guard<std::mutex> lock(mutex);
+    return order.size() == kJobs;
+  }));
+  std::lock_guard<std::mutex> lock(mutex);
+  EXPECT_EQ(order, (std::vector<int>{4, 3, 2, 1, 0}));
+  EXPECT_EQ(scheduler.getStatistics().deadlineMisses, 0u);
+}
+
+TEST(DecodeSchedulerTest, CountsRunsThatStartAfterTheirDeadline) {
+  DecodeScheduler scheduler(2);
+  std::atomic<int> runs = 0;
+  scheduler.add([&]() -> DecodeScheduler::Next {
+    // The buffer ran out a millisecond ago.
+    if (runs.fetch_add(1) == 0) {
+      return {DecodeScheduler::nowUs(), DecodeScheduler::nowUs() - 1000};
+    }
+    return {kNeverUs, std::nullopt};
+  });
+  ASSERT_TRUE(WaitFor([&]() { return runs.load() == 2; }));
+  auto statistics = scheduler.getStatistics();
+  EXPECT_EQ(statistics.runs, 2u);
+  EXPECT_EQ(statistics.deadlineMisses, 1u);
+}
+
+TEST(DecodeSchedulerTest, WakesAWaitingJobAtOnce) {
+  DecodeScheduler scheduler(1);
+  std::atomic<int> runs = 0;
+  auto id = scheduler.add([&]() -> DecodeScheduler::Next {
+    runs.fetch_add(1);
+    return {kNeverUs, std::nullopt};
+  });
+  ASSERT_TRUE(WaitFor([&]() { return runs.load() == 1; }));
+  scheduler.wake(id);
+  ASSERT_TRUE(WaitFor([&]() { return runs.load() == 2; }));
+  scheduler.remove(id);
+  scheduler.wake(id);
+  std::this_thread::sleep_for(std::chrono::milliseconds(20));
+  EXPECT_EQ(runs.load(), 2);
+  EXPECT_EQ(scheduler.getStatistics().jobs, 0u);
+}
+
+// Sixteen streams, half of them resampled, decoding on two threads into one
+// mixer paced like a device, as the decodeLoad benchmark's smoke run does.
+TEST(DecodeSchedulerTest, KeepsManyStreamsFedWithoutMissingADeadline) {
+  const size_t kStreams = 16;
+  auto result = benchmarkDecodeLoad(kStreams, 1, 2);
+  EXPECT_EQ(result.threads, 2u);
+  EXPECT_EQ(result.underruns, 0u);
+  EXPECT_EQ(result.underrunFrames, 0u);
+  EXPECT_EQ(result.deadlineMisses, 0u);
+  // At most one run of each stream is ever due at once.
+  EXPECT_LE(result.maxQueueDepth, kStreams);
+  // Every stream decoded more than once a second.
+  EXPECT_GT(result.runs, kStreams * 2);
+}
+
+}  // namespace
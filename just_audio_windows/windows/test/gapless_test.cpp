@@ -0,0 +1,207 @@
+#include <gtest/gtest.h>
+
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "audio_decoder.hpp"
+#include "generated_decoder.hpp"
+#include "metadata_probe.hpp"
+#include "software_backend.hpp"
+
+namespace {
+
+using Bytes = std::vector<uint8_t>;
+
+void AppendBe32(Bytes *bytes, uint32_t value) {
+  for (int shift = 24; shift >= 0; shift -= 8) {
+    bytes->push_back((uint8_t)(value >> shift));
+  }
+}
+
+void AppendText(Bytes *bytes, const std::string &text) {
+  bytes->insert(bytes->end(), text.begin(), text.end());
+}
+
+Bytes Mp4Box(const char *type, const Bytes &payload) {
+  Bytes box;
+  AppendBe32(&box, (uint32_t)(payload.size() + 8));
+  AppendText(&box, type);
+  box.insert(box.end(), payload.begin(), payload.end());
+  return box;
+}
+
+Bytes Concat(std::initializer_list<Bytes> parts) {
+  Bytes bytes;
+  for (const auto &part : parts) {
+    bytes.insert(bytes.end(), part.begin(), part.end());
+  }
+  return bytes;
+}
+
+// MPEG-1 Layer III frames at 128 kbit/s and 44.1 kHz, the first an Info frame
+// with a LAME tag.
+Bytes Mp3WithLameTag(uint32_t delay, uint32_t padding) {
+  const size_t kFrameLength = 417;
+  const size_t kFrameCount = 4;
+  Bytes bytes(kFrameLength * kFrameCount, 0);
+  for (size_t frame = 0; frame < kFrameCount; frame++) {
+    const uint8_t header[] = {0xFF, 0xFB, 0x90, 0x00};
+    std::memcpy(bytes.data() + frame * kFrameLength, header, sizeof(header));
+  }
+  // Stereo MPEG-1 has 32 bytes of side information.
+  auto *info = bytes.data() + 4 + 32;
+  std::memcpy(info, "Info", 4);
+  info[7] = 1;  // The frame count follows.
+  info[11] = (uint8_t)(kFrameCount - 1);
+  auto *lame = info + 12;
+  std::memcpy(lame, "LAME3.100", 9);
+  uint32_t trim = delay << 12 | padding;
+  lame[21] = (uint8_t)(trim >> 16);
+  lame[22] = (uint8_t)(trim >> 8);
+  lame[23] = (uint8_t)trim;
+  return bytes;
+}
+
+Bytes M4aWithItunSmpb(const std::string &smpb) {
+  Bytes version(4, 0);
+  Bytes handler = version;
+  AppendBe32(&handler, 0);
+  AppendText(&handler, "mdir");
+  handler.resize(handler.size() + 13, 0);
+  Bytes data_header;
+  AppendBe32(&data_header, 1);  // UTF-8.
+  AppendBe32(&data_header, 0);
+  Bytes value = data_header;
+  AppendText(&value, smpb);
+  Bytes mean_text = version;
+  AppendText(&mean_text, "com.apple.iTunes");
+  Bytes name_text = version;
+  AppendText(&name_text, "iTunSMPB");
+  auto item = Mp4Box("----", Concat({Mp4Box("mean", mean_text), Mp4Box("name", name_text), Mp4Box("data", value)}));
+  auto meta = Mp4Box("meta", Concat({version, Mp4Box("hdlr", handler), Mp4Box("ilst", item)}));
+  Bytes brand;
+  AppendText(&brand, "M4A ");
+  AppendBe32(&brand, 0);
+  return Concat({Mp4Box("ftyp", brand), Mp4Box("moov", Mp4Box("udta", meta))});
+}
+
+TEST(GaplessTest, ReadsTheLameTagAndAddsTheMp3DecoderDelay) {
+  auto bytes = Mp3WithLameTag(576, 1000);
+  auto metadata = MetadataProbe::probe(bytes.data(), bytes.size(), false);
+  ASSERT_TRUE(metadata);
+  EXPECT_EQ(metadata->format, "mp3");
+  EXPECT_EQ(metadata->encoderDelay, 576);
+  EXPECT_EQ(metadata->encoderPadding, 1000);
+
+  auto trim = encoderTrimOf(*metadata);
+  EXPECT_EQ(trim.delayFrames, 576 + MetadataProbe::kMp3DecoderDelay);
+  EXPECT_EQ(trim.paddingFrames, 1000 - MetadataProbe::kMp3DecoderDelay);
+}
+
+TEST(GaplessTest, ReadsITunSmpbOfMp4Files) {
+  auto bytes = M4aWithItunSmpb(" 00000000 00000840 000001CC 0000000000046E34 00000000");
+  auto metadata = MetadataProbe::probe(bytes.data(), bytes.size(), false);
+  ASSERT_TRUE(metadata);
+  EXPECT_EQ(metadata->format, "mp4");
+
+  auto trim = encoderTrimOf(*metadata);
+  EXPECT_EQ(trim.delayFrames, 0x840);
+  EXPECT_EQ(trim.paddingFrames, 0x1CC);
+}
+
+TEST(GaplessTest, TrimsNothingWithoutATag) {
+  TrackMetadata metadata{};
+  metadata.format = "mp3";
+  auto trim = encoderTrimOf(metadata);
+  EXPECT_EQ(trim.delayFrames, 0);
+  EXPECT_EQ(trim.paddingFrames, 0);
+}
+
+// Decodes part of a sine between an encoder delay and padding of loud junk,
+// which must never be heard.
+class PaddedDecoder : public GeneratedDecoder {
+ public:
+  PaddedDecoder(AudioFormat format, int64_t start, int64_t length, EncoderTrim trim,
+                std::function<float(int64_t)> signal)
+      : GeneratedDecoder(format, trim.delayFrames + length + trim.paddingFrames,
+                         [=](int64_t frame) {
+                           auto audio = frame - trim.delayFrames;
+                           return audio < 0 || audio >= length ? 0.9f : signal(start + audio);
+                         }),
+        trim_(trim) {}
+
+  EncoderTrim getEncoderTrim() const override { return trim_; }
+
+ private:
+  EncoderTrim trim_;
+};
+
+TEST(GaplessTest, JoinsTwoHalvesOfASineWithoutAGapOrClick) {
+  const AudioFormat format{48000, 2};
+  const int64_t kSplit = 20011;
+  const int64_t kTotal = 48000;
+  // A cosine, so that the first frame heard is not silent.
+  auto signal = [](int64_t frame) { return 0.5f * (float)std::cos(2 * 3.14159265358979 * 440 * frame / 48000); };
+  auto decoders = std::make_shared<DecoderRegistry>();
+  decoders->add([=](const AudioSourceSpec &source) -> std::unique_ptr<AudioDecoder> {
+    if (source.uri == "part:first") {
+      return std::make_unique<PaddedDecoder>(format, 0, kSplit, EncoderTrim{1105, 471}, signal);
+    }
+    if (source.uri == "part:second") {
+      return std::make_unique<PaddedDecoder>(format, kSplit, kTotal - kSplit, EncoderTrim{2112, 460}, signal);
+    }
+    return nullptr;
+  });
+
+  auto capacity = (size_t)kTotal + format.sampleRate;
+  auto sink = std::make_shared<CaptureSink>(format, capacity);
+  {
+    SoftwareBackend backend(sink, decoders);
+    AudioSourceSpec playlist{};
+    playlist.type = AudioSourceSpec::Type::concatenating;
+    for (auto uri : {"part:first", "part:second"}) {
+      AudioSourceSpec item{};
+      item.uri = uri;
+      playlist.children.push_back(item);
+    }
+    backend.load(playlist, std::nullopt, 0);
+    backend.play();
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(10);
+    while (backend.getState().processingState != ProcessingState::completed &&
+           std::chrono::steady_clock::now() < deadline) {
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    ASSERT_EQ(backend.getState().processingState, ProcessingState::completed);
+    EXPECT_EQ(backend.getState().underrunCount, 0u);
+  }
+
+  std::vector<float> output(capacity * format.channels);
+  auto frames = (int64_t)sink->read(output.data(), capacity);
+  int64_t first = 0;
+  while (first < frames && output[first * format.channels] == 0.0f) {
+    first++;
+  }
+  ASSERT_LE(first + kTotal, frames);
+
+  // The largest step between two frames of the sine itself.
+  auto max_step = 0.5 * 2 * 3.14159265358979 * 440 / 48000;
+  for (int64_t f = 0; f < kTotal; f++) {
+    auto *frame = &output[(first + f) * format.channels];
+    ASSERT_NEAR(frame[0], signal(f), 1e-5) << "at frame " << f;
+    ASSERT_NEAR(frame[1], signal(f), 1e-5) << "at frame " << f;
+    if (f > 0) {
+      ASSERT_LE(std::abs(frame[0] - frame[-(int64_t)format.channels]), max_step + 1e-5) << "at frame " << f;
+    }
+  }
+  for (auto f = first + kTotal; f < frames; f++) {
+    ASSERT_EQ(output[f * format.channels], 0.0f) << "padding heard at frame " << f - first;
+  }
+}
+
+}  // namespace
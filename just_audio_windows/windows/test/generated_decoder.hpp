@@ -0,0 +1,51 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <functional>
+#include <optional>
+
+#include "audio_decoder.hpp"
+
+// Plays a function of the frame index on every channel, for tests and
+// benchmarks that need no file.
+class GeneratedDecoder : public AudioDecoder
+{
+public:
+	GeneratedDecoder(AudioFormat format, int64_t length, std::function<float(int64_t)> generate)
+		: format(format), length(length), generate(generate)
+	{
+	}
+
+	AudioFormat getFormat() const override
+	{
+		return format;
+	}
+
+	std::optional<int64_t> getLength() const override
+	{
+		return length;
+	}
+
+	size_t read(float* output, size_t frames) override
+	{
+		auto count = (size_t)std::min<int64_t>((int64_t)frames, length - position);
+		for (size_t f = 0; f < count; f++, position++)
+		{
+			std::fill(output + f * format.channels, output + (f + 1) * format.channels, generate(position));
+		}
+		return count;
+	}
+
+	bool seek(int64_t frame) override
+	{
+		position = std::clamp<int64_t>(frame, 0, length);
+		return true;
+	}
+
+private:
+	AudioFormat format;
+	int64_t length;
+	std::function<float(int64_t)> generate;
+	int64_t position = 0;
+};
@@ -0,0 +1,205 @@
+#include <gtest/gtest.h>
+
+#include <cstdint>
+#include <map>
+#include <optional>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "icy_metadata.hpp"
+#include "loopback_server.hpp"
+
+namespace {
+
+using Bytes = std::vector<uint8_t>;
+
+// A metadata block: its length byte, then the text padded to 16 bytes.
+Bytes MetadataBlock(const std::string &text) {
+  Bytes block(1 + (text.size() + 15) / 16 * 16, 0);
+  block[0] = (uint8_t)((text.size() + 15) / 16);
+  std::copy(text.begin(), text.end(), block.begin() + 1);
+  return block;
+}
+
+// An ICY stream of |audio| with a block from |blocks| after every |interval|
+// audio bytes, an empty one once they run out.
+Bytes IcyStream(const Bytes &audio, uint32_t interval, const std::vector<std::string> &blocks) {
+  Bytes stream;
+  size_t block = 0;
+  for (size_t offset = 0; offset < audio.size(); offset += interval) {
+    auto end = std::min(audio.size(), offset + interval);
+    stream.insert(stream.end(), audio.begin() + offset, audio.begin() + end);
+    if (end - offset == interval) {
+      auto metadata = MetadataBlock(block < blocks.size() ? blocks[block++] : "");
+      stream.insert(stream.end(), metadata.begin(), metadata.end());
+    }
+  }
+  return stream;
+}
+
+TEST(IcyMetadataTest, SeparatesAudioAndTitlesFromChunksOfAnySize) {
+  const uint32_t kInterval = 1000;
+  Bytes audio(25500);
+  for (size_t i = 0; i < audio.size(); i++) {
+    audio[i] = (uint8_t)(i * 7 + 3);
+  }
+  std::vector<std::string> blocks = {
+      "StreamTitle='First';StreamUrl='';",
+      "StreamTitle='First';StreamUrl='';",
+      "StreamTitle='It''s; a title';",
+      "StreamTitle='Caf\xe9';",
+  };
+  auto stream = IcyStream(audio, kInterval, blocks);
+
+  // Chunks of 1 to 700 bytes, so that they split length bytes, blocks and
+  // audio anywhere, as network reads do.
+  std::mt19937 random(42);
+  std::uniform_int_distribution<size_t> sizes(1, 700);
+  IcyParser parser(kInterval);
+  Bytes output;
+  std::vector<std::string> titles;
+  for (size_t offset = 0; offset < stream.size();) {
+    auto size = std::min(sizes(random), stream.size() - offset);
+    Bytes chunk(stream.begin() + offset, stream.begin() + offset + size);
+    auto kept = parser.strip(chunk.data(), chunk.size());
+    output.insert(output.end(), chunk.begin(), chunk.begin() + kept);
+    IcyInfo info;
+    if (parser.takeInfo(info)) {
+      titles.push_back(info.title.value_or(""));
+    }
+    offset += size;
+  }
+
+  EXPECT_EQ(output, audio);
+  // Repeated and empty blocks change nothing; Latin-1 becomes UTF-8.
+  EXPECT_EQ(titles, (std::vector<std::string>{"First", "It''s; a title", "Caf\xc3\xa9"}));
+}
+
+// Reads the status line and headers of a response, returning the headers by
+// lower-case name.
+std::map<std::string, std::string> ReadResponseHead(LoopbackServer::Socket socket) {
+  std::string head;
+  uint8_t byte;
+  while (head.find("\r\n\r\n") == std::string::npos && LoopbackServer::receive(socket, &byte, 1) == 1) {
+    head.push_back((char)byte);
+  }
+  std::map<std::string, std::string> headers;
+  size_t line = head.find("\r\n") + 2;
+  for (auto end = head.find("\r\n", line); end != std::string::npos && end > line; end = head.find("\r\n", line)) {
+    auto colon = head.find(':', line);
+    std::string name;
+    for (auto i = line; i < colon; i++) {
+      name.push_back((char)std::tolower((unsigned char)head[i]));
+    }
+    headers[name] = head.substr(head.find_first_not_of(' ', colon + 1), end - head.find_first_not_of(' ', colon + 1));
+    line = end + 2;
+  }
+  return headers;
+}
+
+// A stream from a stand-in server on a loopback port, sent in TCP writes that
+// split blocks anywhere, read as LiveStream reads it for the decoder.
+TEST(IcyMetadataTest, StripsMetadataFromAServedStreamAtItsInterval) {
+  const uint32_t kInterval = 8000;
+  Bytes audio(IcyStreamReader::kHeadSize * 3 + 1234);
+  for (size_t i = 0; i < audio.size(); i++) {
+    audio[i] = (uint8_t)(i * 13 + 5);
+  }
+  std::vector<std::string> blocks;
+  for (int song = 0; song < 8; song++) {
+    for (int repeat = 0; repeat < 3; repeat++) {
+      blocks.push_back("StreamTitle='Song " + std::to_string(song) + "';");
+    }
+  }
+  auto stream = IcyStream(audio, kInterval, blocks);
+
+  std::string request;
+  LoopbackServer server([&](const std::string &received, LoopbackServer::Connection &connection) {
+    request = received;
+    std::string head = "ICY 200 OK\r\nicy-name: Loopback\r\nicy-metaint: 8000\r\n\r\n";
+    connection.send(Bytes(head.begin(), head.end()), head.size());
+    connection.send(stream, 1379);
+  });
+  ASSERT_NE(server.getPort(), 0);
+  auto socket = server.connect("GET /; HTTP/1.0\r\nIcy-MetaData: 1\r\n\r\n");
+  ASSERT_NE(socket, LoopbackServer::kNoSocket);
+  auto response = ReadResponseHead(socket);
+  auto headers = IcyHeaders::parse([&](const char *name) -> std::optional<std::string> {
+    auto it = response.find(name);
+    return it == response.end() ? std::nullopt : std::optional<std::string>(it->second);
+  });
+  ASSERT_EQ(headers.metadataInterval, (int32_t)kInterval);
+  EXPECT_EQ(headers.name, "Loopback");
+
+  // Each title with the number of audio bytes before it.
+  std::vector<std::pair<uint64_t, std::string>> titles;
+  IcyStreamReader *reading = nullptr;
+  IcyStreamReader reader(
+      (uint32_t)*headers.metadataInterval,
+      [&](uint8_t *data, size_t length) { return LoopbackServer::receive(socket, data, length); },
+      [&](const IcyInfo &info) { titles.push_back({reading->getLivePosition(), info.title.value_or("")}); });
+  reading = &reader;
+
+  // The decoder probes the format, then rewinds to the start.
+  Bytes output(audio.size() + 4096);
+  size_t probed = 0;
+  while (probed < 10000) {
+    auto length = reader.read(output.data() + probed, 4096);
+    ASSERT_GT(length, 0u);
+    probed += length;
+  }
+  reader.seek(0);
+  size_t read = 0;
+  while (auto length = reader.read(output.data() + read, 4096)) {
+    read += length;
+  }
+  LoopbackServer::closeSocket(socket);
+  output.resize(read);
+
+  EXPECT_NE(request.find("Icy-MetaData: 1"), std::string::npos);
+  EXPECT_EQ(output, audio);
+  ASSERT_EQ(titles.size(), 8u);
+  for (size_t song = 0; song < titles.size(); song++) {
+    // Each song's first block follows the interval of audio it ends.
+    EXPECT_EQ(titles[song].first, (song * 3 + 1) * kInterval);
+    EXPECT_EQ(titles[song].second, "Song " + std::to_string(song));
+  }
+
+  // The head is still there to rewind into; nothing before the live edge
+  // past it is.
+  reader.seek(100);
+  ASSERT_EQ(reader.read(output.data(), 10), 10u);
+  EXPECT_EQ(output[0], audio[100]);
+  reader.seek(IcyStreamReader::kHeadSize);
+  EXPECT_THROW(reader.read(output.data(), 10), std::runtime_error);
+}
+
+TEST(IcyMetadataTest, ReadsTheIcyHeaders) {
+  std::map<std::string, std::string> response = {
+      {"icy-br", "128"}, {"icy-name", "Radio"}, {"icy-metaint", "16000"}, {"icy-pub", "1"}};
+  auto headers = IcyHeaders::parse([&](const char *name) -> std::optional<std::string> {
+    auto it = response.find(name);
+    return it == response.end() ? std::nullopt : std::optional<std::string>(it->second);
+  });
+  EXPECT_EQ(headers.bitrate, 128);
+  EXPECT_EQ(headers.name, "Radio");
+  EXPECT_EQ(headers.metadataInterval, 16000);
+  EXPECT_EQ(headers.isPublic, true);
+  EXPECT_FALSE(headers.genre);
+}
+
+TEST(IcyMetadataTest, KnowsStreamsOnlyFromHintsInTheRequest) {
+  std::map<std::string, std::string> none;
+  EXPECT_FALSE(IcyHeaders::isKnownStream("https://example.com/music/song.mp3", none));
+  EXPECT_FALSE(IcyHeaders::isKnownStream("https://example.com/song.mp3?a=1;b=2", none));
+  EXPECT_TRUE(IcyHeaders::isKnownStream("http://radio.example.com:8000/;", none));
+  EXPECT_TRUE(IcyHeaders::isKnownStream("http://radio.example.com:8000/;stream.mp3", none));
+  EXPECT_TRUE(IcyHeaders::isKnownStream("https://example.com/live", {{"icy-metadata", "1"}}));
+  EXPECT_TRUE(IcyHeaders::isKnownStream("https://example.com/live", {{"Icy-MetaData", "1"}}));
+  EXPECT_FALSE(IcyHeaders::isKnownStream("https://example.com/live", {{"Icy-MetaData", "0"}}));
+}
+
+}  // namespace
@@ -0,0 +1,170 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <thread>
+#include <vector>
+
+#ifdef _WIN32
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#else
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#endif
+
+// A TCP server on a loopback port that answers one connection, standing in
+// for a streaming server in tests. |respond| is given the request head and
+// the connection, and sends the response through it.
+class LoopbackServer
+{
+public:
+#ifdef _WIN32
+	using Socket = SOCKET;
+	static constexpr Socket kNoSocket = INVALID_SOCKET;
+#else
+	using Socket = int;
+	static constexpr Socket kNoSocket = -1;
+#endif
+
+	class Connection
+	{
+	public:
+		explicit Connection(Socket socket)
+			: socket(socket)
+		{
+		}
+
+		/// Sends all of |data|, in writes of at most |chunkSize| bytes, each
+		/// sent on its own so that the client sees them split.
+		bool send(const std::vector<uint8_t>& data, size_t chunkSize)
+		{
+			for (size_t offset = 0; offset < data.size(); offset += chunkSize)
+			{
+				auto length = (int)std::min(chunkSize, data.size() - offset);
+				if (::send(socket, (const char*)data.data() + offset, length, 0) != length)
+				{
+					return false;
+				}
+				if (offset % (chunkSize * 16) == 0)
+				{
+					std::this_thread::sleep_for(std::chrono::microseconds(100));
+				}
+			}
+			return true;
+		}
+
+	private:
+		Socket socket;
+	};
+
+	using Respond = std::function<void(const std::string& request, Connection& connection)>;
+
+	explicit LoopbackServer(Respond respond)
+	{
+#ifdef _WIN32
+		WSADATA data;
+		WSAStartup(MAKEWORD(2, 2), &data);
+#endif
+		listener = ::socket(AF_INET, SOCK_STREAM, 0);
+		sockaddr_in address{};
+		address.sin_family = AF_INET;
+		address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+		address.sin_port = 0;
+		if (listener == kNoSocket || bind(listener, (sockaddr*)&address, sizeof(address)) != 0 || listen(listener, 1) != 0)
+		{
+			return;
+		}
+		socklen_t length = sizeof(address);
+		getsockname(listener, (sockaddr*)&address, &length);
+		port = ntohs(address.sin_port);
+
+		thread = std::thread([this, respond]()
+			{
+				auto client = accept(listener, nullptr, nullptr);
+				if (client == kNoSocket)
+				{
+					return;
+				}
+				int noDelay = 1;
+				setsockopt(client, IPPROTO_TCP, TCP_NODELAY, (const char*)&noDelay, sizeof(noDelay));
+				std::string request{};
+				char byte;
+				while (request.find("\r\n\r\n") == std::string::npos && recv(client, &byte, 1, 0) == 1)
+				{
+					request.push_back(byte);
+				}
+				Connection connection(client);
+				respond(request, connection);
+				closeSocket(client); });
+	}
+
+	~LoopbackServer()
+	{
+		if (thread.joinable())
+		{
+			thread.join();
+		}
+		if (listener != kNoSocket)
+		{
+			closeSocket(listener);
+		}
+#ifdef _WIN32
+		WSACleanup();
+#endif
+	}
+
+	// Prevent copying.
+	LoopbackServer(LoopbackServer const&) = delete;
+	LoopbackServer& operator=(LoopbackServer const&) = delete;
+
+	/// The port listened on, or zero if the server could not listen.
+	uint16_t getPort() const
+	{
+		return port;
+	}
+
+	/// Connects to the server and sends |request|, returning the socket.
+	Socket connect(const std::string& request) const
+	{
+		auto client = ::socket(AF_INET, SOCK_STREAM, 0);
+		sockaddr_in address{};
+		address.sin_family = AF_INET;
+		address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+		address.sin_port = htons(port);
+		if (client == kNoSocket || ::connect(client, (sockaddr*)&address, sizeof(address)) != 0)
+		{
+			return kNoSocket;
+		}
+		::send(client, request.data(), (int)request.size(), 0);
+		return client;
+	}
+
+	/// Receives up to |length| bytes, waiting for at least one; zero once the
+	/// server closed the connection.
+	static size_t receive(Socket socket, uint8_t* data, size_t length)
+	{
+		auto received = recv(socket, (char*)data, (int)length, 0);
+		return received > 0 ? (size_t)received : 0;
+	}
+
+	static void closeSocket(Socket socket)
+	{
+#ifdef _WIN32
+		closesocket(socket);
+#else
+		close(socket);
+#endif
+	}
+
+private:
+	Socket listener = kNoSocket;
+	uint16_t port = 0;
+	std::thread thread;
+};
@@ -0,0 +1,67 @@
+#include <gtest/gtest.h>
+
+#include <cmath>
+#include <filesystem>
+#include <fstream>
+#include <memory>
+#include <string>
+
+#include "generated_decoder.hpp"
+#include "loudness_analyzer.hpp"
+
+namespace {
+
+class LoudnessAnalyzerTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    directory_ = std::filesystem::temp_directory_path() /
+                 ("just_audio_windows_loudness_" + std::to_string(::testing::UnitTest::GetInstance()->random_seed()));
+    std::filesystem::create_directories(directory_);
+    // Not a WAV file, so only the registry given to the analyzer decodes it,
+    // as Media Foundation does compressed files in the plugin.
+    path_ = (directory_ / "tone.mp3").string();
+    std::ofstream(path_, std::ios::binary) << "not a wave file";
+  }
+
+  void TearDown() override {
+    std::error_code error;
+    std::filesystem::remove_all(directory_, error);
+  }
+
+  std::filesystem::path directory_;
+  std::string path_;
+};
+
+TEST_F(LoudnessAnalyzerTest, DecodesThroughTheRegistryItIsGiven) {
+  auto decoders = std::make_shared<DecoderRegistry>();
+  auto path = path_;
+  decoders->add([path](const AudioSourceSpec &source) -> std::unique_ptr<AudioDecoder> {
+    if (source.uri != path) {
+      return nullptr;
+    }
+    // Ten seconds of a 1 kHz sine at -6 dBFS on both channels.
+    return std::make_unique<GeneratedDecoder>(AudioFormat{48000, 2}, 480000, [](int64_t frame) {
+      return 0.5f * (float)std::sin(2 * 3.14159265358979 * 1000 * frame / 48000);
+    });
+  });
+
+  LoudnessAnalyzer analyzer(std::make_shared<LoudnessCache>(directory_ / "cache"), decoders, 1);
+  LoudnessStatistics statistics;
+  auto results = analyzer.analyze({path_}, statistics);
+  ASSERT_EQ(results.size(), 1u);
+  ASSERT_TRUE(results[0].result);
+  EXPECT_NEAR(results[0].result->integratedLufs, -6.02, 0.5);
+  EXPECT_NEAR(results[0].result->truePeakDb, -6.02, 0.5);
+  EXPECT_EQ(statistics.failed, 0u);
+}
+
+TEST_F(LoudnessAnalyzerTest, FailsFilesNoDecoderOpens) {
+  LoudnessAnalyzer analyzer(std::make_shared<LoudnessCache>(directory_ / "cache"), std::make_shared<DecoderRegistry>(), 1);
+  LoudnessStatistics statistics;
+  auto results = analyzer.analyze({path_}, statistics);
+  ASSERT_EQ(results.size(), 1u);
+  EXPECT_FALSE(results[0].result);
+  EXPECT_EQ(statistics.failed, 1u);
+}
+
+}  // namespace
@@ -0,0 +1,310 @@
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include "mixer.hpp"
+
+namespace {
+
+const AudioFormat kStereo{48000, 2};
+
+// Renders a constant, and can be told to be not ready.
+class ConstantInput : public MixerInput {
+ public:
+  explicit ConstantInput(float level) : level_(level) {}
+
+  size_t render(float *output, size_t frames) override {
+    std::fill(output, output + frames * kStereo.channels, level_);
+    rendered_ += frames;
+    return frames;
+  }
+
+  bool isReady(size_t frames) override { return ready_; }
+
+  void onStolen() override { stolen_ = true; }
+
+  void set_ready(bool ready) { ready_ = ready; }
+  bool stolen() const { return stolen_; }
+  size_t rendered() const { return rendered_; }
+
+ private:
+  float level_;
+  bool ready_ = true;
+  bool stolen_ = false;
+  size_t rendered_ = 0;
+};
+
+TEST(MixerTest, SumsVoicesWithTheirGainAndPan) {
+  Mixer mixer(kStereo, nullptr);
+  ConstantInput first(0.5f);
+  ConstantInput second(0.25f);
+  VoiceSettings settings{};
+  settings.gain = 0.5f;
+  mixer.addVoice(&first, settings);
+  settings.gain = 1.0f;
+  settings.pan = 1.0f;
+  mixer.addVoice(&second, settings);
+
+  std::vector<float> output(Mixer::kDefaultBlockFrames * kStereo.channels);
+  EXPECT_EQ(mixer.mix(output.data(), Mixer::kDefaultBlockFrames), 2u);
+  for (size_t frame = 0; frame < Mixer::kDefaultBlockFrames; frame++) {
+    // Panned right, the second voice is gone from the left only.
+    ASSERT_FLOAT_EQ(output[frame * 2], 0.25f);
+    ASSERT_FLOAT_EQ(output[frame * 2 + 1], 0.5f);
+  }
+}
+
+TEST(MixerTest, StealsTheLowestPriorityVoiceOnlyForAHigherOne) {
+  Mixer mixer(kStereo, nullptr, 2);
+  ConstantInput low(0.1f);
+  ConstantInput middle(0.1f);
+  ConstantInput high(0.1f);
+  ConstantInput late(0.1f);
+  VoiceSettings settings{};
+  settings.priority = 0;
+  EXPECT_NE(mixer.addVoice(&low, settings), 0u);
+  settings.priority = 1;
+  EXPECT_NE(mixer.addVoice(&middle, settings), 0u);
+  settings.priority = 2;
+  EXPECT_NE(mixer.addVoice(&high, settings), 0u);
+  EXPECT_TRUE(low.stolen());
+  EXPECT_FALSE(middle.stolen());
+
+  settings.priority = 1;
+  EXPECT_EQ(mixer.addVoice(&late, settings), 0u);
+  auto statistics = mixer.getStatistics();
+  EXPECT_EQ(statistics.voices, 2u);
+  EXPECT_EQ(statistics.stolenVoices, 1u);
+  EXPECT_EQ(statistics.rejectedVoices, 1u);
+}
+
+TEST(MixerTest, StartsAVoiceAtItsFrameWithinABlock) {
+  Mixer mixer(kStereo, nullptr);
+  ConstantInput input(0.5f);
+  mixer.addVoice(&input, VoiceSettings{}, 100);
+
+  std::vector<float> output(Mixer::kDefaultBlockFrames * kStereo.channels);
+  mixer.mix(output.data(), Mixer::kDefaultBlockFrames);
+  EXPECT_EQ(output[99 * 2], 0.0f);
+  EXPECT_EQ(output[100 * 2], 0.5f);
+  EXPECT_EQ(input.rendered(), Mixer::kDefaultBlockFrames - 100);
+  EXPECT_EQ(mixer.getFramePosition(), Mixer::kDefaultBlockFrames);
+}
+
+TEST(MixerTest, RendersAGroupTogetherOrNotAtAll) {
+  Mixer mixer(kStereo, nullptr);
+  ConstantInput ready(0.5f);
+  ConstantInput late(0.25f);
+  VoiceSettings settings{};
+  settings.group = mixer.createGroup();
+  mixer.addVoice(&ready, settings, Mixer::kHeld);
+  mixer.addVoice(&late, settings, Mixer::kHeld);
+  EXPECT_EQ(mixer.startGroup(settings.group, 0), 0u);
+
+  std::vector<float> output(Mixer::kDefaultBlockFrames * kStereo.channels);
+  late.set_ready(false);
+  EXPECT_EQ(mixer.mix(output.data(), Mixer::kDefaultBlockFrames), 0u);
+  EXPECT_EQ(ready.rendered(), 0u);
+  EXPECT_EQ(mixer.getStatistics().groupStalls, 1u);
+
+  late.set_ready(true);
+  EXPECT_EQ(mixer.mix(output.data(), Mixer::kDefaultBlockFrames), 2u);
+  EXPECT_EQ(ready.rendered(), late.rendered());
+
+  mixer.holdGroup(settings.group);
+  EXPECT_EQ(mixer.mix(output.data(), Mixer::kDefaultBlockFrames), 0u);
+  EXPECT_EQ(ready.rendered(), Mixer::kDefaultBlockFrames);
+}
+
+// Renders silence on the mixer thread, recording where it was heard first and
+// whether it was rendered once its owner stopped it.
+class WatchedInput : public MixerInput {
+ public:
+  explicit WatchedInput(const Mixer *mixer) : mixer_(mixer) {}
+
+  size_t render(float *output, size_t frames) override {
+    std::fill(output, output + frames * kStereo.channels, 0.0f);
+    if (stopped_.load()) {
+      rendered_after_stop_++;
+    }
+    // A voice starting within the block renders its end.
+    uint64_t frame = mixer_->getFramePosition() + Mixer::kDefaultBlockFrames - frames;
+    uint64_t unset = Mixer::kHeld;
+    first_frame_.compare_exchange_strong(unset, frame);
+    return frames;
+  }
+
+  void reset() {
+    stopped_ = false;
+    first_frame_ = Mixer::kHeld;
+  }
+  void stop() { stopped_ = true; }
+  uint64_t first_frame() const { return first_frame_.load(); }
+  int rendered_after_stop() const { return rendered_after_stop_.load(); }
+
+ private:
+  const Mixer *mixer_;
+  std::atomic<bool> stopped_ = false;
+  std::atomic<uint64_t> first_frame_ = Mixer::kHeld;
+  std::atomic<int> rendered_after_stop_ = 0;
+};
+
+TEST(MixerTest, NeverRendersAVoiceOnceRemoveVoiceReturns) {
+  // Not real-time, so that the mixer thread mixes as fast as it can.
+  Mixer mixer(kStereo, std::make_shared<NullSink>(kStereo, false));
+  ConstantInput background(0.0f);
+  mixer.addVoice(&background, VoiceSettings{});
+  std::vector<std::unique_ptr<WatchedInput>> inputs;
+  for (int i = 0; i < 4; i++) {
+    inputs.push_back(std::make_unique<WatchedInput>(&mixer));
+  }
+  for (int round = 0; round < 500; round++) {
+    std::vector<uint64_t> ids;
+    for (auto &input : inputs) {
+      input->reset();
+      ids.push_back(mixer.addVoice(input.get(), VoiceSettings{}));
+    }
+    std::this_thread::sleep_for(std::chrono::microseconds(50));
+    for (size_t i = 0; i < inputs.size(); i++) {
+      mixer.removeVoice(ids[i]);
+      inputs[i]->stop();
+    }
+  }
+  mixer.close();
+  for (auto &input : inputs) {
+    EXPECT_EQ(input->rendered_after_stop(), 0);
+  }
+}
+
+TEST(MixerTest, StartsAGroupAtTheFrameStartGroupReturnsWhileMixing) {
+  Mixer mixer(kStereo, std::make_shared<NullSink>(kStereo, false));
+  ConstantInput background(0.0f);
+  mixer.addVoice(&background, VoiceSettings{});
+  WatchedInput input(&mixer);
+  VoiceSettings settings{};
+  settings.group = mixer.createGroup();
+  for (int round = 0; round < 200; round++) {
+    input.reset();
+    auto id = mixer.addVoice(&input, settings, Mixer::kHeld);
+    // Alternately as soon as possible and a little ahead, within a block.
+    auto requested = round % 2 ? mixer.getFramePosition() + 1000 : 0;
+    auto frame = mixer.startGroup(settings.group, requested);
+    EXPECT_GE(frame, requested);
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+    while (input.first_frame() == Mixer::kHeld && std::chrono::steady_clock::now() < deadline) {
+      std::this_thread::yield();
+    }
+    ASSERT_EQ(input.first_frame(), frame) << "in round " << round;
+    mixer.holdGroup(settings.group);
+    mixer.removeVoice(id);
+  }
+}
+
+// Mixes a full-scale constant through a ramp of |duration_us| from |from| to
+// |to| and returns the left channel from the block the ramp starts in on.
+std::vector<float> MixRamp(float from, float to, int64_t duration_us, VolumeRamp::Curve curve, size_t frames) {
+  Mixer mixer(kStereo, nullptr);
+  ConstantInput input(1.0f);
+  VoiceSettings settings{};
+  settings.gain = from;
+  auto voice = mixer.addVoice(&input, settings);
+  settings.gain = to;
+  mixer.setVoiceSettings(voice, settings, VolumeRamp{duration_us, curve});
+
+  std::vector<float> left;
+  std::vector<float> output(Mixer::kDefaultBlockFrames * kStereo.channels);
+  while (left.size() < frames) {
+    mixer.mix(output.data(), Mixer::kDefaultBlockFrames);
+    for (size_t frame = 0; frame < Mixer::kDefaultBlockFrames; frame++) {
+      EXPECT_EQ(output[frame * 2], output[frame * 2 + 1]);
+      left.push_back(output[frame * 2]);
+    }
+  }
+  return left;
+}
+
+TEST(MixerTest, RampsTheGainWithoutAStepLargerThanAnExactRamp) {
+  // 10 ms, as the gainRamps benchmark ramps by default.
+  const int64_t kDurationUs = 10000;
+  const size_t kRampFrames = 480;
+  for (auto curve : {VolumeRamp::Curve::linear, VolumeRamp::Curve::exponential}) {
+    auto exponential = curve == VolumeRamp::Curve::exponential;
+    SCOPED_TRACE(exponential ? "exponential" : "linear");
+    auto samples = MixRamp(0.0f, 1.0f, kDurationUs, curve, kRampFrames + Mixer::kDefaultBlockFrames);
+
+    // The largest step of an exact ramp is its last one when exponential.
+    auto expected_max_step = exponential ? 1.0 - std::pow((double)Mixer::kRampFloor, 1.0 / kRampFrames)
+                                         : 1.0 / kRampFrames;
+    double max_step = samples[0];
+    for (size_t frame = 1; frame < samples.size(); frame++) {
+      max_step = std::max(max_step, (double)std::abs(samples[frame] - samples[frame - 1]));
+      if (frame < kRampFrames) {
+        ASSERT_GE(samples[frame], samples[frame - 1]) << "at frame " << frame;
+      }
+    }
+    EXPECT_LE(max_step, expected_max_step * 1.001);
+    EXPECT_LT(samples[kRampFrames - 1], 1.0f);
+    for (auto frame = kRampFrames; frame < samples.size(); frame++) {
+      ASSERT_EQ(samples[frame], 1.0f) << "at frame " << frame;
+    }
+  }
+}
+
+TEST(MixerTest, RampsDownToSilenceAndStaysThere) {
+  const size_t kRampFrames = 4800;
+  for (auto curve : {VolumeRamp::Curve::linear, VolumeRamp::Curve::exponential}) {
+    auto exponential = curve == VolumeRamp::Curve::exponential;
+    SCOPED_TRACE(exponential ? "exponential" : "linear");
+    auto samples = MixRamp(1.0f, 0.0f, 100000, curve, kRampFrames + Mixer::kDefaultBlockFrames);
+    // Falling, the largest step of an exponential ramp is its first one.
+    auto expected_max_step = exponential ? 1.0 - std::pow((double)Mixer::kRampFloor, 1.0 / kRampFrames)
+                                         : 1.0 / kRampFrames;
+    EXPECT_FLOAT_EQ(samples[0], 1.0f);
+    for (size_t frame = 1; frame < kRampFrames; frame++) {
+      ASSERT_LE(samples[frame], samples[frame - 1]) << "at frame " << frame;
+      ASSERT_LE(samples[frame - 1] - samples[frame], expected_max_step * 1.001) << "at frame " << frame;
+    }
+    for (auto frame = kRampFrames; frame < samples.size(); frame++) {
+      ASSERT_EQ(samples[frame], 0.0f) << "at frame " << frame;
+    }
+  }
+}
+
+TEST(MixerTest, AccumulatesARampAsTheScalarLoopDoes) {
+  for (uint32_t channels : {1u, 2u, 3u}) {
+    for (bool exponential : {false, true}) {
+      for (size_t frames : {0u, 1u, 2u, 3u, 5u, 64u, 511u}) {
+        SCOPED_TRACE(testing::Message() << channels << " channels, " << frames << " frames"
+                                        << (exponential ? ", exponential" : ", linear"));
+        const float kGain = 0.25f;
+        const float kStep = exponential ? 1.002f : 0.001f;
+        const float kLeft = 0.5f;
+        const float kRight = 0.75f;
+        std::vector<float> input(frames * channels);
+        for (size_t i = 0; i < input.size(); i++) {
+          input[i] = (float)std::sin(0.1 * i);
+        }
+        std::vector<float> output(input.size(), 0.125f);
+        Mixer::accumulateRamp(output.data(), input.data(), frames, channels, kGain, kStep, exponential, kLeft, kRight);
+
+        for (size_t frame = 0; frame < frames; frame++) {
+          auto gain = exponential ? kGain * std::pow((double)kStep, (double)frame) : kGain + (double)kStep * frame;
+          for (uint32_t channel = 0; channel < channels; channel++) {
+            auto scale = channels == 2 ? (channel ? kRight : kLeft) : 1.0f;
+            auto i = frame * channels + channel;
+            ASSERT_NEAR(output[i], 0.125 + input[i] * gain * scale, 1e-5)
+                << "at frame " << frame << ", channel " << channel;
+          }
+        }
+      }
+    }
+  }
+}
+
+}  // namespace
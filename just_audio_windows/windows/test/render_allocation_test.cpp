@@ -0,0 +1,113 @@
+#include <gtest/gtest.h>
+
+#include <chrono>
+#include <cmath>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "allocation_guard.hpp"
+#include "generated_decoder.hpp"
+#include "software_backend.hpp"
+
+namespace {
+
+const AudioFormat kFormat{48000, 2};
+const size_t kItemCount = 8;
+
+// Plays "tone:" URIs as a tone whose every fifth second is silent, for the
+// silence skipper to find, at a rate other than the output's, so that the
+// resampler runs too.
+std::shared_ptr<DecoderRegistry> CreateToneDecoders(int64_t item_frames) {
+  auto decoders = std::make_shared<DecoderRegistry>();
+  decoders->add([=](const AudioSourceSpec &source) -> std::unique_ptr<AudioDecoder> {
+    if (source.uri.rfind("tone:", 0) != 0) {
+      return nullptr;
+    }
+    return std::make_unique<GeneratedDecoder>(
+        AudioFormat{44100, kFormat.channels}, item_frames * 44100 / kFormat.sampleRate, [](int64_t frame) {
+          return frame / 44100 % 5 == 4 ? 0.0f : 0.3f * (float)std::sin(2 * 3.14159265358979 * 440 * frame / 44100);
+        });
+  });
+  return decoders;
+}
+
+// Half of the items clipped, so that clipping runs on the render path too.
+AudioSourceSpec CreatePlaylist() {
+  AudioSourceSpec playlist{};
+  playlist.type = AudioSourceSpec::Type::concatenating;
+  for (size_t i = 0; i < kItemCount; i++) {
+    AudioSourceSpec item{};
+    item.uri = "tone:" + std::to_string(i);
+    if (i % 2 == 0) {
+      playlist.children.push_back(item);
+      continue;
+    }
+    AudioSourceSpec clipping{};
+    clipping.type = AudioSourceSpec::Type::clipping;
+    clipping.startUs = 1000000;
+    clipping.children.push_back(item);
+    playlist.children.push_back(clipping);
+  }
+  return playlist;
+}
+
+// Plays ten minutes of playlist through every effect of a software backend
+// player, mixing each block as soon as the player is ready so that this runs
+// faster than real time, and fails on any heap allocation or free made while
+// mixing.
+TEST(RenderAllocationTest, MixesAPlaylistWithEveryEffectWithoutAllocating) {
+  ASSERT_TRUE(AllocationGuard::isEnabled());
+  const double seconds = 600;
+  auto mixer = std::make_shared<Mixer>(kFormat, nullptr);
+  auto block_frames = Mixer::kDefaultBlockFrames;
+  uint64_t allocations = 0;
+  uint64_t blocks = 0;
+  {
+    SoftwareBackend backend(mixer, CreateToneDecoders((int64_t)(seconds * kFormat.sampleRate / kItemCount)));
+    backend.setCrossfade(500000);
+    backend.setSpeed(1.25);
+    backend.setPitch(1.1);
+    backend.setSkipSilence(true, SkipSilenceOptions{});
+    backend.setEqualizerEnabled(true);
+    backend.setEqualizerBandGain(1, 6);
+    backend.setEqualizerBandGain(3, -4);
+    backend.setLoudnessEnhancerEnabled(true);
+    backend.setLoudnessEnhancerTargetGain(6);
+    backend.load(CreatePlaylist(), std::nullopt, 0);
+    backend.play();
+    backend.setVolume(0.5, VolumeRamp{200000, VolumeRamp::Curve::exponential});
+
+    std::vector<float> output(block_frames * kFormat.channels);
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(120);
+    while (backend.getState().processingState != ProcessingState::completed &&
+           std::chrono::steady_clock::now() < deadline) {
+      // Waits for the decoder like the mixer thread of a headless sink.
+      for (int i = 0; i < 1000 && !backend.isReady(block_frames); i++) {
+        std::this_thread::sleep_for(std::chrono::microseconds(200));
+      }
+      auto before = AllocationGuard::getCount();
+      size_t audible;
+      {
+        // Counts rather than aborts, so that the test reports how many.
+        RealtimeScope scope(AllocationGuard::Mode::count);
+        audible = mixer->mix(output.data(), block_frames);
+      }
+      allocations += AllocationGuard::getCount() - before;
+      if (audible == 0) {
+        // Played to the end; the player notices on its own thread.
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        continue;
+      }
+      blocks++;
+    }
+    EXPECT_EQ(backend.getState().processingState, ProcessingState::completed);
+  }
+  EXPECT_EQ(allocations, 0u);
+  // Sped up, clipped and skipping silence, the playlist is heard in well
+  // under its length, but not in under a third of it.
+  EXPECT_GT((double)blocks * block_frames / kFormat.sampleRate, seconds / 3);
+}
+
+}  // namespace
@@ -0,0 +1,98 @@
+#include <gtest/gtest.h>
+
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+#include "benchmarks/resampler_benchmark.hpp"
+#include "resampler.hpp"
+
+namespace {
+
+struct Conversion {
+  uint32_t from_rate;
+  uint32_t to_rate;
+  double frequency;
+};
+
+// The rates sources come in, to the rates devices run at and back.
+const Conversion kConversions[] = {
+    {44100, 48000, 1000},
+    {48000, 44100, 1000},
+    {96000, 44100, 5000},
+    {22050, 48000, 3000},
+};
+
+// Each quality must stay this far below the sine, in dB, with some margin
+// over what it measures.
+void ExpectThdN(Resampler::Quality quality, double max_db) {
+  for (const auto &conversion : kConversions) {
+    auto result = benchmarkResampler(quality, conversion.from_rate, conversion.to_rate, conversion.frequency, 0.5);
+    EXPECT_LT(result.thdNDb, max_db) << conversion.from_rate << " Hz to " << conversion.to_rate << " Hz at "
+                                     << conversion.frequency << " Hz";
+  }
+}
+
+TEST(ResamplerTest, FastKeepsThdNBelow55Db) { ExpectThdN(Resampler::Quality::fast, -55); }
+
+TEST(ResamplerTest, BalancedKeepsThdNBelow85Db) { ExpectThdN(Resampler::Quality::balanced, -85); }
+
+TEST(ResamplerTest, BestKeepsThdNBelow100Db) { ExpectThdN(Resampler::Quality::best, -100); }
+
+// Every channel count, including those wider than the summed lanes, must be
+// converted channel by channel.
+TEST(ResamplerTest, KeepsEachChannelApart) {
+  for (uint32_t channels : {1u, 2u, 3u, 4u, 6u, 8u}) {
+    SCOPED_TRACE(testing::Message() << channels << " channels");
+    Resampler resampler(channels);
+    resampler.setStep(44100.0 / 48000);
+    auto before = resampler.getFramesBefore();
+    auto frames = before + resampler.getFramesAfter() + 1;
+    std::vector<float> source(frames * channels);
+    for (size_t frame = 0; frame < frames; frame++) {
+      for (uint32_t channel = 0; channel < channels; channel++) {
+        source[frame * channels + channel] = 0.1f * (float)(channel + 1);
+      }
+    }
+    std::vector<float> out(channels);
+    for (double fraction : {0.0, 0.3, 0.77}) {
+      resampler.interpolate(source.data() + before * channels, fraction, out.data());
+      for (uint32_t channel = 0; channel < channels; channel++) {
+        // Every phase passes a constant through unchanged.
+        EXPECT_NEAR(out[channel], 0.1f * (float)(channel + 1), 1e-5) << "at " << fraction << ", channel " << channel;
+      }
+    }
+  }
+}
+
+TEST(ResamplerTest, FollowsAGlidingStepWithoutAClick) {
+  const double pi = 3.14159265358979323846;
+  Resampler resampler(1);
+  auto before = resampler.getFramesBefore();
+  // Wide enough for the kernel at the largest narrowing.
+  auto margin = (size_t)(Resampler::kMaxNarrowing * 16) + before;
+  const size_t kOutputFrames = 48000;
+  std::vector<float> source(kOutputFrames * 2 + margin * 2);
+  for (size_t frame = 0; frame < source.size(); frame++) {
+    source[frame] = (float)(0.5 * std::sin(2 * pi * 200 * (double)frame / 48000));
+  }
+
+  // From half speed to one and a half, a little faster every frame.
+  double cursor = (double)margin;
+  float previous = 0;
+  for (size_t frame = 0; frame < kOutputFrames; frame++) {
+    auto step = 0.5 + (double)frame / kOutputFrames;
+    resampler.setStep(step);
+    auto index = (size_t)cursor;
+    float out;
+    resampler.interpolate(source.data() + index, cursor - (double)index, &out);
+    if (frame > 0) {
+      // The sine itself moves by at most this much at the fastest step.
+      ASSERT_LE(std::abs(out - previous), 0.5 * 2 * pi * 200 * 1.5 / 48000 * 1.05) << "at frame " << frame;
+    }
+    previous = out;
+    cursor += step;
+  }
+}
+
+}  // namespace
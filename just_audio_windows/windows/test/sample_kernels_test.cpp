@@ -0,0 +1,201 @@
+#include <gtest/gtest.h>
+
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "sample_kernels.hpp"
+
+namespace {
+
+using Conversion = void (*)(const uint8_t *, float *, size_t);
+
+// Runs each test against the kernels of every instruction set, skipping
+// those this CPU lacks.
+class SampleKernelsTest : public testing::TestWithParam<SimdLevel> {
+ protected:
+  void SetUp() override {
+    if (!SampleKernels::isSupported(GetParam())) {
+      GTEST_SKIP() << "not supported here";
+    }
+  }
+
+  const SampleKernels &kernels() const { return SampleKernels::forLevel(GetParam()); }
+  const SampleKernels &reference() const { return SampleKernels::forLevel(SimdLevel::scalar); }
+
+  // Converts all of |bytes|, then every length up to 64 from an offset that
+  // is not a multiple of any vector, and expects exactly the scalar floats.
+  void ExpectConversion(Conversion kernel, Conversion expected_kernel, const std::vector<uint8_t> &bytes,
+                        size_t width) {
+    auto count = bytes.size() / width;
+    std::vector<float> actual(count);
+    std::vector<float> expected(count);
+    kernel(bytes.data(), actual.data(), count);
+    expected_kernel(bytes.data(), expected.data(), count);
+    for (size_t i = 0; i < count; i++) {
+      ASSERT_EQ(actual[i], expected[i]) << "at sample " << i;
+    }
+    for (size_t length = 0; length <= 64; length++) {
+      std::fill(actual.begin(), actual.begin() + length + 1, 2.0f);
+      kernel(bytes.data() + width * 3, actual.data(), length);
+      expected_kernel(bytes.data() + width * 3, expected.data(), length);
+      for (size_t i = 0; i < length; i++) {
+        ASSERT_EQ(actual[i], expected[i]) << "at sample " << i << " of " << length;
+      }
+      ASSERT_EQ(actual[length], 2.0f) << "written past " << length;
+    }
+  }
+};
+
+std::vector<float> Noise(size_t count) {
+  std::vector<float> samples(count);
+  uint32_t seed = 1;
+  for (auto &sample : samples) {
+    seed = seed * 1664525 + 1013904223;
+    sample = (float)(int32_t)seed / 2147483648.0f;
+  }
+  return samples;
+}
+
+TEST_P(SampleKernelsTest, ConvertsEvery16BitSampleAsScalarDoes) {
+  std::vector<uint8_t> bytes(65536 * 2);
+  for (uint32_t value = 0; value < 65536; value++) {
+    bytes[value * 2] = (uint8_t)value;
+    bytes[value * 2 + 1] = (uint8_t)(value >> 8);
+  }
+  ExpectConversion(kernels().int16ToFloat, reference().int16ToFloat, bytes, 2);
+}
+
+TEST_P(SampleKernelsTest, ConvertsEvery24BitSampleAsScalarDoes) {
+  std::vector<uint8_t> bytes((size_t)(1 << 24) * 3);
+  for (uint32_t value = 0; value < (1u << 24); value++) {
+    bytes[value * 3] = (uint8_t)value;
+    bytes[value * 3 + 1] = (uint8_t)(value >> 8);
+    bytes[value * 3 + 2] = (uint8_t)(value >> 16);
+  }
+  ExpectConversion(kernels().int24ToFloat, reference().int24ToFloat, bytes, 3);
+}
+
+TEST_P(SampleKernelsTest, Converts32BitSamplesAsScalarDoes) {
+  // A spread over the whole range, the extremes included.
+  std::vector<uint8_t> bytes((size_t)(1 << 20) * 4);
+  for (uint32_t i = 0; i < (1u << 20); i++) {
+    auto value = i * 4099u + (i >> 4);
+    if (i == 7) {
+      value = 0x80000000u;
+    } else if (i == 8) {
+      value = 0x7FFFFFFFu;
+    }
+    std::memcpy(bytes.data() + i * 4, &value, 4);
+  }
+  ExpectConversion(kernels().int32ToFloat, reference().int32ToFloat, bytes, 4);
+}
+
+TEST_P(SampleKernelsTest, MapsChannelsAsScalarDoes) {
+  auto source = Noise(4096 * 6);
+  for (size_t frames = 0; frames <= 67; frames++) {
+    SCOPED_TRACE(testing::Message() << frames << " frames");
+    std::vector<float> actual(frames * 2 + 1, 2.0f);
+    std::vector<float> expected(frames * 2 + 1, 2.0f);
+    const float *input_planes[2] = {source.data(), source.data() + 4096};
+    kernels().interleave(input_planes, 2, frames, actual.data());
+    reference().interleave(input_planes, 2, frames, expected.data());
+    ASSERT_EQ(actual, expected) << "interleave";
+
+    std::vector<float> left(frames + 1, 2.0f);
+    std::vector<float> right(frames + 1, 2.0f);
+    std::vector<float> expected_left(frames + 1, 2.0f);
+    std::vector<float> expected_right(frames + 1, 2.0f);
+    float *planes[2] = {left.data(), right.data()};
+    float *expected_planes[2] = {expected_left.data(), expected_right.data()};
+    kernels().deinterleave(source.data(), 2, frames, planes);
+    reference().deinterleave(source.data(), 2, frames, expected_planes);
+    ASSERT_EQ(left, expected_left) << "deinterleave";
+    ASSERT_EQ(right, expected_right) << "deinterleave";
+
+    kernels().monoToStereo(source.data(), actual.data(), frames);
+    reference().monoToStereo(source.data(), expected.data(), frames);
+    ASSERT_EQ(actual, expected) << "monoToStereo";
+
+    kernels().stereoToMono(source.data(), actual.data(), frames);
+    reference().stereoToMono(source.data(), expected.data(), frames);
+    for (size_t i = 0; i <= frames; i++) {
+      ASSERT_NEAR(actual[i], expected[i], 1e-6) << "stereoToMono at " << i;
+    }
+
+    kernels().downmix51(source.data(), actual.data(), frames);
+    reference().downmix51(source.data(), expected.data(), frames);
+    for (size_t i = 0; i <= frames * 2; i++) {
+      ASSERT_NEAR(actual[i], expected[i], 1e-6) << "downmix51 at " << i;
+    }
+  }
+}
+
+TEST_P(SampleKernelsTest, AccumulatesAsScalarDoes) {
+  auto source = Noise(200);
+  for (size_t count = 0; count <= 133; count++) {
+    std::vector<float> actual(count + 1, 0.25f);
+    std::vector<float> expected(count + 1, 0.25f);
+    kernels().accumulate(actual.data(), source.data(), count, 0.7f);
+    reference().accumulate(expected.data(), source.data(), count, 0.7f);
+    for (size_t i = 0; i <= count; i++) {
+      ASSERT_NEAR(actual[i], expected[i], 1e-6) << "at " << i << " of " << count;
+    }
+  }
+}
+
+TEST_P(SampleKernelsTest, FiltersAsScalarDoes) {
+  auto input = Noise(512 * 3);
+  // Taps that sum to about one, as the resampler's do.
+  std::vector<float> first(input.begin() + 512, input.begin() + 1024);
+  std::vector<float> second(input.begin() + 1024, input.end());
+  for (auto &tap : first) {
+    tap /= 16;
+  }
+  for (auto &tap : second) {
+    tap /= 16;
+  }
+  for (uint32_t channels = 1; channels <= 8; channels++) {
+    for (size_t frames : {0u, 1u, 3u, 8u, 17u, 64u}) {
+      SCOPED_TRACE(testing::Message() << channels << " channels, " << frames << " frames");
+      auto count = frames * channels;
+      for (float weight : {0.0f, 0.4f, 1.0f}) {
+        std::vector<float> actual(channels + 1, 2.0f);
+        std::vector<float> expected(channels + 1, 2.0f);
+        kernels().firInterpolate(input.data(), first.data(), second.data(), count, channels, weight, actual.data());
+        reference().firInterpolate(input.data(), first.data(), second.data(), count, channels, weight,
+                                   expected.data());
+        for (uint32_t c = 0; c < channels; c++) {
+          ASSERT_NEAR(actual[c], expected[c], 1e-5) << "channel " << c << " at weight " << weight;
+        }
+        ASSERT_EQ(actual[channels], 2.0f) << "written past the channels";
+      }
+    }
+  }
+}
+
+TEST(SampleKernelsSelectionTest, PicksASupportedLevel) {
+  EXPECT_TRUE(SampleKernels::isSupported(SampleKernels::get().level));
+  EXPECT_EQ(SampleKernels::forLevel(SampleKernels::get().level).level, SampleKernels::get().level);
+}
+
+std::string LevelName(const testing::TestParamInfo<SimdLevel> &info) {
+  switch (info.param) {
+    case SimdLevel::sse2:
+      return "sse2";
+    case SimdLevel::avx2:
+      return "avx2";
+    case SimdLevel::neon:
+      return "neon";
+    default:
+      return "scalar";
+  }
+}
+
+INSTANTIATE_TEST_SUITE_P(Levels, SampleKernelsTest,
+                         testing::Values(SimdLevel::scalar, SimdLevel::sse2, SimdLevel::avx2, SimdLevel::neon),
+                         LevelName);
+
+}  // namespace
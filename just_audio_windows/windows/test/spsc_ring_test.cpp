@@ -0,0 +1,119 @@
+#include <gtest/gtest.h>
+
+#include <cstdint>
+#include <numeric>
+#include <thread>
+#include <vector>
+
+#include "spsc_ring.hpp"
+
+namespace {
+
+TEST(SpscRingTest, RoundsTheCapacityUpToAPowerOfTwo) {
+  EXPECT_EQ(SpscRing<int>(1).capacity(), 1u);
+  EXPECT_EQ(SpscRing<int>(5).capacity(), 8u);
+  EXPECT_EQ(SpscRing<int>(64).capacity(), 64u);
+}
+
+TEST(SpscRingTest, WrapsAroundTheEndOfTheBuffer) {
+  SpscRing<int> ring(8);
+  int next_written = 0;
+  int next_read = 0;
+  // Runs of lengths that do not divide the capacity, so that writes and reads
+  // straddle the end of the buffer at every offset.
+  for (int round = 0; round < 100; round++) {
+    std::vector<int> items(5);
+    std::iota(items.begin(), items.end(), next_written);
+    ASSERT_EQ(ring.write(items.data(), items.size()), 5u);
+    next_written += 5;
+    EXPECT_EQ(ring.readAvailable(), 5u);
+    EXPECT_EQ(ring.writeAvailable(), 3u);
+
+    std::vector<int> out(5);
+    ASSERT_EQ(ring.read(out.data(), 3), 3u);
+    ASSERT_EQ(ring.read(out.data() + 3, 5), 2u);
+    for (auto item : out) {
+      ASSERT_EQ(item, next_read++) << "in round " << round;
+    }
+  }
+  EXPECT_EQ(ring.readAvailable(), 0u);
+  EXPECT_EQ(ring.writeAvailable(), 8u);
+}
+
+TEST(SpscRingTest, AcceptsOnlyWhatFits) {
+  SpscRing<int> ring(4);
+  int items[6] = {1, 2, 3, 4, 5, 6};
+  EXPECT_EQ(ring.write(items, 6), 4u);
+  EXPECT_EQ(ring.write(items + 4, 2), 0u);
+  int out[6] = {};
+  EXPECT_EQ(ring.read(out, 6), 4u);
+  EXPECT_EQ(out[3], 4);
+  EXPECT_EQ(ring.read(out, 6), 0u);
+}
+
+TEST(SpscRingTest, SkipsWhatTheProducerDiscarded) {
+  SpscRing<int> ring(8);
+  int stale[6] = {1, 2, 3, 4, 5, 6};
+  ASSERT_EQ(ring.write(stale, 6), 6u);
+  int out[8] = {};
+  ASSERT_EQ(ring.read(out, 2), 2u);
+
+  // As a seek does: what was decoded before it is dropped, and what follows
+  // is read next.
+  ring.discard();
+  int fresh[3] = {10, 11, 12};
+  // The consumer has not yet reclaimed the discarded space.
+  EXPECT_EQ(ring.writeAvailable(), 4u);
+  ASSERT_EQ(ring.write(fresh, 3), 3u);
+  EXPECT_EQ(ring.readAvailable(), 3u);
+  EXPECT_EQ(ring.writeAvailable(), 5u);
+  ASSERT_EQ(ring.read(out, 8), 3u);
+  EXPECT_EQ(out[0], 10);
+  EXPECT_EQ(out[2], 12);
+
+  // A discard with nothing written after it leaves the ring empty.
+  ASSERT_EQ(ring.write(stale, 6), 6u);
+  ring.discard();
+  EXPECT_EQ(ring.read(out, 8), 0u);
+  EXPECT_EQ(ring.writeAvailable(), 8u);
+}
+
+// A producer and a consumer on their own threads, in runs of odd lengths, as
+// the decoder and the render callback use the ring.
+TEST(SpscRingTest, PassesEveryItemInOrderBetweenThreads) {
+  const uint64_t kItems = 2000000;
+  SpscRing<uint64_t> ring(256);
+  std::thread producer([&]() {
+    std::vector<uint64_t> items(37);
+    uint64_t next = 0;
+    while (next < kItems) {
+      auto count = (size_t)std::min<uint64_t>(items.size(), kItems - next);
+      std::iota(items.begin(), items.begin() + count, next);
+      auto written = ring.write(items.data(), count);
+      next += written;
+      if (written == 0) {
+        std::this_thread::yield();
+      }
+    }
+  });
+
+  std::vector<uint64_t> out(29);
+  uint64_t expected = 0;
+  bool in_order = true;
+  while (expected < kItems) {
+    auto count = ring.read(out.data(), out.size());
+    for (size_t i = 0; i < count; i++) {
+      in_order = in_order && out[i] == expected;
+      expected++;
+    }
+    if (count == 0) {
+      std::this_thread::yield();
+    }
+  }
+  producer.join();
+  EXPECT_TRUE(in_order);
+  EXPECT_EQ(expected, kItems);
+  EXPECT_EQ(ring.readAvailable(), 0u);
+}
+
+}  // namespace
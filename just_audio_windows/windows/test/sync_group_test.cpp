@@ -0,0 +1,192 @@
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <random>
+#include <vector>
+
+#include "mixer.hpp"
+#include "sync_group.hpp"
+
+namespace {
+
+const AudioFormat kFormat{44100, 2};
+const size_t kBlockFrames = Mixer::kDefaultBlockFrames;
+const float kLevel = 0.01f;
+
+// A member that renders a constant level and counts its position in quarter
+// frames, which is exact at every speed used here. The test decides when it
+// is ready; when it is not, it underruns, as a player whose decoder ran late.
+class Stem : public MixerInput, public SyncGroupMember {
+ public:
+  Stem(Mixer &mixer, SyncGroup &group) : mixer_(mixer), group_(group) {
+    VoiceSettings settings{};
+    settings.group = group.getId();
+    voice_ = mixer.addVoice(this, settings, Mixer::kHeld);
+    group.add(this);
+  }
+
+  ~Stem() override {
+    group_.remove(this);
+    mixer_.removeVoice(voice_);
+  }
+
+  size_t render(float *output, size_t frames) override {
+    if (!ready_) {
+      std::fill(output, output + frames * kFormat.channels, 0.0f);
+      return 0;
+    }
+    std::fill(output, output + frames * kFormat.channels, kLevel);
+    position_ += (int64_t)frames * speed_quarters_;
+    renders_while_paused_ += playing_ ? 0 : 1;
+    return frames;
+  }
+
+  bool isReady(size_t frames) override { return ready_; }
+
+  bool isPlaying() override { return playing_; }
+  bool holdToPlay() override {
+    playing_ = true;
+    return true;
+  }
+  void pauseHeld() override { playing_ = false; }
+  void seekHeld(std::optional<int32_t> index, int64_t positionUs) override {
+    position_ = positionUs * kFormat.sampleRate / 1000000 * 4;
+  }
+  void setSpeedHeld(double speed) override { speed_quarters_ = (int64_t)std::lround(speed * 4); }
+  void onGroupDissolved() override {}
+
+  void set_ready(bool ready) { ready_ = ready; }
+  int64_t position() const { return position_; }
+  uint64_t renders_while_paused() const { return renders_while_paused_; }
+
+ private:
+  Mixer &mixer_;
+  SyncGroup &group_;
+  uint64_t voice_ = 0;
+  bool ready_ = true;
+  bool playing_ = false;
+  int64_t position_ = 0;
+  int64_t speed_quarters_ = 4;
+  uint64_t renders_while_paused_ = 0;
+};
+
+// An hour of output from three stems, mixed block by block without a sink on
+// a simulated host clock that advances with the frames mixed. About every
+// minute a command pauses the group and starts it again at a host time a
+// second later, seeks it or changes its speed, and each stem is not ready for
+// one block in 40, at random but the same on every run.
+TEST(SyncGroupTest, KeepsStemsInStepForAnHour) {
+  auto mixer = std::make_shared<Mixer>(kFormat, nullptr, 8, kBlockFrames);
+  SyncGroup group(mixer);
+  std::vector<std::unique_ptr<Stem>> stems;
+  for (int i = 0; i < 3; i++) {
+    stems.push_back(std::make_unique<Stem>(*mixer, group));
+  }
+
+  const int64_t kStartUs = 1000000000;
+  auto now_us = [&]() { return kStartUs + (int64_t)(mixer->getFramePosition() * 1000000 / kFormat.sampleRate); };
+  std::mt19937 random(12345);
+  auto command_interval = [&]() { return (uint64_t)((30 + random() % 60) * kFormat.sampleRate / kBlockFrames); };
+  const double speeds[] = {0.75, 1.0, 1.25, 1.5};
+  const uint64_t total_blocks = 3600ull * kFormat.sampleRate / kBlockFrames;
+
+  auto next_command = command_interval();
+  std::optional<uint64_t> resume_block;
+  // The frame the group was last started at, until it is heard.
+  std::optional<uint64_t> pending_start;
+  bool delay_start = false;
+  std::vector<float> output(kBlockFrames * kFormat.channels);
+  uint64_t commands = 0;
+  uint64_t starts = 0;
+  uint64_t start_errors = 0;
+  uint64_t delayed_starts = 0;
+  int64_t max_skew = 0;
+
+  EXPECT_EQ(group.play(std::nullopt, now_us()), 0u);
+  pending_start = 0;
+  for (uint64_t b = 0; b < total_blocks; b++) {
+    if (b == next_command) {
+      next_command += command_interval();
+      commands++;
+      switch (random() % 3) {
+        case 0:
+          group.pause();
+          resume_block = b + kFormat.sampleRate / kBlockFrames;
+          pending_start.reset();
+          break;
+        case 1:
+          group.seek(std::nullopt, (int64_t)(random() % 3600000000ull));
+          break;
+        default:
+          group.setSpeed(speeds[random() % 4]);
+          break;
+      }
+    }
+    if (resume_block && b == *resume_block) {
+      resume_block.reset();
+      commands++;
+      starts++;
+      auto ahead_us = 5000 + (int64_t)(random() % 45000);
+      auto next = mixer->getFramePosition();
+      auto frame = group.play(now_us() + ahead_us, now_us());
+      // Read off the simulated clock, not the steady one.
+      EXPECT_EQ(frame - next, (uint64_t)std::llround((double)ahead_us * kFormat.sampleRate / 1000000));
+      pending_start = frame;
+      // Every other start, a stem is not ready in time.
+      delay_start = starts % 2 == 0;
+    }
+
+    auto block_start = mixer->getFramePosition();
+    auto starting = pending_start && *pending_start < block_start + kBlockFrames;
+    for (auto &stem : stems) {
+      stem->set_ready(random() % 40 != 0);
+    }
+    if (starting && delay_start) {
+      stems.back()->set_ready(false);
+      delay_start = false;
+    }
+    auto stalls = mixer->getStatistics().groupStalls;
+    mixer->mix(output.data(), kBlockFrames);
+
+    if (starting) {
+      if (mixer->getStatistics().groupStalls > stalls) {
+        // A stem was not ready for the block the group starts in, so all of
+        // them start a block later.
+        *pending_start += kBlockFrames;
+        delayed_starts++;
+      } else {
+        auto first = std::find_if(output.begin(), output.end(), [](float sample) { return sample != 0.0f; });
+        auto heard = first == output.end() ? UINT64_MAX : block_start + (uint64_t)(first - output.begin()) / kFormat.channels;
+        start_errors += heard != *pending_start ? 1 : 0;
+        pending_start.reset();
+      }
+    }
+
+    auto [lowest, highest] = std::minmax_element(stems.begin(), stems.end(), [](const auto &a, const auto &b) {
+      return a->position() < b->position();
+    });
+    max_skew = std::max(max_skew, (*highest)->position() - (*lowest)->position());
+  }
+
+  EXPECT_GT(commands, 30u);
+  EXPECT_GT(starts, 5u);
+  // Not a frame apart after any block, whatever ran dry.
+  EXPECT_EQ(max_skew, 0);
+  EXPECT_GT(stems.front()->position(), 0);
+  // Every start heard at the frame it was scheduled for, or as many blocks
+  // later as the group waited for a stem.
+  EXPECT_EQ(start_errors, 0u);
+  EXPECT_GE(delayed_starts, starts / 2);
+  EXPECT_GT(mixer->getStatistics().groupStalls, 0u);
+  for (auto &stem : stems) {
+    EXPECT_EQ(stem->renders_while_paused(), 0u);
+  }
+  stems.clear();
+  group.dissolve();
+}
+
+}  // namespace
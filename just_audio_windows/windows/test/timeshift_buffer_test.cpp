@@ -0,0 +1,162 @@
+#include <gtest/gtest.h>
+
+#include <chrono>
+#include <cstdint>
+#include <filesystem>
+#include <string>
+#include <vector>
+
+#include "timeshift_buffer.hpp"
+
+namespace {
+
+class TimeshiftBufferTest : public ::testing::Test {
+ protected:
+  std::string Path() {
+    return (std::filesystem::temp_directory_path() /
+            ("just_audio_windows_timeshift_" + std::to_string(::testing::UnitTest::GetInstance()->random_seed()) +
+             "_" + ::testing::UnitTest::GetInstance()->current_test_info()->name()))
+        .string();
+  }
+
+  // Appends |chunks| chunks of |length| bytes, each playing for |durationUs|,
+  // whose bytes are their offset in the recording modulo 251.
+  static void Record(TimeshiftBuffer &buffer, size_t chunks, size_t length, int64_t durationUs) {
+    std::vector<uint8_t> chunk(length);
+    for (size_t i = 0; i < chunks; i++) {
+      auto offset = buffer.getEndOffset();
+      for (size_t j = 0; j < length; j++) {
+        chunk[j] = (uint8_t)((offset + j) % 251);
+      }
+      auto start = buffer.getEndTime();
+      buffer.append(chunk.data(), length, start, start + durationUs);
+    }
+  }
+
+  static void ExpectBytes(const std::vector<uint8_t> &bytes, uint64_t offset) {
+    for (size_t i = 0; i < bytes.size(); i++) {
+      ASSERT_EQ(bytes[i], (uint8_t)((offset + i) % 251)) << "at offset " << offset + i;
+    }
+  }
+};
+
+TEST_F(TimeshiftBufferTest, KeepsTheLastCapacityBytesAcrossTheEndOfTheRing) {
+  TimeshiftBuffer buffer(Path(), 1000);
+  ASSERT_TRUE(buffer.isOpen());
+  // 3.5 times round the ring, in chunks that do not divide it.
+  Record(buffer, 50, 70, 10000);
+  EXPECT_EQ(buffer.getEndOffset(), 3500u);
+  EXPECT_EQ(buffer.getStartOffset(), 2500u);
+
+  // The whole window, which starts half way through the file.
+  std::vector<uint8_t> bytes(1000);
+  ASSERT_EQ(buffer.read(2500, bytes.data(), bytes.size()), 1000u);
+  ExpectBytes(bytes, 2500);
+  // A read running over the end of the file and on from its start.
+  bytes.resize(300);
+  ASSERT_EQ(buffer.read(2900, bytes.data(), bytes.size()), 300u);
+  ExpectBytes(bytes, 2900);
+  // Only what was recorded is read at the live edge.
+  ASSERT_EQ(buffer.read(3400, bytes.data(), bytes.size()), 100u);
+
+  // Overwritten and unrecorded bytes are not.
+  EXPECT_EQ(buffer.read(2499, bytes.data(), 1), 0u);
+  EXPECT_EQ(buffer.read(3500, bytes.data(), 1), 0u);
+}
+
+TEST_F(TimeshiftBufferTest, KeepsOnlyTheTailOfAnAppendLargerThanTheRing) {
+  TimeshiftBuffer buffer(Path(), 100);
+  Record(buffer, 1, 250, 10000);
+  EXPECT_EQ(buffer.getEndOffset(), 250u);
+  EXPECT_EQ(buffer.getStartOffset(), 150u);
+  std::vector<uint8_t> bytes(100);
+  ASSERT_EQ(buffer.read(150, bytes.data(), bytes.size()), 100u);
+  ExpectBytes(bytes, 150);
+}
+
+TEST_F(TimeshiftBufferTest, ReadsFromTheWindowStartOnceTheOffsetIsOverwritten) {
+  TimeshiftBuffer buffer(Path(), 1000);
+  Record(buffer, 30, 100, 10000);
+  std::vector<uint8_t> bytes(50);
+  uint64_t offset = 500;
+  ASSERT_EQ(buffer.readFromWindow(offset, bytes.data(), bytes.size()), 50u);
+  EXPECT_EQ(offset, 2000u);
+  ExpectBytes(bytes, 2000);
+  // An offset still in the window is read where it is.
+  offset = 2600;
+  ASSERT_EQ(buffer.readFromWindow(offset, bytes.data(), bytes.size()), 50u);
+  EXPECT_EQ(offset, 2600u);
+  ExpectBytes(bytes, 2600);
+}
+
+TEST_F(TimeshiftBufferTest, EvictsIndexPointsWhoseBytesWereOverwritten) {
+  // A point every 100ms, each chunk of 100 bytes playing for 100ms.
+  TimeshiftBuffer buffer(Path(), 1000, 64, 100000);
+  Record(buffer, 10, 100, 100000);
+  EXPECT_EQ(buffer.getStartTime(), 0);
+  EXPECT_EQ(buffer.offsetForTime(0), 0u);
+
+  Record(buffer, 5, 100, 100000);
+  // Bytes 0 to 500 were overwritten, and with them the points at 0 to 400ms.
+  EXPECT_EQ(buffer.getStartOffset(), 500u);
+  EXPECT_EQ(buffer.getStartTime(), 500000);
+  EXPECT_EQ(buffer.timeForOffset(500), 500000);
+  EXPECT_EQ(buffer.offsetForTime(499999), 500u);
+  // Overwritten bytes have no time of their own any more.
+  EXPECT_EQ(buffer.timeForOffset(0), 500000);
+}
+
+TEST_F(TimeshiftBufferTest, EvictsTheOldestIndexPointsWhenTheIndexIsFull) {
+  // Room for four points, so only the last four chunks stay indexed though
+  // all their bytes are kept.
+  TimeshiftBuffer buffer(Path(), 100000, 4, 100000);
+  Record(buffer, 10, 100, 100000);
+  EXPECT_EQ(buffer.getStartOffset(), 0u);
+  // Times before the first point left clamp to it.
+  EXPECT_EQ(buffer.offsetForTime(0), 600u);
+  EXPECT_EQ(buffer.offsetForTime(600000), 600u);
+  EXPECT_EQ(buffer.offsetForTime(900000), 900u);
+}
+
+TEST_F(TimeshiftBufferTest, FindsOffsetsForTimesAtAndPastTheWindowEdges) {
+  // Points at 0, 100, ... 1900ms; the bytes of the first ten overwritten.
+  TimeshiftBuffer buffer(Path(), 1000, 64, 100000);
+  Record(buffer, 20, 100, 100000);
+  ASSERT_EQ(buffer.getStartOffset(), 1000u);
+  ASSERT_EQ(buffer.getEndOffset(), 2000u);
+  ASSERT_EQ(buffer.getEndTime(), 2000000);
+
+  // Before the window, and at its start.
+  EXPECT_EQ(buffer.offsetForTime(-1), 1000u);
+  EXPECT_EQ(buffer.offsetForTime(0), 1000u);
+  EXPECT_EQ(buffer.offsetForTime(999999), 1000u);
+  EXPECT_EQ(buffer.offsetForTime(1000000), 1000u);
+  // Between points, the one before.
+  EXPECT_EQ(buffer.offsetForTime(1000001), 1000u);
+  EXPECT_EQ(buffer.offsetForTime(1549999), 1500u);
+  EXPECT_EQ(buffer.offsetForTime(1550000), 1500u);
+  // At the last point, at the live edge and past it.
+  EXPECT_EQ(buffer.offsetForTime(1900000), 1900u);
+  EXPECT_EQ(buffer.offsetForTime(2000000), 1900u);
+  EXPECT_EQ(buffer.offsetForTime(INT64_MAX), 1900u);
+
+  // Times of offsets interpolate between points, and up to the live edge
+  // after the last.
+  EXPECT_EQ(buffer.timeForOffset(1000), 1000000);
+  EXPECT_EQ(buffer.timeForOffset(1550), 1550000);
+  EXPECT_EQ(buffer.timeForOffset(1950), 1950000);
+  EXPECT_EQ(buffer.timeForOffset(2000), 2000000);
+}
+
+TEST_F(TimeshiftBufferTest, AnswersTheLiveEdgeBeforeAnythingIsRecorded) {
+  TimeshiftBuffer buffer(Path(), 1000);
+  EXPECT_EQ(buffer.offsetForTime(1000000), 0u);
+  EXPECT_EQ(buffer.getStartTime(), 0);
+  uint8_t byte;
+  EXPECT_EQ(buffer.read(0, &byte, 1), 0u);
+  EXPECT_FALSE(buffer.waitForData(0, std::chrono::milliseconds(1)));
+  buffer.close();
+  EXPECT_TRUE(buffer.isFinished());
+}
+
+}  // namespace
@@ -0,0 +1,41 @@
+#include <gtest/gtest.h>
+
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <thread>
+
+#include "worker_threads.hpp"
+
+namespace {
+
+TEST(WorkerThreadsTest, JoinsRunningJobsWhenDestroyed) {
+  auto finished = std::make_shared<std::atomic<int>>(0);
+  {
+    WorkerThreads workers;
+    for (int i = 0; i < 4; i++) {
+      workers.run([finished]() {
+        std::this_thread::sleep_for(std::chrono::milliseconds(50));
+        finished->fetch_add(1);
+      });
+    }
+  }
+  EXPECT_EQ(finished->load(), 4);
+}
+
+TEST(WorkerThreadsTest, JoinsFinishedJobsAsNewOnesStart) {
+  WorkerThreads workers;
+  std::atomic<bool> done = false;
+  workers.run([&done]() { done = true; });
+  while (!done) {
+    std::this_thread::yield();
+  }
+  // The flag is set just before the job's thread ends.
+  auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+  while (workers.getCount() > 0 && std::chrono::steady_clock::now() < deadline) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+  EXPECT_EQ(workers.getCount(), 0u);
+}
+
+}  // namespace
@@ -0,0 +1,384 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#if defined(_M_X64) || defined(__SSE__)
+#include <xmmintrin.h>
+#ifndef JUST_AUDIO_SSE
+#define JUST_AUDIO_SSE 1
+#endif
+#elif defined(_M_ARM64) || defined(__ARM_NEON)
+#include <arm_neon.h>
+#ifndef JUST_AUDIO_NEON
+#define JUST_AUDIO_NEON 1
+#endif
+#endif
+
+#include "audio_decoder.hpp"
+
+// Changes the tempo of interleaved audio without changing its pitch, by
+// WSOLA: the input is cut into overlapping sequences that are spaced further
+// apart or closer together, each shifted within a small window to where it
+// best matches what was already output so that the seams do not beat.
+//
+// Feed it with write() and take the result with read(). Once the input ends,
+// finish() flushes what is held.
+class TimeStretcher
+{
+public:
+	enum class Quality
+	{
+		// Short sequences and a coarse search, for many streams at once.
+		fast,
+		balanced,
+		// Long sequences and an exhaustive search.
+		best,
+	};
+
+	TimeStretcher(AudioFormat format, Quality quality = Quality::balanced)
+		: format(format)
+	{
+		// Lengths in milliseconds: sequence, overlap, seek window.
+		int sequenceMs = 40, overlapMs = 8, seekMs = 15;
+		switch (quality)
+		{
+		case Quality::fast:
+			sequenceMs = 30, overlapMs = 6, seekMs = 12, searchStep = 4;
+			break;
+		case Quality::balanced:
+			searchStep = 2;
+			break;
+		case Quality::best:
+			sequenceMs = 50, overlapMs = 10, seekMs = 20, searchStep = 1;
+			break;
+		}
+		sequenceFrames = (size_t)format.sampleRate * sequenceMs / 1000;
+		overlapFrames = std::max<size_t>(1, (size_t)format.sampleRate * overlapMs / 1000);
+		seekFrames = (size_t)format.sampleRate * seekMs / 1000;
+		overlap.resize(overlapFrames * format.channels);
+	}
+
+	/// Output frames per input frame are 1 / |value|.
+	void setTempo(double value)
+	{
+		tempo = std::clamp(value, 0.1, 10.0);
+	}
+
+	double getTempo() const
+	{
+		return tempo;
+	}
+
+	void write(const float* samples, size_t frames)
+	{
+		input.insert(input.end(), samples, samples + frames * format.channels);
+		inputTotal += frames;
+		expectedOutput += frames / tempo;
+		process();
+	}
+
+	/// Processes the rest of the input. Nothing can be written afterwards
+	/// until reset().
+	void finish()
+	{
+		if (finished)
+		{
+			return;
+		}
+		finished = true;
+		// Silence pushes the last input through the sequences, and the output
+		// is then cut to the length the input stretches to.
+		input.resize(input.size() + (seekFrames + sequenceFrames) * format.channels, 0.0f);
+		process();
+		auto expected = (uint64_t)std::llround(expectedOutput);
+		auto pending = outputFrames();
+		if (outputTotal > expected)
+		{
+			auto excess = std::min(pending, outputTotal - expected);
+			output.resize(output.size() - excess * format.channels);
+			outputTotal -= excess;
+		}
+		input.clear();
+	}
+
+	/// Moves up to |frames| frames of output into |samples|.
+	size_t read(float* samples, size_t frames)
+	{
+		auto count = std::min(frames, outputFrames());
+		auto* start = output.data() + outputRead * format.channels;
+		std::copy(start, start + count * format.channels, samples);
+		outputRead += count;
+		readInputFrames += count * tempo;
+		if (outputRead * 2 > outputFrames() + outputRead)
+		{
+			output.erase(output.begin(), output.begin() + outputRead * format.channels);
+			outputRead = 0;
+		}
+		return count;
+	}
+
+	/// Whether finish() was called and everything has been read.
+	bool isDrained() const
+	{
+		return finished && outputFrames() == 0;
+	}
+
+	bool isEmpty() const
+	{
+		return inputTotal == 0 && !finished;
+	}
+
+	/// Input frames written but not yet heard through read().
+	double getLatencyFrames() const
+	{
+		return std::max(0.0, (double)inputTotal - readInputFrames);
+	}
+
+	void reset()
+	{
+		input.clear();
+		output.clear();
+		outputRead = 0;
+		skipFraction = 0;
+		skipAhead = 0;
+		started = false;
+		finished = false;
+		inputTotal = 0;
+		outputTotal = 0;
+		expectedOutput = 0;
+		readInputFrames = 0;
+	}
+
+	/// The time spent stretching and the frames produced, since construction.
+	std::pair<int64_t, uint64_t> getCost() const
+	{
+		return std::make_pair(processingNs, producedFrames);
+	}
+
+	/**
+	 * Returns the correlation of |a| and |b|, |count| samples each, and adds the
+	 * energy of |b| to |energy|.
+	 */
+	static float correlate(const float* a, const float* b, size_t count, float& energy)
+	{
+		size_t i = 0;
+		float sum = 0;
+		float norm = 0;
+#ifdef JUST_AUDIO_SSE
+		auto sumVector = _mm_setzero_ps();
+		auto normVector = _mm_setzero_ps();
+		for (; i + 4 <= count; i += 4)
+		{
+			auto bVector = _mm_loadu_ps(b + i);
+			sumVector = _mm_add_ps(sumVector, _mm_mul_ps(_mm_loadu_ps(a + i), bVector));
+			normVector = _mm_add_ps(normVector, _mm_mul_ps(bVector, bVector));
+		}
+		float sums[4];
+		float norms[4];
+		_mm_storeu_ps(sums, sumVector);
+		_mm_storeu_ps(norms, normVector);
+		sum = sums[0] + sums[1] + sums[2] + sums[3];
+		norm = norms[0] + norms[1] + norms[2] + norms[3];
+#elif defined(JUST_AUDIO_NEON)
+		auto sumVector = vdupq_n_f32(0.0f);
+		auto normVector = vdupq_n_f32(0.0f);
+		for (; i + 4 <= count; i += 4)
+		{
+			auto bVector = vld1q_f32(b + i);
+			sumVector = vmlaq_f32(sumVector, vld1q_f32(a + i), bVector);
+			normVector = vmlaq_f32(normVector, bVector, bVector);
+		}
+		float sums[4];
+		float norms[4];
+		vst1q_f32(sums, sumVector);
+		vst1q_f32(norms, normVector);
+		sum = sums[0] + sums[1] + sums[2] + sums[3];
+		norm = norms[0] + norms[1] + norms[2] + norms[3];
+#endif
+		for (; i < count; i++)
+		{
+			sum += a[i] * b[i];
+			norm += b[i] * b[i];
+		}
+		energy += norm;
+		return sum;
+	}
+
+	/// Writes a linear fade from |from| to |to| over |frames| frames.
+	static void crossfade(float* output, const float* from, const float* to, size_t frames, uint32_t channels)
+	{
+		auto step = 1.0f / (float)frames;
+		size_t frame = 0;
+#if defined(JUST_AUDIO_SSE) || defined(JUST_AUDIO_NEON)
+		if (channels <= 2)
+		{
+			auto perVector = (size_t)(4 / channels);
+			float weights[4];
+			for (size_t k = 0; k < 4; k++)
+			{
+				weights[k] = (float)(k / channels) * step;
+			}
+#ifdef JUST_AUDIO_SSE
+			auto weight = _mm_loadu_ps(weights);
+			auto advance = _mm_set1_ps(step * (float)perVector);
+			for (; frame + perVector <= frames; frame += perVector)
+			{
+				auto i = frame * channels;
+				auto a = _mm_loadu_ps(from + i);
+				_mm_storeu_ps(output + i, _mm_add_ps(a, _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(to + i), a), weight)));
+				weight = _mm_add_ps(weight, advance);
+			}
+#else
+			auto weight = vld1q_f32(weights);
+			auto advance = vdupq_n_f32(step * (float)perVector);
+			for (; frame + perVector <= frames; frame += perVector)
+			{
+				auto i = frame * channels;
+				auto a = vld1q_f32(from + i);
+				vst1q_f32(output + i, vmlaq_f32(a, vsubq_f32(vld1q_f32(to + i), a), weight));
+				weight = vaddq_f32(weight, advance);
+			}
+#endif
+		}
+#endif
+		for (; frame < frames; frame++)
+		{
+			auto weight = (float)frame * step;
+			for (uint32_t c = 0; c < channels; c++)
+			{
+				auto i = frame * channels + c;
+				output[i] = from[i] + (to[i] - from[i]) * weight;
+			}
+		}
+	}
+
+private:
+	size_t inputFrames() const
+	{
+		return input.size() / format.channels;
+	}
+
+	size_t outputFrames() const
+	{
+		return output.size() / format.channels - outputRead;
+	}
+
+	void process()
+	{
+		auto start = std::chrono::steady_clock::now();
+		auto channels = format.channels;
+		auto stride = sequenceFrames - overlapFrames;
+		// Above a tempo of about 1.5, sequences skip past the input held.
+		size_t consumed = std::min(skipAhead, inputFrames());
+		skipAhead -= consumed;
+		while (skipAhead == 0 && consumed + seekFrames + sequenceFrames <= inputFrames())
+		{
+			auto* sequence = input.data() + consumed * channels;
+			size_t offset = 0;
+			auto outputStart = output.size();
+			output.resize(outputStart + stride * channels);
+			auto* out = output.data() + outputStart;
+			if (!started)
+			{
+				std::copy(sequence, sequence + stride * channels, out);
+				started = true;
+			}
+			else
+			{
+				offset = findBestOffset(sequence);
+				auto* matched = sequence + offset * channels;
+				crossfade(out, overlap.data(), matched, overlapFrames, channels);
+				std::copy(matched + overlapFrames * channels, matched + stride * channels, out + overlapFrames * channels);
+			}
+			auto* tail = sequence + (offset + stride) * channels;
+			std::copy(tail, tail + overlapFrames * channels, overlap.begin());
+			outputTotal += stride;
+			producedFrames += stride;
+
+			auto skip = tempo * stride + skipFraction;
+			auto whole = (size_t)skip;
+			skipFraction = skip - (double)whole;
+			consumed += whole;
+		}
+		if (consumed > inputFrames())
+		{
+			skipAhead = consumed - inputFrames();
+			consumed = inputFrames();
+		}
+		input.erase(input.begin(), input.begin() + consumed * channels);
+		processingNs += std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+	}
+
+	/// Where in the seek window after |sequence| the next sequence best
+	/// continues the overlap.
+	size_t findBestOffset(const float* sequence) const
+	{
+		auto count = overlapFrames * format.channels;
+		auto score = [&](size_t offset)
+		{
+			float energy = 1e-9f;
+			auto correlation = correlate(overlap.data(), sequence + offset * format.channels, count, energy);
+			return correlation / std::sqrt(energy);
+		};
+
+		size_t best = 0;
+		auto bestScore = score(0);
+		for (size_t offset = searchStep; offset < seekFrames; offset += searchStep)
+		{
+			auto value = score(offset);
+			if (value > bestScore)
+			{
+				bestScore = value;
+				best = offset;
+			}
+		}
+		// Refine around the coarse match.
+		auto first = best >= searchStep ? best - searchStep + 1 : 0;
+		auto last = std::min(seekFrames, best + searchStep);
+		for (auto offset = first; offset < last; offset++)
+		{
+			if (offset == best)
+			{
+				continue;
+			}
+			auto value = score(offset);
+			if (value > bestScore)
+			{
+				bestScore = value;
+				best = offset;
+			}
+		}
+		return best;
+	}
+
+	AudioFormat format;
+	size_t sequenceFrames;
+	size_t overlapFrames;
+	size_t seekFrames;
+	size_t searchStep = 1;
+	double tempo = 1.0;
+
+	std::vector<float> input{};
+	std::vector<float> output{};
+	size_t outputRead = 0;
+	// The end of the last sequence, which the next one fades in over.
+	std::vector<float> overlap{};
+	double skipFraction = 0;
+	size_t skipAhead = 0;
+	bool started = false;
+	bool finished = false;
+
+	// For the length of the flushed output and for the latency.
+	uint64_t inputTotal = 0;
+	uint64_t outputTotal = 0;
+	double expectedOutput = 0;
+	double readInputFrames = 0;
+
+	int64_t processingNs = 0;
+	uint64_t producedFrames = 0;
+};
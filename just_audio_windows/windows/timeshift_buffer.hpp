@@ -0,0 +1,308 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// Records a live stream into a fixed-size ring file on disk, so that playback
+// can pause, rewind within the window, and catch up with the live edge.
+//
+// Bytes are addressed by their offset since the recording started. Only the
+// last |capacity| bytes are kept; older ones are overwritten. Appending is O(1).
+// A fixed-size ring of (time, offset) points, one every |indexInterval|, maps
+// times to offsets by binary search. Memory use does not grow with the
+// recording length.
+class TimeshiftBuffer
+{
+public:
+	struct IndexEntry
+	{
+		int64_t timeUs;
+		uint64_t offset;
+	};
+
+	TimeshiftBuffer(const std::string& path, uint64_t capacity,
+		size_t indexCapacity = 16384,
+		int64_t indexIntervalUs = 250000)
+		: path(path), capacity(capacity), index(indexCapacity), indexIntervalUs(indexIntervalUs)
+	{
+#ifdef _WIN32
+		fopen_s(&file, path.c_str(), "w+b");
+#else
+		file = std::fopen(path.c_str(), "w+b");
+#endif
+	}
+
+	~TimeshiftBuffer()
+	{
+		close();
+		if (file)
+		{
+			std::fclose(file);
+			std::remove(path.c_str());
+		}
+	}
+
+	// Prevent copying.
+	TimeshiftBuffer(TimeshiftBuffer const&) = delete;
+	TimeshiftBuffer& operator=(TimeshiftBuffer const&) = delete;
+
+	bool isOpen() const
+	{
+		return file != nullptr;
+	}
+
+	/// Appends |length| bytes that play from |startTimeUs| to |endTimeUs|.
+	void append(const uint8_t* data, size_t length, int64_t startTimeUs, int64_t endTimeUs)
+	{
+		if (!file || length == 0)
+		{
+			return;
+		}
+
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+
+			if (indexCount == 0 || startTimeUs - indexAt(indexCount - 1).timeUs >= indexIntervalUs)
+			{
+				if (indexCount == index.size())
+				{
+					indexHead = (indexHead + 1) % index.size();
+					indexCount--;
+				}
+				index[(indexHead + indexCount) % index.size()] = { startTimeUs, endOffset };
+				indexCount++;
+			}
+
+			// Only the tail of an append larger than the whole ring survives.
+			if (length > capacity)
+			{
+				data += length - capacity;
+				endOffset += length - capacity;
+				length = (size_t)capacity;
+			}
+
+			auto position = endOffset % capacity;
+			auto first = (size_t)std::min<uint64_t>(length, capacity - position);
+			seekFile(position);
+			std::fwrite(data, 1, first, file);
+			if (first < length)
+			{
+				seekFile(0);
+				std::fwrite(data + first, 1, length - first, file);
+			}
+			endOffset += length;
+			this->endTimeUs = endTimeUs;
+
+			// Forgets index points whose bytes have been overwritten.
+			while (indexCount > 1 && indexAt(0).offset < getStartOffsetLocked())
+			{
+				indexHead = (indexHead + 1) % index.size();
+				indexCount--;
+			}
+		}
+		available.notify_all();
+	}
+
+	/// Copies up to |length| bytes starting at |offset| into |data|, returning
+	/// the number of bytes copied. Returns zero if |offset| is outside the window.
+	size_t read(uint64_t offset, uint8_t* data, size_t length)
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		return readLocked(offset, data, length);
+	}
+
+	/// Like read, but first moves |offset| up to the start of the window if
+	/// the bytes there have been overwritten, in the same step, so that the
+	/// window cannot slide away in between.
+	size_t readFromWindow(uint64_t& offset, uint8_t* data, size_t length)
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		offset = std::max(offset, getStartOffsetLocked());
+		return readLocked(offset, data, length);
+	}
+
+	/// Blocks until the byte at |offset| has been recorded, the recording has
+	/// finished, or |timeout| elapses. Returns whether the byte is available.
+	bool waitForData(uint64_t offset, std::chrono::milliseconds timeout)
+	{
+		std::unique_lock<std::mutex> lock(mutex);
+		available.wait_for(lock, timeout, [&]()
+			{ return finished || offset < endOffset; });
+		return offset < endOffset;
+	}
+
+	/// Marks the recording as finished and wakes up every waiting reader.
+	void close()
+	{
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			finished = true;
+		}
+		available.notify_all();
+	}
+
+	bool isFinished() const
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		return finished;
+	}
+
+	uint64_t getStartOffset() const
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		return getStartOffsetLocked();
+	}
+
+	uint64_t getEndOffset() const
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		return endOffset;
+	}
+
+	int64_t getStartTime() const
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		return indexCount == 0 ? 0 : timeForOffsetLocked(getStartOffsetLocked());
+	}
+
+	int64_t getEndTime() const
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		return endTimeUs;
+	}
+
+	/// Returns the offset of the latest index point at or before |timeUs|,
+	/// clamped to the window. Decoders resynchronize on the next frame header.
+	uint64_t offsetForTime(int64_t timeUs) const
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		if (indexCount == 0)
+		{
+			return endOffset;
+		}
+
+		// Binary search for the first point after |timeUs|.
+		size_t low = 0;
+		size_t high = indexCount;
+		while (low < high)
+		{
+			auto middle = low + (high - low) / 2;
+			if (indexAt(middle).timeUs <= timeUs)
+			{
+				low = middle + 1;
+			}
+			else
+			{
+				high = middle;
+			}
+		}
+
+		auto offset = low == 0 ? indexAt(0).offset : indexAt(low - 1).offset;
+		return std::max(offset, getStartOffsetLocked());
+	}
+
+	/// Returns the time at which the byte at |offset| plays, interpolated
+	/// between index points.
+	int64_t timeForOffset(uint64_t offset) const
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		return timeForOffsetLocked(offset);
+	}
+
+private:
+	size_t readLocked(uint64_t offset, uint8_t* data, size_t length)
+	{
+		if (!file || offset < getStartOffsetLocked() || offset >= endOffset)
+		{
+			return 0;
+		}
+
+		length = (size_t)std::min<uint64_t>(length, endOffset - offset);
+		auto position = offset % capacity;
+		auto first = (size_t)std::min<uint64_t>(length, capacity - position);
+		seekFile(position);
+		auto copied = std::fread(data, 1, first, file);
+		if (copied == first && first < length)
+		{
+			seekFile(0);
+			copied += std::fread(data + first, 1, length - first, file);
+		}
+		return copied;
+	}
+
+	const IndexEntry& indexAt(size_t i) const
+	{
+		return index[(indexHead + i) % index.size()];
+	}
+
+	uint64_t getStartOffsetLocked() const
+	{
+		return endOffset > capacity ? endOffset - capacity : 0;
+	}
+
+	int64_t timeForOffsetLocked(uint64_t offset) const
+	{
+		if (indexCount == 0)
+		{
+			return 0;
+		}
+
+		size_t low = 0;
+		size_t high = indexCount;
+		while (low < high)
+		{
+			auto middle = low + (high - low) / 2;
+			if (indexAt(middle).offset <= offset)
+			{
+				low = middle + 1;
+			}
+			else
+			{
+				high = middle;
+			}
+		}
+		if (low == 0)
+		{
+			return indexAt(0).timeUs;
+		}
+
+		auto& before = indexAt(low - 1);
+		auto afterOffset = low < indexCount ? indexAt(low).offset : endOffset;
+		auto afterTime = low < indexCount ? indexAt(low).timeUs : endTimeUs;
+		if (afterOffset <= before.offset)
+		{
+			return before.timeUs;
+		}
+		return before.timeUs + (int64_t)((double)(afterTime - before.timeUs) * (offset - before.offset) / (afterOffset - before.offset));
+	}
+
+	void seekFile(uint64_t position)
+	{
+#ifdef _WIN32
+		_fseeki64(file, (int64_t)position, SEEK_SET);
+#else
+		fseeko(file, (off_t)position, SEEK_SET);
+#endif
+	}
+
+	std::string path;
+	std::FILE* file = nullptr;
+	uint64_t capacity;
+	uint64_t endOffset = 0;
+	int64_t endTimeUs = 0;
+	bool finished = false;
+
+	std::vector<IndexEntry> index;
+	size_t indexHead = 0;
+	size_t indexCount = 0;
+	int64_t indexIntervalUs;
+
+	mutable std::mutex mutex;
+	std::condition_variable available;
+};
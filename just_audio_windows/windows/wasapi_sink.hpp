@@ -0,0 +1,182 @@
+#pragma once
+
+// This must be included before many other Windows headers.
+#include <windows.h>
+
+#include <audioclient.h>
+#include <mmdeviceapi.h>
+#include <mmreg.h>
+#include <winrt/base.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <iostream>
+
+#include "audio_sink.hpp"
+
+// Plays the output on the default audio device through a shared-mode WASAPI
+// stream. write() blocks until the device has room, which paces the mixer.
+//
+// The stream is opened on the first write, so that it belongs to the mixer
+// thread rather than the platform thread.
+class WasapiSink : public AudioSink
+{
+public:
+	static constexpr REFERENCE_TIME kBufferDuration = 200000; // 20ms
+
+	explicit WasapiSink(AudioFormat format)
+		: format(format)
+	{
+	}
+
+	~WasapiSink()
+	{
+		close();
+	}
+
+	// Prevent copying.
+	WasapiSink(WasapiSink const&) = delete;
+	WasapiSink& operator=(WasapiSink const&) = delete;
+
+	AudioFormat getFormat() const override
+	{
+		return format;
+	}
+
+	bool isRealtime() const override
+	{
+		return true;
+	}
+
+	/// What the device buffer holds, and the latency of the stream behind it.
+	uint64_t getLatencyFrames() const override
+	{
+		return latencyFrames;
+	}
+
+	void write(const float* samples, size_t frames) override
+	{
+		if (closed)
+		{
+			return;
+		}
+		if (!renderClient && (std::chrono::steady_clock::now() < retryAt || !open()))
+		{
+			// Without a device, keep time so that playback still progresses.
+			Sleep((DWORD)(frames * 1000 / format.sampleRate));
+			framesWritten += frames;
+			return;
+		}
+
+		while (frames > 0 && !closed)
+		{
+			WaitForSingleObject(event.get(), 100);
+			UINT32 padding = 0;
+			if (FAILED(audioClient->GetCurrentPadding(&padding)))
+			{
+				// The device went away; try to reopen on the next write.
+				release();
+				return;
+			}
+			auto count = std::min<size_t>(frames, bufferFrames - padding);
+			if (count == 0)
+			{
+				continue;
+			}
+			BYTE* buffer = nullptr;
+			if (FAILED(renderClient->GetBuffer((UINT32)count, &buffer)))
+			{
+				release();
+				return;
+			}
+			std::memcpy(buffer, samples, count * format.channels * sizeof(float));
+			renderClient->ReleaseBuffer((UINT32)count, 0);
+			samples += count * format.channels;
+			frames -= count;
+			framesWritten += count;
+			latencyFrames = padding + count + streamLatencyFrames;
+		}
+	}
+
+	void close() override
+	{
+		closed = true;
+		release();
+	}
+
+private:
+	bool open()
+	{
+		if (!comInitialized)
+		{
+			comInitialized = SUCCEEDED(CoInitializeEx(nullptr, COINIT_MULTITHREADED));
+		}
+
+		try
+		{
+			auto enumerator = winrt::create_instance<IMMDeviceEnumerator>(__uuidof(MMDeviceEnumerator));
+			winrt::com_ptr<IMMDevice> device{};
+			winrt::check_hresult(enumerator->GetDefaultAudioEndpoint(eRender, eConsole, device.put()));
+			winrt::check_hresult(device->Activate(__uuidof(IAudioClient), CLSCTX_ALL, nullptr, audioClient.put_void()));
+
+			WAVEFORMATEXTENSIBLE waveFormat{};
+			waveFormat.Format.wFormatTag = WAVE_FORMAT_EXTENSIBLE;
+			waveFormat.Format.nChannels = (WORD)format.channels;
+			waveFormat.Format.nSamplesPerSec = format.sampleRate;
+			waveFormat.Format.wBitsPerSample = 32;
+			waveFormat.Format.nBlockAlign = (WORD)(format.channels * sizeof(float));
+			waveFormat.Format.nAvgBytesPerSec = format.sampleRate * waveFormat.Format.nBlockAlign;
+			waveFormat.Format.cbSize = sizeof(WAVEFORMATEXTENSIBLE) - sizeof(WAVEFORMATEX);
+			waveFormat.Samples.wValidBitsPerSample = 32;
+			waveFormat.dwChannelMask = format.channels == 1 ? SPEAKER_FRONT_CENTER : SPEAKER_FRONT_LEFT | SPEAKER_FRONT_RIGHT;
+			// KSDATAFORMAT_SUBTYPE_IEEE_FLOAT, which would need ksuser.lib.
+			waveFormat.SubFormat = GUID{ 0x00000003, 0x0000, 0x0010, { 0x80, 0x00, 0x00, 0xaa, 0x00, 0x38, 0x9b, 0x71 } };
+
+			// The engine converts from this format to the device's mix format.
+			winrt::check_hresult(audioClient->Initialize(AUDCLNT_SHAREMODE_SHARED,
+				AUDCLNT_STREAMFLAGS_EVENTCALLBACK | AUDCLNT_STREAMFLAGS_AUTOCONVERTPCM | AUDCLNT_STREAMFLAGS_SRC_DEFAULT_QUALITY,
+				kBufferDuration, 0, &waveFormat.Format, nullptr));
+			event.attach(CreateEventW(nullptr, FALSE, FALSE, nullptr));
+			winrt::check_hresult(audioClient->SetEventHandle(event.get()));
+			winrt::check_hresult(audioClient->GetBufferSize(&bufferFrames));
+			REFERENCE_TIME streamLatency = 0;
+			winrt::check_hresult(audioClient->GetStreamLatency(&streamLatency));
+			streamLatencyFrames = (uint64_t)streamLatency * format.sampleRate / 10000000;
+			winrt::check_hresult(audioClient->GetService(__uuidof(IAudioRenderClient), renderClient.put_void()));
+			winrt::check_hresult(audioClient->Start());
+			return true;
+		}
+		catch (winrt::hresult_error const& error)
+		{
+			std::cerr << "[just_audio_windows] Could not open the audio device: " << winrt::to_string(error.message()) << std::endl;
+			release();
+			retryAt = std::chrono::steady_clock::now() + std::chrono::seconds(1);
+			return false;
+		}
+	}
+
+	void release()
+	{
+		if (audioClient)
+		{
+			audioClient->Stop();
+		}
+		renderClient = nullptr;
+		audioClient = nullptr;
+		event.close();
+		latencyFrames = 0;
+	}
+
+	AudioFormat format;
+	std::atomic<bool> closed = false;
+	bool comInitialized = false;
+	winrt::com_ptr<IAudioClient> audioClient{};
+	winrt::com_ptr<IAudioRenderClient> renderClient{};
+	winrt::handle event{};
+	UINT32 bufferFrames = 0;
+	uint64_t streamLatencyFrames = 0;
+	std::atomic<uint64_t> latencyFrames = 0;
+	std::chrono::steady_clock::time_point retryAt{};
+};
@@ -0,0 +1,84 @@
+#pragma once
+
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Runs one-off jobs, such as probing or analyzing files for a method call,
+// each on a thread of its own, and joins them all when destroyed, so that no
+// job outlives its owner. Jobs that finished are joined as new ones start.
+//
+// Jobs must not use their owner, only what they capture by value or shared
+// pointer.
+class WorkerThreads
+{
+public:
+	WorkerThreads() = default;
+
+	~WorkerThreads()
+	{
+		std::vector<Worker> remaining{};
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			remaining.swap(workers);
+		}
+		for (auto& worker : remaining)
+		{
+			worker.thread.join();
+		}
+	}
+
+	// Prevent copying.
+	WorkerThreads(WorkerThreads const&) = delete;
+	WorkerThreads& operator=(WorkerThreads const&) = delete;
+
+	/// Starts |job| on a new thread.
+	void run(std::function<void()> job)
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		reapLocked();
+		auto done = std::make_shared<std::atomic<bool>>(false);
+		workers.push_back(Worker{ std::thread([job = std::move(job), done]()
+										  {
+											  job();
+											  done->store(true, std::memory_order_release); }),
+			done });
+	}
+
+	/// The jobs started and not joined yet.
+	size_t getCount()
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		reapLocked();
+		return workers.size();
+	}
+
+private:
+	struct Worker
+	{
+		std::thread thread;
+		std::shared_ptr<std::atomic<bool>> done;
+	};
+
+	void reapLocked()
+	{
+		for (auto it = workers.begin(); it != workers.end();)
+		{
+			if (it->done->load(std::memory_order_acquire))
+			{
+				it->thread.join();
+				it = workers.erase(it);
+			}
+			else
+			{
+				++it;
+			}
+		}
+	}
+
+	std::mutex mutex;
+	std::vector<Worker> workers{};
+};